@@ -182,7 +182,9 @@ int main_impl(int argc, char* argv[])
 #else
 					node.m_Cfg.m_MiningThreads = vm[cli::MINING_THREADS].as<uint32_t>();
 #endif
+					node.m_Cfg.m_MiningCooperative = vm[cli::MINING_COOPERATIVE].as<bool>();
 					node.m_Cfg.m_VerificationThreads = vm[cli::VERIFICATION_THREADS].as<int>();
+					node.m_Cfg.m_BlockValidationThreads = vm[cli::BLOCK_VALIDATION_THREADS].as<uint32_t>();
 
 					std::string sKeyOwner;
 					{
@@ -277,6 +279,9 @@ int main_impl(int argc, char* argv[])
 					if (vm.count(cli::RESYNC))
 						node.m_Cfg.m_Sync.m_ForceResync = vm[cli::RESYNC].as<bool>();
 
+					if (vm.count(cli::BODY_STORE))
+						node.m_Cfg.m_BodyStore = vm[cli::BODY_STORE].as<bool>();
+
 					node.Initialize(stratumServer.get());
 
 					Height hImport = vm[cli::IMPORT].as<Height>();
@@ -822,10 +822,132 @@ void AES::StreamCipher::PerfXor(uint8_t* pBuf, uint32_t nSize)
 	m_nBuf -= (uint8_t) nSize;
 }
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#	define AES_HW_X86
+#	include <wmmintrin.h>
+#	include <tmmintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define AES_HW_TARGET
+#	else // _MSC_VER
+#		include <cpuid.h>
+#		define AES_HW_TARGET __attribute__((target("aes,ssse3")))
+#	endif // _MSC_VER
+#endif // x86
+
+bool AES::StreamCipher::s_UseHw = true;
+
+bool AES::StreamCipher::IsHwSupported()
+{
+#ifdef AES_HW_X86
+
+	static const bool bSupported = []() {
+
+		const uint32_t nMskAes = 1U << 25;
+		const uint32_t nMskSsse3 = 1U << 9;
+
+		uint32_t nEcx;
+#ifdef _MSC_VER
+		int pRegs[4];
+		__cpuid(pRegs, 1);
+		nEcx = static_cast<uint32_t>(pRegs[2]);
+#else // _MSC_VER
+		unsigned int a, b, c, d;
+		if (!__get_cpuid(1, &a, &b, &c, &d))
+			return false;
+		nEcx = c;
+#endif // _MSC_VER
+
+		return (nMskAes & nEcx) && (nMskSsse3 & nEcx);
+	}();
+
+	return bSupported;
+
+#else // AES_HW_X86
+	return false;
+#endif // AES_HW_X86
+}
+
+#ifdef AES_HW_X86
+
+// XORs the buffer with the cipherstream of the consequent counter values. 4 blocks are interleaved to hide the aesenc latency
+AES_HW_TARGET
+static void XCryptBlocksHw(const AES::Encoder& enc, beam::uintBig_t<AES::s_BlockSize>& ctr, uint8_t* pBuf, uint32_t nBlocks)
+{
+	// round keys are kept as big-endian words
+	const __m128i mskBswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+	__m128i pK[AES::Nr + 1];
+	for (int i = 0; i <= AES::Nr; i++)
+		pK[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (enc.m_erk + i * 4)), mskBswap);
+
+	for (; nBlocks >= 4; nBlocks -= 4, pBuf += AES::s_BlockSize * 4)
+	{
+		__m128i x0 = _mm_loadu_si128((const __m128i*) ctr.m_pData); ctr.Inc();
+		__m128i x1 = _mm_loadu_si128((const __m128i*) ctr.m_pData); ctr.Inc();
+		__m128i x2 = _mm_loadu_si128((const __m128i*) ctr.m_pData); ctr.Inc();
+		__m128i x3 = _mm_loadu_si128((const __m128i*) ctr.m_pData); ctr.Inc();
+
+		x0 = _mm_xor_si128(x0, pK[0]);
+		x1 = _mm_xor_si128(x1, pK[0]);
+		x2 = _mm_xor_si128(x2, pK[0]);
+		x3 = _mm_xor_si128(x3, pK[0]);
+
+		for (int i = 1; i < AES::Nr; i++)
+		{
+			x0 = _mm_aesenc_si128(x0, pK[i]);
+			x1 = _mm_aesenc_si128(x1, pK[i]);
+			x2 = _mm_aesenc_si128(x2, pK[i]);
+			x3 = _mm_aesenc_si128(x3, pK[i]);
+		}
+
+		x0 = _mm_aesenclast_si128(x0, pK[AES::Nr]);
+		x1 = _mm_aesenclast_si128(x1, pK[AES::Nr]);
+		x2 = _mm_aesenclast_si128(x2, pK[AES::Nr]);
+		x3 = _mm_aesenclast_si128(x3, pK[AES::Nr]);
+
+		__m128i* p = (__m128i*) pBuf;
+		_mm_storeu_si128(p, _mm_xor_si128(x0, _mm_loadu_si128(p)));
+		_mm_storeu_si128(p + 1, _mm_xor_si128(x1, _mm_loadu_si128(p + 1)));
+		_mm_storeu_si128(p + 2, _mm_xor_si128(x2, _mm_loadu_si128(p + 2)));
+		_mm_storeu_si128(p + 3, _mm_xor_si128(x3, _mm_loadu_si128(p + 3)));
+	}
+
+	for (; nBlocks; nBlocks--, pBuf += AES::s_BlockSize)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*) ctr.m_pData); ctr.Inc();
+
+		x = _mm_xor_si128(x, pK[0]);
+		for (int i = 1; i < AES::Nr; i++)
+			x = _mm_aesenc_si128(x, pK[i]);
+		x = _mm_aesenclast_si128(x, pK[AES::Nr]);
+
+		__m128i* p = (__m128i*) pBuf;
+		_mm_storeu_si128(p, _mm_xor_si128(x, _mm_loadu_si128(p)));
+	}
+}
+
+#endif // AES_HW_X86
+
 void AES::StreamCipher::XCrypt(const Encoder& enc, uint8_t* pBuf, uint32_t nSize)
 {
 	while (true)
 	{
+#ifdef AES_HW_X86
+		if (!m_nBuf && (nSize >= s_BlockSize) && s_UseHw && IsHwSupported())
+		{
+			uint32_t nBlocks = nSize / s_BlockSize;
+			XCryptBlocksHw(enc, m_Counter, pBuf, nBlocks);
+
+			nBlocks *= s_BlockSize;
+			pBuf += nBlocks;
+			nSize -= nBlocks;
+
+			if (!nSize)
+				break;
+		}
+#endif // AES_HW_X86
+
 		if (!m_nBuf)
 		{
 			enc.Proceed(m_pBuf, m_Counter.m_pData);
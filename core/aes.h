@@ -34,6 +34,10 @@ struct AES
 
 		void Reset();
 		void XCrypt(const Encoder&, uint8_t* pBuf, uint32_t nSize);
+
+		// Whole blocks are processed by the hardware AES (AES-NI) if the CPU supports it. The output is the same.
+		static bool s_UseHw; // on by default, can be disabled (for tests and benchmarks)
+		static bool IsHwSupported();
 	};
 
 };
@@ -14,6 +14,7 @@
 
 #include <ctime>
 #include <chrono>
+#include <thread>
 #include "block_crypt.h"
 
 namespace beam
@@ -187,6 +188,90 @@ namespace beam
 		comm = comm2;
 	}
 
+	void SwitchCommitment::CreateBatchInternal(ECC::Point* pComm, Key::IKdf* const* ppKdf, const Key::IDV* pKidv, uint32_t nCount) const
+	{
+		uint32_t nChunk = s_BatchChunk;
+		if (nChunk > nCount)
+			nChunk = nCount;
+
+		// per element: comm0 and sk0_J, both needed in the normalized form for sk1
+		std::vector<ECC::Point::Native> vPts(nChunk * 2);
+		std::vector<ECC::Point> vExp(vPts.size());
+
+		ECC::Scalar::Native sk;
+
+		for (uint32_t i0 = 0; i0 < nCount; )
+		{
+			uint32_t n = std::min(nCount - i0, nChunk);
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				ppKdf[i0 + i]->DeriveKey(sk, pKidv[i0 + i]);
+
+				ECC::Point::Native& comm = vPts[i * 2];
+				comm = ECC::Context::get().G * sk;
+				AddValue(comm, pKidv[i0 + i].m_Value);
+
+				vPts[i * 2 + 1] = ECC::Context::get().J * sk;
+			}
+
+			ECC::Point::Native::ExportBatch(&vExp.front(), &vPts.front(), n * 2);
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				ECC::Oracle()
+					<< vExp[i * 2]
+					<< vExp[i * 2 + 1]
+					>> sk; // sk1
+
+				vPts[i] = vPts[i * 2]; // compact in-place, i <= 2*i
+				vPts[i] += ECC::Context::get().G * sk;
+			}
+
+			ECC::Point::Native::ExportBatch(pComm + i0, &vPts.front(), n);
+
+			i0 += n;
+		}
+	}
+
+	void SwitchCommitment::CreateBatch(ECC::Point* pComm, Key::IKdf* const* ppKdf, const Key::IDV* pKidv, uint32_t nCount, uint32_t nThreads) const
+	{
+		if (!nThreads)
+		{
+			nThreads = std::thread::hardware_concurrency();
+			if (!nThreads)
+				nThreads = 1;
+		}
+
+		nThreads = std::min(nThreads, nCount / s_BatchPerThreadMin); // don't spawn threads for small batches
+
+		if (nThreads <= 1)
+		{
+			CreateBatchInternal(pComm, ppKdf, pKidv, nCount);
+			return;
+		}
+
+		std::vector<std::thread> vThreads(nThreads - 1);
+		uint32_t i0 = 0;
+
+		for (uint32_t i = 0; i < nThreads; i++)
+		{
+			uint32_t i1 = static_cast<uint32_t>(uint64_t(nCount) * (i + 1) / nThreads);
+
+			if (i < vThreads.size())
+				vThreads[i] = std::thread(&SwitchCommitment::CreateBatchInternal, this, pComm + i0, ppKdf + i0, pKidv + i0, i1 - i0);
+			else
+				CreateBatchInternal(pComm + i0, ppKdf + i0, pKidv + i0, i1 - i0); // the last range - in this thread
+
+			i0 = i1;
+		}
+
+		assert(i0 == nCount);
+
+		for (size_t i = 0; i < vThreads.size(); i++)
+			vThreads[i].join();
+	}
+
 	void SwitchCommitment::Recover(ECC::Point::Native& res, Key::IPKdf& pkdf, const Key::IDV& kidv) const
 	{
 		ECC::Hash::Value hv;
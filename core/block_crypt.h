@@ -127,6 +127,7 @@ namespace beam
 		static void get_sk1(ECC::Scalar::Native& res, const ECC::Point::Native& comm0, const ECC::Point::Native& sk0_J);
 		void CreateInternal(ECC::Scalar::Native&, ECC::Point::Native&, bool bComm, Key::IKdf& kdf, const Key::IDV& kidv) const;
 		void AddValue(ECC::Point::Native& comm, Amount) const;
+		void CreateBatchInternal(ECC::Point* pComm, Key::IKdf* const* ppKdf, const Key::IDV* pKidv, uint32_t nCount) const;
 	public:
 
 		ECC::Point::Native m_hGen;
@@ -136,6 +137,11 @@ namespace beam
 		void Create(ECC::Scalar::Native& sk, ECC::Point::Native& comm, Key::IKdf&, const Key::IDV&) const;
 		void Create(ECC::Scalar::Native& sk, ECC::Point& comm, Key::IKdf&, const Key::IDV&) const;
 		void Recover(ECC::Point::Native& comm, Key::IPKdf&, const Key::IDV&) const;
+
+		// Commitments only, same as Create() for each element. Point normalization is shared within the batch, and the work is split between threads (0 = hardware concurrency)
+		void CreateBatch(ECC::Point* pComm, Key::IKdf* const* ppKdf, const Key::IDV* pKidv, uint32_t nCount, uint32_t nThreads = 0) const;
+		static const uint32_t s_BatchPerThreadMin = 0x20;
+		static const uint32_t s_BatchChunk = 0x80;
 	};
 
 	struct TxElement
@@ -428,6 +434,9 @@ namespace beam
 			// returns false only if cancelled
 			bool Solve(const void* pInput, uint32_t nSizeInput, const Cancel& = [](bool) { return false; });
 
+			// All the threads cooperate on the same nonce (instead of each solving its own), the working set is shared
+			bool SolveMT(const void* pInput, uint32_t nSizeInput, uint32_t nThreads, const Cancel& = [](bool) { return false; });
+
 #if defined (BEAM_USE_GPU)
             bool SolveGPU(const void* pInput, uint32_t nSizeInput, const Cancel& = [](bool) { return false; });
 #endif
@@ -465,6 +465,52 @@ namespace ECC {
 		v.m_Y = (secp256k1_fe_is_odd(&ge.y) != 0);
 	}
 
+	void Point::Native::ExportBatch(Point* pRes, const Native* pSrc, uint32_t nCount)
+	{
+		if (!nCount)
+			return;
+
+		// Montgomery's trick: invert the product of all the z-coordinates once, then unwind
+		std::vector<secp256k1_fe> vAcc(nCount);
+
+		NoLeak<secp256k1_fe> acc, zi;
+		secp256k1_fe_set_int(&acc.V, 1);
+
+		for (uint32_t i = 0; i < nCount; i++)
+		{
+			vAcc[i] = acc.V;
+
+			const secp256k1_gej& v = pSrc[i];
+			if (!secp256k1_gej_is_infinity(&v))
+				secp256k1_fe_mul(&acc.V, &acc.V, &v.z);
+		}
+
+		secp256k1_fe_inv(&acc.V, &acc.V);
+
+		NoLeak<secp256k1_ge> ge;
+
+		for (uint32_t i = nCount; i--; )
+		{
+			const secp256k1_gej& v = pSrc[i];
+			if (secp256k1_gej_is_infinity(&v))
+			{
+				ZeroObject(pRes[i]);
+				continue;
+			}
+
+			secp256k1_fe_mul(&zi.V, &acc.V, &vAcc[i]);
+			secp256k1_fe_mul(&acc.V, &acc.V, &v.z);
+
+			secp256k1_ge_set_gej_zinv(&ge.V, &v, &zi.V);
+			secp256k1_fe_normalize(&ge.V.x);
+			secp256k1_fe_normalize(&ge.V.y);
+
+			ExportEx(pRes[i], ge.V);
+		}
+
+		SecureErase(&vAcc.front(), static_cast<uint32_t>(sizeof(secp256k1_fe) * nCount));
+	}
+
 	Point::Native& Point::Native::operator = (Zero_)
 	{
 		secp256k1_gej_set_infinity(this);
@@ -144,6 +144,7 @@ namespace ECC
 		bool Export(Point&) const; // if the point is zero - returns false and zeroes the result
 
 		static void ExportEx(Point&, const secp256k1_ge&);
+		static void ExportBatch(Point*, const Native*, uint32_t nCount); // single inversion for all the points. Zero points are zeroed
 	};
 
 #ifdef NDEBUG
@@ -82,6 +82,7 @@ void FlyClient::NetworkStd::Connection::ResetVars()
     ZeroObject(m_Tip);
     m_LoginFlags = 0;
     m_Flags = 0;
+    m_UtxoEventsID = 0;
     m_NodeID = Zero;
 }
 
@@ -92,6 +93,17 @@ void FlyClient::NetworkStd::Connection::ResetInternal()
     if (Flags::Owned & m_Flags)
         m_This.m_Client.OnOwnedNode(m_NodeID, false);
 
+    if (Flags::UtxoEventsStream & m_Flags)
+    {
+        m_Flags &= ~Flags::UtxoEventsStream;
+        m_This.m_pUtxoEvents->OnUtxoEventsStream(false);
+
+        // let another owned node take over
+        for (ConnectionList::iterator it = m_This.m_Connections.begin(); m_This.m_Connections.end() != it; it++)
+            if (this != &*it)
+                it->UtxoEventsStart();
+    }
+
     if (Flags::ReportedConnected & m_Flags)
         m_This.OnNodeConnected(m_iIndex, false);
 
@@ -191,6 +203,8 @@ void FlyClient::NetworkStd::Connection::OnMsg(Authentication&& msg)
             //  viewer confirmed!
             m_Flags |= Flags::Owned;
             m_This.m_Client.OnOwnedNode(m_NodeID, true);
+
+            UtxoEventsStart();
         }
         break;
 
@@ -238,6 +252,8 @@ void FlyClient::NetworkStd::Connection::OnMsg(Login&& msg)
             msgOut.m_On = true;
             Send(msgOut);
         }
+
+    UtxoEventsStart();
 }
 
 void FlyClient::NetworkStd::Connection::OnMsg(NewTip&& msg)
@@ -827,5 +843,77 @@ void FlyClient::NetworkStd::Connection::OnMsg(BbsMsg&& msg)
     }
 }
 
+void FlyClient::NetworkStd::UtxoEventsSubscribe(IUtxoEventsReceiver* p)
+{
+    if (m_pUtxoEvents && (m_pUtxoEvents != p))
+        for (ConnectionList::iterator it = m_Connections.begin(); m_Connections.end() != it; it++)
+            it->UtxoEventsStop();
+
+    m_pUtxoEvents = p;
+
+    for (ConnectionList::iterator it = m_Connections.begin(); m_Connections.end() != it; it++)
+        it->UtxoEventsStart();
+}
+
+void FlyClient::NetworkStd::Connection::UtxoEventsStart()
+{
+    if (!m_This.m_pUtxoEvents)
+        return;
+
+    if (!(Flags::UtxoEventsStream & m_Flags))
+    {
+        if (!(Flags::Owned & m_Flags) || !(LoginFlags::UtxoEventsStream & m_LoginFlags))
+            return;
+
+        for (ConnectionList::iterator it = m_This.m_Connections.begin(); m_This.m_Connections.end() != it; it++)
+            if (Flags::UtxoEventsStream & it->m_Flags)
+                return; // a single stream is enough
+
+        m_Flags |= Flags::UtxoEventsStream;
+        m_This.m_pUtxoEvents->OnUtxoEventsStream(true);
+    }
+
+    // (re)start
+    proto::UtxoEventsSubscribe msg;
+    msg.m_ID = ++m_UtxoEventsID;
+    msg.m_HeightMin = m_This.m_pUtxoEvents->get_UtxoEventsStart();
+    msg.m_Window = UtxoEvent::s_MaxWindow;
+    Send(msg);
+}
+
+void FlyClient::NetworkStd::Connection::UtxoEventsStop()
+{
+    if (!(Flags::UtxoEventsStream & m_Flags))
+        return;
+
+    m_Flags &= ~Flags::UtxoEventsStream;
+
+    proto::UtxoEventsSubscribe msg(Zero);
+    msg.m_ID = ++m_UtxoEventsID;
+    Send(msg);
+
+    m_This.m_pUtxoEvents->OnUtxoEventsStream(false);
+}
+
+void FlyClient::NetworkStd::Connection::OnMsg(UtxoEventsPack&& msg)
+{
+    if (!(Flags::Owned & m_Flags) || (msg.m_HeightMin > msg.m_HeightMax))
+        ThrowUnexpected();
+
+    std::vector<UtxoEvent> v;
+    UtxoEvent::Decode(v, msg.m_Events, msg.m_HeightMin);
+
+    for (size_t i = 0; i < v.size(); i++)
+        if (v[i].m_Height > msg.m_HeightMax)
+            ThrowUnexpected();
+
+    // the packs that were sent before the stream was restarted or stopped may still arrive. The node doesn't expect them to be acknowledged
+    if ((msg.m_ID != m_UtxoEventsID) || !(Flags::UtxoEventsStream & m_Flags))
+        return;
+
+    Send(proto::UtxoEventsAck(Zero));
+    m_This.m_pUtxoEvents->OnUtxoEvents(v, msg.m_HeightMin, msg.m_HeightMax);
+}
+
 } // namespace proto
 } // namespace beam
@@ -87,6 +87,13 @@ namespace proto {
 			virtual void OnMsg(proto::BbsMsg&&) = 0;
 		};
 
+		struct IUtxoEventsReceiver
+		{
+			virtual Height get_UtxoEventsStart() = 0; // the stream is (re)started from this height
+			virtual void OnUtxoEvents(std::vector<UtxoEvent>&, Height hMin, Height hMax) = 0; // all the events within [hMin, hMax]
+			virtual void OnUtxoEventsStream(bool bUp) {} // streaming owned node connected/disconnected
+		};
+
 		struct INetwork
 		{
 			virtual ~INetwork() {}
@@ -95,6 +102,7 @@ namespace proto {
 			virtual void Disconnect() = 0;
 			virtual void PostRequestInternal(Request&) = 0;
 			virtual void BbsSubscribe(BbsChannel, Timestamp, IBbsReceiver*) {} // duplicates should be handled internally
+			virtual void UtxoEventsSubscribe(IUtxoEventsReceiver*) {} // NULL to unsubscribe. Call again to restart the stream (i.e. after rollback)
 
 			void PostRequest(Request&, Request::IHandler&);
 		};
@@ -187,13 +195,18 @@ namespace proto {
 				bool IsAtTip() const;
 				uint8_t m_LoginFlags;
 				uint8_t m_Flags;
+				uint32_t m_UtxoEventsID; // of the current subscription
 
 				struct Flags {
 					static const uint8_t Node = 1;
 					static const uint8_t Owned = 2;
 					static const uint8_t ReportedConnected = 4;
+					static const uint8_t UtxoEventsStream = 8;
 				};
 
+				void UtxoEventsStart(); // if eligible, and no other connection streams already
+				void UtxoEventsStop();
+
 				// NodeConnection
 				virtual void OnConnectedSecure() override;
 				virtual void OnDisconnect(const DisconnectReason&) override;
@@ -204,6 +217,7 @@ namespace proto {
 				virtual void OnMsg(proto::ProofCommonState&& msg) override;
 				virtual void OnMsg(proto::ProofChainWork&& msg) override;
 				virtual void OnMsg(proto::BbsMsg&& msg) override;
+				virtual void OnMsg(proto::UtxoEventsPack&& msg) override;
 #define THE_MACRO(type, msgOut, msgIn) \
 				virtual void OnMsg(proto::msgIn&&) override; \
 				bool IsSupported(Request##type&); \
@@ -221,11 +235,14 @@ namespace proto {
 			typedef std::map<BbsChannel, std::pair<IBbsReceiver*, Timestamp> > BbsSubscriptions;
 			BbsSubscriptions m_BbsSubscriptions;
 
+			IUtxoEventsReceiver* m_pUtxoEvents = NULL;
+
 			// INetwork
 			virtual void Connect() override;
 			virtual void Disconnect() override;
 			virtual void PostRequestInternal(Request&) override;
 			virtual void BbsSubscribe(BbsChannel, Timestamp, IBbsReceiver*) override;
+			virtual void UtxoEventsSubscribe(IUtxoEventsReceiver*) override;
 
 			// more events
 			virtual void OnNodeConnected(size_t iNodeIdx, bool) {}
@@ -87,54 +87,60 @@ void ProtocolPlus::Encrypt(SerializedMsg& sm, MsgSerializer& ser)
     ser.finalize(sm);
 
     if (Mode::Plaintext != m_Mode)
-    {
-        // 2. get size
-        size_t n = 0;
+        Encrypt(sm);
+}
 
-        for (size_t i = 0; i < sm.size(); i++)
-            n += sm[i].size;
+void ProtocolPlus::Encrypt(SerializedMsg& sm)
+{
+    assert(Mode::Plaintext != m_Mode);
+    MacValue hmac;
 
-        // 3. Calculate
-        ECC::Hash::Mac hm = m_HMac;
-        size_t n2 = n - MacValue::nBytes;
+    // 2. get size
+    size_t n = 0;
+
+    for (size_t i = 0; i < sm.size(); i++)
+        n += sm[i].size;
+
+    // 3. Calculate
+    ECC::Hash::Mac hm = m_HMac;
+    size_t n2 = n - MacValue::nBytes;
 
-        for (size_t i = 0; ; i++)
+    for (size_t i = 0; ; i++)
+    {
+        assert(i < sm.size());
+        io::IOVec& iov = sm[i];
+        if (iov.size >= n2)
         {
-            assert(i < sm.size());
-            io::IOVec& iov = sm[i];
-            if (iov.size >= n2)
-            {
-                hm.Write(iov.data, (uint32_t) n2);
-                break;
-            }
-
-            hm.Write(iov.data, (uint32_t)iov.size);
-            n2 -= iov.size;
+            hm.Write(iov.data, (uint32_t) n2);
+            break;
         }
 
-        get_HMac(hm, hmac);
-
-        // 4. Overwrite the hmac, encrypt
-        n2 = n;
+        hm.Write(iov.data, (uint32_t)iov.size);
+        n2 -= iov.size;
+    }
 
-        for (size_t i = 0; i < sm.size(); i++)
-        {
-            io::IOVec& iov = sm[i];
-            uint8_t* dst = (uint8_t*) iov.data;
+    get_HMac(hm, hmac);
 
-            if (n2 <= hmac.nBytes)
-                memcpy(dst, hmac.m_pData + hmac.nBytes - n2, iov.size);
-            else
-            {
-                size_t offs = n2 - hmac.nBytes;
-                if (offs < iov.size)
-                    memcpy(dst + offs, hmac.m_pData, iov.size - offs);
-            }
+    // 4. Overwrite the hmac, encrypt
+    n2 = n;
 
-            n2 -= iov.size;
+    for (size_t i = 0; i < sm.size(); i++)
+    {
+        io::IOVec& iov = sm[i];
+        uint8_t* dst = (uint8_t*) iov.data;
 
-            m_CipherOut.XCrypt(m_Enc, dst, (uint32_t) iov.size);
+        if (n2 <= hmac.nBytes)
+            memcpy(dst, hmac.m_pData + hmac.nBytes - n2, iov.size);
+        else
+        {
+            size_t offs = n2 - hmac.nBytes;
+            if (offs < iov.size)
+                memcpy(dst + offs, hmac.m_pData, iov.size - offs);
         }
+
+        n2 -= iov.size;
+
+        m_CipherOut.XCrypt(m_Enc, dst, (uint32_t) iov.size);
     }
 }
 
@@ -260,6 +266,78 @@ bool BbsDecrypt(uint8_t*& p, uint32_t& n, const ECC::Scalar::Native& privateAddr
     return (hvMac == hvMac2);
 }
 
+/////////////////////////
+// UtxoEvent
+void UtxoEvent::Encode(ByteBuffer& res, const std::vector<UtxoEvent>& v, Height hBase)
+{
+    Serializer ser;
+
+    for (size_t i = 0; i < v.size(); i++)
+    {
+        const UtxoEvent& evt = v[i];
+        assert(evt.m_Height >= hBase);
+
+        bool bMaturityBelow = (evt.m_Maturity < evt.m_Height); // spent utxos
+        Height dh = evt.m_Height - hBase;
+        Height dm = bMaturityBelow ? (evt.m_Height - evt.m_Maturity) : (evt.m_Maturity - evt.m_Height);
+
+        uint8_t nFlags =
+            (evt.m_Added ? 1 : 0) |
+            (evt.m_Commitment.m_Y ? 2 : 0) |
+            ((evt.m_AssetID == Zero) ? 0 : 4) |
+            (bMaturityBelow ? 8 : 0);
+
+        ser
+            & nFlags
+            & evt.m_Commitment.m_X
+            & evt.m_Kidv
+            & dh
+            & dm;
+
+        if (4 & nFlags)
+            ser & evt.m_AssetID;
+
+        hBase = evt.m_Height;
+    }
+
+    ser.swap_buf(res);
+}
+
+void UtxoEvent::Decode(std::vector<UtxoEvent>& v, const ByteBuffer& buf, Height hBase)
+{
+    Deserializer der;
+    der.reset(buf);
+
+    while (der.bytes_left())
+    {
+        v.emplace_back();
+        UtxoEvent& evt = v.back();
+
+        uint8_t nFlags;
+        Height dh, dm;
+
+        der
+            & nFlags
+            & evt.m_Commitment.m_X
+            & evt.m_Kidv
+            & dh
+            & dm;
+
+        evt.m_Added = (1 & nFlags) ? 1 : 0;
+        evt.m_Commitment.m_Y = (2 & nFlags) ? 1 : 0;
+
+        if (4 & nFlags)
+            der & evt.m_AssetID;
+        else
+            evt.m_AssetID = Zero;
+
+        evt.m_Height = hBase + dh;
+        evt.m_Maturity = (8 & nFlags) ? (evt.m_Height - dm) : (evt.m_Height + dm);
+
+        hBase = evt.m_Height;
+    }
+}
+
 union HighestMsgCode
 {
 #define THE_MACRO(code, msg) uint8_t m_pBuf_##msg[code + 1];
@@ -499,6 +577,55 @@ bool NodeConnection::OnMsgInternal(uint64_t, msg##_NoInit&& v) \
 BeamNodeMsgsAll(THE_MACRO)
 #undef THE_MACRO
 
+void NodeConnection::SendBody(const io::SharedBuffer& bodyP, const io::SharedBuffer& bodyE)
+{
+    if (!IsLive())
+        return;
+
+    // The wire format is the same as of the serialized Body: for each ByteBuffer its size, then the raw bytes.
+    // The serializer produces the header and the 1st size, the rest is appended as fragments.
+    bool bEncrypt = (ProtocolPlus::Mode::Plaintext != m_Protocol.m_Mode);
+
+    Serializer serSize;
+    serSize & static_cast<uint64_t>(bodyE.size);
+    io::SharedBuffer bufSizeE(serSize.buffer().first, serSize.buffer().second);
+
+    size_t nTail = bodyP.size + bufSizeE.size + bodyE.size;
+    if (bEncrypt)
+        nTail += ProtocolPlus::MacValue::nBytes;
+
+    m_SerializeCache.clear();
+    MsgSerializer& ser = m_Protocol.serializeNoFinalize(m_SerializeCache, Body::s_Code, static_cast<uint64_t>(bodyP.size));
+    ser.finalize(m_SerializeCache, nTail);
+
+    if (bEncrypt)
+    {
+        if (bodyP.size)
+            m_SerializeCache.push_back(io::SharedBuffer(bodyP.data, bodyP.size));
+        m_SerializeCache.push_back(std::move(bufSizeE));
+        if (bodyE.size)
+            m_SerializeCache.push_back(io::SharedBuffer(bodyE.data, bodyE.size));
+
+        ProtocolPlus::MacValue hmac(Zero);
+        m_SerializeCache.push_back(io::SharedBuffer(hmac.m_pData, hmac.nBytes));
+
+        m_Protocol.Encrypt(m_SerializeCache);
+    }
+    else
+    {
+        if (bodyP.size)
+            m_SerializeCache.push_back(bodyP);
+        m_SerializeCache.push_back(std::move(bufSizeE));
+        if (bodyE.size)
+            m_SerializeCache.push_back(bodyE);
+    }
+
+    io::Result res = m_Connection->write_msg(m_SerializeCache);
+    m_SerializeCache.clear();
+
+    TestIoResultAsync(res);
+}
+
 void NodeConnection::TestInputMsgContext(uint8_t code)
 {
     if (!IsSecureIn())
@@ -56,6 +56,34 @@ namespace proto {
     macro(ByteBuffer, Perishable) \
     macro(ByteBuffer, Eternal)
 
+#define BeamNodeMsg_GetBodyPack(macro) \
+    macro(Block::SystemState::ID, Top) \
+    macro(Height, CountExtra) /* num of blocks below the Top */
+
+#define BeamNodeMsg_BodyPack(macro) \
+    macro(std::vector<BodyBuffers>, Bodies) /* from the lowest, may be truncated */
+
+#define BeamNodeMsg_GetBodyCompact(macro) \
+    macro(Block::SystemState::ID, ID)
+
+#define BeamNodeMsg_BodyCompact(macro) \
+    macro(Block::BodyBase, Base) \
+    macro(std::vector<Input::Ptr>, Inputs) \
+    macro(std::vector<uint64_t>, OutputIDs) /* short IDs, salted by the block hash */ \
+    macro(std::vector<uint64_t>, KernelIDs) \
+    macro(std::vector<Output::Ptr>, Outputs) /* prefilled, in the order of their IDs */ \
+    macro(std::vector<TxKernel::Ptr>, Kernels) /* prefilled, in the order of their IDs */ \
+    macro(Merkle::Hash, Checksum)
+
+#define BeamNodeMsg_GetBodyMissing(macro) \
+    macro(Block::SystemState::ID, ID) \
+    macro(std::vector<uint32_t>, Outputs) /* indexes in the block */ \
+    macro(std::vector<uint32_t>, Kernels)
+
+#define BeamNodeMsg_BodyMissing(macro) \
+    macro(std::vector<Output::Ptr>, Outputs) \
+    macro(std::vector<TxKernel::Ptr>, Kernels)
+
 #define BeamNodeMsg_GetProofState(macro) \
     macro(Height, Height)
 
@@ -181,6 +209,19 @@ namespace proto {
 #define BeamNodeMsg_UtxoEvents(macro) \
     macro(std::vector<UtxoEvent>, Events)
 
+#define BeamNodeMsg_UtxoEventsSubscribe(macro) \
+    macro(uint32_t, ID) /* echoed in the packs. Those of the previous subscriptions should be ignored, and not acknowledged */ \
+    macro(Height, HeightMin) \
+    macro(uint32_t, Window) /* max unacknowledged packs, 0 to unsubscribe */
+
+#define BeamNodeMsg_UtxoEventsPack(macro) \
+    macro(uint32_t, ID) \
+    macro(Height, HeightMin) \
+    macro(Height, HeightMax) /* all the events within [HeightMin, HeightMax] are included */ \
+    macro(ByteBuffer, Events) /* see UtxoEvent::Encode */
+
+#define BeamNodeMsg_UtxoEventsAck(macro)
+
 #define BeamNodeMsg_GetBlockFinalization(macro) \
     macro(Height, Height) \
     macro(Amount, Fees)
@@ -227,6 +268,12 @@ namespace proto {
     macro(0x23, ProofCommonState) \
     macro(0x24, GetProofKernel2) \
     macro(0x25, ProofKernel2) \
+    macro(0x26, GetBodyCompact) \
+    macro(0x27, BodyCompact) \
+    macro(0x28, GetBodyMissing) \
+    macro(0x29, BodyMissing) \
+    macro(0x2a, GetBodyPack) \
+    macro(0x2b, BodyPack) \
     /* onwer-relevant */ \
     macro(0x2c, GetUtxoEvents) \
     macro(0x2d, UtxoEvents) \
@@ -236,6 +283,10 @@ namespace proto {
     macro(0x30, NewTransaction) \
     macro(0x31, HaveTransaction) \
     macro(0x32, GetTransaction) \
+    /* owner utxo events streaming */ \
+    macro(0x33, UtxoEventsSubscribe) \
+    macro(0x34, UtxoEventsPack) \
+    macro(0x35, UtxoEventsAck) \
     /* bbs */ \
     macro(0x38, BbsMsg) \
     macro(0x39, BbsHaveMsg) \
@@ -250,6 +301,9 @@ namespace proto {
         static const uint8_t Bbs                    = 0x2; // I'm spreading bbs messages
         static const uint8_t SendPeers                = 0x4; // Please send me periodically peers recommendations
         static const uint8_t MiningFinalization        = 0x8; // I want to finalize block construction for my owned node
+        static const uint8_t CompactBlocks            = 0x10; // I can serve and receive compact block bodies
+        static const uint8_t UtxoEventsStream        = 0x20; // I can stream utxo events to the owner (see UtxoEventsSubscribe)
+        static const uint8_t BodyPack                = 0x40; // I can serve consecutive blocks in packs (see GetBodyPack)
     };
 
     struct IDType
@@ -260,10 +314,27 @@ namespace proto {
     };
 
     static const uint32_t g_HdrPackMaxSize = 128;
+    static const uint32_t g_BodyPackMaxSize = 0x500000; // flow control. The response is truncated once it reaches this size, but at least 1 body is sent
+
+    struct BodyBuffers
+    {
+        ByteBuffer m_Perishable;
+        ByteBuffer m_Eternal;
+
+        template <typename Archive>
+        void serialize(Archive& ar)
+        {
+            ar
+                & m_Perishable
+                & m_Eternal;
+        }
+    };
 
     struct UtxoEvent
     {
         static const uint32_t s_Max = 64; // will send more, if the remaining events are on the same height
+        static const uint32_t s_MaxPack = 0x400; // same for the streamed packs
+        static const uint32_t s_MaxWindow = 8; // packs in flight, the requested window is clamped to it
 
         Key::IDV m_Kidv;
         ECC::Point m_Commitment;
@@ -286,6 +357,10 @@ namespace proto {
                 & m_Maturity
                 & m_Added;
         }
+
+        // Compact encoding for the streamed packs. Heights are delta-encoded (starting from hBase), maturity is relative to the height.
+        static void Encode(ByteBuffer&, const std::vector<UtxoEvent>&, Height hBase);
+        static void Decode(std::vector<UtxoEvent>&, const ByteBuffer&, Height hBase); // throws on malformed data
     };
 
     enum Unused_ { Unused };
@@ -307,6 +382,7 @@ namespace proto {
     inline void ZeroInit(Block::SystemState::Full& x) { ZeroObject(x); }
     inline void ZeroInit(Block::SystemState::Sequence::Prefix& x) { ZeroObject(x); }
     inline void ZeroInit(Block::ChainWorkProof& x) {}
+    inline void ZeroInit(Block::BodyBase& x) { x.ZeroInit(); }
     inline void ZeroInit(ECC::Point& x) { ZeroObject(x); }
     inline void ZeroInit(ECC::Signature& x) { ZeroObject(x); }
     inline void ZeroInit(TxKernel::LongProof& x) { ZeroObject(x.m_State); }
@@ -321,6 +397,11 @@ namespace proto {
         static void Set(std::unique_ptr<T>& var, TArg arg) { var = std::move(arg); }
     };
 
+    template <typename T> struct InitArg<std::vector<std::unique_ptr<T> > > {
+        typedef std::vector<std::unique_ptr<T> >& TArg;
+        static void Set(std::vector<std::unique_ptr<T> >& var, TArg arg) { var = std::move(arg); }
+    };
+
 
 #define THE_MACRO6(type, name) InitArg<type>::Set(m_##name, arg##name);
 #define THE_MACRO5(type, name) typename InitArg<type>::TArg arg##name,
@@ -383,6 +464,7 @@ namespace proto {
         virtual bool VerifyMsg(const uint8_t*, uint32_t nSize) override;
 
         void Encrypt(SerializedMsg&, MsgSerializer&);
+        void Encrypt(SerializedMsg&); // already finalized, ends with the MAC placeholder. Fragments are encrypted in-place, must be writable
     };
 
     void Sk2Pk(PeerID&, ECC::Scalar::Native&); // will negate the scalar iff necessary
@@ -534,6 +616,10 @@ namespace proto {
         BeamNodeMsgsAll(THE_MACRO)
 #undef THE_MACRO
 
+        // Same as Send(Body), but the buffers are referenced by the outgoing message rather than serialized.
+        // In the encrypted mode they're copied once (since encryption is in-place).
+        void SendBody(const io::SharedBuffer& bodyP, const io::SharedBuffer& bodyE);
+
         struct Server
         {
             io::TcpServer::Ptr m_pServer; // just delete it to stop listening
@@ -14,9 +14,97 @@
 
 #include "radixtree.h"
 #include "ecc_native.h"
+#include <thread>
 
 namespace beam {
 
+/////////////////////////////
+// RadixTree::SlabAllocator
+RadixTree::SlabAllocator::SlabAllocator(size_t nSize)
+	:m_pFree(NULL)
+	,m_nInSlab(0)
+	,m_nUsed(0)
+	,m_nFree(0)
+{
+	const size_t nAlign = sizeof(uint64_t);
+	m_nSize = (std::max(nSize, sizeof(FreeNode)) + nAlign - 1) & ~(nAlign - 1);
+	m_nPerSlab = s_SlabSize / m_nSize;
+	assert(m_nPerSlab);
+}
+
+RadixTree::SlabAllocator::~SlabAllocator()
+{
+	assert(!m_nUsed);
+}
+
+void* RadixTree::SlabAllocator::Alloc()
+{
+	if (m_pFree)
+	{
+		FreeNode* p = m_pFree;
+		m_pFree = p->m_pNext;
+		m_nFree--;
+		m_nUsed++;
+		return p;
+	}
+
+	if (m_vSlabs.empty() || (m_nPerSlab == m_nInSlab))
+	{
+		std::unique_ptr<uint8_t[]> pSlab(new uint8_t[m_nSize * m_nPerSlab]);
+		m_vSlabs.push_back(std::move(pSlab));
+		m_nInSlab = 0;
+	}
+
+	void* p = m_vSlabs.back().get() + m_nSize * m_nInSlab++;
+	m_nUsed++;
+	return p;
+}
+
+void RadixTree::SlabAllocator::Free(void* p)
+{
+	assert(p && m_nUsed);
+
+	if (!--m_nUsed)
+		Reset();
+	else
+	{
+		FreeNode* pF = reinterpret_cast<FreeNode*>(p);
+		pF->m_pNext = m_pFree;
+		m_pFree = pF;
+		m_nFree++;
+	}
+}
+
+void RadixTree::SlabAllocator::Reset()
+{
+	assert(!m_nUsed);
+	m_vSlabs.clear();
+	m_pFree = NULL;
+	m_nInSlab = 0;
+	m_nFree = 0;
+}
+
+void RadixTree::SlabAllocator::get_Stats(Stats& s) const
+{
+	s.m_Nodes += m_nUsed;
+	s.m_BytesUsed += m_nUsed * m_nSize;
+	s.m_BytesReserved += m_vSlabs.size() * m_nPerSlab * m_nSize;
+	s.m_BytesFree += m_nFree * m_nSize;
+}
+
+void RadixTree::SlabAllocator::Stats::operator += (const Stats& s)
+{
+	m_Nodes += s.m_Nodes;
+	m_BytesUsed += s.m_BytesUsed;
+	m_BytesReserved += s.m_BytesReserved;
+	m_BytesFree += s.m_BytesFree;
+}
+
+double RadixTree::SlabAllocator::Stats::get_Fragmentation() const
+{
+	return m_BytesReserved ? double(m_BytesFree) / double(m_BytesReserved) : 0.;
+}
+
 /////////////////////////////
 // RadixTree
 uint16_t RadixTree::Node::get_Bits() const
@@ -301,6 +389,145 @@ void RadixTree::Delete(CursorBase& cu)
 }
 
 
+struct RadixTree::BulkBuilder
+{
+	RadixTree& m_Tree;
+	Leaf** m_ppLeaf;
+	Joint** m_ppJoint;
+	uint16_t m_nKeyBits;
+
+	BulkBuilder(RadixTree& t) :m_Tree(t) {}
+
+	const uint8_t* get_Key(size_t i) const
+	{
+		return m_Tree.GetLeafKey(*m_ppLeaf[i]);
+	}
+
+	static uint8_t get_Bit(const uint8_t* pKey, uint16_t nBit)
+	{
+		return 1 & CursorBase::get_BitRawStat(pKey, nBit);
+	}
+
+	static uint16_t get_CommonBits(const uint8_t* p0, const uint8_t* p1, uint16_t n0)
+	{
+		// keys are known to differ
+		uint16_t n = n0;
+		for ( ; 7 & n; n++)
+			if (get_Bit(p0, n) != get_Bit(p1, n))
+				return n - n0;
+
+		for ( ; p0[n >> 3] == p1[n >> 3]; n += 8)
+			;
+
+		for ( ; get_Bit(p0, n) == get_Bit(p1, n); n++)
+			;
+
+		return n - n0;
+	}
+
+	// Builds the subtree of leaves [i0, i1), which share the first nStart bits. Joints are taken from [iJ, iJ + i1 - i0 - 1).
+	Node* Build(size_t i0, size_t i1, size_t iJ, uint16_t nStart, uint32_t nForkDepth)
+	{
+		assert(i1 > i0);
+		if (i1 - i0 == 1)
+		{
+			Leaf* pL = m_ppLeaf[i0];
+			pL->m_Bits = (m_nKeyBits - nStart) | Node::s_Leaf;
+			return pL;
+		}
+
+		const uint8_t* pKey0 = get_Key(i0);
+		uint16_t nBits = get_CommonBits(pKey0, get_Key(i1 - 1), nStart);
+		uint16_t nBitSplit = nStart + nBits;
+
+		// first element with the split bit set
+		size_t iLo = i0 + 1, iHi = i1 - 1;
+		while (iLo < iHi)
+		{
+			size_t iMid = (iLo + iHi) >> 1;
+			if (get_Bit(get_Key(iMid), nBitSplit))
+				iHi = iMid;
+			else
+				iLo = iMid + 1;
+		}
+
+		Joint* pJ = m_ppJoint[iJ + (iLo - i0 - 1)];
+		pJ->m_Bits = nBits;
+		pJ->m_pKeyPtr = pKey0;
+
+		if (nForkDepth)
+		{
+			nForkDepth--;
+
+			std::thread t;
+			try {
+				t = std::thread(&BulkBuilder::BuildAsync, this, pJ, iLo, i1, iJ + (iLo - i0), nBitSplit + 1, nForkDepth);
+			} catch (const std::system_error&) {
+				// run inline
+			}
+
+			pJ->m_ppC[0] = Build(i0, iLo, iJ, nBitSplit + 1, nForkDepth);
+
+			if (t.joinable())
+			{
+				t.join();
+				return pJ;
+			}
+		}
+		else
+			pJ->m_ppC[0] = Build(i0, iLo, iJ, nBitSplit + 1, 0);
+
+		pJ->m_ppC[1] = Build(iLo, i1, iJ + (iLo - i0), nBitSplit + 1, nForkDepth);
+		return pJ;
+	}
+
+	void BuildAsync(Joint* pJ, size_t i0, size_t i1, size_t iJ, uint16_t nStart, uint32_t nForkDepth)
+	{
+		Node* p = Build(i0, i1, iJ, nStart, nForkDepth);
+		m_Tree.OnSubtreeBuilt(*p);
+		pJ->m_ppC[1] = p;
+	}
+};
+
+void RadixTree::BuildSorted(Leaf** ppLeaf, size_t nCount, uint16_t nKeyBits, uint32_t nThreads)
+{
+	assert(!m_pRoot);
+	if (!nCount)
+		return;
+
+	// Allocate all the joints in advance, so that the build itself can't fail
+	struct Guard
+	{
+		RadixTree& m_Tree;
+		std::vector<Joint*> m_vJoints;
+
+		Guard(RadixTree& t) :m_Tree(t) {}
+		~Guard()
+		{
+			for (size_t i = 0; i < m_vJoints.size(); i++)
+				m_Tree.DeleteJoint(m_vJoints[i]);
+		}
+	} g(*this);
+
+	g.m_vJoints.reserve(nCount - 1);
+	for (size_t i = 1; i < nCount; i++)
+		g.m_vJoints.push_back(CreateJoint());
+
+	uint32_t nForkDepth = 0;
+	while ((2U << nForkDepth) <= nThreads)
+		nForkDepth++;
+
+	BulkBuilder bb(*this);
+	bb.m_ppLeaf = ppLeaf;
+	bb.m_ppJoint = g.m_vJoints.empty() ? NULL : &g.m_vJoints.front();
+	bb.m_nKeyBits = nKeyBits;
+
+	m_pRoot = bb.Build(0, nCount, 0, 0, nForkDepth);
+	g.m_vJoints.clear(); // dismissed
+
+	OnSubtreeBuilt(*m_pRoot);
+}
+
 bool RadixTree::Traverse(const Node& n, ITraveler& t) const
 {
 	if (t.m_pCu->m_pp)
@@ -443,6 +670,25 @@ size_t RadixTree::Count() const
 
 /////////////////////////////
 // RadixHashTree
+RadixHashTree::RadixHashTree(size_t nLeafSize)
+	:m_JointAlloc(sizeof(MyJoint))
+	,m_LeafAlloc(nLeafSize)
+{
+}
+
+void RadixHashTree::DeleteJoint(Joint* p)
+{
+	MyJoint* pJ = Cast::Up<MyJoint>(p);
+	pJ->~MyJoint();
+	m_JointAlloc.Free(pJ);
+}
+
+void RadixHashTree::get_MemStats(MemStats& s) const
+{
+	m_JointAlloc.get_Stats(s);
+	m_LeafAlloc.get_Stats(s);
+}
+
 void RadixHashTree::get_Hash(Merkle::Hash& hv)
 {
 	Node* p = get_Root();
@@ -452,6 +698,12 @@ void RadixHashTree::get_Hash(Merkle::Hash& hv)
 		hv = Zero;
 }
 
+void RadixHashTree::OnSubtreeBuilt(Node& n)
+{
+	Merkle::Hash hv;
+	get_Hash(n, hv);
+}
+
 const Merkle::Hash& RadixHashTree::get_Hash(Node& n, Merkle::Hash& hv)
 {
 	if (Node::s_Leaf & n.m_Bits)
@@ -479,6 +731,67 @@ const Merkle::Hash& RadixHashTree::get_Hash(Node& n, Merkle::Hash& hv)
 	return x.m_Hash;
 }
 
+void RadixHashTree::ParallelHash::Prepare(RadixHashTree& t, uint32_t nThreads)
+{
+	struct Dirty {
+		static bool IsJoint(const Node* p) {
+			return !((Node::s_Clean | Node::s_Leaf) & p->m_Bits);
+		}
+	};
+
+	m_vTasks.clear();
+
+	Node* pRoot = t.get_Root();
+	if (!pRoot || !Dirty::IsJoint(pRoot))
+		return;
+
+	// breadth-first descent through the dirty joints, until there are enough subtrees.
+	// Leaves aren't collected, they're cheap and are anyway rehashed by their parents.
+	m_vTasks.push_back(pRoot);
+
+	const size_t nTarget = size_t(nThreads) * s_TasksPerThread;
+	size_t i0 = 0;
+
+	for ( ; (i0 < m_vTasks.size()) && (m_vTasks.size() - i0 < nTarget); i0++)
+	{
+		const Joint& x = Cast::Up<Joint>(*m_vTasks[i0]);
+
+		for (size_t i = 0; i < _countof(x.m_ppC); i++)
+			if (Dirty::IsJoint(x.m_ppC[i]))
+				m_vTasks.push_back(x.m_ppC[i]);
+	}
+
+	// Count the rest of the dirty joints, up to the threshold. Below it the serial rehash is faster than waking up the threads.
+	std::vector<const Node*> vStack(m_vTasks.begin() + i0, m_vTasks.end());
+	for (size_t nDirty = i0; nDirty < s_MinDirtyJoints; nDirty++)
+	{
+		if (vStack.empty())
+		{
+			m_vTasks.clear();
+			return;
+		}
+
+		const Joint& x = Cast::Up<Joint>(*vStack.back());
+		vStack.pop_back();
+
+		for (size_t i = 0; i < _countof(x.m_ppC); i++)
+			if (Dirty::IsJoint(x.m_ppC[i]))
+				vStack.push_back(x.m_ppC[i]);
+	}
+
+	m_vTasks.erase(m_vTasks.begin(), m_vTasks.begin() + i0);
+}
+
+void RadixHashTree::ParallelHash::Execute(RadixHashTree& t, uint32_t iThread, uint32_t nThreads)
+{
+	// the subtrees are interleaved between the threads, each writes only to its own nodes
+	for (size_t i = iThread; i < m_vTasks.size(); i += nThreads)
+	{
+		Merkle::Hash hv;
+		t.get_Hash(*m_vTasks[i], hv);
+	}
+}
+
 void RadixHashTree::get_Proof(Merkle::Proof& proof, const CursorBase& cu)
 {
 	uint16_t n = cu.get_Depth();
@@ -504,8 +817,24 @@ void RadixHashTree::get_Proof(Merkle::Proof& proof, const CursorBase& cu)
 	assert(proof.size() == nOut);
 }
 
+/////////////////////////////
+// RadixHashOnlyTree
+void RadixHashOnlyTree::DeleteLeaf(Leaf* p)
+{
+	MyLeaf* pL = Cast::Up<MyLeaf>(p);
+	pL->~MyLeaf();
+	m_LeafAlloc.Free(pL);
+}
+
 /////////////////////////////
 // UtxoTree
+void UtxoTree::DeleteLeaf(Leaf* p)
+{
+	MyLeaf* pL = Cast::Up<MyLeaf>(p);
+	pL->~MyLeaf();
+	m_LeafAlloc.Free(pL);
+}
+
 void UtxoTree::Value::get_Hash(Merkle::Hash& hv, const Key& key) const
 {
 	ECC::Hash::Processor()
@@ -562,29 +891,46 @@ void UtxoTree::LoadIntenral(ISerializer& s)
 	uint32_t n = 0;
 	s.Process(n);
 
-	Key pKey[2];
+	// Read all the elements first, then build the tree at once
+	struct Guard
+	{
+		UtxoTree& m_Tree;
+		std::vector<Leaf*> m_vLeafs;
+
+		Guard(UtxoTree& t) :m_Tree(t) {}
+		~Guard()
+		{
+			for (size_t i = 0; i < m_vLeafs.size(); i++)
+				m_Tree.DeleteLeaf(m_vLeafs[i]);
+		}
+	} g(*this);
+
+	g.m_vLeafs.reserve(n);
 
 	for (uint32_t i = 0; i < n; i++)
 	{
-		Key& key = pKey[1 & i];
-		const Key& keyPrev = pKey[!(1 & i)];
+		g.m_vLeafs.push_back(CreateLeaf());
+		MyLeaf& x = Cast::Up<MyLeaf>(*g.m_vLeafs.back());
 
-		s.Process(key);
+		s.Process(x.m_Key);
 
 		if (i)
 		{
 			// must be in ascending order
-			if (keyPrev.cmp(key) >= 0)
+			const MyLeaf& xPrev = Cast::Up<MyLeaf>(*g.m_vLeafs[i - 1]);
+			if (xPrev.m_Key.cmp(x.m_Key) >= 0)
 				throw std::runtime_error("incorrect order");
 		}
 
-		Cursor cu;
-		bool bCreate = true;
-		MyLeaf* p = Find(cu, key, bCreate);
-
-		p->m_Value.m_Count = 0;
-		s.Process(p->m_Value);
+		x.m_Value.m_Count = 0;
+		s.Process(x.m_Value);
 	}
+
+	if (g.m_vLeafs.empty())
+		return;
+
+	BuildSorted(&g.m_vLeafs.front(), g.m_vLeafs.size(), Key::s_Bits, std::thread::hardware_concurrency());
+	g.m_vLeafs.clear(); // dismissed
 }
 
 int UtxoTree::Key::cmp(const Key& k) const
@@ -53,8 +53,57 @@ protected:
 	virtual void DeleteJoint(Joint*) = 0;
 	virtual void DeleteLeaf(Leaf*) = 0;
 
+	// Called once for each subtree completed by BuildSorted, on the thread that built it, and finally for the root.
+	// Must not throw.
+	virtual void OnSubtreeBuilt(Node&) {}
+
+	// Builds the tree bottom-up from leaves (allocated via CreateLeaf) with strictly ascending keys. The tree must be empty.
+	// Independent subtrees are built on up to nThreads threads. On success the tree takes ownership of the leaves.
+	void BuildSorted(Leaf** ppLeaf, size_t nCount, uint16_t nKeyBits, uint32_t nThreads);
+
 public:
 
+	// Fixed-size node allocator. Nodes are carved from slabs, freed nodes are kept in a free list for reuse.
+	// All the slabs are released once the last node is freed. Not thread-safe.
+	class SlabAllocator
+	{
+		struct FreeNode {
+			FreeNode* m_pNext;
+		};
+
+		std::vector<std::unique_ptr<uint8_t[]> > m_vSlabs;
+		FreeNode* m_pFree;
+		size_t m_nSize;
+		size_t m_nPerSlab;
+		size_t m_nInSlab; // nodes carved from the last slab
+		size_t m_nUsed;
+		size_t m_nFree;
+
+	public:
+		static const size_t s_SlabSize = 0x10000;
+
+		struct Stats
+		{
+			size_t m_Nodes;
+			size_t m_BytesUsed;
+			size_t m_BytesReserved;
+			size_t m_BytesFree; // freed nodes awaiting reuse
+
+			Stats() { ZeroObject(*this); }
+			void operator += (const Stats&);
+			double get_Fragmentation() const; // freed part of the reserved memory
+		};
+
+		SlabAllocator(size_t nSize);
+		~SlabAllocator();
+
+		void* Alloc();
+		void Free(void*);
+		void Reset();
+
+		void get_Stats(Stats&) const; // accumulates
+	};
+
 	RadixTree();
 	~RadixTree();
 
@@ -126,6 +175,8 @@ private:
 
 	void DeleteNode(Node*);
 	void ReplaceTip(CursorBase& cu, Node* pNew);
+
+	struct BulkBuilder;
 	bool Traverse(const Node&, ITraveler&) const;
 
 	static int Cmp(const uint8_t* pKey, const uint8_t* pThreshold, uint16_t n0, uint16_t dn);
@@ -141,13 +192,38 @@ public:
 		Merkle::Hash m_Hash;
 	};
 
+	RadixHashTree(size_t nLeafSize);
+
 	void get_Hash(Merkle::Hash&);
 	void get_Proof(Merkle::Proof&, const CursorBase&);
 
+	typedef SlabAllocator::Stats MemStats;
+	void get_MemStats(MemStats&) const;
+
+	// Multi-threaded hash update. Prepare() splits the dirty part of the tree into independent subtrees,
+	// then Execute() should be called concurrently for each thread index, and get_Hash() finishes the upper part.
+	// Prepare() yields no tasks if the dirty part is too small to benefit from it.
+	class ParallelHash
+	{
+		std::vector<Node*> m_vTasks;
+	public:
+		static const uint32_t s_TasksPerThread = 8;
+		static const size_t s_MinDirtyJoints = 512; // ~1ms of serial hashing, smaller changes are left to the serial get_Hash()
+
+		void Prepare(RadixHashTree&, uint32_t nThreads);
+		void Execute(RadixHashTree&, uint32_t iThread, uint32_t nThreads);
+		size_t get_Tasks() const { return m_vTasks.size(); }
+	};
+
 protected:
+	SlabAllocator m_JointAlloc;
+	SlabAllocator m_LeafAlloc;
+
 	// RadixTree
-	virtual Joint* CreateJoint() override { return new MyJoint; }
-	virtual void DeleteJoint(Joint* p) override { delete Cast::Up<MyJoint>(p); }
+	virtual Joint* CreateJoint() override { return new (m_JointAlloc.Alloc()) MyJoint; }
+	virtual void DeleteJoint(Joint* p) override;
+
+	virtual void OnSubtreeBuilt(Node& n) override;
 
 	const Merkle::Hash& get_Hash(Node&, Merkle::Hash&);
 
@@ -174,12 +250,13 @@ public:
 		return Cast::Up<MyLeaf>(RadixTree::Find(cu, key.m_pData, ECC::nBits, bCreate));
 	}
 
+	RadixHashOnlyTree() :RadixHashTree(sizeof(MyLeaf)) {}
 	~RadixHashOnlyTree() { Clear(); }
 
 protected:
-	virtual Leaf* CreateLeaf() override { return new MyLeaf; }
+	virtual Leaf* CreateLeaf() override { return new (m_LeafAlloc.Alloc()) MyLeaf; }
 	virtual uint8_t* GetLeafKey(const Leaf& x) const override { return Cast::Up<MyLeaf>(Cast::NotConst(x)).m_Hash.m_pData; }
-	virtual void DeleteLeaf(Leaf* p) override { delete Cast::Up<MyLeaf>(p); }
+	virtual void DeleteLeaf(Leaf* p) override;
 	virtual const Merkle::Hash& get_LeafHash(Node& n, Merkle::Hash&) override { return Cast::Up<MyLeaf>(n).m_Hash; }
 };
 
@@ -233,6 +310,7 @@ public:
 		return Cast::Up<MyLeaf>(RadixTree::Find(cu, key.m_pArr, key.s_Bits, bCreate));
 	}
 
+	UtxoTree() :RadixHashTree(sizeof(MyLeaf)) {}
 	~UtxoTree() { Clear(); }
 
     template<typename Archive>
@@ -253,9 +331,9 @@ public:
 
 
 protected:
-	virtual Leaf* CreateLeaf() override { return new MyLeaf; }
+	virtual Leaf* CreateLeaf() override { return new (m_LeafAlloc.Alloc()) MyLeaf; }
 	virtual uint8_t* GetLeafKey(const Leaf& x) const override { return Cast::Up<MyLeaf>(Cast::NotConst(x)).m_Key.m_pArr; }
-	virtual void DeleteLeaf(Leaf* p) override { delete Cast::Up<MyLeaf>(p); }
+	virtual void DeleteLeaf(Leaf* p) override;
 	virtual const Merkle::Hash& get_LeafHash(Node&, Merkle::Hash&) override;
 
 	struct ISerializer {
@@ -497,6 +497,33 @@ void TestCommitments()
 	sigma = -sigma;
 	sigma += comm;
 	verify_test(sigma == Zero);
+
+	// batch, should be the same
+	Key::IKdf::Ptr pChild;
+	HKdf::CreateChild(pChild, kdf, 3);
+
+	const uint32_t nBatch = beam::SwitchCommitment::s_BatchChunk * 3 + 5; // several chunks, uneven
+	std::vector<Key::IDV> vKidv(nBatch);
+	std::vector<Key::IKdf*> vKdf(nBatch);
+	std::vector<Point> vComm(nBatch);
+
+	for (uint32_t i = 0; i < nBatch; i++)
+	{
+		vKidv[i] = Key::IDV(i * 1000, i, Key::Type::Regular, (i & 1) ? 3 : 0);
+		vKdf[i] = (i & 1) ? pChild.get() : &kdf;
+	}
+
+	for (uint32_t nThreads = 1; nThreads <= 4; nThreads += 3)
+	{
+		beam::SwitchCommitment().CreateBatch(&vComm.front(), &vKdf.front(), &vKidv.front(), nBatch, nThreads);
+
+		for (uint32_t i = 0; i < nBatch; i++)
+		{
+			Point comm2;
+			beam::SwitchCommitment().Create(sk, comm2, *vKdf[i], vKidv[i]);
+			verify_test(vComm[i] == comm2);
+		}
+	}
 }
 
 template <typename T>
@@ -1034,6 +1061,35 @@ void TestAES()
 
 	sd.dec.Proceed(pBuf, pBuf); // inplace decode
 	verify_test(!memcmp(pBuf, pPlaintext, sizeof(pPlaintext)));
+
+	// stream cipher: the hardware path (if supported) must give the same result, regardless to the fragmentation
+	AES::StreamCipher asc0, asc1;
+	asc0.Reset();
+	memset(asc0.m_Counter.m_pData + 8, 0xff, 8); // test the carry
+	asc0.m_Counter.m_pData[15] = 0xf0;
+	asc1 = asc0;
+
+	uint8_t pStream0[0x401], pStream1[sizeof(pStream0)];
+	GenerateRandom(pStream0, sizeof(pStream0));
+	memcpy(pStream1, pStream0, sizeof(pStream0));
+
+	bool bUseHw = AES::StreamCipher::s_UseHw;
+
+	AES::StreamCipher::s_UseHw = false;
+	asc0.XCrypt(se.enc, pStream0, sizeof(pStream0));
+
+	AES::StreamCipher::s_UseHw = true;
+	for (uint32_t i = 0, nDone = 0; nDone < sizeof(pStream1); i++)
+	{
+		uint32_t n = std::min((i * 37) % 101, static_cast<uint32_t>(sizeof(pStream1)) - nDone);
+		asc1.XCrypt(se.enc, pStream1 + nDone, n);
+		nDone += n;
+	}
+
+	AES::StreamCipher::s_UseHw = bUseHw;
+
+	verify_test(!memcmp(pStream0, pStream1, sizeof(pStream0)));
+	verify_test(asc0.m_Counter == asc1.m_Counter);
 }
 
 void TestKdf()
@@ -1362,6 +1418,7 @@ struct BenchmarkMeter
 	uint64_t m_Cycles;
 
 	uint32_t N;
+	uint32_t m_nBytes; // per cycle, if specified the throughput is printed as well
 
 #ifdef WIN32
 
@@ -1391,6 +1448,7 @@ struct BenchmarkMeter
 		:m_sz(sz)
 		,m_Cycles(0)
 		,N(1000)
+		,m_nBytes(0)
 	{
 #ifdef WIN32
 		QueryPerformanceFrequency((LARGE_INTEGER*) &m_Freq);
@@ -1406,7 +1464,10 @@ struct BenchmarkMeter
 		double dt_s = double(get_Time() - m_Start) / double(m_Freq);
 		if (dt_s >= 1.)
 		{
-			printf("%-24s: %.2f us\n", m_sz, dt_s * 1e6 / double(m_Cycles));
+			if (m_nBytes)
+				printf("%-24s: %.2f us, %.1f MB/s\n", m_sz, dt_s * 1e6 / double(m_Cycles), double(m_nBytes) * double(m_Cycles) / (dt_s * 1024. * 1024.));
+			else
+				printf("%-24s: %.2f us\n", m_sz, dt_s * 1e6 / double(m_Cycles));
 			return false;
 		}
 
@@ -1791,7 +1852,14 @@ void RunBenchmark()
 		} while (bm.ShouldContinue());
 	}
 
+	for (int iHw = 0; iHw < 2; iHw++)
 	{
+		if (iHw && !AES::StreamCipher::IsHwSupported())
+			break;
+
+		bool bUseHw = AES::StreamCipher::s_UseHw;
+		AES::StreamCipher::s_UseHw = (iHw != 0);
+
 		AES::Encoder enc;
 		enc.Init(hv.m_pData);
 		AES::StreamCipher asc;
@@ -1799,8 +1867,9 @@ void RunBenchmark()
 
 		uint8_t pBuf[0x400];
 
-		BenchmarkMeter bm("AES.XCrypt-1MB");
+		BenchmarkMeter bm(iHw ? "AES.XCrypt-1MB.HW" : "AES.XCrypt-1MB");
 		bm.N = 10;
+		bm.m_nBytes = 0x100000;
 		do
 		{
 			for (uint32_t i = 0; i < bm.N; i++)
@@ -1810,6 +1879,8 @@ void RunBenchmark()
 			}
 
 		} while (bm.ShouldContinue());
+
+		AES::StreamCipher::s_UseHw = bUseHw;
 	}
 
 	{
@@ -0,0 +1,200 @@
+// Copyright 2018 The Beam Team
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include "../radixtree.h"
+#include "../../utility/serialize.h"
+
+using namespace std;
+using namespace beam;
+
+namespace
+{
+    typedef chrono::high_resolution_clock Clock;
+
+    uint64_t get_Micro(const Clock::time_point& t0, const Clock::time_point& t1)
+    {
+        return chrono::duration_cast<chrono::microseconds>(t1 - t0).count();
+    }
+
+    void SetRandomUtxoKey(UtxoTree::Key& key)
+    {
+        UtxoTree::Key::Data d;
+
+        for (size_t i = 0; i < d.m_Commitment.m_X.nBytes; i++)
+            d.m_Commitment.m_X.m_pData[i] = (uint8_t) rand();
+
+        d.m_Commitment.m_Y = (1 & rand());
+
+        for (size_t i = 0; i < sizeof(d.m_Maturity); i++)
+            ((uint8_t*) &d.m_Maturity)[i] = (uint8_t) rand();
+
+        key = d;
+    }
+
+    void BenchBuild(uint32_t nElements)
+    {
+        // one-by-one insertion vs bulk load of the same elements
+        UtxoTree t;
+        Merkle::Hash hv;
+
+        auto tm0 = Clock::now();
+
+        for (uint32_t i = 0; i < nElements; i++)
+        {
+            UtxoTree::Key key;
+            SetRandomUtxoKey(key);
+
+            UtxoTree::Cursor cu;
+            bool bCreate = true;
+            t.Find(cu, key, bCreate)->m_Value.m_Count = 1;
+        }
+        t.get_Hash(hv);
+
+        auto tm1 = Clock::now();
+
+        UtxoTree::MemStats ms;
+        t.get_MemStats(ms);
+
+        Serializer ser;
+        t.save(ser);
+        SerializeBuffer sb = ser.buffer();
+
+        UtxoTree t2;
+        Deserializer der;
+        der.reset(sb.first, sb.second);
+
+        auto tm2 = Clock::now();
+
+        t2.load(der);
+        t2.get_Hash(hv);
+
+        auto tm3 = Clock::now();
+
+        cout << "UtxoTree " << nElements << " elements: insert+hash = " << get_Micro(tm0, tm1) / 1000
+            << " ms, bulk load = " << get_Micro(tm2, tm3) / 1000 << " ms" << endl;
+
+        cout << "UtxoTree " << nElements << " elements: used = " << ms.m_BytesUsed << ", reserved = " << ms.m_BytesReserved << endl;
+    }
+
+    void BenchRehash(uint32_t nElements, uint32_t nThreads)
+    {
+        // apply synthetic blocks to 2 identical trees, rehash one of them serially, and the other in parallel
+        UtxoTree pT[2];
+        vector<UtxoTree::Key> vKeys;
+
+        auto fnInsert = [&pT, &vKeys]() {
+            UtxoTree::Key key;
+            SetRandomUtxoKey(key);
+
+            for (size_t iTree = 0; iTree < _countof(pT); iTree++)
+            {
+                UtxoTree::Cursor cu;
+                bool bCreate = true;
+                pT[iTree].Find(cu, key, bCreate)->m_Value.m_Count = 1;
+            }
+
+            vKeys.push_back(key);
+        };
+
+        for (uint32_t i = 0; i < nElements; i++)
+            fnInsert();
+
+        Merkle::Hash hv1, hv2;
+        pT[0].get_Hash(hv1);
+        pT[1].get_Hash(hv2);
+
+        for (uint32_t nPerBlock = 10; nPerBlock <= 10000; nPerBlock *= 10)
+        {
+            const uint32_t nBlocks = 5;
+            uint64_t pMicro[2] = { 0 };
+            size_t nTasks = 0;
+
+            for (uint32_t iBlock = 0; iBlock < nBlocks; iBlock++)
+            {
+                for (uint32_t i = 0; i < nPerBlock; i++)
+                {
+                    // spend
+                    size_t iKey = rand() % vKeys.size();
+
+                    for (size_t iTree = 0; iTree < _countof(pT); iTree++)
+                    {
+                        UtxoTree::Cursor cu;
+                        bool bCreate = false;
+                        pT[iTree].Find(cu, vKeys[iKey], bCreate);
+                        pT[iTree].Delete(cu);
+                    }
+
+                    vKeys[iKey] = vKeys.back();
+                    vKeys.pop_back();
+
+                    fnInsert();
+                }
+
+                auto tm0 = Clock::now();
+
+                pT[0].get_Hash(hv1);
+
+                auto tm1 = Clock::now();
+
+                RadixHashTree::ParallelHash ph;
+                ph.Prepare(pT[1], nThreads);
+                nTasks = ph.get_Tasks();
+
+                if (nTasks >= 2)
+                {
+                    vector<thread> vThreads;
+                    for (uint32_t i = 0; i < nThreads; i++)
+                        vThreads.push_back(thread(&RadixHashTree::ParallelHash::Execute, &ph, ref(pT[1]), i, nThreads));
+                    for (uint32_t i = 0; i < nThreads; i++)
+                        vThreads[i].join();
+                }
+
+                pT[1].get_Hash(hv2);
+
+                auto tm2 = Clock::now();
+
+                if (hv1 != hv2)
+                    cout << "Hash mismatch!" << endl;
+
+                pMicro[0] += get_Micro(tm0, tm1);
+                pMicro[1] += get_Micro(tm1, tm2);
+            }
+
+            cout << "UtxoTree rehash, " << nPerBlock << " inputs+outputs per block: serial = " << pMicro[0] / nBlocks
+                << " us, parallel (" << nThreads << " threads, " << nTasks << " tasks) = " << pMicro[1] / nBlocks << " us" << endl;
+        }
+    }
+}
+
+// Usage: storage_bench [elements] [threads]
+// Times the UtxoTree one-by-one insertion vs the bulk load and reports its memory usage, and the serial vs the parallel rehash after synthetic blocks.
+// The parallel rehash falls back to serial for small blocks (see RadixHashTree::ParallelHash::s_MinDirtyJoints).
+int main(int argc, char* argv[])
+{
+    uint32_t nElements = (argc > 1) ? atoi(argv[1]) : 70000;
+    uint32_t nThreads = (argc > 2) ? atoi(argv[2]) : thread::hardware_concurrency();
+    if (!nElements)
+        nElements = 1;
+    if (!nThreads)
+        nThreads = 1;
+
+    BenchBuild(nElements);
+    BenchRehash(nElements, nThreads);
+
+    return 0;
+}
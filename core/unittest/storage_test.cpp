@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <iostream>
+#include <thread>
 #include "../radixtree.h"
 #include "../navigator.h"
 #include "../../utility/serialize.h"
@@ -265,11 +266,25 @@ namespace beam
 
 		t.get_Hash(hv1);
 
+		UtxoTree::MemStats ms;
+		t.get_MemStats(ms);
+		verify_test(ms.m_Nodes == vKeys.size() * 2 - 1);
+		verify_test(ms.m_BytesUsed <= ms.m_BytesReserved);
+		verify_test(ms.m_BytesReserved - ms.m_BytesUsed < RadixTree::SlabAllocator::s_SlabSize * 2); // only the tails of the last joint and leaf slabs
+
 		for (uint32_t i = 0; i < vKeys.size(); i++)
 		{
 			if (i == vKeys.size()/2)
+			{
 				t.get_Hash(hvMid);
 
+				UtxoTree::MemStats ms2;
+				t.get_MemStats(ms2);
+				verify_test(ms2.m_Nodes == vKeys.size() - 1);
+				verify_test(ms2.m_BytesReserved == ms.m_BytesReserved);
+				verify_test(ms2.get_Fragmentation() > 0.4);
+			}
+
 			UtxoTree::Cursor cu;
 			bool bCreate = true;
 			UtxoTree::MyLeaf* p = t.Find(cu, vKeys[i], bCreate);
@@ -285,6 +300,10 @@ namespace beam
 		t.get_Hash(hv2);
 		verify_test(hv2 == Zero);
 
+		ms = UtxoTree::MemStats();
+		t.get_MemStats(ms);
+		verify_test(!ms.m_Nodes && !ms.m_BytesReserved);
+
 		// construct tree in different order
 		for (uint32_t i = (uint32_t) vKeys.size(); i--; )
 		{
@@ -326,6 +345,55 @@ namespace beam
 		t.get_Hash(hv2);
 		verify_test(hv2 == hv1);
 
+		{
+			// bulk load into a fresh tree
+			UtxoTree t3;
+
+			der.reset(sb.first, sb.second);
+			t3.load(der);
+			t3.get_Hash(hv2);
+			verify_test(hv2 == hv1);
+
+			// the bulk-loaded tree must remain consistent under modifications
+			for (uint32_t i = 0; i < vKeys.size(); i += 2)
+			{
+				UtxoTree::Cursor cu;
+				bool bCreate = false;
+				verify_test(t3.Find(cu, vKeys[i], bCreate));
+				t3.Delete(cu);
+
+				if (!(i % 1000))
+				{
+					t3.get_Hash(hv2);
+
+					uint32_t j = i + 1;
+					UtxoTree::MyLeaf* p = t3.Find(cu, vKeys[j], bCreate);
+					verify_test(p && (p->m_Value.m_Count == j));
+
+					Merkle::Proof proof;
+					t3.get_Proof(proof, cu);
+
+					Merkle::Hash hvElement;
+					p->m_Value.get_Hash(hvElement, p->m_Key);
+
+					Merkle::Interpret(hvElement, proof);
+					verify_test(hvElement == hv2);
+				}
+			}
+
+			UtxoTree t4;
+			for (uint32_t i = 1; i < vKeys.size(); i += 2)
+			{
+				UtxoTree::Cursor cu;
+				bool bCreate = true;
+				t4.Find(cu, vKeys[i], bCreate)->m_Value.m_Count = i;
+			}
+
+			t3.get_Hash(hv2);
+			t4.get_Hash(hvMid);
+			verify_test(hv2 == hvMid);
+		}
+
 		// narrow traverse
 		struct Traveler
 			:public RadixTree::ITraveler
@@ -357,6 +425,81 @@ namespace beam
 		t.Traverse(t2);
 	}
 
+	void TestUtxoRehash()
+	{
+		// apply synthetic blocks to 2 identical trees, rehash one of them serially, and the other in parallel.
+		// The timing is in storage_bench, here only the results are compared.
+		const uint32_t nThreads = 4;
+
+		UtxoTree pT[2];
+		std::vector<UtxoTree::Key> vKeys;
+
+		auto fnInsert = [&pT, &vKeys]() {
+			UtxoTree::Key::Data d;
+			SetRandomUtxoKey(d);
+			UtxoTree::Key key;
+			key = d;
+
+			for (size_t iTree = 0; iTree < _countof(pT); iTree++)
+			{
+				UtxoTree::Cursor cu;
+				bool bCreate = true;
+				pT[iTree].Find(cu, key, bCreate)->m_Value.m_Count = 1;
+			}
+
+			vKeys.push_back(key);
+		};
+
+		for (uint32_t i = 0; i < 20000; i++)
+			fnInsert();
+
+		Merkle::Hash hv1, hv2;
+		pT[0].get_Hash(hv1);
+		pT[1].get_Hash(hv2);
+
+		for (uint32_t nPerBlock = 10; nPerBlock <= 10000; nPerBlock *= 10)
+		{
+			for (uint32_t iBlock = 0; iBlock < 2; iBlock++)
+			{
+				for (uint32_t i = 0; i < nPerBlock; i++)
+				{
+					// spend
+					size_t iKey = rand() % vKeys.size();
+
+					for (size_t iTree = 0; iTree < _countof(pT); iTree++)
+					{
+						UtxoTree::Cursor cu;
+						bool bCreate = false;
+						verify_test(pT[iTree].Find(cu, vKeys[iKey], bCreate));
+						pT[iTree].Delete(cu);
+					}
+
+					vKeys[iKey] = vKeys.back();
+					vKeys.pop_back();
+
+					fnInsert();
+				}
+
+				pT[0].get_Hash(hv1);
+
+				RadixHashTree::ParallelHash ph;
+				ph.Prepare(pT[1], nThreads);
+
+				// small changes are left to the serial rehash
+				verify_test((ph.get_Tasks() >= 2) == (nPerBlock >= 100));
+
+				std::vector<std::thread> vThreads;
+				for (uint32_t i = 0; i < nThreads; i++)
+					vThreads.push_back(std::thread(&RadixHashTree::ParallelHash::Execute, &ph, std::ref(pT[1]), i, nThreads));
+				for (uint32_t i = 0; i < nThreads; i++)
+					vThreads[i].join();
+
+				pT[1].get_Hash(hv2);
+				verify_test(hv1 == hv2);
+			}
+		}
+	}
+
 	struct MyMmr
 		:public Merkle::Mmr
 	{
@@ -593,6 +736,7 @@ int main()
 {
 	beam::TestNavigator();
 	beam::TestUtxoTree();
+	beam::TestUtxoRehash();
 	beam::TestMmr();
 
 	return g_TestsFailed ? -1 : 0;
@@ -13,6 +13,15 @@
 // limitations under the License.
 
 #include "db.h"
+#include <set>
+#include <algorithm>
+
+#ifndef WIN32
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif // WIN32
 
 namespace beam {
 
@@ -76,6 +85,213 @@ namespace beam {
 #define TblDummy_ID				"ID"
 #define TblDummy_SpendHeight	"SpendHeight"
 
+#define TblBodies				"Bodies"
+#define TblBodies_State			"State"
+#define TblBodies_Segment		"Segment"
+#define TblBodies_Offset		"Offset"
+#define TblBodies_SizeP			"SizeP"
+#define TblBodies_SizeE			"SizeE"
+
+// The space isn't reclaimed within a segment: deleted bodies leave gaps, and so do the bodies appended by a rolled-back transaction
+// (until the next open, which resumes from the last referenced body). A segment file is deleted once none of its bodies is referenced,
+// so the space is eventually reclaimed as the old blocks are erased, but there's no compaction.
+struct NodeDB::BodyStore
+{
+	static const uint32_t s_SegmentSize = 64 * 1024 * 1024;
+	static const uint32_t s_MappedMax = 4; // besides the one being appended. The least recently used are unmapped on commit
+
+	struct Segment
+		:public io::AllocatedMemory
+	{
+#ifdef WIN32
+		HANDLE m_hFile; // needed to flush the file buffers. On POSIX msync is enough, the descriptor is closed right after mapping
+#endif // WIN32
+		uint8_t* m_pPtr;
+		uint64_t m_nUsed; // when last accessed
+
+		Segment();
+		~Segment() { Close(); }
+
+		// bWrite: the segment being appended, mapped writable. bCreate: may be created (as a sparse file of the segment size).
+		// Otherwise the file must exist and have the segment size
+		bool Open(const char* szPath, bool bWrite, bool bCreate);
+		void Close();
+		bool Flush(uint32_t nOffset, uint32_t nSize);
+	};
+
+	std::string m_sPath;
+	std::vector<std::shared_ptr<Segment> > m_vSegs; // by segment number, not-yet-mapped are NULL. May be referenced by the buffers being sent
+	std::set<uint32_t> m_setFree; // segments that may become unreferenced after commit
+
+	bool m_bWrite;
+	bool m_bAny; // if there are no bodies in the segments - the index lookup is skipped
+	uint32_t m_iLast; // the segment being appended
+	uint32_t m_nPos; // in the last segment
+	uint32_t m_nFlushed;
+	uint64_t m_nUseStamp;
+
+	std::string get_Path(uint32_t iSeg) const;
+	Segment& get_Seg(uint32_t iSeg);
+	void Flush();
+	void Remove(uint32_t iSeg);
+	void UnmapCold();
+};
+
+NodeDB::BodyStore::Segment::Segment()
+	:m_pPtr(NULL)
+	,m_nUsed(0)
+{
+#ifdef WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+#endif // WIN32
+}
+
+bool NodeDB::BodyStore::Segment::Open(const char* szPath, bool bWrite, bool bCreate)
+{
+	assert(!m_pPtr);
+	assert(bWrite || !bCreate);
+
+#ifdef WIN32
+	m_hFile = CreateFileW(Utf8toUtf16(szPath).c_str(), bWrite ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ, NULL, bCreate ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == m_hFile)
+		return false;
+
+	if (!bCreate)
+	{
+		LARGE_INTEGER nSize;
+		if (!GetFileSizeEx(m_hFile, &nSize) || (nSize.QuadPart < s_SegmentSize))
+			return false;
+	}
+
+	// extends the file if necessary
+	HANDLE hMap = CreateFileMappingW(m_hFile, NULL, bWrite ? PAGE_READWRITE : PAGE_READONLY, 0, s_SegmentSize, NULL);
+	if (!hMap)
+		return false;
+
+	m_pPtr = (uint8_t*) MapViewOfFile(hMap, bWrite ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, s_SegmentSize);
+	CloseHandle(hMap); // the view keeps the mapping object alive
+#else // WIN32
+	int hFile = open(szPath, bWrite ? (bCreate ? (O_RDWR | O_CREAT) : O_RDWR) : O_RDONLY, 0644);
+	if (hFile < 0)
+		return false;
+
+	struct stat st;
+	bool bSized =
+		!fstat(hFile, &st) &&
+		((st.st_size >= static_cast<off_t>(s_SegmentSize)) || (bCreate && !ftruncate(hFile, s_SegmentSize)));
+
+	if (bSized)
+	{
+		void* p = mmap(NULL, s_SegmentSize, bWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, hFile, 0);
+		if (MAP_FAILED != p)
+			m_pPtr = (uint8_t*) p;
+	}
+
+	close(hFile); // the mapping remains valid
+#endif // WIN32
+
+	return NULL != m_pPtr;
+}
+
+void NodeDB::BodyStore::Segment::Close()
+{
+#ifdef WIN32
+	if (m_pPtr)
+		UnmapViewOfFile(m_pPtr);
+	if (INVALID_HANDLE_VALUE != m_hFile)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+#else // WIN32
+	if (m_pPtr)
+		munmap(m_pPtr, s_SegmentSize);
+#endif // WIN32
+
+	m_pPtr = NULL;
+}
+
+bool NodeDB::BodyStore::Segment::Flush(uint32_t nOffset, uint32_t nSize)
+{
+#ifdef WIN32
+	return FlushViewOfFile(m_pPtr + nOffset, nSize) && FlushFileBuffers(m_hFile);
+#else // WIN32
+	static const uint32_t nPage = static_cast<uint32_t>(sysconf(_SC_PAGESIZE));
+
+	uint32_t nOffset0 = nOffset - nOffset % nPage; // msync needs a page-aligned address
+	return !msync(m_pPtr + nOffset0, nOffset + nSize - nOffset0, MS_SYNC);
+#endif // WIN32
+}
+
+std::string NodeDB::BodyStore::get_Path(uint32_t iSeg) const
+{
+	return m_sPath + std::to_string(iSeg);
+}
+
+NodeDB::BodyStore::Segment& NodeDB::BodyStore::get_Seg(uint32_t iSeg)
+{
+	if (m_vSegs.size() <= iSeg)
+		m_vSegs.resize(iSeg + 1);
+
+	std::shared_ptr<Segment>& pSeg = m_vSegs[iSeg];
+	if (!pSeg)
+	{
+		// Only the segment being appended is writable, and it's created only before anything is written to it.
+		// Other segments are referenced by the index, if they're missing or truncated - the data is corrupted
+		bool bWrite = m_bWrite && (iSeg == m_iLast);
+		bool bCreate = bWrite && !m_nPos;
+
+		std::shared_ptr<Segment> pNew(new Segment);
+		if (!pNew->Open(get_Path(iSeg).c_str(), bWrite, bCreate))
+		{
+			if (bCreate)
+				ThrowError("body segment open failed");
+			ThrowInconsistent();
+		}
+
+		pSeg = std::move(pNew);
+	}
+
+	pSeg->m_nUsed = ++m_nUseStamp;
+	return *pSeg;
+}
+
+void NodeDB::BodyStore::Flush()
+{
+	if (m_nPos > m_nFlushed)
+	{
+		if (!get_Seg(m_iLast).Flush(m_nFlushed, m_nPos - m_nFlushed))
+			ThrowError("body segment flush failed");
+
+		m_nFlushed = m_nPos;
+	}
+}
+
+void NodeDB::BodyStore::Remove(uint32_t iSeg)
+{
+	if (iSeg < m_vSegs.size())
+		m_vSegs[iSeg].reset();
+
+	DeleteFile(get_Path(iSeg).c_str());
+}
+
+void NodeDB::BodyStore::UnmapCold()
+{
+	std::vector<std::pair<uint64_t, uint32_t> > v; // last used, segment
+
+	for (uint32_t iSeg = 0; iSeg < m_vSegs.size(); iSeg++)
+		if (m_vSegs[iSeg] && (iSeg != m_iLast))
+			v.emplace_back(m_vSegs[iSeg]->m_nUsed, iSeg);
+
+	if (v.size() <= s_MappedMax)
+		return;
+
+	std::sort(v.begin(), v.end());
+
+	for (size_t i = 0; i + s_MappedMax < v.size(); i++)
+		m_vSegs[v[i].second].reset(); // the buffers being sent may still hold it, then it's unmapped once they're released
+}
+
 NodeDB::NodeDB()
 	:m_pDb(NULL)
 {
@@ -127,6 +343,8 @@ void NodeDB::Close()
 		verify(SQLITE_OK == sqlite3_close(m_pDb));
 		m_pDb = NULL;
 	}
+
+	m_pBodies.reset();
 }
 
 NodeDB::Recordset::Recordset(NodeDB& db)
@@ -241,7 +459,7 @@ const void* NodeDB::Recordset::get_BlobStrict(int col, uint32_t n)
 	return x.p;
 }
 
-void NodeDB::Open(const char* szPath)
+void NodeDB::Open(const char* szPath, bool bBodyStore /* = false */)
 {
 	TestRet(sqlite3_open_v2(szPath, &m_pDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_CREATE, NULL));
 	// Attempt to fix the "busy" error when PC goes to sleep and then awakes. Try the busy handler with non-zero timeout (maybe a single retry would be enough)
@@ -269,6 +487,46 @@ void NodeDB::Open(const char* szPath)
 		if (nVersion != ParamIntGetDef(ParamID::DbVer))
 			ThrowError("wrong version");
 	}
+
+	OpenBodies(szPath, bBodyStore);
+}
+
+void NodeDB::OpenBodies(const char* szPath, bool bWrite)
+{
+	// The index is created regardless to the mode, the bodies that were already written to the segments remain readable.
+	ExecQuick("CREATE TABLE IF NOT EXISTS [" TblBodies "] ("
+		"[" TblBodies_State		"] INTEGER NOT NULL PRIMARY KEY,"
+		"[" TblBodies_Segment	"] INTEGER NOT NULL,"
+		"[" TblBodies_Offset	"] INTEGER NOT NULL,"
+		"[" TblBodies_SizeP		"] INTEGER NOT NULL,"
+		"[" TblBodies_SizeE		"] INTEGER NOT NULL,"
+		"FOREIGN KEY (" TblBodies_State ") REFERENCES " TblStates "(OID))");
+
+	ExecQuick("CREATE INDEX IF NOT EXISTS [Idx" TblBodies "Seg] ON [" TblBodies "] ([" TblBodies_Segment "],[" TblBodies_Offset "]);");
+
+	m_pBodies.reset(new BodyStore);
+	BodyStore& bs = *m_pBodies;
+
+	bs.m_sPath = szPath;
+	bs.m_sPath += ".body";
+	bs.m_bWrite = bWrite;
+	bs.m_iLast = 0;
+	bs.m_nPos = 0;
+	bs.m_nUseStamp = 0;
+
+	Recordset rs(*this, Query::BodyLast, "SELECT " TblBodies_Segment "," TblBodies_Offset "+" TblBodies_SizeP "+" TblBodies_SizeE " FROM " TblBodies " ORDER BY " TblBodies_Segment " DESC," TblBodies_Offset " DESC LIMIT 1");
+	bs.m_bAny = rs.Step();
+	if (bs.m_bAny)
+	{
+		rs.get(0, bs.m_iLast);
+		rs.get(1, bs.m_nPos);
+	}
+
+	bs.m_nFlushed = bs.m_nPos;
+
+	// segments beyond the last referenced one may be left by a rolled-back transaction
+	for (uint32_t iSeg = bs.m_iLast + 1; DeleteFile(bs.get_Path(iSeg).c_str()); iSeg++)
+		;
 }
 
 void NodeDB::Create()
@@ -513,7 +771,10 @@ void NodeDB::Transaction::Start(NodeDB& db)
 void NodeDB::Transaction::Commit()
 {
 	assert(m_pDB);
+	m_pDB->BodyFlush(); // the appended bodies must hit the disk before the index that references them
 	m_pDB->ExecStep(Query::Commit, "COMMIT");
+	m_pDB->BodyRemoveFree();
+	m_pDB->BodyUnmapCold(); // the pointers into the mapped segments are valid until the commit
 	m_pDB = NULL;
 }
 
@@ -726,6 +987,8 @@ bool NodeDB::DeleteState(uint64_t rowid, uint64_t& rowPrev)
 	if (StateFlags::Reachable & nFlags)
 		TipReachableDel(rowid);
 
+	BodyDel(rowid);
+
 	rs.Reset(Query::StateDel, "DELETE FROM " TblStates " WHERE rowid=?");
 	rs.put(0, rowid);
 
@@ -1000,10 +1263,15 @@ bool NodeDB::get_Peer(uint64_t rowid, PeerID& peer)
 
 void NodeDB::SetStateBlock(uint64_t rowid, const Blob& bodyP, const Blob& bodyE)
 {
+	BodyDel(rowid);
+
+	// in the body store mode the DB columns are left NULL, unless the body is too large for a segment
+	bool bInDB = !(m_pBodies && m_pBodies->m_bWrite && (bodyP.n || bodyE.n) && BodyPut(rowid, bodyP, bodyE));
+
 	Recordset rs(*this, Query::StateSetBlock, "UPDATE " TblStates " SET " TblStates_BodyP "=?," TblStates_BodyE "=? WHERE rowid=?");
-	if (bodyP.n)
+	if (bInDB && bodyP.n)
 		rs.put(0, bodyP);
-	if (bodyE.n)
+	if (bInDB && bodyE.n)
 		rs.put(1, bodyE);
 	rs.put(2, rowid);
 
@@ -1023,6 +1291,181 @@ void NodeDB::GetStateBlock(uint64_t rowid, ByteBuffer* pP, ByteBuffer* pE, ByteB
 		rs.get(1, *pE);
 	if (pRollback && !rs.IsNull(2))
 		rs.get(2, *pRollback);
+
+	if ((pP || pE) && rs.IsNull(0) && rs.IsNull(1))
+	{
+		Blob bodyP, bodyE;
+		if (GetStateBlockMapped(rowid, bodyP, bodyE))
+		{
+			if (pP)
+				bodyP.Export(*pP);
+			if (pE)
+				bodyE.Export(*pE);
+		}
+	}
+}
+
+bool NodeDB::GetStateBlockMapped(uint64_t rowid, Blob& bodyP, Blob& bodyE)
+{
+	uint32_t iSeg;
+	return BodyGet(rowid, bodyP, bodyE, iSeg);
+}
+
+bool NodeDB::GetStateBlockMapped(uint64_t rowid, io::SharedBuffer& bodyP, io::SharedBuffer& bodyE)
+{
+	Blob bP, bE;
+	uint32_t iSeg;
+	if (!BodyGet(rowid, bP, bE, iSeg))
+		return false;
+
+	io::SharedMem pGuard = m_pBodies->m_vSegs[iSeg];
+	bodyP.assign(bP.p, bP.n, pGuard);
+	bodyE.assign(bE.p, bE.n, std::move(pGuard));
+
+	return true;
+}
+
+bool NodeDB::BodyGet(uint64_t rowid, Blob& bodyP, Blob& bodyE, uint32_t& iSeg)
+{
+	if (!(m_pBodies && m_pBodies->m_bAny))
+		return false;
+
+	Recordset rs(*this, Query::BodyGet, "SELECT " TblBodies_Segment "," TblBodies_Offset "," TblBodies_SizeP "," TblBodies_SizeE " FROM " TblBodies " WHERE " TblBodies_State "=?");
+	rs.put(0, rowid);
+	if (!rs.Step())
+		return false;
+
+	uint32_t nOffset;
+	rs.get(0, iSeg);
+	rs.get(1, nOffset);
+	rs.get(2, bodyP.n);
+	rs.get(3, bodyE.n);
+
+	if (static_cast<uint64_t>(nOffset) + bodyP.n + bodyE.n > BodyStore::s_SegmentSize)
+		ThrowInconsistent();
+
+	const uint8_t* p = m_pBodies->get_Seg(iSeg).m_pPtr + nOffset;
+	bodyP.p = p;
+	bodyE.p = p + bodyP.n;
+
+	return true;
+}
+
+bool NodeDB::BodyPut(uint64_t rowid, const Blob& bodyP, const Blob& bodyE)
+{
+	BodyStore& bs = *m_pBodies;
+
+	uint64_t nSize = static_cast<uint64_t>(bodyP.n) + bodyE.n;
+	if (nSize > BodyStore::s_SegmentSize)
+		return false;
+
+	if (bs.m_nPos + nSize > BodyStore::s_SegmentSize)
+	{
+		// start the next segment. The current one may become unreferenced later
+		bs.Flush();
+		bs.m_setFree.insert(bs.m_iLast);
+
+		bs.m_iLast++;
+		bs.m_nPos = 0;
+		bs.m_nFlushed = 0;
+	}
+
+	uint32_t nOffset = bs.m_nPos;
+	uint8_t* p = bs.get_Seg(bs.m_iLast).m_pPtr + nOffset;
+
+	if (bodyP.n)
+		memcpy(p, bodyP.p, bodyP.n);
+	if (bodyE.n)
+		memcpy(p + bodyP.n, bodyE.p, bodyE.n);
+
+	bs.m_nPos += static_cast<uint32_t>(nSize);
+
+	if (sqlite3_get_autocommit(m_pDb))
+		bs.Flush(); // no transaction, the index is committed right away
+
+	Recordset rs(*this, Query::BodyIns, "INSERT INTO " TblBodies "(" TblBodies_State "," TblBodies_Segment "," TblBodies_Offset "," TblBodies_SizeP "," TblBodies_SizeE ") VALUES(?,?,?,?,?)");
+	rs.put(0, rowid);
+	rs.put(1, bs.m_iLast);
+	rs.put(2, nOffset);
+	rs.put(3, bodyP.n);
+	rs.put(4, bodyE.n);
+	rs.Step();
+	TestChanged1Row();
+
+	bs.m_bAny = true;
+	return true;
+}
+
+void NodeDB::BodyDel(uint64_t rowid)
+{
+	if (!(m_pBodies && m_pBodies->m_bAny))
+		return;
+
+	Recordset rs(*this, Query::BodyGet, "SELECT " TblBodies_Segment "," TblBodies_Offset "," TblBodies_SizeP "," TblBodies_SizeE " FROM " TblBodies " WHERE " TblBodies_State "=?");
+	rs.put(0, rowid);
+	if (!rs.Step())
+		return;
+
+	uint32_t iSeg;
+	rs.get(0, iSeg);
+
+	rs.Reset(Query::BodyDel, "DELETE FROM " TblBodies " WHERE " TblBodies_State "=?");
+	rs.put(0, rowid);
+	rs.Step();
+	TestChanged1Row();
+
+	m_pBodies->m_setFree.insert(iSeg);
+
+	if (sqlite3_get_autocommit(m_pDb))
+		BodyRemoveFree();
+}
+
+void NodeDB::BodyFlush()
+{
+	if (m_pBodies)
+		m_pBodies->Flush();
+}
+
+void NodeDB::BodyRemoveFree()
+{
+	if (!m_pBodies)
+		return;
+	BodyStore& bs = *m_pBodies;
+
+	for (std::set<uint32_t>::iterator it = bs.m_setFree.begin(); bs.m_setFree.end() != it; it++)
+	{
+		uint32_t iSeg = *it;
+		if (iSeg == bs.m_iLast)
+			continue;
+
+		Recordset rs(*this, Query::BodySegUsed, "SELECT 1 FROM " TblBodies " WHERE " TblBodies_Segment "=? LIMIT 1");
+		rs.put(0, iSeg);
+		if (!rs.Step())
+			bs.Remove(iSeg);
+	}
+
+	bs.m_setFree.clear();
+}
+
+void NodeDB::BodyUnmapCold()
+{
+	if (m_pBodies)
+		m_pBodies->UnmapCold();
+}
+
+uint32_t NodeDB::get_BodySegmentsMapped() const
+{
+	if (!m_pBodies)
+		return 0;
+
+	const BodyStore& bs = *m_pBodies;
+
+	uint32_t nRet = 0;
+	for (size_t i = 0; i < bs.m_vSegs.size(); i++)
+		if (bs.m_vSegs[i])
+			nRet++;
+
+	return nRet;
 }
 
 void NodeDB::SetStateRollback(uint64_t rowid, const Blob& rollback)
@@ -1655,11 +2098,16 @@ uint64_t NodeDB::GetDummyLastID()
 }
 
 void NodeDB::DeleteDummy(uint64_t id)
+{
+	DeleteDummySafe(id);
+	TestChanged1Row();
+}
+
+void NodeDB::DeleteDummySafe(uint64_t id)
 {
 	Recordset rs(*this, Query::DummyDel, "DELETE FROM " TblDummy " WHERE " TblDummy_ID "=?");
 	rs.put(0, id);
 	rs.Step();
-	TestChanged1Row();
 }
 
 void NodeDB::SetDummyHeight(uint64_t rowid, Height h)
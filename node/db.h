@@ -16,6 +16,7 @@
 
 #include "core/common.h"
 #include "core/block_crypt.h"
+#include "utility/io/buffer.h"
 #include "sqlite/sqlite3.h"
 
 namespace beam {
@@ -119,6 +120,11 @@ public:
 			KernelFind,
 			KernelDel,
 			KernelDelAll,
+			BodyIns,
+			BodyGet,
+			BodyDel,
+			BodyLast,
+			BodySegUsed,
 
 			Dbg0,
 			Dbg1,
@@ -135,7 +141,7 @@ public:
 	virtual ~NodeDB();
 
 	void Close();
-	void Open(const char* szPath);
+	void Open(const char* szPath, bool bBodyStore = false); // bBodyStore: new block bodies go to the append-only segment files, rather than the DB. No compaction, the space is reclaimed per segment
 
 	virtual void OnModified() {}
 
@@ -229,6 +235,11 @@ public:
 	void SetStateRollback(uint64_t rowid, const Blob& rollback);
 	//void DelStateBlockPRB(uint64_t rowid); // perishable and rollback, but no ethernal
 	void DelStateBlockAll(uint64_t rowid);
+	// Succeeds only if the body is kept in the segment files. Returns pointers directly into the mapped segment, valid until the next commit.
+	bool GetStateBlockMapped(uint64_t rowid, Blob& bodyP, Blob& bodyE);
+	// Same, the buffers keep the segment mapped, and may outlive the transaction
+	bool GetStateBlockMapped(uint64_t rowid, io::SharedBuffer& bodyP, io::SharedBuffer& bodyE);
+	uint32_t get_BodySegmentsMapped() const; // only the recently used ones remain mapped after commit
 
 	struct StateID {
 		uint64_t m_Row;
@@ -331,6 +342,7 @@ public:
 	uint64_t GetLowestDummy(Height& h);
 	uint64_t GetDummyLastID();
 	void DeleteDummy(uint64_t);
+	void DeleteDummySafe(uint64_t); // no-op if not found
 	void SetDummyHeight(uint64_t, Height);
 
 	void InsertKernel(const Blob&, Height h);
@@ -373,6 +385,17 @@ private:
 	void TestChanged1Row();
 
 	struct Dmmr;
+
+	struct BodyStore;
+	std::unique_ptr<BodyStore> m_pBodies;
+
+	void OpenBodies(const char* szPath, bool bWrite);
+	bool BodyPut(uint64_t rowid, const Blob& bodyP, const Blob& bodyE);
+	bool BodyGet(uint64_t rowid, Blob& bodyP, Blob& bodyE, uint32_t& iSeg);
+	void BodyDel(uint64_t rowid);
+	void BodyFlush();
+	void BodyRemoveFree();
+	void BodyUnmapCold();
 };
 
 
@@ -217,6 +217,12 @@ bool Node::TryAssignTask(Task& t, Peer& p)
     if (!p.ShouldAssignTasks())
         return false;
 
+    if (p.m_pCompact)
+        return false; // the compact body must be completed first, the following requests would mess the order of responses
+
+    if (Peer::Flags::Lagging & p.m_Flags)
+        return false;
+
     if (p.m_Tip.m_Height < t.m_Key.first.m_Height)
         return false;
 
@@ -265,12 +271,79 @@ bool Node::TryAssignTask(Task& t, Peer& p)
 
     if (t.m_Key.second)
     {
-        if (nBlocks >= m_Cfg.m_MaxConcurrentBlocksRequest)
+        if (nBlocks >= p.get_BlocksWindow())
             return false;
 
-        proto::GetBody msg;
-        msg.m_ID = t.m_Key.first;
-        p.Send(msg);
+        // Pending packs of all the peers (one per peer at most). Blocks within them aren't requested meanwhile, and the new pack must not overlap them
+        bool bPackAllowed = m_Cfg.m_BodyPacks && (proto::LoginFlags::BodyPack & p.m_LoginFlags);
+        Height hPackMax = std::min(p.m_Tip.m_Height, t.m_Key.first.m_Height + proto::g_HdrPackMaxSize - 1);
+
+        for (PeerList::iterator itP = m_lstPeers.begin(); m_lstPeers.end() != itP; itP++)
+        {
+            for (TaskList::iterator it = itP->m_lstTasks.begin(); itP->m_lstTasks.end() != it; it++)
+            {
+                const Task& tPack = *it;
+                if (!tPack.m_Key.second || !tPack.m_bPack)
+                    continue;
+
+                if (&p == &*itP)
+                    bPackAllowed = false;
+
+                if (!tPack.m_bRelevant)
+                    continue; // lagging, its blocks may be requested individually
+
+                HeightRange hr(tPack.m_Key.first.m_Height, tPack.m_sidPack.m_Height);
+                if (hr.IsInRange(t.m_Key.first.m_Height))
+                    return false; // should arrive with the pending pack
+
+                if (hr.m_Min > t.m_Key.first.m_Height)
+                    hPackMax = std::min(hPackMax, hr.m_Min - 1);
+            }
+        }
+
+        // Request the following blocks of the same branch along with this one, as much as the peer has
+        NodeDB::StateID sidTop = t.m_sidTrg;
+        if (bPackAllowed && (t.m_Key.first.m_Height >= Rules::HeightGenesis))
+        {
+            while ((sidTop.m_Height > hPackMax) && m_Processor.get_DB().get_Prev(sidTop))
+                ;
+        }
+
+        if (bPackAllowed && (sidTop.m_Height > t.m_Key.first.m_Height))
+        {
+            proto::GetBodyPack msg;
+            m_Processor.get_DB().get_StateID(sidTop, msg.m_Top);
+            msg.m_CountExtra = sidTop.m_Height - t.m_Key.first.m_Height;
+            p.Send(msg);
+
+            t.m_bPack = true;
+            t.m_sidPack = sidTop;
+        }
+        else
+        {
+            // A new tip block most likely consists of the txs we already have. Request it in a compact form
+            bool bCompact =
+                !nBlocks &&
+                m_Cfg.m_CompactBlocks &&
+                (proto::LoginFlags::CompactBlocks & p.m_LoginFlags) &&
+                (t.m_Key.first.m_Height == m_Processor.m_Cursor.m_ID.m_Height + 1) &&
+                !m_TxPool.m_setTxs.empty();
+
+            if (bCompact)
+            {
+                proto::GetBodyCompact msg;
+                msg.m_ID = t.m_Key.first;
+                p.Send(msg);
+
+                p.m_pCompact.reset(new Compact::Pending);
+            }
+            else
+            {
+                proto::GetBody msg;
+                msg.m_ID = t.m_Key.first;
+                p.Send(msg);
+            }
+        }
     }
     else
     {
@@ -299,6 +372,7 @@ bool Node::TryAssignTask(Task& t, Peer& p)
 
     assert(!t.m_pOwner);
     t.m_pOwner = &p;
+    t.m_Sent_ms = GetTime_ms();
 
     m_lstTasksUnassigned.erase(TaskList::s_iterator_to(t));
     p.m_lstTasks.push_back(t);
@@ -314,17 +388,198 @@ void Node::Peer::SetTimerWrtFirstTask()
     if (m_lstTasks.empty())
         KillTimer();
     else
-        SetTimer(m_lstTasks.front().m_Key.second ? m_This.m_Cfg.m_Timeout.m_GetBlock_ms : m_This.m_Cfg.m_Timeout.m_GetState_ms);
+    {
+        const Task& t = m_lstTasks.front();
+        uint32_t timeout_ms = t.m_Key.second ? m_This.m_Cfg.m_Timeout.m_GetBlock_ms : m_This.m_Cfg.m_Timeout.m_GetState_ms;
+
+        m_TimeoutRemaining_ms = 0;
+
+        // if we know what to expect from this peer - detect the lagging request earlier
+        uint32_t nBlocks = t.m_Key.second ? (t.m_bPack ? static_cast<uint32_t>(t.m_sidPack.m_Height - t.m_Key.first.m_Height + 1) : 1) : 0;
+        uint32_t nLagging_ms = m_Perf.get_Lagging_ms(nBlocks, timeout_ms, m_This.m_Cfg.m_Timeout);
+        if (nLagging_ms)
+        {
+            m_TimeoutRemaining_ms = timeout_ms - nLagging_ms;
+            timeout_ms = nLagging_ms;
+        }
+
+        SetTimer(timeout_ms);
+    }
+}
+
+void Node::PeerPerf::OnSample(uint32_t dt_ms, uint32_t dtPipe_ms, size_t nSize, uint32_t nBlocks)
+{
+    // moving averages, the weight of the new sample is 1/4
+    const uint32_t nWeight = 4;
+
+    struct Avg {
+        static void Add(uint32_t& x, uint64_t n)
+        {
+            n = std::min<uint64_t>(n, uint32_t(-1));
+            x = x ? static_cast<uint32_t>((uint64_t(x) * (nWeight - 1) + n) / nWeight) : static_cast<uint32_t>(n);
+        }
+    };
+
+    dt_ms = std::max(dt_ms, 1U);
+    dtPipe_ms = std::min(dtPipe_ms, dt_ms);
+
+    if (nBlocks)
+    {
+        // dt = rtt + transfer time. A pipelined response could only start after the previous one was received, its transfer time is known.
+        // Otherwise estimate one part from the other. If neither is known yet - account everything to the transfer (underestimates the rate, which is safe)
+        if (dtPipe_ms)
+            Avg::Add(m_BytesPerSec, nSize * 1000ULL / dtPipe_ms);
+        else
+        {
+            // both are estimated from the values before this sample
+            uint32_t nRtt_ms = m_Rtt_ms;
+            uint32_t nRate = m_BytesPerSec;
+
+            if (nRate)
+            {
+                uint64_t nTransfer_ms = nSize * 1000ULL / nRate;
+                if (nTransfer_ms < dt_ms)
+                    Avg::Add(m_Rtt_ms, dt_ms - nTransfer_ms);
+            }
+
+            if (nRtt_ms ? (nRtt_ms < dt_ms) : !nRate)
+                Avg::Add(m_BytesPerSec, nSize * 1000ULL / (dt_ms - nRtt_ms));
+        }
+
+        Avg::Add(m_BlockSize, nSize / nBlocks);
+    }
+    else
+    {
+        if (!dtPipe_ms)
+            Avg::Add(m_Rtt_ms, dt_ms); // if pipelined - it waited for the previous response, the latency is unknown
+    }
+
+    m_Samples++;
+}
+
+uint32_t Node::PeerPerf::get_Expected_ms(uint32_t nBlocks) const
+{
+    if (m_Samples < 2)
+        return 0;
+
+    if (!nBlocks)
+        return m_Rtt_ms;
+
+    if (!m_BytesPerSec)
+        return 0;
+
+    uint64_t n = m_Rtt_ms + uint64_t(nBlocks) * m_BlockSize * 1000ULL / m_BytesPerSec;
+
+    return static_cast<uint32_t>(std::min<uint64_t>(n, uint32_t(-1) / 4));
+}
+
+uint32_t Node::PeerPerf::get_Lagging_ms(uint32_t nBlocks, uint32_t timeout_ms, const Config::Timeout& cfg) const
+{
+    const uint32_t nLaggingFactor = 4;
+    uint32_t nLagging_ms = get_Expected_ms(nBlocks) * nLaggingFactor;
+    if (!nLagging_ms)
+        return 0;
+
+    nLagging_ms = std::max(nLagging_ms, cfg.m_LaggingMin_ms);
+    return (nLagging_ms < timeout_ms) ? nLagging_ms : 0;
+}
+
+uint32_t Node::PeerPerf::get_BlocksWindow(uint32_t nMax) const
+{
+    if (!m_Rtt_ms || !m_BytesPerSec || !m_BlockSize)
+        return nMax; // not measured yet
+
+    // bandwidth-delay product (in blocks), plus the one being transferred
+    uint64_t n = uint64_t(m_BytesPerSec) * m_Rtt_ms / (1000ULL * m_BlockSize) + 1;
+    return static_cast<uint32_t>(std::min<uint64_t>(n, nMax));
+}
+
+uint32_t Node::Peer::get_BlocksWindow() const
+{
+    return m_Perf.get_BlocksWindow(m_This.m_Cfg.m_MaxConcurrentBlocksRequest);
+}
+
+void Node::Peer::OnTaskCompleted(size_t nSize, uint32_t nBlocks)
+{
+    const Task& t = get_FirstTask();
+    uint32_t t_ms = GetTime_ms();
+
+    // if the previous response arrived after this request was sent - this one was queued behind it
+    bool bPipelined = static_cast<int32_t>(m_LastRcv_ms - t.m_Sent_ms) > 0;
+    m_Perf.OnSample(t_ms - t.m_Sent_ms, bPipelined ? (t_ms - m_LastRcv_ms) : 0, nSize, nBlocks);
+    m_LastRcv_ms = t_ms;
+
+    LOG_DEBUG() << "Peer " << m_RemoteAddr << " rtt=" << m_Perf.m_Rtt_ms << "ms, rate=" << m_Perf.m_BytesPerSec << "B/s, window=" << get_BlocksWindow();
+}
+
+void Node::Peer::OnLagging()
+{
+    uint32_t timeout_ms = m_TimeoutRemaining_ms;
+    m_TimeoutRemaining_ms = 0;
+    m_Flags |= Flags::Lagging;
+
+    LOG_INFO() << "Peer " << m_RemoteAddr << " lagging, rtt=" << m_Perf.m_Rtt_ms << "ms, rate=" << m_Perf.m_BytesPerSec << "B/s. Re-assigning its blocks";
+
+    // The requests are already sent, and the responses are expected in order. So the tasks remain, but other peers get their copies.
+    // Whichever arrives first is accepted, the other is ignored.
+    std::vector<Task*> vCopies;
+    for (TaskList::iterator it = m_lstTasks.begin(); m_lstTasks.end() != it; it++)
+    {
+        Task& t = *it;
+        if (!t.m_Key.second || !t.m_bRelevant)
+            continue;
+
+        Task* pTask = new Task;
+        pTask->m_Key = t.m_Key;
+        pTask->m_bRelevant = true;
+        pTask->m_bPack = false;
+        pTask->m_pOwner = NULL;
+        pTask->m_sidTrg = t.m_sidTrg;
+        pTask->m_sidPack.SetNull();
+
+        t.m_bRelevant = false;
+
+        m_This.m_setTasks.insert(*pTask);
+        m_This.m_lstTasksUnassigned.push_back(*pTask);
+        vCopies.push_back(pTask);
+    }
+
+    SetTimer(timeout_ms);
+
+    for (size_t i = 0; i < vCopies.size(); i++)
+        m_This.TryAssignTask(*vCopies[i], NULL);
 }
 
-void Node::Processor::RequestData(const Block::SystemState::ID& id, bool bBlock, const PeerID* pPreferredPeer)
+void Node::get_PeerStats(std::vector<PeerStats>& v) const
+{
+    v.clear();
+
+    for (PeerList::const_iterator it = m_lstPeers.begin(); m_lstPeers.end() != it; it++)
+    {
+        const Peer& p = *it;
+
+        v.emplace_back();
+        PeerStats& x = v.back();
+
+        x.m_Addr = p.m_RemoteAddr;
+        x.m_Rtt_ms = p.m_Perf.m_Rtt_ms;
+        x.m_BytesPerSec = p.m_Perf.m_BytesPerSec;
+        x.m_Samples = p.m_Perf.m_Samples;
+        x.m_Window = p.get_BlocksWindow();
+        x.m_Tasks = static_cast<uint32_t>(p.m_lstTasks.size());
+        x.m_Lagging = !!(Peer::Flags::Lagging & p.m_Flags);
+    }
+}
+
+void Node::Processor::RequestData(const Block::SystemState::ID& id, bool bBlock, const PeerID* pPreferredPeer, const NodeDB::StateID& sidTrg)
 {
     Task tKey;
     tKey.m_Key.first = id;
     tKey.m_Key.second = bBlock;
 
-    TaskSet::iterator it = get_ParentObj().m_setTasks.find(tKey);
-    if (get_ParentObj().m_setTasks.end() == it)
+    TaskSet& ts = get_ParentObj().m_setTasks;
+    TaskSet::iterator it = ts.lower_bound(tKey);
+    if ((ts.end() == it) || (it->m_Key != tKey.m_Key))
     {
         LOG_INFO() << "Requesting " << (bBlock ? "block" : "header") << " " << id;
 
@@ -333,6 +588,8 @@ void Node::Processor::RequestData(const Block::SystemState::ID& id, bool bBlock,
         pTask->m_bRelevant = true;
         pTask->m_bPack = false;
         pTask->m_pOwner = NULL;
+        pTask->m_sidTrg = sidTrg;
+        pTask->m_sidPack.SetNull();
 
         get_ParentObj().m_setTasks.insert(*pTask);
         get_ParentObj().m_lstTasksUnassigned.push_back(*pTask);
@@ -354,7 +611,18 @@ void Node::Processor::RequestData(const Block::SystemState::ID& id, bool bBlock,
         ReportProgress();
 
     } else
+    {
+        // if there are copies - prefer the one that isn't waiting for a lagging peer
+        for (TaskSet::iterator it2 = it; (ts.end() != it2) && (it2->m_Key == tKey.m_Key); it2++)
+            if (!(it2->m_pOwner && (Peer::Flags::Lagging & it2->m_pOwner->m_Flags)))
+            {
+                it = it2;
+                break;
+            }
+
         it->m_bRelevant = true;
+        it->m_sidTrg = sidTrg;
+    }
 }
 
 void Node::Processor::OnPeerInsane(const PeerID& peerID)
@@ -418,10 +686,12 @@ void Node::Processor::OnNewState()
         if (!(Peer::Flags::Connected & peer.m_Flags))
             continue;
 
-        if (!NodeProcessor::IsRemoteTipNeeded(msg.m_Description, peer.m_Tip))
-            continue;
+        if (NodeProcessor::IsRemoteTipNeeded(msg.m_Description, peer.m_Tip))
+            peer.Send(msg);
 
-        peer.Send(msg);
+        // the subscribers get the new events regardless of the tip they've reported
+        if (MaxHeight != peer.m_UtxoEvents.m_hNext)
+            peer.SendUtxoEvents();
     }
 
     get_ParentObj().m_Compressor.OnNewState();
@@ -435,6 +705,15 @@ void Node::Processor::OnRolledBack()
 {
     LOG_INFO() << "Rolled back to: " << m_Cursor.m_ID;
     get_ParentObj().m_Compressor.OnRolledBack();
+
+    // the events above the cursor are gone, the subscribers will be re-sent the replacing ones
+    Height hNext = m_Cursor.m_ID.m_Height + 1;
+    for (PeerList::iterator it = get_ParentObj().m_lstPeers.begin(); get_ParentObj().m_lstPeers.end() != it; it++)
+    {
+        Peer::UtxoEventsStream& x = it->m_UtxoEvents;
+        if ((MaxHeight != x.m_hNext) && (x.m_hNext > hNext))
+            x.m_hNext = hNext;
+    }
 }
 
 bool Node::Processor::Verifier::ValidateAndSummarize(TxBase::Context& ctx, const TxBase& txb, TxBase::IReader&& r)
@@ -442,14 +721,7 @@ bool Node::Processor::Verifier::ValidateAndSummarize(TxBase::Context& ctx, const
     uint32_t nThreads = get_ParentObj().get_ParentObj().m_Cfg.m_VerificationThreads;
     if (!nThreads)
     {
-        if (m_pBc)
-            m_pBc->Reset();
-        else
-        {
-            m_pBc.reset(new Verifier::MyBatch);
-            m_pBc->m_bEnableBatch = true;
-        }
-        Verifier::MyBatch::Scope scope(*m_pBc);
+        Verifier::MyBatch::Scope scope(ResetBatch());
 
         return
             ctx.ValidateAndSummarize(txb, std::move(r)) &&
@@ -458,6 +730,139 @@ bool Node::Processor::Verifier::ValidateAndSummarize(TxBase::Context& ctx, const
 
     std::unique_lock<std::mutex> scope(m_Mutex);
 
+    m_eTask = TaskType::Tx;
+    m_pTx = &txb;
+    m_pR = &r;
+    m_pCtx = &ctx;
+
+    RunTask(scope, nThreads);
+
+    return !m_bFail;
+}
+
+void Node::Processor::Verifier::VerifyPoW(const Block::SystemState::Full* pS, uint8_t* pValid, uint32_t nCount)
+{
+    uint32_t nThreads = get_ParentObj().get_ParentObj().m_Cfg.m_VerificationThreads;
+    if ((nThreads < 2) || (nCount < 2))
+    {
+        get_ParentObj().NodeProcessor::VerifyPoW(pS, pValid, nCount);
+        return;
+    }
+
+    std::unique_lock<std::mutex> scope(m_Mutex);
+
+    m_eTask = TaskType::PoW;
+    m_pStates = pS;
+    m_pStatesValid = pValid;
+    m_nStates = nCount;
+
+    RunTask(scope, nThreads);
+}
+
+void Node::Processor::Verifier::UpdateUtxoHash(UtxoTree& t)
+{
+    uint32_t nThreads = get_ParentObj().get_ParentObj().m_Cfg.m_VerificationThreads;
+    if ((nThreads < 2) || (std::thread::hardware_concurrency() < 2))
+        return; // on a single core the threads only add the switching overhead
+
+    RadixHashTree::ParallelHash ph;
+    ph.Prepare(t, nThreads);
+    if (ph.get_Tasks() < 2)
+        return; // too small, not worth it
+
+    std::unique_lock<std::mutex> scope(m_Mutex);
+
+    m_eTask = TaskType::UtxoHash;
+    m_pUtxoHash = &ph;
+    m_pUtxoTree = &t;
+
+    RunTask(scope, nThreads);
+}
+
+void Node::Processor::Verifier::RecognizeOutputs(UtxoRecognizer& r)
+{
+    uint32_t nThreads = get_ParentObj().get_ParentObj().m_Cfg.m_VerificationThreads;
+    if ((nThreads < 2) || (r.m_nCount < 2))
+    {
+        r.Execute(0, 1);
+        return;
+    }
+
+    std::unique_lock<std::mutex> scope(m_Mutex);
+
+    m_eTask = TaskType::Recognize;
+    m_pRecognizer = &r;
+
+    RunTask(scope, nThreads);
+}
+
+Node::Processor::Verifier::MyBatch& Node::Processor::Verifier::ResetBatch()
+{
+    if (m_pBc)
+        m_pBc->Reset();
+    else
+    {
+        m_pBc.reset(new Verifier::MyBatch);
+        m_pBc->m_bEnableBatch = true;
+    }
+
+    return *m_pBc;
+}
+
+void Node::Processor::Verifier::ValidateTxs(const Transaction* const* ppTx, Transaction::Context* pCtx, uint8_t* pValid, uint32_t nCount)
+{
+    if (!nCount)
+        return;
+
+    for (uint32_t i = 0; i < nCount; i++)
+        pCtx[i].Reset();
+
+    if (ValidateTxsBatch(ppTx, pCtx, pValid, nCount))
+        return;
+
+    // the batch is invalid, though it's unknown which tx is guilty. Bisect
+    if (1 == nCount)
+        pValid[0] = false;
+    else
+    {
+        uint32_t nHalf = nCount >> 1;
+        ValidateTxs(ppTx, pCtx, pValid, nHalf);
+        ValidateTxs(ppTx + nHalf, pCtx + nHalf, pValid + nHalf, nCount - nHalf);
+    }
+}
+
+bool Node::Processor::Verifier::ValidateTxsBatch(const Transaction* const* ppTx, Transaction::Context* pCtx, uint8_t* pValid, uint32_t nCount)
+{
+    // All the txs share the same batch, and it's flushed once. Returns false if the batch verification failed.
+    // Txs that failed on their own are marked in pValid regardless.
+    uint32_t nThreads = get_ParentObj().get_ParentObj().m_Cfg.m_VerificationThreads;
+    if (!nThreads)
+    {
+        Verifier::MyBatch::Scope scope(ResetBatch());
+
+        for (uint32_t i = 0; i < nCount; i++)
+            pValid[i] = pCtx[i].ValidateAndSummarize(*ppTx[i], ppTx[i]->get_Reader());
+
+        return m_pBc->Flush();
+    }
+
+    std::unique_lock<std::mutex> scope(m_Mutex);
+
+    m_eTask = TaskType::Txs;
+    m_ppTxs = ppTx;
+    m_pTxsCtx = pCtx;
+    m_pTxsValid = pValid;
+    m_nTxs = nCount;
+
+    memset(pValid, 1, nCount);
+
+    RunTask(scope, nThreads);
+
+    return !m_bFail;
+}
+
+void Node::Processor::Verifier::RunTask(std::unique_lock<std::mutex>& scope, uint32_t nThreads)
+{
     if (m_vThreads.empty())
     {
         m_iTask = 1;
@@ -468,9 +873,6 @@ bool Node::Processor::Verifier::ValidateAndSummarize(TxBase::Context& ctx, const
     }
 
     m_iTask ^= 2;
-    m_pTx = &txb;
-    m_pR = &r;
-    m_pCtx = &ctx;
     m_bFail = false;
     m_Remaining = nThreads;
 
@@ -478,8 +880,6 @@ bool Node::Processor::Verifier::ValidateAndSummarize(TxBase::Context& ctx, const
 
     while (m_Remaining)
         m_TaskFinished.wait(scope);
-
-    return !m_bFail;
 }
 
 bool Node::Processor::VerifyBlock(const Block::BodyBase& block, TxBase::IReader&& r, const HeightRange& hr)
@@ -496,47 +896,253 @@ bool Node::Processor::VerifyBlock(const Block::BodyBase& block, TxBase::IReader&
         ctx.IsValidBlock(block);
 }
 
-void Node::Processor::Verifier::Thread(uint32_t iVerifier)
+void Node::Processor::VerifyPoW(const Block::SystemState::Full* pS, uint8_t* pValid, uint32_t nCount)
 {
-    uint32_t nThreads = get_ParentObj().get_ParentObj().m_Cfg.m_VerificationThreads;
+    m_Verifier.VerifyPoW(pS, pValid, nCount);
+}
 
-    std::unique_ptr<Verifier::MyBatch> p(new Verifier::MyBatch);
-    p->m_bEnableBatch = true;
-    Verifier::MyBatch::Scope scope(*p);
+void Node::Processor::UpdateUtxoHash()
+{
+    m_Verifier.UpdateUtxoHash(get_Utxos());
+}
 
-    for (uint32_t iTask = 1; ; )
-    {
-        {
-            std::unique_lock<std::mutex> scope2(m_Mutex);
+void Node::Processor::RecognizeOutputs(UtxoRecognizer& r)
+{
+    m_Verifier.RecognizeOutputs(r);
+}
 
-            while (m_iTask == iTask)
-                m_TaskNew.wait(scope2);
+bool Node::Processor::VerifyBlockAsync(uint64_t rowid, Height h, const Blob& bodyP, const Blob& bodyE)
+{
+    uint32_t nThreads = get_ParentObj().m_Cfg.m_BlockValidationThreads;
+    if (!nThreads)
+        return false;
 
-            if (!m_iTask)
-                return;
+    BlockValidator::Task::Ptr pTask(new BlockValidator::Task);
+    pTask->m_Row = rowid;
+    pTask->m_Height = h;
+    bodyP.Export(pTask->m_BodyP);
+    bodyE.Export(pTask->m_BodyE);
+    pTask->m_bValid = false;
 
-            iTask = m_iTask;
-        }
+    m_BlockValidator.Push(std::move(pTask), nThreads);
+    return true;
+}
 
-        p->Reset();
+void Node::Processor::BlockValidator::Push(Task::Ptr&& pTask, uint32_t nThreads)
+{
+    if (m_vThreads.empty())
+    {
+        io::AsyncEvent::Callback cb = [this]() { OnDone(); };
+        m_pEvtDone = io::AsyncEvent::create(io::Reactor::get_Current(), std::move(cb));
 
-        assert(m_Remaining);
+        m_bStop = false;
+        m_vThreads.resize(nThreads);
+        for (uint32_t i = 0; i < nThreads; i++)
+            m_vThreads[i] = std::thread(&BlockValidator::Thread, this);
+    }
 
-        TxBase::Context ctx;
-        ctx.m_bBlockMode = m_pCtx->m_bBlockMode;
-        ctx.m_Height = m_pCtx->m_Height;
-        ctx.m_nVerifiers = nThreads;
-        ctx.m_iVerifier = iVerifier;
-        ctx.m_pAbort = &m_bFail; // obsolete actually
+    std::unique_lock<std::mutex> scope(m_Mutex);
+    m_queIn.push_back(std::move(pTask));
+    m_NewTask.notify_one();
+}
 
-        TxBase::IReader::Ptr pR;
-        m_pR->Clone(pR);
+void Node::Processor::BlockValidator::Stop()
+{
+    if (m_vThreads.empty())
+        return;
 
-        bool bValid = ctx.ValidateAndSummarize(*m_pTx, std::move(*pR)) && p->Flush();
+    {
+        std::unique_lock<std::mutex> scope(m_Mutex);
+        m_bStop = true;
+        m_NewTask.notify_all();
+    }
 
-        std::unique_lock<std::mutex> scope2(m_Mutex);
+    for (size_t i = 0; i < m_vThreads.size(); i++)
+        if (m_vThreads[i].joinable())
+            m_vThreads[i].join();
 
-        verify(m_Remaining--);
+    m_vThreads.clear();
+    m_queIn.clear();
+    m_queOut.clear();
+    m_pEvtDone.reset();
+}
+
+void Node::Processor::BlockValidator::Thread()
+{
+    while (true)
+    {
+        Task::Ptr pTask;
+
+        {
+            std::unique_lock<std::mutex> scope(m_Mutex);
+
+            while (m_queIn.empty() && !m_bStop)
+                m_NewTask.wait(scope);
+
+            if (m_bStop)
+                return;
+
+            pTask = std::move(m_queIn.front());
+            m_queIn.pop_front();
+        }
+
+        pTask->m_bValid = NodeProcessor::VerifyBlockContextFree(pTask->m_BodyP, pTask->m_BodyE, pTask->m_Height);
+
+        // the bodies aren't needed anymore
+        ByteBuffer().swap(pTask->m_BodyP);
+        ByteBuffer().swap(pTask->m_BodyE);
+
+        {
+            std::unique_lock<std::mutex> scope(m_Mutex);
+            m_queOut.push_back(std::move(pTask));
+        }
+
+        m_pEvtDone->post();
+    }
+}
+
+void Node::Processor::BlockValidator::OnDone()
+{
+    // reactor thread. Apply the verdicts in order of arrival, the processor takes care of the ordering
+    while (true)
+    {
+        Task::Ptr pTask;
+
+        {
+            std::unique_lock<std::mutex> scope(m_Mutex);
+            if (m_queOut.empty())
+                break;
+
+            pTask = std::move(m_queOut.front());
+            m_queOut.pop_front();
+        }
+
+        get_ParentObj().OnBlockVerified(pTask->m_Row, pTask->m_bValid);
+    }
+}
+
+void Node::Processor::Verifier::Thread(uint32_t iVerifier)
+{
+    uint32_t nThreads = get_ParentObj().get_ParentObj().m_Cfg.m_VerificationThreads;
+
+    std::unique_ptr<Verifier::MyBatch> p(new Verifier::MyBatch);
+    p->m_bEnableBatch = true;
+    Verifier::MyBatch::Scope scope(*p);
+
+    for (uint32_t iTask = 1; ; )
+    {
+        TaskType::Enum eTask;
+        {
+            std::unique_lock<std::mutex> scope2(m_Mutex);
+
+            while (m_iTask == iTask)
+                m_TaskNew.wait(scope2);
+
+            if (!m_iTask)
+                return;
+
+            iTask = m_iTask;
+            eTask = m_eTask;
+        }
+
+        assert(m_Remaining);
+
+        if (TaskType::Txs == eTask)
+        {
+            p->Reset();
+
+            // each verifier handles its share of every tx, all within the same batch
+            std::vector<TxBase::Context> vCtx(m_nTxs);
+            std::vector<uint8_t> vValid(m_nTxs);
+
+            for (uint32_t i = 0; i < m_nTxs; i++)
+            {
+                TxBase::Context& ctx = vCtx[i];
+                ctx.m_Height = m_pTxsCtx[i].m_Height;
+                ctx.m_nVerifiers = nThreads;
+                ctx.m_iVerifier = iVerifier;
+
+                vValid[i] = ctx.ValidateAndSummarize(*m_ppTxs[i], m_ppTxs[i]->get_Reader());
+            }
+
+            bool bValid = p->Flush();
+
+            std::unique_lock<std::mutex> scope2(m_Mutex);
+
+            verify(m_Remaining--);
+
+            if (!bValid)
+                m_bFail = true;
+
+            for (uint32_t i = 0; i < m_nTxs; i++)
+                if (m_pTxsValid[i] && !(vValid[i] && m_pTxsCtx[i].Merge(vCtx[i])))
+                    m_pTxsValid[i] = false;
+
+            if (!m_Remaining)
+                m_TaskFinished.notify_one();
+
+            continue;
+        }
+
+        if (TaskType::UtxoHash == eTask)
+        {
+            m_pUtxoHash->Execute(*m_pUtxoTree, iVerifier, nThreads);
+
+            std::unique_lock<std::mutex> scope2(m_Mutex);
+
+            verify(m_Remaining--);
+            if (!m_Remaining)
+                m_TaskFinished.notify_one();
+
+            continue;
+        }
+
+        if (TaskType::PoW == eTask)
+        {
+            // the states are interleaved between the verifiers, the results are written to distinct elements
+            for (uint32_t i = iVerifier; i < m_nStates; i += nThreads)
+                m_pStatesValid[i] = m_pStates[i].IsValidPoW();
+
+            std::unique_lock<std::mutex> scope2(m_Mutex);
+
+            verify(m_Remaining--);
+            if (!m_Remaining)
+                m_TaskFinished.notify_one();
+
+            continue;
+        }
+
+        if (TaskType::Recognize == eTask)
+        {
+            m_pRecognizer->Execute(iVerifier, nThreads);
+
+            std::unique_lock<std::mutex> scope2(m_Mutex);
+
+            verify(m_Remaining--);
+            if (!m_Remaining)
+                m_TaskFinished.notify_one();
+
+            continue;
+        }
+
+        assert(TaskType::Tx == eTask);
+        p->Reset();
+
+        TxBase::Context ctx;
+        ctx.m_bBlockMode = m_pCtx->m_bBlockMode;
+        ctx.m_Height = m_pCtx->m_Height;
+        ctx.m_nVerifiers = nThreads;
+        ctx.m_iVerifier = iVerifier;
+        ctx.m_pAbort = &m_bFail; // obsolete actually
+
+        TxBase::IReader::Ptr pR;
+        m_pR->Clone(pR);
+
+        bool bValid = ctx.ValidateAndSummarize(*m_pTx, std::move(*pR)) && p->Flush();
+
+        std::unique_lock<std::mutex> scope2(m_Mutex);
+
+        verify(m_Remaining--);
 
         if (bValid && !m_bFail)
             bValid = m_pCtx->Merge(ctx);
@@ -675,6 +1281,12 @@ Node::Peer* Node::AllocPeer(const beam::io::Address& addr)
     ZeroObject(pPeer->m_Tip);
     pPeer->m_RemoteAddr = addr;
     pPeer->m_LoginFlags = 0;
+    pPeer->m_LastRcv_ms = GetTime_ms();
+    pPeer->m_TimeoutRemaining_ms = 0;
+    pPeer->m_UtxoEvents.m_ID = 0;
+    pPeer->m_UtxoEvents.m_hNext = MaxHeight;
+    pPeer->m_UtxoEvents.m_Window = 0;
+    pPeer->m_UtxoEvents.m_InFlight = 0;
 
     LOG_INFO() << "+Peer " << addr;
 
@@ -700,7 +1312,8 @@ void Node::Keys::SetSingleKey(const Key::IKdf::Ptr& pKdf)
 void Node::Initialize(IExternalPOW* externalPOW)
 {
     m_Processor.m_Horizon = m_Cfg.m_Horizon;
-    m_Processor.Initialize(m_Cfg.m_sPathLocal.c_str(), m_Cfg.m_Sync.m_ForceResync);
+    m_Processor.m_UtxoSnapshot = m_Cfg.m_UtxoSnapshot;
+    m_Processor.Initialize(m_Cfg.m_sPathLocal.c_str(), m_Cfg.m_Sync.m_ForceResync, m_Cfg.m_BodyStore);
 
     if (m_Cfg.m_Sync.m_ForceResync)
         m_Processor.get_DB().ParamSet(NodeDB::ParamID::SyncTarget, NULL, NULL);
@@ -907,6 +1520,8 @@ Node::~Node()
     m_Miner.m_vThreads.clear();
 
     m_Compressor.StopCurrent();
+    m_Processor.m_BlockValidator.Stop();
+    m_Dandelion.Stop();
 
     for (PeerList::iterator it = m_lstPeers.begin(); m_lstPeers.end() != it; it++)
         it->m_LoginFlags = 0; // prevent re-assigning of tasks in the next loop
@@ -958,6 +1573,12 @@ void Node::Peer::OnTimer()
     {
         assert(!m_lstTasks.empty());
 
+        if (m_TimeoutRemaining_ms)
+        {
+            OnLagging();
+            return;
+        }
+
         LOG_WARNING() << "Peer " << m_RemoteAddr << " request timeout";
 
         if (m_pInfo)
@@ -1015,7 +1636,12 @@ void Node::Peer::OnConnectedSecure()
     msgLogin.m_Flags =
         proto::LoginFlags::SpreadingTransactions | // indicate ability to receive and broadcast transactions
         proto::LoginFlags::Bbs | // indicate ability to receive and broadcast BBS messages
-        proto::LoginFlags::SendPeers; // request a another node to periodically send a list of recommended peers
+        proto::LoginFlags::SendPeers | // request a another node to periodically send a list of recommended peers
+        proto::LoginFlags::CompactBlocks | // indicate ability to serve and rebuild compact block bodies
+        proto::LoginFlags::UtxoEventsStream; // indicate ability to stream utxo events to the owner
+
+    if (m_This.m_Cfg.m_BodyPacks)
+        msgLogin.m_Flags |= proto::LoginFlags::BodyPack; // indicate ability to serve blocks in packs
 
     Send(msgLogin);
 
@@ -1203,12 +1829,17 @@ void Node::Peer::ReleaseTask(Task& t)
     assert(this == t.m_pOwner);
     t.m_pOwner = NULL;
 
+    if (t.m_Key.second)
+        m_pCompact.reset();
+
     if (t.m_bPack)
     {
-        uint32_t& nCounter = t.m_Key.second ? m_This.m_nTasksPackBody : m_This.m_nTasksPackHdr;
-        assert(nCounter);
+        if (!t.m_Key.second)
+        {
+            assert(m_This.m_nTasksPackHdr);
+            m_This.m_nTasksPackHdr--;
+        }
 
-        nCounter--;
         t.m_bPack = false;
     }
 
@@ -1246,6 +1877,7 @@ void Node::Peer::DeleteSelf(bool bIsError, uint8_t nByeReason)
 
     ReleaseTasks();
     Unsubscribe();
+    m_This.m_TxBatch.OnPeerDeleted(*this);
 
     if (m_pInfo)
     {
@@ -1587,6 +2219,7 @@ Node::Task& Node::Peer::get_FirstTask()
 
 void Node::Peer::OnFirstTaskDone()
 {
+    m_Flags &= ~Flags::Lagging; // responded
     ReleaseTask(get_FirstTask());
     SetTimerWrtFirstTask();
 
@@ -1628,6 +2261,8 @@ void Node::Peer::OnMsg(proto::Hdr&& msg)
     if (id != t.m_Key.first)
         ThrowUnexpected();
 
+    OnTaskCompleted(0, 0);
+
     assert((Flags::PiRcvd & m_Flags) && m_pInfo);
     m_This.m_PeerMan.ModifyRating(*m_pInfo, PeerMan::Rating::RewardHeader, true);
 
@@ -1683,40 +2318,13 @@ void Node::Peer::OnMsg(proto::HdrPack&& msg)
     if (msg.m_vElements.empty() || (msg.m_vElements.size() > proto::g_HdrPackMaxSize))
         ThrowUnexpected();
 
-    Block::SystemState::Full s;
-    Cast::Down<Block::SystemState::Sequence::Prefix>(s) = msg.m_Prefix;
-    Cast::Down<Block::SystemState::Sequence::Element>(s) = msg.m_vElements.back();
-
-    uint32_t nAccepted = 0;
-    bool bInvalid = false;
-
-    for (size_t i = msg.m_vElements.size(); ; )
-    {
-        NodeProcessor::DataStatus::Enum eStatus = m_This.m_Processor.OnState(s, m_pInfo->m_ID.m_Key);
-        switch (eStatus)
-        {
-        case NodeProcessor::DataStatus::Invalid:
-            bInvalid = true;
-            break;
-
-        case NodeProcessor::DataStatus::Accepted:
-            nAccepted++;
-
-        default:
-            break; // suppress warning
-        }
-
-        if (! --i)
-            break;
+    OnTaskCompleted(0, 0);
 
-        s.NextPrefix();
-        Cast::Down<Block::SystemState::Sequence::Element>(s) = msg.m_vElements[i - 1];
-        s.m_ChainWork += s.m_PoW.m_Difficulty;
-    }
+    bool bInvalid;
+    Block::SystemState::ID id;
+    uint32_t nAccepted = m_This.m_Processor.OnStatePack(msg.m_Prefix, msg.m_vElements, m_pInfo->m_ID.m_Key, bInvalid, id);
 
     // just to be pedantic
-    Block::SystemState::ID id;
-    s.get_ID(id);
     if (id != t.m_Key.first)
         bInvalid = true;
 
@@ -1738,11 +2346,19 @@ void Node::Peer::OnMsg(proto::GetBody&& msg)
 {
     if (msg.m_ID.m_Height)
     {
-        uint64_t rowid = m_This.m_Processor.get_DB().StateFindSafe(msg.m_ID);
+        NodeDB& db = m_This.m_Processor.get_DB();
+        uint64_t rowid = db.StateFindSafe(msg.m_ID);
         if (rowid)
         {
+            io::SharedBuffer bodyP, bodyE;
+            if (db.GetStateBlockMapped(rowid, bodyP, bodyE) && bodyP.size)
+            {
+                SendBody(bodyP, bodyE); // straight from the mapped segment
+                return;
+            }
+
             proto::Body msgBody;
-            m_This.m_Processor.get_DB().GetStateBlock(rowid, &msgBody.m_Perishable, &msgBody.m_Eternal, NULL);
+            db.GetStateBlock(rowid, &msgBody.m_Perishable, &msgBody.m_Eternal, NULL);
 
             if (!msgBody.m_Perishable.empty())
             {
@@ -1776,32 +2392,496 @@ void Node::Peer::OnMsg(proto::Body&& msg)
     if (!t.m_Key.second || t.m_bPack)
         ThrowUnexpected();
 
+    OnTaskCompleted(msg.m_Perishable.size() + msg.m_Eternal.size(), 1);
+    m_This.m_BodyStats.m_Single++;
+
     assert((Flags::PiRcvd & m_Flags) && m_pInfo);
     m_This.m_PeerMan.ModifyRating(*m_pInfo, PeerMan::Rating::RewardBlock, true);
 
     const Block::SystemState::ID& id = t.m_Key.first;
     Height h = id.m_Height;
 
+    if (h)
+        m_This.m_Compact.OnBlock(id, msg.m_Perishable, msg.m_Eternal);
+
     NodeProcessor::DataStatus::Enum eStatus = h ?
         m_This.m_Processor.OnBlock(id, msg.m_Perishable, msg.m_Eternal, m_pInfo->m_ID.m_Key) :
         m_This.m_Processor.OnTreasury(msg.m_Eternal);
 
     OnFirstTaskDone(eStatus);
 
-    if (!h)
-        m_This.InitMode(); // maybe fast-sync now
-}
+    if (!h)
+        m_This.InitMode(); // maybe fast-sync now
+}
+
+void Node::Peer::OnFirstTaskDone(NodeProcessor::DataStatus::Enum eStatus)
+{
+    if (NodeProcessor::DataStatus::Invalid == eStatus)
+        ThrowUnexpected();
+
+    get_FirstTask().m_bRelevant = false;
+    OnFirstTaskDone();
+
+    if (NodeProcessor::DataStatus::Accepted == eStatus)
+        m_This.RefreshCongestions();
+}
+
+void Node::Peer::OnMsg(proto::GetBodyPack&& msg)
+{
+    if (!m_This.m_Cfg.m_BodyPacks || (msg.m_CountExtra >= proto::g_HdrPackMaxSize))
+        ThrowUnexpected();
+
+    proto::BodyPack msgOut;
+
+    NodeDB& db = m_This.m_Processor.get_DB();
+    uint64_t rowid = msg.m_Top.m_Height ? db.StateFindSafe(msg.m_Top) : 0;
+    if (rowid)
+    {
+        std::vector<uint64_t> vRows;
+        vRows.reserve(msg.m_CountExtra + 1);
+
+        for (vRows.push_back(rowid); vRows.size() <= msg.m_CountExtra; vRows.push_back(rowid))
+            if (!db.get_Prev(rowid))
+                break;
+
+        if (vRows.size() > msg.m_CountExtra)
+        {
+            // from the lowest, until the size limit is reached
+            size_t nSize = 0;
+            for (size_t i = vRows.size(); (nSize < proto::g_BodyPackMaxSize) && i--; )
+            {
+                msgOut.m_Bodies.emplace_back();
+                proto::BodyBuffers& x = msgOut.m_Bodies.back();
+
+                Blob bodyP, bodyE;
+                if (db.GetStateBlockMapped(vRows[i], bodyP, bodyE) && bodyP.n)
+                {
+                    bodyP.Export(x.m_Perishable);
+                    bodyE.Export(x.m_Eternal);
+                }
+                else
+                    db.GetStateBlock(vRows[i], &x.m_Perishable, &x.m_Eternal, NULL);
+
+                if (x.m_Perishable.empty())
+                {
+                    msgOut.m_Bodies.pop_back();
+                    break;
+                }
+
+                nSize += x.m_Perishable.size() + x.m_Eternal.size();
+            }
+        }
+    }
+
+    if (msgOut.m_Bodies.empty())
+        Send(proto::DataMissing(Zero));
+    else
+        Send(msgOut);
+}
+
+void Node::Peer::OnMsg(proto::BodyPack&& msg)
+{
+    Task& t = get_FirstTask();
+
+    if (!t.m_Key.second || !t.m_bPack)
+        ThrowUnexpected();
+
+    const Block::SystemState::ID& id = t.m_Key.first;
+    if (msg.m_Bodies.empty() || (msg.m_Bodies.size() > t.m_sidPack.m_Height - id.m_Height + 1))
+        ThrowUnexpected();
+
+    // IDs of the blocks, from the lowest
+    std::vector<Block::SystemState::ID> vIDs(msg.m_Bodies.size());
+
+    NodeDB& db = m_This.m_Processor.get_DB();
+    for (NodeDB::StateID sid = t.m_sidPack; ; )
+    {
+        Height i = sid.m_Height - id.m_Height;
+        if (i < vIDs.size())
+            db.get_StateID(sid, vIDs[i]);
+
+        if (!i || !db.get_Prev(sid))
+            break;
+    }
+
+    if (vIDs[0] != id)
+    {
+        // the branch has changed meanwhile, accept only the requested block
+        vIDs.resize(1);
+        vIDs[0] = id;
+    }
+
+    size_t nSize = 0;
+    for (size_t i = 0; i < msg.m_Bodies.size(); i++)
+        nSize += msg.m_Bodies[i].m_Perishable.size() + msg.m_Bodies[i].m_Eternal.size();
+
+    OnTaskCompleted(nSize, static_cast<uint32_t>(msg.m_Bodies.size()));
+
+    m_This.m_BodyStats.m_Packs++;
+    m_This.m_BodyStats.m_PackBlocks += msg.m_Bodies.size();
+
+    assert((Flags::PiRcvd & m_Flags) && m_pInfo);
+
+    NodeProcessor::DataStatus::Enum eStatus = NodeProcessor::DataStatus::Rejected;
+    for (size_t i = 0; i < vIDs.size(); i++)
+    {
+        const proto::BodyBuffers& x = msg.m_Bodies[i];
+        m_This.m_PeerMan.ModifyRating(*m_pInfo, PeerMan::Rating::RewardBlock, true);
+
+        NodeProcessor::DataStatus::Enum eStatusBlock = m_This.m_Processor.OnBlock(vIDs[i], x.m_Perishable, x.m_Eternal, m_pInfo->m_ID.m_Key);
+        if (NodeProcessor::DataStatus::Invalid == eStatusBlock)
+            ThrowUnexpected();
+
+        if (!i || (NodeProcessor::DataStatus::Accepted == eStatusBlock))
+            eStatus = eStatusBlock;
+    }
+
+    OnFirstTaskDone(eStatus);
+}
+
+bool Node::Peer::ReadBlock(const Block::SystemState::ID& id, Block::Body& block, Merkle::Hash* pChecksum)
+{
+    if (!id.m_Height)
+        return false;
+
+    NodeDB& db = m_This.m_Processor.get_DB();
+    uint64_t rowid = db.StateFindSafe(id);
+    if (!rowid)
+        return false;
+
+    ByteBuffer bbP, bbE;
+    Blob bodyP, bodyE;
+    if (!(db.GetStateBlockMapped(rowid, bodyP, bodyE) && bodyP.n))
+    {
+        db.GetStateBlock(rowid, &bbP, &bbE, NULL);
+        if (bbP.empty())
+            return false;
+
+        bodyP = bbP;
+        bodyE = bbE;
+    }
+
+    NodeProcessor::ReadBody(block, bodyP, bodyE);
+
+    if (pChecksum)
+        Compact::get_Checksum(*pChecksum, bodyP, bodyE);
+
+    return true;
+}
+
+void Node::Peer::OnMsg(proto::GetBodyCompact&& msg)
+{
+    Block::Body block;
+    proto::BodyCompact msgOut;
+
+    if (!ReadBlock(msg.m_ID, block, &msgOut.m_Checksum))
+    {
+        proto::DataMissing msgMiss(Zero);
+        Send(msgMiss);
+        return;
+    }
+
+    // prefill what was missing in our pool, the peer most likely doesn't have it either.
+    // If we don't remember this block - only the coinbase outputs
+    const Compact::Entry* pEntry = m_This.m_Compact.Find(msg.m_ID);
+
+    msgOut.m_Base = Cast::Down<Block::BodyBase>(block);
+    msgOut.m_Inputs.swap(block.m_vInputs);
+
+    msgOut.m_OutputIDs.reserve(block.m_vOutputs.size());
+    for (size_t i = 0; i < block.m_vOutputs.size(); i++)
+    {
+        Output::Ptr& pOutp = block.m_vOutputs[i];
+        msgOut.m_OutputIDs.push_back(TxPool::Fluff::get_ShortID(*pOutp, msg.m_ID.m_Hash));
+
+        uint64_t id = TxPool::Fluff::get_ShortID(*pOutp);
+        if (pOutp->m_Coinbase || (pEntry && (pEntry->m_bAll || (pEntry->m_setPrefill.end() != pEntry->m_setPrefill.find(id)))))
+            msgOut.m_Outputs.push_back(std::move(pOutp));
+    }
+
+    msgOut.m_KernelIDs.reserve(block.m_vKernels.size());
+    for (size_t i = 0; i < block.m_vKernels.size(); i++)
+    {
+        TxKernel::Ptr& pKrn = block.m_vKernels[i];
+        msgOut.m_KernelIDs.push_back(TxPool::Fluff::get_ShortID(*pKrn, msg.m_ID.m_Hash));
+
+        uint64_t id = TxPool::Fluff::get_ShortID(*pKrn);
+        if (pEntry && (pEntry->m_bAll || (pEntry->m_setPrefill.end() != pEntry->m_setPrefill.find(id))))
+            msgOut.m_Kernels.push_back(std::move(pKrn));
+    }
+
+    Send(msgOut);
+}
+
+void Node::Peer::OnMsg(proto::GetBodyMissing&& msg)
+{
+    Block::Body block;
+    if (!ReadBlock(msg.m_ID, block, NULL))
+    {
+        proto::DataMissing msgMiss(Zero);
+        Send(msgMiss);
+        return;
+    }
+
+    proto::BodyMissing msgOut;
+
+    msgOut.m_Outputs.reserve(msg.m_Outputs.size());
+    for (size_t i = 0; i < msg.m_Outputs.size(); i++)
+    {
+        uint32_t iIdx = msg.m_Outputs[i];
+        if ((iIdx >= block.m_vOutputs.size()) || !block.m_vOutputs[iIdx])
+            ThrowUnexpected(); // out of bounds, or duplicated
+
+        msgOut.m_Outputs.push_back(std::move(block.m_vOutputs[iIdx]));
+    }
+
+    msgOut.m_Kernels.reserve(msg.m_Kernels.size());
+    for (size_t i = 0; i < msg.m_Kernels.size(); i++)
+    {
+        uint32_t iIdx = msg.m_Kernels[i];
+        if ((iIdx >= block.m_vKernels.size()) || !block.m_vKernels[iIdx])
+            ThrowUnexpected();
+
+        msgOut.m_Kernels.push_back(std::move(block.m_vKernels[iIdx]));
+    }
+
+    Send(msgOut);
+}
+
+void Node::Peer::OnMsg(proto::BodyCompact&& msg)
+{
+    Task& t = get_FirstTask();
+
+    if (!t.m_Key.second || t.m_bPack || !m_pCompact || m_pCompact->m_bRcvd)
+        ThrowUnexpected();
+
+    Compact::Pending& x = *m_pCompact;
+    x.m_bRcvd = true;
+    x.m_Checksum = msg.m_Checksum;
+
+    m_This.m_Compact.m_Stats.m_Received++;
+
+    Block::Body& block = x.m_Body;
+    Cast::Down<Block::BodyBase>(block) = msg.m_Base;
+    block.m_vInputs.swap(msg.m_Inputs);
+
+    // The IDs are salted by the block hash, index the pool accordingly
+    const Merkle::Hash& hvSalt = t.m_Key.first.m_Hash;
+    TxPool::Fluff::SaltedIndex txp;
+    txp.Build(m_This.m_TxPool, hvSalt);
+
+    // The prefilled elements are in the same order as their IDs. Match them first, then look in the pool
+    block.m_vOutputs.resize(msg.m_OutputIDs.size());
+    for (size_t i = 0, iPrefilled = 0; i < msg.m_OutputIDs.size(); i++)
+    {
+        uint64_t id = msg.m_OutputIDs[i];
+        Output::Ptr& pOutp = block.m_vOutputs[i];
+
+        if ((iPrefilled < msg.m_Outputs.size()) && msg.m_Outputs[iPrefilled] && (TxPool::Fluff::get_ShortID(*msg.m_Outputs[iPrefilled], hvSalt) == id))
+            pOutp = std::move(msg.m_Outputs[iPrefilled++]);
+        else
+        {
+            const Output* pSrc = txp.FindOutput(id);
+            if (pSrc)
+            {
+                pOutp.reset(new Output);
+                *pOutp = *pSrc;
+            }
+            else
+                x.m_vMissingOutputs.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    block.m_vKernels.resize(msg.m_KernelIDs.size());
+    for (size_t i = 0, iPrefilled = 0; i < msg.m_KernelIDs.size(); i++)
+    {
+        uint64_t id = msg.m_KernelIDs[i];
+        TxKernel::Ptr& pKrn = block.m_vKernels[i];
+
+        if ((iPrefilled < msg.m_Kernels.size()) && msg.m_Kernels[iPrefilled] && (TxPool::Fluff::get_ShortID(*msg.m_Kernels[iPrefilled], hvSalt) == id))
+            pKrn = std::move(msg.m_Kernels[iPrefilled++]);
+        else
+        {
+            const TxKernel* pSrc = txp.FindKernel(id);
+            if (pSrc)
+            {
+                pKrn.reset(new TxKernel);
+                *pKrn = *pSrc;
+            }
+            else
+                x.m_vMissingKernels.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    if (x.m_vMissingOutputs.empty() && x.m_vMissingKernels.empty())
+    {
+        OnBodyCompactReady();
+        return;
+    }
+
+    m_This.m_Compact.m_Stats.m_MissingRounds++;
+    m_This.m_Compact.m_Stats.m_ElementsMissing += x.m_vMissingOutputs.size() + x.m_vMissingKernels.size();
+
+    proto::GetBodyMissing msgOut;
+    msgOut.m_ID = t.m_Key.first;
+    msgOut.m_Outputs = x.m_vMissingOutputs;
+    msgOut.m_Kernels = x.m_vMissingKernels;
+    Send(msgOut);
+}
+
+void Node::Peer::OnMsg(proto::BodyMissing&& msg)
+{
+    get_FirstTask();
+
+    if (!m_pCompact || !m_pCompact->m_bRcvd)
+        ThrowUnexpected();
+
+    Compact::Pending& x = *m_pCompact;
+    if ((x.m_vMissingOutputs.empty() && x.m_vMissingKernels.empty()) ||
+        (msg.m_Outputs.size() != x.m_vMissingOutputs.size()) ||
+        (msg.m_Kernels.size() != x.m_vMissingKernels.size()))
+        ThrowUnexpected();
+
+    for (size_t i = 0; i < msg.m_Outputs.size(); i++)
+    {
+        if (!msg.m_Outputs[i])
+            ThrowUnexpected();
+        x.m_Body.m_vOutputs[x.m_vMissingOutputs[i]] = std::move(msg.m_Outputs[i]);
+    }
+
+    for (size_t i = 0; i < msg.m_Kernels.size(); i++)
+    {
+        if (!msg.m_Kernels[i])
+            ThrowUnexpected();
+        x.m_Body.m_vKernels[x.m_vMissingKernels[i]] = std::move(msg.m_Kernels[i]);
+    }
+
+    x.m_vMissingOutputs.clear();
+    x.m_vMissingKernels.clear();
+
+    OnBodyCompactReady();
+}
+
+void Node::Peer::OnBodyCompactReady()
+{
+    Task& t = get_FirstTask();
+
+    std::unique_ptr<Compact::Pending> pCompact = std::move(m_pCompact);
+    Block::Body& block = pCompact->m_Body;
+
+    ByteBuffer bbP, bbE;
+    Serializer ser;
+
+    ser.reset();
+    ser & Cast::Down<Block::BodyBase>(block);
+    ser & Cast::Down<TxVectors::Perishable>(block);
+    ser.swap_buf(bbP);
+
+    ser.reset();
+    ser & Cast::Down<TxVectors::Eternal>(block);
+    ser.swap_buf(bbE);
+
+    Merkle::Hash hv;
+    Compact::get_Checksum(hv, bbP, bbE);
+
+    if (hv != pCompact->m_Checksum)
+    {
+        // most likely a short ID collision, not necessarily the peer's fault. Fall back to the full body
+        LOG_WARNING() << "Compact body mismatch " << t.m_Key.first << ", requesting the full body";
+        m_This.m_Compact.m_Stats.m_Fallback++;
+
+        proto::GetBody msg;
+        msg.m_ID = t.m_Key.first;
+        Send(msg);
+        return;
+    }
+
+    m_This.m_Compact.m_Stats.m_Reconstructed++;
+
+    assert((Flags::PiRcvd & m_Flags) && m_pInfo);
+    m_This.m_PeerMan.ModifyRating(*m_pInfo, PeerMan::Rating::RewardBlock, true);
+
+    const Block::SystemState::ID& id = t.m_Key.first;
+    m_This.m_Compact.OnBlock(id, bbP, bbE);
+
+    NodeProcessor::DataStatus::Enum eStatus = m_This.m_Processor.OnBlock(id, bbP, bbE, m_pInfo->m_ID.m_Key);
+    OnFirstTaskDone(eStatus);
+}
+
+void Node::Compact::get_Checksum(Merkle::Hash& hv, const Blob& bodyP, const Blob& bodyE)
+{
+    ECC::Hash::Processor()
+        << bodyP.n
+        << bodyP
+        << bodyE
+        >> hv;
+}
+
+const Node::Compact::Entry* Node::Compact::Find(const Block::SystemState::ID& id) const
+{
+    for (size_t i = m_lstEntries.size(); i--; )
+        if (m_lstEntries[i].m_ID == id)
+            return &m_lstEntries[i];
+
+    return NULL;
+}
+
+void Node::Compact::OnBlock(const Block::SystemState::ID& id, const Blob& bodyP, const Blob& bodyE)
+{
+    if (Find(id))
+        return;
+
+    // Only the new tip is likely to be relayed in the compact form. Don't deserialize the blocks during sync or of the stale branches
+    NodeProcessor& p = get_ParentObj().m_Processor;
+    if (id.m_Height != p.m_Cursor.m_ID.m_Height + 1)
+        return;
+
+    uint64_t rowid = p.get_DB().StateFindSafe(id);
+    if (!rowid || p.get_DB().GetStateNextCount(rowid))
+        return; // we already know the headers above it
+
+    if (m_lstEntries.size() >= s_Entries)
+        m_lstEntries.pop_front();
+
+    m_lstEntries.emplace_back();
+    Entry& x = m_lstEntries.back();
+    x.m_ID = id;
+
+    const TxPool::Fluff& txp = get_ParentObj().m_TxPool;
+    x.m_bAll = txp.m_setTxs.empty();
+    if (x.m_bAll)
+        return;
+
+    Block::Body block;
+    try
+    {
+        NodeProcessor::ReadBody(block, bodyP, bodyE);
+    }
+    catch (const std::exception&)
+    {
+        x.m_bAll = true; // malformed, will be rejected anyway
+        return;
+    }
+
+    for (size_t i = 0; i < block.m_vOutputs.size(); i++)
+    {
+        if (!block.m_vOutputs[i])
+            continue;
 
-void Node::Peer::OnFirstTaskDone(NodeProcessor::DataStatus::Enum eStatus)
-{
-    if (NodeProcessor::DataStatus::Invalid == eStatus)
-        ThrowUnexpected();
+        uint64_t val = TxPool::Fluff::get_ShortID(*block.m_vOutputs[i]);
+        if (!txp.FindOutput(val))
+            x.m_setPrefill.insert(val);
+    }
 
-    get_FirstTask().m_bRelevant = false;
-    OnFirstTaskDone();
+    for (size_t i = 0; i < block.m_vKernels.size(); i++)
+    {
+        if (!block.m_vKernels[i])
+            continue;
 
-    if (NodeProcessor::DataStatus::Accepted == eStatus)
-        m_This.RefreshCongestions();
+        uint64_t val = TxPool::Fluff::get_ShortID(*block.m_vKernels[i]);
+        if (!txp.FindKernel(val))
+            x.m_setPrefill.insert(val);
+    }
 }
 
 void Node::Peer::OnMsg(proto::NewTransaction&& msg)
@@ -1811,7 +2891,7 @@ void Node::Peer::OnMsg(proto::NewTransaction&& msg)
     // However the transaction body must have already been checked for NULLs
 
     if (msg.m_Fluff)
-        m_This.OnTransactionFluff(std::move(msg.m_Transaction), this, NULL);
+        m_This.m_TxBatch.Add(std::move(msg.m_Transaction), this);
     else
     {
         proto::Boolean msgOut;
@@ -1933,7 +3013,7 @@ bool Node::OnTransactionStem(Transaction::Ptr&& ptx, const Peer* pPeer)
         {
             pDup = pElem; // exact match
 
-            if (pDup->m_bAggregating)
+            if (pDup->m_bAggregating || pDup->m_pMerge)
                 return true; // it shouldn't have been received, but nevermind, just ignore
 
             break;
@@ -1955,6 +3035,9 @@ bool Node::OnTransactionStem(Transaction::Ptr&& ptx, const Peer* pPeer)
 
         std::unique_ptr<TxPool::Stem::Element> pGuard(new TxPool::Stem::Element);
         pGuard->m_bAggregating = false;
+        pGuard->m_pMerge = NULL;
+        pGuard->m_Depth = 1;
+        pGuard->m_Received_ms = GetTime_ms();
         pGuard->m_Time.m_Value = 0;
         pGuard->m_Profit.m_Fee = ctx.m_Fee;
         pGuard->m_Profit.SetSize(*ptx);
@@ -1980,6 +3063,13 @@ bool Node::OnTransactionStem(Transaction::Ptr&& ptx, const Peer* pPeer)
 
 void Node::OnTransactionAggregated(TxPool::Stem::Element& x)
 {
+    assert(!x.m_bAggregating && !x.m_pMerge);
+
+    DandelionStats& s = m_Dandelion.m_Stats;
+    s.m_Aggregated++;
+    s.m_Depth += x.m_Depth;
+    s.m_DepthMax = std::max(s.m_DepthMax, x.m_Depth);
+
     // must have at least 1 peer to continue the stem phase
     uint32_t nStemPeers = 0;
 
@@ -2022,11 +3112,26 @@ void Node::PerformAggregation(TxPool::Stem::Element& x)
 {
     assert(x.m_bAggregating);
 
-    // Aggregation policiy: first select those with worse profit, than those with better
+    // Aggregation policiy: first select those with worse profit, than those with better.
+    // Txs that spend the same input can't be merged.
+    std::vector<TxPool::Stem::Element*> vSrc;
+    std::set<ECC::Point> setSpent;
+    NodeProcessor::MarkSpent(*x.m_pValue, setSpent);
+    size_t nOutputs = x.m_pValue->m_vOutputs.size();
+
+    auto fnAdd = [&](TxPool::Stem::Element& src) {
+        if (NodeProcessor::IsConflicting(*src.m_pValue, setSpent))
+            return;
+
+        NodeProcessor::MarkSpent(*src.m_pValue, setSpent);
+        nOutputs += src.m_pValue->m_vOutputs.size();
+        vSrc.push_back(&src);
+    };
+
     TxPool::Stem::ProfitSet::iterator it = TxPool::Stem::ProfitSet::s_iterator_to(x.m_Profit);
     ++it;
 
-    while (x.m_pValue->m_vOutputs.size() <= m_Cfg.m_Dandelion.m_OutputsMax)
+    while (nOutputs <= m_Cfg.m_Dandelion.m_OutputsMax)
     {
         if (m_Dandelion.m_setProfit.end() == it)
             break;
@@ -2034,14 +3139,14 @@ void Node::PerformAggregation(TxPool::Stem::Element& x)
         TxPool::Stem::Element& src = it->get_ParentObj();
         ++it;
 
-        m_Dandelion.TryMerge(x, src);
+        fnAdd(src);
     }
 
     it = TxPool::Stem::ProfitSet::s_iterator_to(x.m_Profit);
     if (m_Dandelion.m_setProfit.begin() != it)
     {
         --it;
-        while (x.m_pValue->m_vOutputs.size() <= m_Cfg.m_Dandelion.m_OutputsMax)
+        while (nOutputs <= m_Cfg.m_Dandelion.m_OutputsMax)
         {
             TxPool::Stem::Element& src = it->get_ParentObj();
 
@@ -2049,14 +3154,26 @@ void Node::PerformAggregation(TxPool::Stem::Element& x)
             if (!bEnd)
                 --it;
 
-            m_Dandelion.TryMerge(x, src);
+            fnAdd(src);
 
             if (bEnd)
                 break;
         }
     }
 
-    if (x.m_pValue->m_vOutputs.size() >= m_Cfg.m_Dandelion.m_OutputsMin)
+    if (!vSrc.empty())
+    {
+        TxPool::Stem::Merge::Ptr pMerge(new TxPool::Stem::Merge);
+        m_Dandelion.Freeze(*pMerge, x);
+
+        for (size_t i = 0; i < vSrc.size(); i++)
+            m_Dandelion.Freeze(*pMerge, *vSrc[i]);
+
+        m_Dandelion.Push(std::move(pMerge));
+        return;
+    }
+
+    if (nOutputs >= m_Cfg.m_Dandelion.m_OutputsMin)
     {
         m_Dandelion.DeleteAggr(x);
         OnTransactionAggregated(x);
@@ -2064,6 +3181,154 @@ void Node::PerformAggregation(TxPool::Stem::Element& x)
         m_Dandelion.SetTimer(m_Cfg.m_Dandelion.m_AggregationTime_ms, x);
 }
 
+void Node::OnMerged(TxPool::Stem::Merge& m)
+{
+    if (!m_Dandelion.ApplyMerge(m))
+    {
+        m_Dandelion.m_Stats.m_MergesAborted++;
+        DeleteDummyOutputs(m);
+
+        // return the survivors to the aggregation
+        for (size_t i = 0; i < m.m_vElems.size(); i++)
+        {
+            TxPool::Stem::Element* pElem = m.m_vElems[i];
+            if (!pElem)
+                continue;
+
+            if (m_Processor.ValidateTxContext(*pElem->m_pValue))
+            {
+                m_Dandelion.InsertAggr(*pElem);
+                m_Dandelion.SetTimer(m_Cfg.m_Dandelion.m_AggregationTime_ms, *pElem);
+            }
+            else
+                m_Dandelion.Delete(*pElem);
+        }
+
+        return;
+    }
+
+    TxPool::Stem::Element& x = *m.m_vElems.front();
+
+    if (m.m_bFinal || (x.m_pValue->m_vOutputs.size() >= m_Cfg.m_Dandelion.m_OutputsMin))
+        OnTransactionAggregated(x);
+    else
+    {
+        m_Dandelion.InsertAggr(x);
+        m_Dandelion.SetTimer(m_Cfg.m_Dandelion.m_AggregationTime_ms, x);
+    }
+}
+
+void Node::Dandelion::Push(Merge::Ptr&& pMerge)
+{
+    uint32_t nThreads = get_ParentObj().m_Cfg.m_Dandelion.m_AggregationThreads;
+    if (!nThreads)
+    {
+        pMerge->Execute();
+        get_ParentObj().OnMerged(*pMerge);
+        return;
+    }
+
+    if (m_vThreads.empty())
+    {
+        io::AsyncEvent::Callback cb = [this]() { OnDone(); };
+        m_pEvtDone = io::AsyncEvent::create(io::Reactor::get_Current(), std::move(cb));
+
+        m_bStop = false;
+        m_vThreads.resize(nThreads);
+        for (uint32_t i = 0; i < nThreads; i++)
+            m_vThreads[i] = std::thread(&Dandelion::Thread, this);
+    }
+
+    std::unique_lock<std::mutex> scope(m_Mutex);
+    m_queIn.push_back(std::move(pMerge));
+    m_NewTask.notify_one();
+}
+
+void Node::Dandelion::Stop()
+{
+    if (m_vThreads.empty())
+        return;
+
+    {
+        std::unique_lock<std::mutex> scope(m_Mutex);
+        m_bStop = true;
+        m_NewTask.notify_all();
+    }
+
+    for (size_t i = 0; i < m_vThreads.size(); i++)
+        if (m_vThreads[i].joinable())
+            m_vThreads[i].join();
+
+    m_vThreads.clear();
+
+    // unfreeze the pending elements, they may outlive the merges. The reserved dummies won't be created
+    for (int iQue = 0; iQue < 2; iQue++)
+    {
+        std::deque<Merge::Ptr>& que = iQue ? m_queOut : m_queIn;
+        for (size_t i = 0; i < que.size(); i++)
+        {
+            std::vector<Element*>& v = que[i]->m_vElems;
+            for (size_t j = 0; j < v.size(); j++)
+                if (v[j])
+                    v[j]->m_pMerge = NULL;
+
+            get_ParentObj().DeleteDummyOutputs(*que[i]);
+        }
+        que.clear();
+    }
+
+    m_pEvtDone.reset();
+}
+
+void Node::Dandelion::Thread()
+{
+    while (true)
+    {
+        Merge::Ptr pMerge;
+
+        {
+            std::unique_lock<std::mutex> scope(m_Mutex);
+
+            while (m_queIn.empty() && !m_bStop)
+                m_NewTask.wait(scope);
+
+            if (m_bStop)
+                return;
+
+            pMerge = std::move(m_queIn.front());
+            m_queIn.pop_front();
+        }
+
+        pMerge->Execute();
+
+        {
+            std::unique_lock<std::mutex> scope(m_Mutex);
+            m_queOut.push_back(std::move(pMerge));
+        }
+
+        m_pEvtDone->post();
+    }
+}
+
+void Node::Dandelion::OnDone()
+{
+    while (true)
+    {
+        Merge::Ptr pMerge;
+
+        {
+            std::unique_lock<std::mutex> scope(m_Mutex);
+            if (m_queOut.empty())
+                break;
+
+            pMerge = std::move(m_queOut.front());
+            m_queOut.pop_front();
+        }
+
+        get_ParentObj().OnMerged(*pMerge);
+    }
+}
+
 void Node::AddDummyInputs(Transaction& tx)
 {
     bool bModified = false;
@@ -2131,17 +3396,17 @@ void Node::AddDummyInputs(Transaction& tx)
     }
 }
 
-void Node::AddDummyOutputs(Transaction& tx)
+void Node::AddDummyOutputs(TxPool::Stem::Merge& m, size_t nOutputs)
 {
     if (!m_Cfg.m_Dandelion.m_DummyLifetimeHi)
         return;
 
-    // add dummy outputs
+    // reserve dummy outputs, they're created along with the merge
     bool bModified = false;
 
     NodeDB& db = m_Processor.get_DB();
 
-    while (tx.m_vOutputs.size() < m_Cfg.m_Dandelion.m_OutputsMin)
+    for (; nOutputs < m_Cfg.m_Dandelion.m_OutputsMin; nOutputs++)
     {
         if (!m_LastDummyID)
             m_LastDummyID = db.GetDummyLastID();
@@ -2149,29 +3414,36 @@ void Node::AddDummyOutputs(Transaction& tx)
         ++m_LastDummyID;
         bModified = true;
 
-        Output::Ptr pOutput(new Output);
-        ECC::Scalar::Native sk;
-        pOutput->Create(sk, *m_Keys.m_pDummy, Key::IDV(0, m_LastDummyID, Key::Type::Decoy), *m_Keys.m_pDummy);
-
         Height h = m_Processor.m_Cursor.m_ID.m_Height + 1 + m_Cfg.m_Dandelion.m_DummyLifetimeLo;
         if (m_Cfg.m_Dandelion.m_DummyLifetimeHi > m_Cfg.m_Dandelion.m_DummyLifetimeLo)
             h += RandomUInt32(m_Cfg.m_Dandelion.m_DummyLifetimeHi - m_Cfg.m_Dandelion.m_DummyLifetimeLo);
 
         db.InsertDummy(h, m_LastDummyID);
 
-        tx.m_vOutputs.push_back(std::move(pOutput));
-
-        sk = -sk;
-        tx.m_Offset = ECC::Scalar::Native(tx.m_Offset) + sk;
+        m.m_vDummies.push_back(Key::IDV(0, m_LastDummyID, Key::Type::Decoy));
     }
 
     if (bModified)
     {
         m_Processor.FlushDB();
-        tx.Normalize();
+        m.m_pKdf = m_Keys.m_pDummy;
     }
 }
 
+void Node::DeleteDummyOutputs(TxPool::Stem::Merge& m)
+{
+    // the merge is aborted, release the reserved IDs. Those might be already deleted by AddDummyInputs, if the merge took long
+    if (m.m_vDummies.empty())
+        return;
+
+    NodeDB& db = m_Processor.get_DB();
+    for (size_t i = 0; i < m.m_vDummies.size(); i++)
+        db.DeleteDummySafe(m.m_vDummies[i].m_Idx);
+
+    m.m_vDummies.clear();
+    m_Processor.FlushDB();
+}
+
 bool Node::OnTransactionFluff(Transaction::Ptr&& ptxArg, const Peer* pPeer, TxPool::Stem::Element* pElem)
 {
     Transaction::Ptr ptx;
@@ -2180,22 +3452,17 @@ bool Node::OnTransactionFluff(Transaction::Ptr&& ptxArg, const Peer* pPeer, TxPo
     Transaction::Context ctx;
     if (pElem)
     {
+        DandelionStats& s = m_Dandelion.m_Stats;
+        uint32_t dt_ms = GetTime_ms() - pElem->m_Received_ms;
+        s.m_Fluffed++;
+        s.m_TimeToFluff_ms += dt_ms;
+        s.m_TimeToFluffMax_ms = std::max(s.m_TimeToFluffMax_ms, dt_ms);
+
         ctx.m_Fee = pElem->m_Profit.m_Fee;
         m_Dandelion.Delete(*pElem);
     }
     else
-    {
-        for (size_t i = 0; i < ptx->m_vKernels.size(); i++)
-        {
-            TxPool::Stem::Element::Kernel key;
-            ptx->m_vKernels[i]->get_ID(key.m_hv);
-
-            TxPool::Stem::KrnSet::iterator it = m_Dandelion.m_setKrns.find(key);
-            if (m_Dandelion.m_setKrns.end() != it)
-                m_Dandelion.Delete(*it->m_pThis);
-        }
-
-    }
+        DeleteStemByKernels(*ptx);
 
     TxPool::Fluff::Element::Tx key;
     ptx->get_Key(key.m_Key);
@@ -2204,19 +3471,35 @@ bool Node::OnTransactionFluff(Transaction::Ptr&& ptxArg, const Peer* pPeer, TxPo
     if (m_TxPool.m_setTxs.end() != it)
         return true;
 
-    const Transaction& tx = *ptx;
-
     m_Wtx.Delete(key.m_Key);
 
     // new transaction
-    bool bValid = pElem ? true: ValidateTx(ctx, tx);
-    LogTx(tx, bValid, key.m_Key);
+    bool bValid = pElem ? true: ValidateTx(ctx, *ptx);
+    return OnTransactionFluffValidated(std::move(ptx), key.m_Key, ctx, bValid, pPeer);
+}
+
+void Node::DeleteStemByKernels(const Transaction& tx)
+{
+    for (size_t i = 0; i < tx.m_vKernels.size(); i++)
+    {
+        TxPool::Stem::Element::Kernel key;
+        tx.m_vKernels[i]->get_ID(key.m_hv);
+
+        TxPool::Stem::KrnSet::iterator it = m_Dandelion.m_setKrns.find(key);
+        if (m_Dandelion.m_setKrns.end() != it)
+            m_Dandelion.Delete(*it->m_pThis);
+    }
+}
+
+bool Node::OnTransactionFluffValidated(Transaction::Ptr&& ptx, const Transaction::KeyType& keyTx, Transaction::Context& ctx, bool bValid, const Peer* pPeer)
+{
+    LogTx(*ptx, bValid, keyTx);
 
     if (!bValid)
         return false;
 
     proto::HaveTransaction msgOut;
-    msgOut.m_ID = key.m_Key;
+    msgOut.m_ID = keyTx;
 
     for (PeerList::iterator it2 = m_lstPeers.begin(); m_lstPeers.end() != it2; it2++)
     {
@@ -2229,7 +3512,7 @@ bool Node::OnTransactionFluff(Transaction::Ptr&& ptxArg, const Peer* pPeer, TxPo
         peer.Send(msgOut);
     }
 
-    m_TxPool.AddValidTx(std::move(ptx), ctx, key.m_Key);
+    m_TxPool.AddValidTx(std::move(ptx), ctx, keyTx);
     m_TxPool.ShrinkUpTo(m_Cfg.m_MaxPoolTransactions);
 
     if (m_Miner.IsEnabled() && !m_Miner.m_pTaskToFinalize)
@@ -2238,12 +3521,117 @@ bool Node::OnTransactionFluff(Transaction::Ptr&& ptxArg, const Peer* pPeer, TxPo
     return true;
 }
 
+void Node::TxBatch::Add(Transaction::Ptr&& ptx, const Peer* pPeer)
+{
+    Node& n = get_ParentObj();
+    if (!n.m_Cfg.m_Timeout.m_TxBatch_ms)
+    {
+        n.OnTransactionFluff(std::move(ptx), pPeer, NULL);
+        return;
+    }
+
+    m_vPending.emplace_back();
+    Entry& e = m_vPending.back();
+    e.m_pTx = std::move(ptx);
+    e.m_pPeer = pPeer;
+
+    if (m_vPending.size() >= n.m_Cfg.m_TxBatchMax)
+    {
+        Flush();
+        return;
+    }
+
+    if (1 == m_vPending.size())
+    {
+        if (!m_pTimer)
+            m_pTimer = io::Timer::create(io::Reactor::get_Current());
+
+        m_pTimer->start(n.m_Cfg.m_Timeout.m_TxBatch_ms, false, [this]() { Flush(); });
+    }
+}
+
+void Node::TxBatch::OnPeerDeleted(const Peer& peer)
+{
+    for (size_t i = 0; i < m_vPending.size(); i++)
+        if (&peer == m_vPending[i].m_pPeer)
+            m_vPending[i].m_pPeer = NULL;
+}
+
+void Node::TxBatch::Flush()
+{
+    if (m_pTimer)
+        m_pTimer->cancel();
+
+    std::vector<Entry> v;
+    v.swap(m_vPending);
+
+    Node& n = get_ParentObj();
+
+    // drop the txs that are already known
+    std::vector<Transaction::KeyType> vKeys;
+    std::set<Transaction::KeyType> setKeys;
+    size_t nCount = 0;
+
+    for (size_t i = 0; i < v.size(); i++)
+    {
+        Entry& e = v[i];
+        n.DeleteStemByKernels(*e.m_pTx);
+
+        TxPool::Fluff::Element::Tx key;
+        e.m_pTx->get_Key(key.m_Key);
+
+        if ((n.m_TxPool.m_setTxs.end() != n.m_TxPool.m_setTxs.find(key)) || !setKeys.insert(key.m_Key).second)
+            continue;
+
+        n.m_Wtx.Delete(key.m_Key);
+
+        vKeys.push_back(key.m_Key);
+        if (nCount != i)
+            v[nCount] = std::move(e);
+        nCount++;
+    }
+
+    if (!nCount)
+        return;
+
+    std::vector<const Transaction*> vTx(nCount);
+    std::vector<Transaction::Context> vCtx(nCount);
+    std::vector<uint8_t> vValid(nCount);
+
+    for (size_t i = 0; i < nCount; i++)
+        vTx[i] = v[i].m_pTx.get();
+
+    n.m_Processor.m_Verifier.ValidateTxs(&vTx.front(), &vCtx.front(), &vValid.front(), static_cast<uint32_t>(nCount));
+
+    for (size_t i = 0; i < nCount; i++)
+    {
+        bool bValid =
+            vValid[i] &&
+            vCtx[i].IsValidTransaction() &&
+            n.m_Processor.ValidateTxContext(*vTx[i]);
+
+        n.OnTransactionFluffValidated(std::move(v[i].m_pTx), vKeys[i], vCtx[i], bValid, v[i].m_pPeer);
+    }
+}
+
 void Node::Dandelion::OnTimedOut(Element& x)
 {
     if (x.m_bAggregating)
     {
-        get_ParentObj().AddDummyOutputs(*x.m_pValue);
-        get_ParentObj().OnTransactionAggregated(x);
+        Merge::Ptr pMerge(new Merge);
+        get_ParentObj().AddDummyOutputs(*pMerge, x.m_pValue->m_vOutputs.size());
+
+        if (pMerge->m_vDummies.empty())
+        {
+            DeleteAggr(x);
+            get_ParentObj().OnTransactionAggregated(x);
+        }
+        else
+        {
+            pMerge->m_bFinal = true;
+            Freeze(*pMerge, x);
+            Push(std::move(pMerge));
+        }
     } else
         get_ParentObj().OnTransactionFluff(std::move(x.m_pValue), NULL, &x);
 }
@@ -2747,6 +4135,25 @@ void Node::Peer::OnMsg(proto::MacroblockGet&& msg)
     Send(msgOut);
 }
 
+bool Node::Peer::ReadUtxoEvent(proto::UtxoEvent& res, const NodeDB::WalkerEvent& wlk)
+{
+    typedef NodeProcessor::UtxoEvent UE;
+
+    if (wlk.m_Body.n < sizeof(UE::Value) || (wlk.m_Key.n != sizeof(ECC::Point)))
+        return false; // although shouldn't happen
+    const UE::Value& evt = *reinterpret_cast<const UE::Value*>(wlk.m_Body.p);
+
+    res.m_Height = wlk.m_Height;
+    res.m_Kidv = evt.m_Kidv;
+    evt.m_Maturity.Export(res.m_Maturity);
+
+    res.m_Commitment = *reinterpret_cast<const ECC::Point*>(wlk.m_Key.p);
+    res.m_AssetID = evt.m_AssetID;
+    res.m_Added = evt.m_Added;
+
+    return true;
+}
+
 void Node::Peer::OnMsg(proto::GetUtxoEvents&& msg)
 {
     proto::UtxoEvents msgOut;
@@ -2759,25 +4166,12 @@ void Node::Peer::OnMsg(proto::GetUtxoEvents&& msg)
         Height hLast = 0;
         for (db.EnumEvents(wlk, msg.m_HeightMin); wlk.MoveNext(); hLast = wlk.m_Height)
         {
-            typedef NodeProcessor::UtxoEvent UE;
-
             if ((msgOut.m_Events.size() >= proto::UtxoEvent::s_Max) && (wlk.m_Height != hLast))
                 break;
 
-            if (wlk.m_Body.n < sizeof(UE::Value) || (wlk.m_Key.n != sizeof(ECC::Point)))
-                continue; // although shouldn't happen
-            const UE::Value& evt = *reinterpret_cast<const UE::Value*>(wlk.m_Body.p);
-
             msgOut.m_Events.emplace_back();
-            proto::UtxoEvent& res = msgOut.m_Events.back();
-
-            res.m_Height = wlk.m_Height;
-            res.m_Kidv = evt.m_Kidv;
-            evt.m_Maturity.Export(res.m_Maturity);
-
-            res.m_Commitment = *reinterpret_cast<const ECC::Point*>(wlk.m_Key.p);
-            res.m_AssetID = evt.m_AssetID;
-            res.m_Added = evt.m_Added;
+            if (!ReadUtxoEvent(msgOut.m_Events.back(), wlk))
+                msgOut.m_Events.pop_back();
         }
     }
     else
@@ -2786,6 +4180,77 @@ void Node::Peer::OnMsg(proto::GetUtxoEvents&& msg)
     Send(msgOut);
 }
 
+void Node::Peer::OnMsg(proto::UtxoEventsSubscribe&& msg)
+{
+    if (!(Flags::Owner & m_Flags))
+    {
+        LOG_WARNING() << "Peer " << m_RemoteAddr << " Unauthorized Utxo events subscription.";
+        return;
+    }
+
+    // the packs of the previous subscription won't be acknowledged
+    m_UtxoEvents.m_ID = msg.m_ID;
+    m_UtxoEvents.m_InFlight = 0;
+    m_UtxoEvents.m_Window = std::min(msg.m_Window, proto::UtxoEvent::s_MaxWindow);
+    m_UtxoEvents.m_hNext = m_UtxoEvents.m_Window ? msg.m_HeightMin : MaxHeight;
+
+    SendUtxoEvents();
+}
+
+void Node::Peer::OnMsg(proto::UtxoEventsAck&& msg)
+{
+    if (!m_UtxoEvents.m_InFlight)
+        ThrowUnexpected();
+
+    m_UtxoEvents.m_InFlight--;
+    SendUtxoEvents();
+}
+
+void Node::Peer::SendUtxoEvents()
+{
+    // Each pack covers a contiguous range of heights, up to the current tip. Events of the same height are never split
+    // between packs. Empty packs are sent as well, they let the owner know up to which height it's synced.
+    Height hTip = m_This.m_Processor.m_Cursor.m_ID.m_Height;
+    if (hTip < Rules::HeightGenesis)
+        return;
+
+    NodeDB& db = m_This.m_Processor.get_DB();
+    std::vector<proto::UtxoEvent> vEvents;
+
+    while ((m_UtxoEvents.m_InFlight < m_UtxoEvents.m_Window) && (m_UtxoEvents.m_hNext <= hTip))
+    {
+        proto::UtxoEventsPack msg;
+        msg.m_ID = m_UtxoEvents.m_ID;
+        msg.m_HeightMin = m_UtxoEvents.m_hNext;
+        msg.m_HeightMax = hTip;
+
+        vEvents.clear();
+
+        NodeDB::WalkerEvent wlk(db);
+        for (db.EnumEvents(wlk, msg.m_HeightMin); wlk.MoveNext(); )
+        {
+            if (wlk.m_Height > hTip)
+                break;
+
+            if ((vEvents.size() >= proto::UtxoEvent::s_MaxPack) && (wlk.m_Height != vEvents.back().m_Height))
+            {
+                msg.m_HeightMax = wlk.m_Height - 1;
+                break;
+            }
+
+            vEvents.emplace_back();
+            if (!ReadUtxoEvent(vEvents.back(), wlk))
+                vEvents.pop_back();
+        }
+
+        proto::UtxoEvent::Encode(msg.m_Events, vEvents, msg.m_HeightMin);
+        Send(msg);
+
+        m_UtxoEvents.m_hNext = msg.m_HeightMax + 1;
+        m_UtxoEvents.m_InFlight++;
+    }
+}
+
 void Node::Peer::OnMsg(proto::BlockFinalization&& msg)
 {
     if (!(Flags::Owner & m_Flags) ||
@@ -2890,8 +4355,11 @@ void Node::Miner::Initialize(IExternalPOW* externalPOW)
     m_pEvtMined = io::AsyncEvent::create(io::Reactor::get_Current(), [this]() { OnMined(); });
 
     if (cfg.m_MiningThreads) {
-        m_vThreads.resize(cfg.m_MiningThreads);
-        for (uint32_t i = 0; i < cfg.m_MiningThreads; i++) {
+        // in the cooperative mode the solver spawns its own threads
+        uint32_t nThreads = cfg.m_MiningCooperative ? 1 : cfg.m_MiningThreads;
+
+        m_vThreads.resize(nThreads);
+        for (uint32_t i = 0; i < nThreads; i++) {
             PerThread &pt = m_vThreads[i];
             pt.m_pReactor = io::Reactor::create();
             pt.m_pEvt = io::AsyncEvent::create(*pt.m_pReactor, [this, i]() { OnRefresh(i); });
@@ -2994,11 +4462,23 @@ void Node::Miner::OnRefresh(uint32_t iIdx)
         {
             try
             {
+                const Config& cfg = get_ParentObj().m_Cfg;
+                bool bSolved;
+
+                if (cfg.m_MiningCooperative)
+                {
+                    Merkle::Hash hv;
+                    s.get_HashForPoW(hv);
+                    bSolved = s.m_PoW.SolveMT(hv.m_pData, hv.nBytes, cfg.m_MiningThreads, fnCancel);
+                }
+                else
 #if defined(BEAM_USE_GPU)
-                if (!s.GeneratePoW(fnCancel, get_ParentObj().m_Cfg.m_UseGpu))
+                    bSolved = s.GeneratePoW(fnCancel, cfg.m_UseGpu);
 #else
-                if (!s.GeneratePoW(fnCancel))
+                    bSolved = s.GeneratePoW(fnCancel);
 #endif
+
+                if (!bSolved)
                     continue;
             }
             catch (const std::exception& ex)
@@ -3083,10 +4563,16 @@ bool Node::Miner::Restart()
         keys.m_pMiner ? *keys.m_pMiner : *keys.m_pGeneric,
         keys.m_pOwner ? *keys.m_pOwner : *keys.m_pGeneric);
 
+    bool bRes;
     if (m_pFinalizer)
+    {
         bc.m_Mode = NodeProcessor::BlockContext::Mode::Assemble;
+        m_Template.Reset();
 
-    bool bRes = get_ParentObj().m_Processor.GenerateNewBlock(bc);
+        bRes = get_ParentObj().m_Processor.GenerateNewBlock(bc);
+    }
+    else
+        bRes = get_ParentObj().m_Processor.GenerateNewBlock(bc, m_Template);
 
     if (!bRes)
     {
@@ -3234,6 +4720,8 @@ void Node::Miner::OnMined()
     }
     assert(NodeProcessor::DataStatus::Accepted == eStatus);
 
+    get_ParentObj().m_Compact.OnBlock(id, pTask->m_BodyP, pTask->m_BodyE);
+
     eStatus = get_ParentObj().m_Processor.OnBlock(id, pTask->m_BodyP, pTask->m_BodyE, get_ParentObj().m_MyPublicID); // will likely trigger OnNewState(), and spread this block to the network
     assert(NodeProcessor::DataStatus::Accepted == eStatus);
 
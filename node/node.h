@@ -44,6 +44,8 @@ struct Node
 
 		std::string m_sPathLocal;
 		NodeProcessor::Horizon m_Horizon;
+		NodeProcessor::UtxoSnapshot m_UtxoSnapshot;
+		bool m_BodyStore = false; // keep new block bodies in the append-only segment files next to the DB
 
 #if defined(BEAM_USE_GPU)
 		bool m_UseGpu;
@@ -61,18 +63,29 @@ struct Node
 			uint32_t m_BbsMessageTimeout_s	= 3600 * 24; // 1 day
 			uint32_t m_BbsMessageMaxAhead_s	= 3600 * 2; // 2 hours
 			uint32_t m_BbsCleanupPeriod_ms = 3600 * 1000; // 1 hour
+			uint32_t m_TxBatch_ms = 0; // fluff txs received within this window are verified in a single batch, at the cost of up to this latency. 0 - verify each immediately
+			uint32_t m_LaggingMin_ms = 2000; // a request takes much longer than the peer's measured speed suggests - its work is re-assigned. But not earlier than this
 		} m_Timeout;
 
 		uint32_t m_MaxConcurrentBlocksRequest = 5;
+		bool m_CompactBlocks = true; // request new tip blocks as short IDs, and rebuild them from the tx pool
+		bool m_BodyPacks = true; // request and serve consecutive blocks in packs. If disabled - behaves like a node that doesn't support them
 		uint32_t m_BbsIdealChannelPopulation = 100;
 		uint32_t m_MaxPoolTransactions = 100 * 1000;
+		uint32_t m_TxBatchMax = 100; // batch is verified immediately once it reaches this size
 		uint32_t m_MiningThreads = 0; // by default disabled
+		bool m_MiningCooperative = false; // if set - a single nonce is solved by all the mining threads together, rather than each its own
 
-		// Number of verification threads for CPU-hungry cryptography. Currently used for block validation only.
+		// Number of verification threads for CPU-hungry cryptography. Used for block and batched tx validation.
 		// 0: single threaded
 		// negative: number of cores minus number of mining threads.
 		int m_VerificationThreads = 0;
 
+		// Number of background threads for context-free verification of the received blocks, off the reactor thread.
+		// Several blocks may be verified concurrently, before they're applied (in order) on the reactor thread.
+		// 0: disabled, blocks are verified when applied
+		uint32_t m_BlockValidationThreads = 0;
+
 		struct HistoryCompression
 		{
 			std::string m_sPathOutput;
@@ -117,6 +130,9 @@ struct Node
 			uint32_t m_DummyLifetimeLo = 720;
 			uint32_t m_DummyLifetimeHi = 1440 * 7; // set to 0 to disable
 
+			// CPU budget for merging and dummy outputs creation, done off the reactor thread. Set to 0 to do this inline
+			uint32_t m_AggregationThreads = 1;
+
 		} m_Dandelion;
 
 		INodeObserver* m_Observer = nullptr;
@@ -145,17 +161,86 @@ struct Node
 
 	NodeProcessor& get_Processor() { return m_Processor; } // for tests only!
 
+	struct DandelionStats
+	{
+		uint64_t m_Aggregated = 0; // txs that completed the aggregation phase
+		uint64_t m_Depth = 0; // total num of original txs in them
+		uint32_t m_DepthMax = 0;
+
+		uint64_t m_Fluffed = 0;
+		uint64_t m_TimeToFluff_ms = 0; // total, since the earliest original tx arrived
+		uint32_t m_TimeToFluffMax_ms = 0;
+
+		uint64_t m_MergesAborted = 0; // elements were deleted or became invalid meanwhile
+	};
+
+	const DandelionStats& get_DandelionStats() const { return m_Dandelion.m_Stats; }
+
+	struct CompactStats
+	{
+		uint64_t m_Received = 0; // compact bodies received
+		uint64_t m_Reconstructed = 0; // rebuilt and matched the checksum
+		uint64_t m_MissingRounds = 0; // needed an extra round-trip for the missing elements
+		uint64_t m_ElementsMissing = 0;
+		uint64_t m_Fallback = 0; // checksum mismatch, the full body was requested
+	};
+
+	const CompactStats& get_CompactStats() const { return m_Compact.m_Stats; }
+
+	struct BodyStats
+	{
+		uint64_t m_Packs = 0; // body packs received
+		uint64_t m_PackBlocks = 0; // total blocks in them
+		uint64_t m_Single = 0; // full bodies received one-by-one
+	};
+
+	const BodyStats& get_BodyStats() const { return m_BodyStats; }
+
+	struct PeerStats
+	{
+		io::Address m_Addr;
+		uint32_t m_Rtt_ms; // 0 if not measured yet
+		uint32_t m_BytesPerSec; // bodies download rate, 0 if not measured yet
+		uint32_t m_Samples;
+		uint32_t m_Window; // max blocks requested concurrently
+		uint32_t m_Tasks; // currently in progress
+		bool m_Lagging;
+	};
+
+	void get_PeerStats(std::vector<PeerStats>&) const;
+
+	// Per-peer estimation, based on completed requests. Used to size the in-flight blocks window, and to detect lagging requests
+	struct PeerPerf
+	{
+		uint32_t m_Rtt_ms = 0; // smoothed, 0 if not measured yet
+		uint32_t m_BytesPerSec = 0; // smoothed, 0 if not measured yet
+		uint32_t m_BlockSize = 0; // smoothed
+		uint32_t m_Samples = 0;
+
+		// dt_ms - since the request was sent.
+		// dtPipe_ms - since the previous response was received, if it arrived after this request was sent (i.e. the request was pipelined), otherwise 0.
+		// nBlocks == 0 for headers
+		void OnSample(uint32_t dt_ms, uint32_t dtPipe_ms, size_t nSize, uint32_t nBlocks);
+
+		uint32_t get_Expected_ms(uint32_t nBlocks) const; // nBlocks == 0 for headers. 0 if not enough data
+		uint32_t get_Lagging_ms(uint32_t nBlocks, uint32_t timeout_ms, const Config::Timeout&) const; // 0 if the lagging can't be detected before the timeout
+		uint32_t get_BlocksWindow(uint32_t nMax) const;
+	};
+
 private:
 
 	struct Processor
 		:public NodeProcessor
 	{
 		// NodeProcessor
-		void RequestData(const Block::SystemState::ID&, bool bBlock, const PeerID* pPreferredPeer) override;
+		void RequestData(const Block::SystemState::ID&, bool bBlock, const PeerID* pPreferredPeer, const NodeDB::StateID& sidTrg) override;
 		void OnPeerInsane(const PeerID&) override;
 		void OnNewState() override;
 		void OnRolledBack() override;
 		bool VerifyBlock(const Block::BodyBase&, TxBase::IReader&&, const HeightRange&) override;
+		void VerifyPoW(const Block::SystemState::Full*, uint8_t* pValid, uint32_t nCount) override;
+		void UpdateUtxoHash() override;
+		void RecognizeOutputs(UtxoRecognizer&) override;
 		void AdjustFossilEnd(Height&) override;
 		void OnStateData() override;
 		void OnBlockData() override;
@@ -163,6 +248,7 @@ private:
 		bool OpenMacroblock(Block::BodyBase::RW&, const NodeDB::StateID&) override;
 		void OnModified() override;
 		bool EnumViewerKeys(IKeyWalker&) override;
+		bool VerifyBlockAsync(uint64_t rowid, Height, const Blob& bodyP, const Blob& bodyE) override;
 
 		void ReportProgress();
 		void ReportNewState();
@@ -171,10 +257,36 @@ private:
 		{
 			typedef ECC::InnerProduct::BatchContextEx<100> MyBatch; // seems to be ok, for larger batches difference is marginal
 
+			struct TaskType {
+				enum Enum {
+					Tx, // tx or block, split between the verifiers
+					Txs, // transactions batch
+					PoW, // headers
+					UtxoHash, // UTXO tree rehash
+					Recognize, // outputs recognition
+				};
+			};
+
+			TaskType::Enum m_eTask; // only the parameters of the current task type are set
+
 			const TxBase* m_pTx;
 			TxBase::IReader* m_pR;
 			TxBase::Context* m_pCtx;
 
+			const Block::SystemState::Full* m_pStates;
+			uint8_t* m_pStatesValid;
+			uint32_t m_nStates;
+
+			RadixHashTree::ParallelHash* m_pUtxoHash;
+			UtxoTree* m_pUtxoTree;
+
+			const Transaction* const* m_ppTxs;
+			Transaction::Context* m_pTxsCtx;
+			uint8_t* m_pTxsValid;
+			uint32_t m_nTxs;
+
+			UtxoRecognizer* m_pRecognizer;
+
 			bool m_bFail;
 			uint32_t m_iTask;
 			uint32_t m_Remaining;
@@ -187,11 +299,49 @@ private:
 			std::unique_ptr<MyBatch> m_pBc;
 
 			bool ValidateAndSummarize(TxBase::Context&, const TxBase&, TxBase::IReader&&);
+			void VerifyPoW(const Block::SystemState::Full*, uint8_t* pValid, uint32_t nCount);
+			void UpdateUtxoHash(UtxoTree&);
+			void ValidateTxs(const Transaction* const*, Transaction::Context*, uint8_t* pValid, uint32_t nCount); // bisects on failure
+			bool ValidateTxsBatch(const Transaction* const*, Transaction::Context*, uint8_t* pValid, uint32_t nCount);
+			void RecognizeOutputs(UtxoRecognizer&);
+			MyBatch& ResetBatch();
+			void RunTask(std::unique_lock<std::mutex>&, uint32_t nThreads);
 			void Thread(uint32_t);
 
 			IMPLEMENT_GET_PARENT_OBJ(Processor, m_Verifier)
 		} m_Verifier;
 
+		struct BlockValidator
+		{
+			struct Task
+			{
+				typedef std::unique_ptr<Task> Ptr;
+
+				uint64_t m_Row;
+				Height m_Height;
+				ByteBuffer m_BodyP;
+				ByteBuffer m_BodyE;
+				bool m_bValid;
+			};
+
+			std::mutex m_Mutex;
+			std::condition_variable m_NewTask;
+			std::deque<Task::Ptr> m_queIn;
+			std::deque<Task::Ptr> m_queOut;
+			std::vector<std::thread> m_vThreads;
+			bool m_bStop = false;
+			io::AsyncEvent::Ptr m_pEvtDone;
+
+			void Push(Task::Ptr&&, uint32_t nThreads);
+			void Stop();
+			void Thread();
+			void OnDone();
+
+			~BlockValidator() { Stop(); }
+
+			IMPLEMENT_GET_PARENT_OBJ(Processor, m_BlockValidator)
+		} m_BlockValidator;
+
 		Block::ChainWorkProof m_Cwp; // cached
 		bool BuildCwp();
 
@@ -229,6 +379,10 @@ private:
 		bool m_bPack;
 		bool m_bRelevant;
 		Peer* m_pOwner;
+		uint32_t m_Sent_ms; // when the request was sent
+
+		NodeDB::StateID m_sidTrg; // for blocks: the highest block of the same branch, that is needed too
+		NodeDB::StateID m_sidPack; // for blocks pack: the top of the requested range
 
 		bool operator < (const Task& t) const { return (m_Key < t.m_Key); }
 	};
@@ -237,13 +391,48 @@ private:
 	typedef boost::intrusive::multiset<Task> TaskSet;
 
 	uint32_t m_nTasksPackHdr = 0;
-	uint32_t m_nTasksPackBody = 0;
+	BodyStats m_BodyStats;
 
 	TaskList m_lstTasksUnassigned;
 	TaskSet m_setTasks;
 
 	uint64_t m_LastDummyID = 0;
 
+	struct Compact
+	{
+		// Block elements are referenced by short IDs salted by the block hash (see TxPool::Fluff), and looked-up in the pool. Ambiguous ones are requested.
+		// Other collisions are harmless: the reconstructed body is verified against the checksum of the original, and on mismatch the full body is requested.
+		static void get_Checksum(Merkle::Hash&, const Blob& bodyP, const Blob& bodyE);
+
+		// The elements of the recent tip blocks which were missing in our pool when we got them (by unsalted IDs). They're prefilled when the block is relayed.
+		struct Entry
+		{
+			Block::SystemState::ID m_ID;
+			bool m_bAll; // our pool was empty, prefill everything
+			std::set<uint64_t> m_setPrefill;
+		};
+
+		static const size_t s_Entries = 16;
+		std::deque<Entry> m_lstEntries;
+
+		void OnBlock(const Block::SystemState::ID&, const Blob& bodyP, const Blob& bodyE); // must be called before the block is processed
+		const Entry* Find(const Block::SystemState::ID&) const;
+
+		// a block being reconstructed by the peer
+		struct Pending
+		{
+			bool m_bRcvd = false;
+			Block::Body m_Body; // missing elements are NULL
+			Merkle::Hash m_Checksum;
+			std::vector<uint32_t> m_vMissingOutputs;
+			std::vector<uint32_t> m_vMissingKernels;
+		};
+
+		CompactStats m_Stats;
+
+		IMPLEMENT_GET_PARENT_OBJ(Node, m_Compact)
+	} m_Compact;
+
 	struct FirstTimeSync
 	{
 		// there are 2 phases:
@@ -325,6 +514,24 @@ private:
 	struct Dandelion
 		:public TxPool::Stem
 	{
+		DandelionStats m_Stats;
+
+		// merges are executed by the worker threads, and applied on the reactor thread
+		std::mutex m_Mutex;
+		std::condition_variable m_NewTask;
+		std::deque<Merge::Ptr> m_queIn;
+		std::deque<Merge::Ptr> m_queOut;
+		std::vector<std::thread> m_vThreads;
+		bool m_bStop = false;
+		io::AsyncEvent::Ptr m_pEvtDone;
+
+		void Push(Merge::Ptr&&);
+		void Stop();
+		void Thread();
+		void OnDone();
+
+		~Dandelion() { Stop(); }
+
 		// TxPool::Stem
 		virtual bool ValidateTxContext(const Transaction&) override;
 		virtual void OnTimedOut(Element&) override;
@@ -335,9 +542,32 @@ private:
 	bool OnTransactionStem(Transaction::Ptr&&, const Peer*);
 	void OnTransactionAggregated(Dandelion::Element&);
 	void PerformAggregation(Dandelion::Element&);
+	void OnMerged(Dandelion::Merge&);
 	void AddDummyInputs(Transaction&);
-	void AddDummyOutputs(Transaction&);
+	void AddDummyOutputs(Dandelion::Merge&, size_t nOutputs);
+	void DeleteDummyOutputs(Dandelion::Merge&);
 	bool OnTransactionFluff(Transaction::Ptr&&, const Peer*, Dandelion::Element*);
+	bool OnTransactionFluffValidated(Transaction::Ptr&&, const Transaction::KeyType&, Transaction::Context&, bool bValid, const Peer*);
+	void DeleteStemByKernels(const Transaction&);
+
+	struct TxBatch
+	{
+		// fluff transactions pending batch verification
+		struct Entry
+		{
+			Transaction::Ptr m_pTx;
+			const Peer* m_pPeer;
+		};
+
+		std::vector<Entry> m_vPending;
+		io::Timer::Ptr m_pTimer;
+
+		void Add(Transaction::Ptr&&, const Peer*);
+		void Flush();
+		void OnPeerDeleted(const Peer&);
+
+		IMPLEMENT_GET_PARENT_OBJ(Node, m_TxBatch)
+	} m_TxBatch;
 
 	bool ValidateTx(Transaction::Context&, const Transaction&); // complete validation
 	void LogTx(const Transaction&, bool bValid, const Transaction::KeyType&);
@@ -429,6 +659,7 @@ private:
 			static const uint16_t DontSync		= 0x040;
 			static const uint16_t Finalizing	= 0x080;
 			static const uint16_t HasTreasury	= 0x100;
+			static const uint16_t Lagging		= 0x200; // the current request is overdue, its work was duplicated to other peers
 		};
 
 		uint16_t m_Flags;
@@ -443,6 +674,14 @@ private:
 
 		Bbs::Subscription::PeerSet m_Subscriptions;
 
+		PeerPerf m_Perf;
+		uint32_t m_LastRcv_ms; // when the last response to a task was received
+		uint32_t m_TimeoutRemaining_ms; // set while the timer waits for the lagging deadline, rather than the timeout
+
+		uint32_t get_BlocksWindow() const;
+		void OnTaskCompleted(size_t nSize, uint32_t nBlocks); // the 1st task only, before it's released
+		void OnLagging();
+
 		io::Timer::Ptr m_pTimer;
 		io::Timer::Ptr m_pTimerPeers;
 
@@ -467,8 +706,24 @@ private:
 		void OnFirstTaskDone();
 		void OnFirstTaskDone(NodeProcessor::DataStatus::Enum);
 
+		std::unique_ptr<Compact::Pending> m_pCompact; // set while the compact body of the (single) block task is in progress
+		void OnBodyCompactReady();
+		bool ReadBlock(const Block::SystemState::ID&, Block::Body&, Merkle::Hash* pChecksum);
+
 		void SendTx(Transaction::Ptr& ptx, bool bFluff);
 
+		// owner utxo events stream (see proto::UtxoEventsSubscribe). Continues live as new blocks are added
+		struct UtxoEventsStream
+		{
+			uint32_t m_ID; // as requested by the owner, echoed in the packs
+			Height m_hNext; // MaxHeight if not subscribed
+			uint32_t m_Window;
+			uint32_t m_InFlight; // packs not acknowledged yet
+		} m_UtxoEvents;
+
+		void SendUtxoEvents();
+		static bool ReadUtxoEvent(proto::UtxoEvent&, const NodeDB::WalkerEvent&);
+
 		// proto::NodeConnection
 		virtual void OnConnectedSecure() override;
 		virtual void OnDisconnect(const DisconnectReason&) override;
@@ -486,6 +741,12 @@ private:
 		virtual void OnMsg(proto::HdrPack&&) override;
 		virtual void OnMsg(proto::GetBody&&) override;
 		virtual void OnMsg(proto::Body&&) override;
+		virtual void OnMsg(proto::GetBodyPack&&) override;
+		virtual void OnMsg(proto::BodyPack&&) override;
+		virtual void OnMsg(proto::GetBodyCompact&&) override;
+		virtual void OnMsg(proto::BodyCompact&&) override;
+		virtual void OnMsg(proto::GetBodyMissing&&) override;
+		virtual void OnMsg(proto::BodyMissing&&) override;
 		virtual void OnMsg(proto::NewTransaction&&) override;
 		virtual void OnMsg(proto::HaveTransaction&&) override;
 		virtual void OnMsg(proto::GetTransaction&&) override;
@@ -508,6 +769,8 @@ private:
 		virtual void OnMsg(proto::Macroblock&&) override;
 		virtual void OnMsg(proto::ProofChainWork&&) override;
 		virtual void OnMsg(proto::GetUtxoEvents&&) override;
+		virtual void OnMsg(proto::UtxoEventsSubscribe&&) override;
+		virtual void OnMsg(proto::UtxoEventsAck&&) override;
 		virtual void OnMsg(proto::BlockFinalization&&) override;
 	};
 
@@ -601,6 +864,8 @@ private:
 		Peer* m_pFinalizer = NULL;
 		Task::Ptr m_pTaskToFinalize;
 
+		NodeProcessor::BlockTemplate m_Template; // for the soft restarts, used unless the block is finalized by the owner
+
 		std::mutex m_Mutex;
 		Task::Ptr m_pTask; // currently being-mined
 
@@ -32,11 +32,20 @@ NodeProcessor::Horizon::Horizon()
 {
 }
 
-void NodeProcessor::Initialize(const char* szPath, bool bResetCursor /* = false */)
+NodeProcessor::UtxoSnapshot::UtxoSnapshot()
+	:m_Period(100)
 {
-	m_DB.Open(szPath);
+}
+
+void NodeProcessor::Initialize(const char* szPath, bool bResetCursor /* = false */, bool bBodyStore /* = false */)
+{
+	m_DB.Open(szPath, bBodyStore);
 	m_DbTx.Start(m_DB);
 
+	m_sPathUtxoSnapshot = szPath;
+	m_sPathUtxoSnapshot += ".utxo";
+	m_hUtxoSnapshot = Rules::HeightGenesis - 1;
+
 	Merkle::Hash hv;
 	Blob blob(hv);
 
@@ -76,10 +85,13 @@ NodeProcessor::~NodeProcessor()
 	{
 		try {
 			m_DbTx.Commit();
+			OnCommitted(true);
 		} catch (std::exception& e) {
 			LOG_ERROR() << "DB Commit failed: %s" << e.what();
 		}
 	}
+
+	WaitUtxoSnapshot();
 }
 
 void NodeProcessor::CommitDB()
@@ -88,9 +100,156 @@ void NodeProcessor::CommitDB()
 	{
 		m_DbTx.Commit();
 		m_DbTx.Start(m_DB);
+
+		OnCommitted(false);
 	}
 }
 
+void NodeProcessor::OnCommitted(bool bFinal)
+{
+	// The snapshot must never be ahead of the committed DB state, hence it's written only after the commit.
+	if (!m_UtxoSnapshot.m_Period || !m_Extra.m_TreasuryHandled)
+		return;
+
+	Height h = m_Cursor.m_ID.m_Height;
+	if ((h < Rules::HeightGenesis) || (h == m_hUtxoSnapshot))
+		return;
+
+	if (!bFinal && (h > m_hUtxoSnapshot) && (h - m_hUtxoSnapshot < m_UtxoSnapshot.m_Period))
+		return;
+
+	try {
+		SaveUtxoSnapshot();
+	} catch (const std::exception& e) {
+		LOG_WARNING() << "UTXO snapshot write failed: " << e.what();
+	}
+}
+
+void NodeProcessor::SaveUtxoSnapshot()
+{
+	// Only the serialization is done here, in memory. The file is written (and flushed) by a separate thread
+	detail::SerializeOstream os;
+	{
+		uint32_t nVer = s_UtxoSnapshotVer;
+
+		yas::binary_oarchive<detail::SerializeOstream, SERIALIZE_OPTIONS> arc(os);
+		arc
+			& nVer
+			& m_Cursor.m_ID;
+
+		m_Utxos.save(arc);
+	}
+
+	WaitUtxoSnapshot(); // the previous one, if still being written
+
+	m_UtxoSnapshotThread = std::thread(&NodeProcessor::WriteUtxoSnapshot, m_sPathUtxoSnapshot, std::move(os.m_vec), m_Cursor.m_ID);
+	m_hUtxoSnapshot = m_Cursor.m_ID.m_Height;
+}
+
+void NodeProcessor::WaitUtxoSnapshot()
+{
+	if (m_UtxoSnapshotThread.joinable())
+		m_UtxoSnapshotThread.join();
+}
+
+void NodeProcessor::WriteUtxoSnapshot(const std::string& sPath, const ByteBuffer& buf, const Block::SystemState::ID& id)
+{
+	std::string sTmp = sPath + ".tmp";
+
+	try {
+		{
+			std::FStream fs;
+			fs.Open(sTmp.c_str(), false, true);
+
+			if (!buf.empty())
+				fs.write(&buf.front(), buf.size());
+			fs.Flush();
+		}
+
+#ifdef WIN32
+		bool bOk = MoveFileExW(Utf8toUtf16(sTmp.c_str()).c_str(), Utf8toUtf16(sPath.c_str()).c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else // WIN32
+		bool bOk = !rename(sTmp.c_str(), sPath.c_str());
+#endif // WIN32
+
+		if (!bOk)
+		{
+			DeleteFile(sTmp.c_str());
+			throw std::runtime_error("rename failed");
+		}
+
+		LOG_INFO() << "UTXO snapshot saved at " << id;
+	}
+	catch (const std::exception& e) {
+		// the previous snapshot (if any) remains, it's verified on load anyway
+		LOG_WARNING() << "UTXO snapshot write failed: " << e.what();
+	}
+}
+
+bool NodeProcessor::LoadUtxoSnapshot(Height& h)
+{
+	if (!m_UtxoSnapshot.m_Period || (m_Cursor.m_ID.m_Height < Rules::HeightGenesis))
+		return false;
+
+	std::FStream fs;
+	if (!fs.Open(m_sPathUtxoSnapshot.c_str(), true))
+		return false;
+
+	try {
+		yas::binary_iarchive<std::FStream, SERIALIZE_OPTIONS> arc(fs);
+
+		uint32_t nVer = 0;
+		arc & nVer;
+		if (s_UtxoSnapshotVer != nVer)
+			return false;
+
+		Block::SystemState::ID id;
+		arc & id;
+
+		// the blocks above the snapshot must still be available
+		if ((id.m_Height < Rules::HeightGenesis) || (id.m_Height > m_Cursor.m_ID.m_Height) || (id.m_Height < get_FossilHeight()))
+			return false;
+
+		NodeDB::StateID sid;
+		sid.m_Height = id.m_Height;
+		sid.m_Row = FindActiveAtStrict(id.m_Height);
+
+		Block::SystemState::Full s;
+		m_DB.get_State(sid.m_Row, s);
+
+		Block::SystemState::ID idActive;
+		s.get_ID(idActive);
+		if (idActive != id)
+			return false; // snapshot belongs to a different branch
+
+		m_Utxos.load(arc);
+
+		Merkle::Hash hvHist;
+		if (m_DB.get_Prev(sid))
+			m_DB.get_PredictedStatesHash(hvHist, sid);
+		else
+			ZeroObject(hvHist);
+
+		Merkle::Hash hv;
+		get_Definition(hv, hvHist);
+		if (s.m_Definition != hv)
+		{
+			m_Utxos.Clear();
+			return false;
+		}
+
+		h = id.m_Height;
+	}
+	catch (const std::exception&) {
+		m_Utxos.Clear();
+		return false;
+	}
+
+	m_hUtxoSnapshot = h;
+	m_InitStats.m_UtxoSnapshot = h;
+	return true;
+}
+
 void NodeProcessor::InitCursor()
 {
 	if (m_DB.get_Cursor(m_Cursor.m_Sid))
@@ -123,7 +282,11 @@ void NodeProcessor::EnumCongestions(uint32_t nMaxBlocksBacklog)
 	{
 		Block::SystemState::ID id;
 		ZeroObject(id);
-		RequestData(id, true, NULL);
+
+		NodeDB::StateID sidTrg;
+		sidTrg.SetNull();
+
+		RequestData(id, true, NULL, sidTrg);
 		return;
 	}
 
@@ -173,6 +336,11 @@ void NodeProcessor::EnumCongestions(uint32_t nMaxBlocksBacklog)
 
 		if (nBlocks)
 		{
+			// the highest block within the window that we remember
+			NodeDB::StateID sidTrg;
+			sidTrg.m_Height = sid.m_Height + std::min<Height>(nBlocks, nMaxBlocks);
+			sidTrg.m_Row = pBlockRow[(nBlocks - std::min<Height>(nBlocks, nMaxBlocks)) % nMaxBlocks];
+
 			if (!nMaxBlocksBacklog)
 				nMaxBlocksBacklog = 1;
 			else
@@ -194,7 +362,7 @@ void NodeProcessor::EnumCongestions(uint32_t nMaxBlocksBacklog)
 
 				m_DB.get_StateID(sid, id);
 
-				RequestDataInternal(id, sid.m_Row, true);
+				RequestDataInternal(id, sid.m_Row, true, sidTrg);
 			}
 		}
 		else
@@ -205,7 +373,7 @@ void NodeProcessor::EnumCongestions(uint32_t nMaxBlocksBacklog)
 			id.m_Height = s.m_Height - 1;
 			id.m_Hash = s.m_Prev;
 
-			RequestDataInternal(id, sid.m_Row, false);
+			RequestDataInternal(id, sid.m_Row, false, sid);
 		}
 	}
 	if (noRequests)
@@ -214,14 +382,14 @@ void NodeProcessor::EnumCongestions(uint32_t nMaxBlocksBacklog)
 	}
 }
 
-void NodeProcessor::RequestDataInternal(const Block::SystemState::ID& id, uint64_t row, bool bBlock)
+void NodeProcessor::RequestDataInternal(const Block::SystemState::ID& id, uint64_t row, bool bBlock, const NodeDB::StateID& sidTrg)
 {
 	if (id.m_Height >= m_Cursor.m_LoHorizon)
 	{
 		PeerID peer;
 		bool bPeer = m_DB.get_Peer(row, peer);
 
-		RequestData(id, bBlock, bPeer ? &peer : NULL);
+		RequestData(id, bBlock, bPeer ? &peer : NULL, sidTrg);
 	}
 	else
 	{
@@ -260,14 +428,26 @@ void NodeProcessor::TryGoUp()
 				break; // already at maximum (though maybe at different tip)
 		}
 
-		// Calculate the path
+		// Calculate the path, and how many blocks should be rolled back to reach the fork point
 		std::vector<uint64_t> vPath;
-		while (sidTrg.m_Row != m_Cursor.m_Sid.m_Row)
+		uint32_t nRollback = 0;
+
+		NodeDB::StateID sidCur = m_Cursor.m_Sid;
+		Difficulty::Raw wrkCur = m_Cursor.m_Full.m_ChainWork;
+
+		while (sidTrg.m_Row != sidCur.m_Row)
 		{
-			if (m_Cursor.m_Full.m_ChainWork > wrkTrg)
+			if (wrkCur > wrkTrg)
 			{
-				Rollback();
-				bDirty = true;
+				nRollback++;
+
+				if (m_DB.get_Prev(sidCur))
+					m_DB.get_ChainWork(sidCur.m_Row, wrkCur);
+				else
+				{
+					sidCur.SetNull();
+					wrkCur = Zero;
+				}
 			}
 			else
 			{
@@ -284,10 +464,33 @@ void NodeProcessor::TryGoUp()
 			}
 		}
 
+		if (nRollback)
+		{
+			// Don't leave the current branch before the new one can be applied. Resumed once verified
+			bool bPending = false;
+			for (size_t i = 0; i < vPath.size(); i++)
+				if (IsAsyncVerifyPending(vPath[i]))
+				{
+					bPending = true;
+					break;
+				}
+
+			if (bPending)
+				break;
+
+			for (; nRollback; nRollback--)
+				Rollback();
+
+			bDirty = true;
+		}
+
 		bool bPathOk = true;
 
 		for (size_t i = vPath.size(); i--; )
 		{
+			if (IsAsyncVerifyPending(vPath[i]))
+				break; // resume once verified
+
 			bDirty = true;
 			if (!GoForward(vPath[i]))
 			{
@@ -330,8 +533,11 @@ void NodeProcessor::PruneOld()
 
 			do
 			{
+				uint64_t rowDel = rowid;
 				if (!m_DB.DeleteState(rowid, rowid))
 					break;
+
+				m_mapAsyncVerdicts.erase(rowDel); // the block was never applied. The row may be reused by another state
 			} while (rowid);
 		}
 	}
@@ -358,6 +564,7 @@ void NodeProcessor::PruneOld()
 
 				m_DB.DelStateBlockAll(ws.m_Sid.m_Row);
 				m_DB.set_Peer(ws.m_Sid.m_Row, NULL);
+				m_mapAsyncVerdicts.erase(ws.m_Sid.m_Row);
 			}
 
 			m_DB.ParamSet(NodeDB::ParamID::FossilHeight, &hFossil, NULL);
@@ -372,6 +579,7 @@ Height NodeProcessor::get_FossilHeight()
 
 void NodeProcessor::get_Definition(Merkle::Hash& hv, const Merkle::Hash& hvHist)
 {
+	UpdateUtxoHash();
 	m_Utxos.get_Hash(hv);
 	Merkle::Interpret(hv, hvHist, false);
 }
@@ -420,17 +628,30 @@ struct NodeProcessor::RollbackData
 	}
 };
 
-void NodeProcessor::ReadBody(Block::Body& res, const ByteBuffer& bbP, const ByteBuffer& bbE)
+void NodeProcessor::ReadBody(Block::Body& res, const Blob& bodyP, const Blob& bodyE)
 {
 	Deserializer der;
-	der.reset(bbP);
+	der.reset(bodyP.p, bodyP.n);
 	der & Cast::Down<Block::BodyBase>(res);
 	der & Cast::Down<TxVectors::Perishable>(res);
 
-	der.reset(bbE);
+	der.reset(bodyE.p, bodyE.n);
 	der & Cast::Down<TxVectors::Eternal>(res);
 }
 
+void NodeProcessor::ReadBody(Block::Body& res, uint64_t rowid)
+{
+	Blob bodyP, bodyE;
+	if (m_DB.GetStateBlockMapped(rowid, bodyP, bodyE))
+		ReadBody(res, bodyP, bodyE);
+	else
+	{
+		ByteBuffer bbP, bbE;
+		m_DB.GetStateBlock(rowid, &bbP, &bbE, NULL);
+		ReadBody(res, bbP, bbE);
+	}
+}
+
 uint64_t NodeProcessor::ProcessKrnMmr(Merkle::Mmr& mmr, TxBase::IReader&& r, Height h, const Merkle::Hash& idKrn, TxKernel::Ptr* ppRes)
 {
 	uint64_t iRet = uint64_t (-1);
@@ -582,9 +803,8 @@ bool NodeProcessor::HandleTreasury(const Blob& blob, bool bFirstTime)
 
 bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 {
-	ByteBuffer bbP, bbE;
 	RollbackData rbData;
-	m_DB.GetStateBlock(sid.m_Row, &bbP, &bbE, &rbData.m_Buf);
+	m_DB.GetStateBlock(sid.m_Row, NULL, NULL, &rbData.m_Buf);
 
 	Block::SystemState::Full s;
 	m_DB.get_State(sid.m_Row, s); // need it for logging anyway
@@ -594,7 +814,7 @@ bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 
 	Block::Body block;
 	try {
-		ReadBody(block, bbP, bbE);
+		ReadBody(block, sid.m_Row);
 	}
 	catch (const std::exception&) {
 		LOG_WARNING() << id << " Block deserialization failed";
@@ -654,7 +874,7 @@ bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 				return false;
 			}
 
-			if (!VerifyBlock(block, block.get_Reader(), sid.m_Height))
+			if (!VerifyBlockCached(sid.m_Row, block, sid.m_Height))
 			{
 				LOG_WARNING() << id << " context-free verification failed";
 				return false;
@@ -703,6 +923,8 @@ bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 
 	if (bOk)
 	{
+		m_PoolSync.OnBlock(block.get_Reader(), bFwd);
+
 		for (size_t i = 0; i < vKrnID.size(); i++)
 		{
 			const Merkle::Hash& hv = vKrnID[i];
@@ -753,60 +975,109 @@ void NodeProcessor::RecognizeUtxos(TxBase::IReader&& r, Height hMax)
 		}
 	}
 
-	for (; r.m_pUtxoOut; r.NextUtxoOut())
+	if (!r.m_pUtxoOut)
+		return;
+
+	UtxoRecognizer rec;
+
+	struct Walker :public IKeyWalker
 	{
-		const Output& x = *r.m_pUtxoOut;
+		std::vector<Key::IPKdf*>& m_vKeys;
+		Walker(std::vector<Key::IPKdf*>& v) :m_vKeys(v) {}
 
-		struct Walker :public IKeyWalker
+		virtual bool OnKey(Key::IPKdf& tag, Key::Index) override
 		{
-			const Output& m_Output;
-			UtxoEvent::Value m_Value;
+			m_vKeys.push_back(&tag);
+			return true; // continue enumeration
+		}
+	};
 
-			Walker(const Output& x) :m_Output(x) {}
+	Walker w(rec.m_vKeys);
+	EnumViewerKeys(w);
 
-			virtual bool OnKey(Key::IPKdf& tag, Key::Index) override
-			{
-				Key::IDV kidv;
-				if (!m_Output.Recover(tag, kidv))
-					return true; // continue enumeration
+	if (rec.m_vKeys.empty())
+		return;
 
-				m_Value.m_Kidv = kidv;
-				return false; // stop
-			}
-		};
+	for (; r.m_pUtxoOut; r.NextUtxoOut())
+		if (rec.Add(*r.m_pUtxoOut))
+			RecognizeUtxosBatch(rec, hMax);
 
-		Walker w(x);
-		w.m_Value.m_Added = 1;
-		if (!EnumViewerKeys(w))
-		{
-			// filter-out dummies
-			if (w.m_Value.m_Kidv.m_Value == Zero)
-			{
-				uint32_t nType;
-				w.m_Value.m_Kidv.m_Type.Export(nType);
-				if (Key::Type::Decoy == nType)
-					continue;
-			}
+	RecognizeUtxosBatch(rec, hMax);
+}
 
-			// bingo!
-			Height h;
-			if (x.m_Maturity)
-			{
-				w.m_Value.m_Maturity = x.m_Maturity;
-				// try to reverse-engineer the original block from the maturity
-				h = x.m_Maturity - x.get_MinMaturity(0);
-			}
-			else
-			{
-				h = hMax;
-				w.m_Value.m_Maturity = x.get_MinMaturity(h);
-			}
+void NodeProcessor::RecognizeUtxosBatch(UtxoRecognizer& rec, Height hMax)
+{
+	if (!rec.m_nCount)
+		return;
 
-			w.m_Value.m_AssetID = r.m_pUtxoOut->m_AssetID;
+	RecognizeOutputs(rec);
 
-			const UtxoEvent::Key& key = x.m_Commitment;
-			m_DB.InsertEvent(h, Blob(&w.m_Value, sizeof(w.m_Value)), Blob(&key, sizeof(key)));
+	for (uint32_t i = 0; i < rec.m_nCount; i++)
+	{
+		const UtxoRecognizer::Result& res = rec.m_vResults[i];
+		if (UtxoRecognizer::s_KeyNone == res.m_iKey)
+			continue;
+
+		const Output& x = *rec.m_vOutputs[i];
+
+		// filter-out dummies
+		if (!res.m_Kidv.m_Value && (Key::Type::Decoy == res.m_Kidv.m_Type))
+			continue;
+
+		// bingo!
+		UtxoEvent::Value evt;
+		evt.m_Kidv = res.m_Kidv;
+		evt.m_Added = 1;
+
+		Height h;
+		if (x.m_Maturity)
+		{
+			evt.m_Maturity = x.m_Maturity;
+			// try to reverse-engineer the original block from the maturity
+			h = x.m_Maturity - x.get_MinMaturity(0);
+		}
+		else
+		{
+			h = hMax;
+			evt.m_Maturity = x.get_MinMaturity(h);
 		}
+
+		evt.m_AssetID = x.m_AssetID;
+
+		const UtxoEvent::Key& key = x.m_Commitment;
+		m_DB.InsertEvent(h, Blob(&evt, sizeof(evt)), Blob(&key, sizeof(key)));
+	}
+
+	rec.m_nCount = 0;
+}
+
+bool NodeProcessor::UtxoRecognizer::Add(const Output& x)
+{
+	if (m_vOutputs.size() == m_nCount)
+	{
+		m_vOutputs.emplace_back(new Output);
+		m_vResults.emplace_back();
+	}
+
+	*m_vOutputs[m_nCount++] = x;
+	return m_nCount >= s_BatchMax;
+}
+
+void NodeProcessor::UtxoRecognizer::Execute(uint32_t iThread, uint32_t nThreads)
+{
+	ECC::Mode::Scope scope(m_bFast ? ECC::Mode::Fast : ECC::Mode::Secure); // the mode is per-thread
+
+	for (uint32_t i = iThread; i < m_nCount; i += nThreads)
+	{
+		Result& res = m_vResults[i];
+		res.m_iKey = s_KeyNone;
+
+		for (uint32_t iKey = 0; iKey < m_vKeys.size(); iKey++)
+			if (m_vOutputs[i]->Recover(*m_vKeys[iKey], res.m_Kidv))
+			{
+				res.m_iKey = iKey;
+				break;
+			}
 	}
 }
 
@@ -1000,6 +1271,7 @@ bool NodeProcessor::GoForward(uint64_t row)
 
 	m_DB.DelStateBlockAll(row);
 	m_DB.SetStateNotFunctional(row);
+	m_mapAsyncVerdicts.erase(row);
 
 	PeerID peer;
 	if (m_DB.get_Peer(row, peer))
@@ -1023,11 +1295,11 @@ void NodeProcessor::Rollback()
 	OnRolledBack();
 }
 
-NodeProcessor::DataStatus::Enum NodeProcessor::OnStateInternal(const Block::SystemState::Full& s, Block::SystemState::ID& id)
+NodeProcessor::DataStatus::Enum NodeProcessor::OnStateInternal(const Block::SystemState::Full& s, Block::SystemState::ID& id, bool bTestPoW /* = true */)
 {
 	s.get_ID(id);
 
-	if (!s.IsValid())
+	if (!s.IsSane() || (bTestPoW && !s.IsValidPoW()))
 	{
 		LOG_WARNING() << id << " header invalid!";
 		return DataStatus::Invalid;
@@ -1070,6 +1342,92 @@ NodeProcessor::DataStatus::Enum NodeProcessor::OnState(const Block::SystemState:
 	return ret;
 }
 
+uint32_t NodeProcessor::OnStatePack(const Block::SystemState::Sequence::Prefix& prefix, const std::vector<Block::SystemState::Sequence::Element>& v, const PeerID& peer, bool& bInvalid, Block::SystemState::ID& idTop)
+{
+	bInvalid = false;
+	if (v.empty())
+		return 0;
+
+	// The elements are ordered from the most recent to the oldest, the prefix corresponds to the oldest one.
+	// Expand them into the full headers in the reverse order, so that they're inserted from the oldest, each after its parent.
+	std::vector<Block::SystemState::Full> vStates(v.size());
+
+	Block::SystemState::Full s;
+	Cast::Down<Block::SystemState::Sequence::Prefix>(s) = prefix;
+	Cast::Down<Block::SystemState::Sequence::Element>(s) = v.back();
+
+	for (size_t i = v.size(), j = 0; ; j++)
+	{
+		vStates[j] = s;
+		if (! --i)
+			break;
+
+		s.NextPrefix();
+		Cast::Down<Block::SystemState::Sequence::Element>(s) = v[i - 1];
+		s.m_ChainWork += s.m_PoW.m_Difficulty;
+	}
+
+	s.get_ID(idTop);
+
+	// all the cheap checks first, leave only the headers that need PoW verification
+	std::vector<Block::SystemState::ID> vIDs(v.size());
+	uint32_t nPending = 0;
+
+	for (size_t i = 0; i < vStates.size(); i++)
+	{
+		switch (OnStateInternal(vStates[i], vIDs[nPending], false))
+		{
+		case DataStatus::Invalid:
+			bInvalid = true;
+			break;
+
+		case DataStatus::Accepted:
+			if (nPending != i)
+				vStates[nPending] = vStates[i];
+			nPending++;
+
+		default:
+			break; // suppress warning
+		}
+	}
+
+	if (!nPending)
+		return 0;
+
+	std::vector<uint8_t> vValid(nPending);
+	VerifyPoW(&vStates.front(), &vValid.front(), nPending);
+
+	uint32_t nAccepted = 0;
+	for (uint32_t i = 0; i < nPending; i++)
+	{
+		const Block::SystemState::Full& sVal = vStates[i];
+		const Block::SystemState::ID& id = vIDs[i];
+
+		if (!vValid[i])
+		{
+			LOG_WARNING() << id << " header invalid!";
+			bInvalid = true;
+			continue;
+		}
+
+		uint64_t rowid = m_DB.InsertState(sVal);
+		m_DB.set_Peer(rowid, &peer);
+
+		LOG_INFO() << id << " Header accepted";
+		OnStateData();
+
+		nAccepted++;
+	}
+
+	return nAccepted;
+}
+
+void NodeProcessor::VerifyPoW(const Block::SystemState::Full* pS, uint8_t* pValid, uint32_t nCount)
+{
+	for (uint32_t i = 0; i < nCount; i++)
+		pValid[i] = pS[i].IsValidPoW();
+}
+
 NodeProcessor::DataStatus::Enum NodeProcessor::OnBlock(const Block::SystemState::ID& id, const Blob& bbP, const Blob& bbE, const PeerID& peer)
 {
 	size_t nSize = size_t(bbP.n) + size_t(bbE.n);
@@ -1101,6 +1459,9 @@ NodeProcessor::DataStatus::Enum NodeProcessor::OnBlock(const Block::SystemState:
 	m_DB.SetStateFunctional(rowid);
 	m_DB.set_Peer(rowid, &peer);
 
+	if (VerifyBlockAsync(rowid, id.m_Height, bbP, bbE))
+		m_mapAsyncVerdicts[rowid] = AsyncVerdict::Pending;
+
 	if (NodeDB::StateFlags::Reachable & m_DB.GetStateFlags(rowid))
 		TryGoUp();
 
@@ -1108,6 +1469,60 @@ NodeProcessor::DataStatus::Enum NodeProcessor::OnBlock(const Block::SystemState:
 	return DataStatus::Accepted;
 }
 
+bool NodeProcessor::IsAsyncVerifyPending(uint64_t row) const
+{
+	std::map<uint64_t, AsyncVerdict::Enum>::const_iterator it = m_mapAsyncVerdicts.find(row);
+	return (m_mapAsyncVerdicts.end() != it) && (AsyncVerdict::Pending == it->second);
+}
+
+void NodeProcessor::OnBlockVerified(uint64_t rowid, bool bValid)
+{
+	std::map<uint64_t, AsyncVerdict::Enum>::iterator it = m_mapAsyncVerdicts.find(rowid);
+	if (m_mapAsyncVerdicts.end() == it)
+		return; // no more relevant
+
+	it->second = bValid ? AsyncVerdict::Valid : AsyncVerdict::Invalid;
+	TryGoUp();
+}
+
+bool NodeProcessor::VerifyBlockCached(uint64_t row, const Block::Body& block, Height h)
+{
+	std::map<uint64_t, AsyncVerdict::Enum>::iterator it = m_mapAsyncVerdicts.find(row);
+	if (m_mapAsyncVerdicts.end() == it)
+		return VerifyBlock(block, block.get_Reader(), h);
+
+	assert(AsyncVerdict::Pending != it->second);
+	bool bValid = (AsyncVerdict::Valid == it->second);
+	m_mapAsyncVerdicts.erase(it);
+
+	return bValid;
+}
+
+bool NodeProcessor::VerifyBlockContextFree(const Blob& bodyP, const Blob& bodyE, Height h)
+{
+	Block::Body block;
+	try {
+		ReadBody(block, bodyP, bodyE);
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+
+	ECC::InnerProduct::BatchContextEx<100> bc;
+	bc.m_bEnableBatch = true;
+	ECC::InnerProduct::BatchContext::Scope scope(bc);
+
+	TxBase::Context ctx;
+	ctx.m_Height = h;
+	ctx.m_bBlockMode = true;
+
+	return
+		(h >= Rules::HeightGenesis) &&
+		ctx.ValidateAndSummarize(block, block.get_Reader()) &&
+		bc.Flush() &&
+		ctx.IsValidBlock(block);
+}
+
 NodeProcessor::DataStatus::Enum NodeProcessor::OnTreasury(const Blob& blob)
 {
 	if (Rules::get().TreasuryChecksum == Zero)
@@ -1308,16 +1723,78 @@ bool NodeProcessor::ValidateTxContext(const Transaction& tx)
 	return true;
 }
 
+void NodeProcessor::PoolSync::OnBlock(TxBase::IReader&& r, bool bFwd)
+{
+	if (m_bFull)
+		return;
+
+	if (!bFwd)
+	{
+		// outputs of the reverted block vanish, maturity of the remaining ones is effectively raised. Not worth tracking
+		m_bFull = true;
+		m_vSpent.clear();
+		return;
+	}
+
+	for (r.Reset(); r.m_pUtxoIn; r.NextUtxoIn())
+		m_vSpent.push_back(r.m_pUtxoIn->m_Commitment);
+
+	if (m_vSpent.size() > s_MaxSpent)
+	{
+		m_bFull = true;
+		m_vSpent.clear();
+	}
+}
+
 void NodeProcessor::DeleteOutdated(TxPool::Fluff& txp)
 {
-	for (TxPool::Fluff::ProfitSet::iterator it = txp.m_setProfit.begin(); txp.m_setProfit.end() != it; )
+	if (m_PoolSync.m_bFull || (m_PoolSync.m_vSpent.size() > txp.m_setInputs.size()))
 	{
-		TxPool::Fluff::Element& x = (it++)->get_ParentObj();
-		Transaction& tx = *x.m_pValue;
+		for (TxPool::Fluff::ProfitSet::iterator it = txp.m_setProfit.begin(); txp.m_setProfit.end() != it; )
+		{
+			TxPool::Fluff::Element& x = (it++)->get_ParentObj();
+			Transaction& tx = *x.m_pValue;
+
+			if (!ValidateTxContext(tx))
+				txp.Delete(x);
+		}
+	}
+	else
+	{
+		// Moving forward only: kernel height locks may lapse, and the inputs may be spent by the new blocks.
+		// Other txs remain valid (no UTXO vanished except those spent, maturity only grows).
+		txp.DeleteOutOfBound(m_Cursor.m_Sid.m_Height + 1);
 
-		if (!ValidateTxContext(tx))
-			txp.Delete(x);
+		std::set<TxPool::Fluff::Element*> setConflicting;
+		for (size_t i = 0; i < m_PoolSync.m_vSpent.size(); i++)
+			txp.EnumSpending(m_PoolSync.m_vSpent[i], [&setConflicting](TxPool::Fluff::Element& x) { setConflicting.insert(&x); });
+
+		// The same UTXO may exist in multiple instances, hence revalidate rather than delete blindly
+		for (std::set<TxPool::Fluff::Element*>::iterator it = setConflicting.begin(); setConflicting.end() != it; it++)
+		{
+			TxPool::Fluff::Element& x = **it;
+			if (!ValidateTxContext(*x.m_pValue))
+				txp.Delete(x);
+		}
 	}
+
+	m_PoolSync.m_vSpent.clear();
+	m_PoolSync.m_bFull = false;
+}
+
+bool NodeProcessor::IsConflicting(const Transaction& tx, const std::set<ECC::Point>& setSpent)
+{
+	for (size_t i = 0; i < tx.m_vInputs.size(); i++)
+		if (setSpent.end() != setSpent.find(tx.m_vInputs[i]->m_Commitment))
+			return true;
+
+	return false;
+}
+
+void NodeProcessor::MarkSpent(const Transaction& tx, std::set<ECC::Point>& setSpent)
+{
+	for (size_t i = 0; i < tx.m_vInputs.size(); i++)
+		setSpent.insert(tx.m_vInputs[i]->m_Commitment);
 }
 
 size_t NodeProcessor::GenerateNewBlockInternal(BlockContext& bc)
@@ -1378,6 +1855,7 @@ size_t NodeProcessor::GenerateNewBlockInternal(BlockContext& bc)
 	}
 
 	size_t nTxNum = 0;
+	std::set<ECC::Point> setSpent;
 
 	for (TxPool::Fluff::ProfitSet::iterator it = bc.m_TxPool.m_setProfit.begin(); bc.m_TxPool.m_setProfit.end() != it; )
 	{
@@ -1413,8 +1891,14 @@ size_t NodeProcessor::GenerateNewBlockInternal(BlockContext& bc)
 
 		Transaction& tx = *x.m_pValue;
 
+		// An alternative of an already selected tx. It's still valid wrt the current tip (the block may be not mined by us),
+		// hence it's skipped, but not evicted. Otherwise the pool would lose it each time a block is assembled.
+		if (IsConflicting(tx, setSpent))
+			continue;
+
 		if (ValidateTxWrtHeight(tx) && HandleValidatedTx(tx.get_Reader(), h, true))
 		{
+			MarkSpent(tx, setSpent);
 			TxVectors::Writer(bc.m_Block, bc.m_Block).Dump(tx.get_Reader());
 
 			bc.m_Fees = feesNext;
@@ -1432,10 +1916,14 @@ size_t NodeProcessor::GenerateNewBlockInternal(BlockContext& bc)
 	{
 		if (bc.m_Fees)
 		{
+			bc.m_skFees = -bb.m_Offset;
 			bb.AddFees(bc.m_Fees, pOutp);
+			bc.m_skFees += bb.m_Offset;
+
 			if (!HandleBlockElement(*pOutp, h, NULL, true))
 				return 0;
 
+			bc.m_pFeesOutp = pOutp.get();
 			bc.m_Block.m_vOutputs.push_back(std::move(pOutp));
 		}
 
@@ -1469,13 +1957,16 @@ void NodeProcessor::GenerateNewHdr(BlockContext& bc)
 	fmmr.get_Hash(bc.m_Hdr.m_Kernels);
 
 	bc.m_Hdr.m_PoW.m_Difficulty = m_Cursor.m_DifficultyNext;
-	bc.m_Hdr.m_TimeStamp = getTimestamp();
+	bc.m_Hdr.m_TimeStamp = get_NextBlockTimestamp();
 
 	bc.m_Hdr.m_ChainWork = m_Cursor.m_Full.m_ChainWork + bc.m_Hdr.m_PoW.m_Difficulty;
+}
 
+Timestamp NodeProcessor::get_NextBlockTimestamp()
+{
 	// Adjust the timestamp to be no less than the moving median (otherwise the block'll be invalid)
 	Timestamp tm = get_MovingMedian() + 1;
-	bc.m_Hdr.m_TimeStamp = std::max(bc.m_Hdr.m_TimeStamp, tm);
+	return std::max(getTimestamp(), tm);
 }
 
 NodeProcessor::BlockContext::BlockContext(TxPool::Fluff& txp, Key::Index nSubKey, Key::IKdf& coin, Key::IPKdf& tag)
@@ -1559,6 +2050,162 @@ bool NodeProcessor::GenerateNewBlock(BlockContext& bc)
 	return nSize <= Rules::get().MaxBodySize;
 }
 
+void NodeProcessor::BlockTemplate::Reset()
+{
+	m_Block.m_vInputs.clear();
+	m_Block.m_vOutputs.clear();
+	m_Block.m_vKernels.clear();
+	m_Block.ZeroInit();
+	m_pFeesOutp = NULL;
+	m_Fees = 0;
+	m_nSize = 0;
+	m_setSeen.clear();
+	m_setSpent.clear();
+	m_Hdr.m_Height = 0;
+	m_BodyP.clear();
+	m_BodyE.clear();
+}
+
+bool NodeProcessor::GenerateNewBlock(BlockContext& bc, BlockTemplate& bt)
+{
+	assert(BlockContext::Mode::SinglePass == bc.m_Mode);
+
+	if (bt.m_Hdr.m_Height && (bt.m_Tip == m_Cursor.m_ID))
+	{
+		Height h = m_Cursor.m_Sid.m_Height + 1;
+		const size_t nSizeMax = Rules::get().MaxBodySize;
+
+		Amount fees = bt.m_Fees;
+		size_t nSize = bt.m_nSize;
+		ECC::Scalar::Native offset = bt.m_Block.m_Offset;
+		size_t nTxNum = 0;
+
+		for (TxPool::Fluff::ProfitSet::iterator it = bc.m_TxPool.m_setProfit.begin(); bc.m_TxPool.m_setProfit.end() != it; it++)
+		{
+			TxPool::Fluff::Element& x = it->get_ParentObj();
+			if (!bt.m_setSeen.insert(x.m_Tx.m_Key).second)
+				continue;
+
+			// Unlike the full build the template is never rolled back, hence the tx is only appended if it's valid wrt the current tip,
+			// and doesn't spend what's already spent by the template. Otherwise it waits for the next full build.
+			if (AmountBig::get_Hi(x.m_Profit.m_Fee))
+				continue;
+
+			Amount feesNext = fees + AmountBig::get_Lo(x.m_Profit.m_Fee);
+			if (feesNext < fees)
+				continue;
+
+			size_t nSizeNext = nSize + x.m_Profit.m_nSize;
+			if (!fees && feesNext)
+				nSizeNext += m_nSizeUtxoComission;
+
+			if (nSizeNext > nSizeMax)
+				continue;
+
+			const Transaction& tx = *x.m_pValue;
+
+			if (IsConflicting(tx, bt.m_setSpent) || !ValidateTxWrtHeight(tx) || !ValidateTxContext(tx))
+				continue;
+
+			MarkSpent(tx, bt.m_setSpent);
+
+			TxVectors::Writer(bt.m_Block, bt.m_Block).Dump(tx.get_Reader());
+
+			fees = feesNext;
+			nSize = nSizeNext;
+			offset += ECC::Scalar::Native(tx.m_Offset);
+			nTxNum++;
+		}
+
+		if (!nTxNum)
+		{
+			// the block is the same
+			bc.m_Hdr = bt.m_Hdr;
+			bc.m_Hdr.m_TimeStamp = get_NextBlockTimestamp();
+			bc.m_BodyP = bt.m_BodyP;
+			bc.m_BodyE = bt.m_BodyE;
+			bc.m_Fees = bt.m_Fees;
+
+			LOG_INFO() << "GenerateNewBlock: template reused as-is";
+			return true;
+		}
+
+		if (fees != bt.m_Fees)
+		{
+			// replace the fees output
+			for (size_t i = 0; i < bt.m_Block.m_vOutputs.size(); i++)
+				if (bt.m_Block.m_vOutputs[i].get() == bt.m_pFeesOutp)
+				{
+					bt.m_Block.m_vOutputs.erase(bt.m_Block.m_vOutputs.begin() + i);
+					offset += bt.m_skFees;
+					break;
+				}
+
+			Block::Builder bb(bc.m_SubIdx, bc.m_Coin, bc.m_Tag, h);
+
+			Output::Ptr pOutp;
+			bb.AddFees(fees, pOutp);
+
+			bt.m_skFees = bb.m_Offset;
+			bt.m_pFeesOutp = pOutp.get();
+			bt.m_Block.m_vOutputs.push_back(std::move(pOutp));
+			bt.m_Fees = fees;
+
+			offset += -bt.m_skFees;
+		}
+
+		bt.m_Block.m_Offset = offset;
+		bt.m_nSize = nSize;
+
+		LOG_INFO() << "GenerateNewBlock: template reused, amount of tx appended = " << nTxNum;
+
+		// finalize it: header and serialization
+		std::swap(bc.m_Block, bt.m_Block);
+		bc.m_Fees = bt.m_Fees;
+
+		bc.m_Mode = BlockContext::Mode::Finalize;
+		bool bRes = GenerateNewBlock(bc);
+		bc.m_Mode = BlockContext::Mode::SinglePass;
+
+		std::swap(bc.m_Block, bt.m_Block);
+
+		if (bRes)
+		{
+			bt.m_Hdr = bc.m_Hdr;
+			bt.m_BodyP = bc.m_BodyP;
+			bt.m_BodyE = bc.m_BodyE;
+			return true;
+		}
+
+		LOG_WARNING() << "Block template finalization failed, rebuilding";
+		bc.m_Fees = 0;
+		bc.m_pFeesOutp = NULL;
+	}
+
+	bt.Reset();
+
+	if (!GenerateNewBlock(bc))
+		return false;
+
+	bt.m_Tip = m_Cursor.m_ID;
+	std::swap(bt.m_Block, bc.m_Block);
+	bt.m_Fees = bc.m_Fees;
+	bt.m_pFeesOutp = bc.m_pFeesOutp;
+	bt.m_skFees = bc.m_skFees;
+	bt.m_nSize = bc.m_BodyP.size() + bc.m_BodyE.size();
+	bt.m_Hdr = bc.m_Hdr;
+	bt.m_BodyP = bc.m_BodyP;
+	bt.m_BodyE = bc.m_BodyE;
+
+	for (TxPool::Fluff::TxSet::iterator it = bc.m_TxPool.m_setTxs.begin(); bc.m_TxPool.m_setTxs.end() != it; it++)
+		bt.m_setSeen.insert(it->m_Key);
+
+	for (size_t i = 0; i < bt.m_Block.m_vInputs.size(); i++)
+		bt.m_setSpent.insert(bt.m_Block.m_vInputs[i]->m_Commitment);
+
+	return true;
+}
+
 bool NodeProcessor::VerifyBlock(const Block::BodyBase& block, TxBase::IReader&& r, const HeightRange& hr)
 {
 	return block.IsValid(hr, std::move(r));
@@ -1566,11 +2213,10 @@ bool NodeProcessor::VerifyBlock(const Block::BodyBase& block, TxBase::IReader&&
 
 void NodeProcessor::ExtractBlockWithExtra(Block::Body& block, const NodeDB::StateID& sid)
 {
-	ByteBuffer bbP, bbE;
 	RollbackData rbData;
-	m_DB.GetStateBlock(sid.m_Row, &bbP, &bbE, &rbData.m_Buf);
+	m_DB.GetStateBlock(sid.m_Row, NULL, NULL, &rbData.m_Buf);
 
-	ReadBody(block, bbP, bbE);
+	ReadBody(block, sid.m_Row);
 	rbData.Export(block);
 
 	for (size_t i = 0; i < block.m_vOutputs.size(); i++)
@@ -1676,6 +2322,7 @@ bool NodeProcessor::ImportMacroBlock(Block::BodyBase::IMacroReader& r)
 	if (!ImportMacroBlockInternal(r))
 		return false;
 
+	m_PoolSync.m_bFull = true;
 	TryGoUp();
 	return true;
 }
@@ -1837,6 +2484,7 @@ bool NodeProcessor::ImportMacroBlockInternal(Block::BodyBase::IMacroReader& r)
 
 		m_DB.DelStateBlockAll(sid.m_Row); // if somehow it was downloaded
 		m_DB.set_Peer(sid.m_Row, NULL);
+		m_mapAsyncVerdicts.erase(sid.m_Row);
 
 		sid.m_Height = id.m_Height;
 		m_DB.MoveFwd(sid);
@@ -1897,6 +2545,11 @@ bool NodeProcessor::EnumBlocks(IBlockWalker& wlk)
 			return false;
 	}
 
+	return EnumBlocksAbove(wlk, h);
+}
+
+bool NodeProcessor::EnumBlocksAbove(IBlockWalker& wlk, Height h)
+{
 	std::vector<uint64_t> vPath;
 	vPath.reserve(m_Cursor.m_ID.m_Height - h);
 
@@ -1915,16 +2568,10 @@ bool NodeProcessor::EnumBlocks(IBlockWalker& wlk)
 		vPath.push_back(rowid);
 	}
 
-	ByteBuffer bbP, bbE;
 	for (; !vPath.empty(); vPath.pop_back())
 	{
-		bbP.clear();
-		bbE.clear();
-
-		m_DB.GetStateBlock(vPath.back(), &bbP, &bbE, NULL);
-
 		Block::Body block;
-		ReadBody(block, bbP, bbE);
+		ReadBody(block, vPath.back());
 
 		if (!wlk.OnBlock(block, block.get_Reader(), vPath.back(), ++h, NULL))
 			return false;
@@ -1957,16 +2604,25 @@ void NodeProcessor::InitializeFromBlocks()
 			if (!m_pThis->HandleValidatedBlock(std::move(r), body, h, true, pHMax))
 				OnCorrupted();
 
+			m_pThis->m_InitStats.m_BlocksInterpreted++;
 			return true;
 		}
 	};
 
-	if (EnsureTreasuryHandled())
+	MyWalker wlk;
+	wlk.m_pThis = this;
+
+	Height hSnapshot = Rules::HeightGenesis - 1;
+	if (LoadUtxoSnapshot(hSnapshot))
 	{
-		MyWalker wlk;
-		wlk.m_pThis = this;
-		EnumBlocks(wlk);
+		LOG_INFO() << "UTXO snapshot loaded at " << hSnapshot;
+
+		m_Extra.m_TreasuryHandled = true; // already included in the snapshot
+		EnumBlocksAbove(wlk, hSnapshot);
 	}
+	else
+		if (EnsureTreasuryHandled())
+			EnumBlocks(wlk);
 
 	if (m_Cursor.m_ID.m_Height >= Rules::HeightGenesis)
 	{
@@ -1998,10 +2654,25 @@ bool NodeProcessor::IUtxoWalker::OnBlock(const Block::BodyBase&, TxBase::IReader
 
 bool NodeProcessor::UtxoRecoverSimple::Proceed()
 {
+	m_Recognizer.m_vKeys.resize(m_vKeys.size());
+	for (size_t i = 0; i < m_vKeys.size(); i++)
+		m_Recognizer.m_vKeys[i] = m_vKeys[i].get();
+
+	m_Recognizer.m_nCount = 0;
+	m_Recognizer.m_bFast = true;
+
 	ECC::Mode::Scope scope(ECC::Mode::Fast);
 	return m_This.EnumBlocks(*this);
 }
 
+bool NodeProcessor::UtxoRecoverSimple::OnBlock(const Block::BodyBase& body, TxBase::IReader&& r, uint64_t rowid, Height h, const Height* pHMax)
+{
+	// the outputs of the block are recognized at once. Must be done before the next block, its inputs may spend them
+	return
+		IUtxoWalker::OnBlock(body, std::move(r), rowid, h, pHMax) &&
+		FlushOutputs();
+}
+
 bool NodeProcessor::UtxoRecoverEx::OnOutput(uint32_t iKey, const Key::IDV& kidv, const Output& x)
 {
 	Value& v0 = m_Map[x.m_Commitment];
@@ -2033,11 +2704,27 @@ bool NodeProcessor::UtxoRecoverEx::OnInput(const Input& x)
 
 bool NodeProcessor::UtxoRecoverSimple::OnOutput(const Output& x)
 {
-	Key::IDV kidv;
+	return
+		!m_Recognizer.Add(x) ||
+		FlushOutputs();
+}
+
+bool NodeProcessor::UtxoRecoverSimple::FlushOutputs()
+{
+	if (!m_Recognizer.m_nCount)
+		return true;
 
-	for (uint32_t iKey = 0; iKey < m_vKeys.size(); iKey++)
-		if (x.Recover(*m_vKeys[iKey], kidv))
-			return OnOutput(iKey, kidv, x);
+	m_This.RecognizeOutputs(m_Recognizer);
+
+	uint32_t nCount = m_Recognizer.m_nCount;
+	m_Recognizer.m_nCount = 0;
+
+	for (uint32_t i = 0; i < nCount; i++)
+	{
+		const UtxoRecognizer::Result& res = m_Recognizer.m_vResults[i];
+		if ((UtxoRecognizer::s_KeyNone != res.m_iKey) && !OnOutput(res.m_iKey, res.m_Kidv, *m_Recognizer.m_vOutputs[i]))
+			return false;
+	}
 
 	return true;
 }
@@ -17,6 +17,8 @@
 #include "../core/radixtree.h"
 #include "db.h"
 #include "txpool.h"
+#include <set>
+#include <thread>
 
 namespace beam {
 
@@ -42,7 +44,7 @@ class NodeProcessor
 	void Rollback();
 	void PruneOld();
 	void InitializeFromBlocks();
-	void RequestDataInternal(const Block::SystemState::ID&, uint64_t row, bool bBlock);
+	void RequestDataInternal(const Block::SystemState::ID&, uint64_t row, bool bBlock, const NodeDB::StateID& sidTrg);
 
 	struct RollbackData;
 
@@ -50,12 +52,36 @@ class NodeProcessor
 	bool HandleTreasury(const Blob&, bool bFirstTime);
 
 	bool HandleBlock(const NodeDB::StateID&, bool bFwd);
+	bool VerifyBlockCached(uint64_t row, const Block::Body&, Height);
+
+	// Context-free verification results for the blocks verified asynchronously (in advance)
+	struct AsyncVerdict {
+		enum Enum {
+			Pending,
+			Valid,
+			Invalid
+		};
+	};
+
+	std::map<uint64_t, AsyncVerdict::Enum> m_mapAsyncVerdicts; // by state row. Erased once the block is applied, or its state/body is deleted
+	bool IsAsyncVerifyPending(uint64_t row) const;
 	bool HandleValidatedTx(TxBase::IReader&&, Height, bool bFwd, const Height* = NULL);
 	bool HandleValidatedBlock(TxBase::IReader&&, const Block::BodyBase&, Height, bool bFwd, const Height* = NULL);
 	bool HandleBlockElement(const Input&, Height, const Height*, bool bFwd);
 	bool HandleBlockElement(const Output&, Height, const Height*, bool bFwd);
 
 	bool ImportMacroBlockInternal(Block::BodyBase::IMacroReader&);
+
+	// Changes since the last DeleteOutdated
+	struct PoolSync
+	{
+		static const size_t s_MaxSpent = 0x10000; // beyond this the full revalidation is cheaper anyway
+
+		std::vector<ECC::Point> m_vSpent; // inputs of the applied blocks
+		bool m_bFull = true; // rollback, macroblock import or etc. Must revalidate everything
+
+		void OnBlock(TxBase::IReader&&, bool bFwd);
+	} m_PoolSync;
 	void RecognizeUtxos(TxBase::IReader&&, Height hMax);
 
 	static void SquashOnce(std::vector<Block::Body>&);
@@ -93,11 +119,24 @@ class NodeProcessor
 	};
 
 	bool EnumBlocks(IBlockWalker&);
+	bool EnumBlocksAbove(IBlockWalker&, Height);
 	Height OpenLatestMacroblock(Block::Body::RW&);
 
+	static const uint32_t s_UtxoSnapshotVer = 1;
+
+	std::string m_sPathUtxoSnapshot;
+	Height m_hUtxoSnapshot;
+	std::thread m_UtxoSnapshotThread; // writes the serialized UTXO set to the file
+
+	bool LoadUtxoSnapshot(Height&);
+	void SaveUtxoSnapshot();
+	void WaitUtxoSnapshot();
+	static void WriteUtxoSnapshot(const std::string& sPath, const ByteBuffer&, const Block::SystemState::ID&);
+	void OnCommitted(bool bFinal);
+
 public:
 
-	void Initialize(const char* szPath, bool bResetCursor = false);
+	void Initialize(const char* szPath, bool bResetCursor = false, bool bBodyStore = false);
 	virtual ~NodeProcessor();
 
 	struct Horizon {
@@ -109,6 +148,19 @@ public:
 
 	} m_Horizon;
 
+	struct UtxoSnapshot {
+
+		Height m_Period; // the UTXO set is saved once per this number of blocks, to avoid re-interpreting all the blocks on startup. 0 = disabled
+
+		UtxoSnapshot();
+
+	} m_UtxoSnapshot;
+
+	struct InitStats {
+		Height m_UtxoSnapshot = 0; // the height of the loaded UTXO snapshot, 0 if the UTXO set was rebuilt from all the blocks
+		uint64_t m_BlocksInterpreted = 0;
+	} m_InitStats;
+
 	struct Cursor
 	{
 		// frequently used data
@@ -144,13 +196,20 @@ public:
 	};
 
 	DataStatus::Enum OnState(const Block::SystemState::Full&, const PeerID&);
+	// Headers pack (see proto::HdrPack). PoW is verified for all the relevant headers at once (see VerifyPoW), then the valid ones are inserted.
+	// Returns the number of accepted headers, idTop is set to the ID of the most recent header in the pack.
+	uint32_t OnStatePack(const Block::SystemState::Sequence::Prefix&, const std::vector<Block::SystemState::Sequence::Element>&, const PeerID&, bool& bInvalid, Block::SystemState::ID& idTop);
 	DataStatus::Enum OnBlock(const Block::SystemState::ID&, const Blob& bbP, const Blob& bbE, const PeerID&);
 	DataStatus::Enum OnTreasury(const Blob&);
 
 	// use only for data retrieval for peers
 	NodeDB& get_DB() { return m_DB; }
 	UtxoTree& get_Utxos() { return m_Utxos; }
-	static void ReadBody(Block::Body&, const ByteBuffer& bbP, const ByteBuffer& bbE);
+	static void ReadBody(Block::Body&, const Blob& bodyP, const Blob& bodyE);
+	static bool VerifyBlockContextFree(const Blob& bodyP, const Blob& bodyE, Height); // single-threaded, can be called from any thread
+	void OnBlockVerified(uint64_t rowid, bool bValid); // completes VerifyBlockAsync
+	size_t get_AsyncVerdictsCount() const { return m_mapAsyncVerdicts.size(); }
+	void ReadBody(Block::Body&, uint64_t rowid); // directly from the mapped body store if possible
 
 	Height get_ProofKernel(Merkle::Proof&, TxKernel::Ptr*, const Merkle::Hash& idKrn);
 
@@ -158,11 +217,15 @@ public:
 	void EnumCongestions(uint32_t nMaxBlocksBacklog);
 	static bool IsRemoteTipNeeded(const Block::SystemState::Full& sTipRemote, const Block::SystemState::Full& sTipMy);
 
-	virtual void RequestData(const Block::SystemState::ID&, bool bBlock, const PeerID* pPreferredPeer) {}
+	// sidTrg - the highest state of the same branch that is requested too (valid for blocks). May be used to request them in a pack
+	virtual void RequestData(const Block::SystemState::ID&, bool bBlock, const PeerID* pPreferredPeer, const NodeDB::StateID& sidTrg) {}
 	virtual void OnPeerInsane(const PeerID&) {}
 	virtual void OnNewState() {}
 	virtual void OnRolledBack() {}
 	virtual bool VerifyBlock(const Block::BodyBase&, TxBase::IReader&&, const HeightRange&);
+	virtual void VerifyPoW(const Block::SystemState::Full*, uint8_t* pValid, uint32_t nCount); // sets pValid[i] to nonzero for valid
+	virtual bool VerifyBlockAsync(uint64_t rowid, Height, const Blob& bodyP, const Blob& bodyE) { return false; } // if started - OnBlockVerified() must be called later, on the same thread
+	virtual void UpdateUtxoHash() {} // may rehash the modified parts of the UTXO tree in parallel, before its root hash is evaluated
 	virtual void AdjustFossilEnd(Height&) {}
 	virtual void OnStateData() {}
 	virtual void OnBlockData() {}
@@ -180,6 +243,10 @@ public:
 	bool ValidateTxContext(const Transaction&); // assuming context-free validation is already performed, but 
 	bool ValidateTxWrtHeight(const Transaction&) const;
 
+	// Txs that spend the same input are alternatives, at most one of them can go into a block
+	static bool IsConflicting(const Transaction&, const std::set<ECC::Point>& setSpent);
+	static void MarkSpent(const Transaction&, std::set<ECC::Point>& setSpent);
+
 	struct GeneratedBlock
 	{
 		Block::SystemState::Full m_Hdr;
@@ -207,23 +274,86 @@ public:
 
 		Mode m_Mode = Mode::SinglePass;
 
+		// the fees output, if added (not in the Assemble mode)
+		const Output* m_pFeesOutp = NULL;
+		ECC::Scalar::Native m_skFees;
+
 		BlockContext(TxPool::Fluff& txp, Key::Index, Key::IKdf& coin, Key::IPKdf& tag);
 	};
+
+	bool GenerateNewBlock(BlockContext&);
+
+	// Block template that survives the mempool changes. While the tip is the same - the txs that appeared in the pool
+	// since the last call are appended to it (if they fit and don't conflict), the rest of the block is reused as-is.
+	// Rebuilt from scratch on a new tip.
+	// If nothing is appended - the last finalized block is returned, only its timestamp is refreshed.
+	// Once txs are appended the block is finalized anew, which is still O(block size): the UTXO commitment is evaluated by applying
+	// the whole block to the live tree (and undoing it), and the kernel MMR and the serialized body are over the sorted elements,
+	// hence the new ones can't just be folded in. What's saved is the tx selection and validation, and the coinbase.
+	struct BlockTemplate
+	{
+		Block::SystemState::ID m_Tip; // on which it was built
+		Block::Body m_Block; // complete, incl. coinbase and fees output
+		const Output* m_pFeesOutp;
+		ECC::Scalar::Native m_skFees;
+		Amount m_Fees;
+		size_t m_nSize;
+
+		std::set<Transaction::KeyType> m_setSeen; // pool txs that were already considered
+		std::set<ECC::Point> m_setSpent;
+
+		// the last finalized block, zero height if the template is empty
+		Block::SystemState::Full m_Hdr;
+		ByteBuffer m_BodyP;
+		ByteBuffer m_BodyE;
+
+		BlockTemplate() { Reset(); }
+		void Reset();
+	};
+
+	// SinglePass mode only. On success the bc.m_Block is retained by the template (only the serialized body is returned)
+	bool GenerateNewBlock(BlockContext&, BlockTemplate&);
+	void DeleteOutdated(TxPool::Fluff&); // incremental: only the txs that conflict with the blocks applied since the last call are revalidated
+
+	// Outputs collected for recognition by the viewer keys. They're processed in batches (all the outputs of a block, or
+	// up to s_BatchMax of a macroblock), each output is independent, hence the batch may be split between threads.
+	// Recover() already rejects the foreign outputs cheaply (by the padding check) before the expensive part.
+	struct UtxoRecognizer
+	{
+		static const uint32_t s_BatchMax = 0x400; // outputs are copied, don't let the batch grow unbounded
+		static const uint32_t s_KeyNone = uint32_t(-1);
+
+		struct Result {
+			Key::IDV m_Kidv;
+			uint32_t m_iKey; // s_KeyNone if not recognized
+		};
 
-	bool GenerateNewBlock(BlockContext&);
-	void DeleteOutdated(TxPool::Fluff&);
+		std::vector<Key::IPKdf*> m_vKeys;
+		std::vector<Output::Ptr> m_vOutputs; // allocated outputs are reused across batches
+		std::vector<Result> m_vResults;
+		uint32_t m_nCount = 0;
+		bool m_bFast = false; // recognize in ECC::Mode::Fast
+
+		bool Add(const Output&); // returns true if the batch is full
+		void Execute(uint32_t iThread, uint32_t nThreads); // outputs are interleaved between the threads
+	};
+
+	virtual void RecognizeOutputs(UtxoRecognizer& r) { r.Execute(0, 1); }
 
 	struct UtxoRecoverSimple
 		:public IUtxoWalker
 	{
 		std::vector<Key::IPKdf::Ptr> m_vKeys;
+		UtxoRecognizer m_Recognizer;
 
 		UtxoRecoverSimple(NodeProcessor& x) :IUtxoWalker(x) {}
 
 		bool Proceed();
 
+		virtual bool OnBlock(const Block::BodyBase&, TxBase::IReader&&, uint64_t rowid, Height, const Height* pHMax) override;
 		virtual bool OnInput(const Input&) override;
 		virtual bool OnOutput(const Output&) override;
+		bool FlushOutputs();
 
 		virtual bool OnOutput(uint32_t iKey, const Key::IDV&, const Output&) = 0;
 	};
@@ -266,7 +396,9 @@ public:
 private:
 	size_t GenerateNewBlockInternal(BlockContext&);
 	void GenerateNewHdr(BlockContext&);
-	DataStatus::Enum OnStateInternal(const Block::SystemState::Full&, Block::SystemState::ID&);
+	Timestamp get_NextBlockTimestamp();
+	DataStatus::Enum OnStateInternal(const Block::SystemState::Full&, Block::SystemState::ID&, bool bTestPoW = true);
+	void RecognizeUtxosBatch(UtxoRecognizer&, Height hMax);
 };
 
 
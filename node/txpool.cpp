@@ -53,6 +53,41 @@ void TxPool::Fluff::AddValidTx(Transaction::Ptr&& pValue, const Transaction::Con
 	p->m_Profit.SetSize(*p->m_pValue);
 	p->m_Tx.m_Key = key;
 
+	const Transaction& tx = *p->m_pValue;
+
+	// the context may be not fully evaluated (if the tx was validated in the stem phase). Make sure the threshold accounts for all the kernels
+	for (size_t i = 0; i < tx.m_vKernels.size(); i++)
+		p->m_Threshold.m_Value = std::min(p->m_Threshold.m_Value, tx.m_vKernels[i]->m_Height.m_Max);
+
+	p->m_vInputs.resize(tx.m_vInputs.size());
+	for (size_t i = 0; i < tx.m_vInputs.size(); i++)
+	{
+		Element::Input& x = p->m_vInputs[i];
+		x.m_pThis = p;
+		x.m_Commitment = tx.m_vInputs[i]->m_Commitment;
+		m_setInputs.insert(x);
+	}
+
+	p->m_vOutputIDs.resize(tx.m_vOutputs.size());
+	for (size_t i = 0; i < tx.m_vOutputs.size(); i++)
+	{
+		Element::ShortID& x = p->m_vOutputIDs[i];
+		x.m_pThis = p;
+		x.m_Idx = static_cast<uint32_t>(i);
+		x.m_Value = get_ShortID(*tx.m_vOutputs[i]);
+		m_setOutputIDs.insert(x);
+	}
+
+	p->m_vKernelIDs.resize(tx.m_vKernels.size());
+	for (size_t i = 0; i < tx.m_vKernels.size(); i++)
+	{
+		Element::ShortID& x = p->m_vKernelIDs[i];
+		x.m_pThis = p;
+		x.m_Idx = static_cast<uint32_t>(i);
+		x.m_Value = get_ShortID(*tx.m_vKernels[i]);
+		m_setKernelIDs.insert(x);
+	}
+
 	m_setThreshold.insert(p->m_Threshold);
 	m_setProfit.insert(p->m_Profit);
 	m_setTxs.insert(p->m_Tx);
@@ -60,12 +95,129 @@ void TxPool::Fluff::AddValidTx(Transaction::Ptr&& pValue, const Transaction::Con
 
 void TxPool::Fluff::Delete(Element& x)
 {
+	for (size_t i = 0; i < x.m_vInputs.size(); i++)
+		m_setInputs.erase(InputSet::s_iterator_to(x.m_vInputs[i]));
+	for (size_t i = 0; i < x.m_vOutputIDs.size(); i++)
+		m_setOutputIDs.erase(ShortIDSet::s_iterator_to(x.m_vOutputIDs[i]));
+	for (size_t i = 0; i < x.m_vKernelIDs.size(); i++)
+		m_setKernelIDs.erase(ShortIDSet::s_iterator_to(x.m_vKernelIDs[i]));
+
 	m_setThreshold.erase(ThresholdSet::s_iterator_to(x.m_Threshold));
 	m_setProfit.erase(ProfitSet::s_iterator_to(x.m_Profit));
 	m_setTxs.erase(TxSet::s_iterator_to(x.m_Tx));
 	delete &x;
 }
 
+uint64_t TxPool::Fluff::get_ShortID(const Output& v)
+{
+	uint64_t ret;
+	v.m_Commitment.m_X.ExportWord<0>(ret);
+	return ret;
+}
+
+uint64_t TxPool::Fluff::get_ShortID(const TxKernel& v)
+{
+	Merkle::Hash hv;
+	v.get_ID(hv);
+
+	uint64_t ret;
+	hv.ExportWord<0>(ret);
+	return ret;
+}
+
+static const TxPool::Fluff::Element::ShortID* FindShortID(const TxPool::Fluff::ShortIDSet& s, uint64_t val)
+{
+	TxPool::Fluff::Element::ShortID key;
+	key.m_Value = val;
+
+	TxPool::Fluff::ShortIDSet::const_iterator it = s.lower_bound(key);
+	if ((s.end() == it) || (it->m_Value != val))
+		return NULL;
+
+	const TxPool::Fluff::Element::ShortID& x = *it;
+	if ((s.end() != ++it) && (it->m_Value == val))
+		return NULL; // ambiguous
+
+	return &x;
+}
+
+const Output* TxPool::Fluff::FindOutput(uint64_t val) const
+{
+	const Element::ShortID* p = FindShortID(m_setOutputIDs, val);
+	return p ? p->m_pThis->m_pValue->m_vOutputs[p->m_Idx].get() : NULL;
+}
+
+const TxKernel* TxPool::Fluff::FindKernel(uint64_t val) const
+{
+	const Element::ShortID* p = FindShortID(m_setKernelIDs, val);
+	return p ? p->m_pThis->m_pValue->m_vKernels[p->m_Idx].get() : NULL;
+}
+
+uint64_t TxPool::Fluff::get_ShortID(const Output& v, const Merkle::Hash& hvSalt)
+{
+	Merkle::Hash hv;
+	ECC::Hash::Processor()
+		<< hvSalt
+		<< v.m_Commitment
+		>> hv;
+
+	uint64_t ret;
+	hv.ExportWord<0>(ret);
+	return ret;
+}
+
+uint64_t TxPool::Fluff::get_ShortID(const TxKernel& v, const Merkle::Hash& hvSalt)
+{
+	Merkle::Hash hv;
+	v.get_ID(hv);
+
+	ECC::Hash::Processor()
+		<< hvSalt
+		<< hv
+		>> hv;
+
+	uint64_t ret;
+	hv.ExportWord<0>(ret);
+	return ret;
+}
+
+template <typename T>
+static void AddSaltedID(std::map<uint64_t, const T*>& m, uint64_t val, const T* p)
+{
+	std::pair<typename std::map<uint64_t, const T*>::iterator, bool> res = m.insert(std::make_pair(val, p));
+	if (!res.second)
+		res.first->second = NULL; // ambiguous
+}
+
+void TxPool::Fluff::SaltedIndex::Build(const Fluff& txp, const Merkle::Hash& hvSalt)
+{
+	m_mapOutputs.clear();
+	m_mapKernels.clear();
+
+	for (TxSet::const_iterator it = txp.m_setTxs.begin(); txp.m_setTxs.end() != it; it++)
+	{
+		const Transaction& tx = *it->get_ParentObj().m_pValue;
+
+		for (size_t i = 0; i < tx.m_vOutputs.size(); i++)
+			AddSaltedID(m_mapOutputs, get_ShortID(*tx.m_vOutputs[i], hvSalt), tx.m_vOutputs[i].get());
+
+		for (size_t i = 0; i < tx.m_vKernels.size(); i++)
+			AddSaltedID(m_mapKernels, get_ShortID(*tx.m_vKernels[i], hvSalt), tx.m_vKernels[i].get());
+	}
+}
+
+const Output* TxPool::Fluff::SaltedIndex::FindOutput(uint64_t val) const
+{
+	std::map<uint64_t, const Output*>::const_iterator it = m_mapOutputs.find(val);
+	return (m_mapOutputs.end() == it) ? NULL : it->second;
+}
+
+const TxKernel* TxPool::Fluff::SaltedIndex::FindKernel(uint64_t val) const
+{
+	std::map<uint64_t, const TxKernel*>::const_iterator it = m_mapKernels.find(val);
+	return (m_mapKernels.end() == it) ? NULL : it->second;
+}
+
 void TxPool::Fluff::DeleteOutOfBound(Height h)
 {
 	while (!m_setThreshold.empty())
@@ -92,37 +244,100 @@ void TxPool::Fluff::Clear()
 
 /////////////////////////////
 // Stem
-bool TxPool::Stem::TryMerge(Element& trg, Element& src)
+void TxPool::Stem::Freeze(Merge& m, Element& x)
 {
-	assert(trg.m_bAggregating && src.m_bAggregating);
+	assert(!x.m_pMerge);
+
+	DeleteAggr(x);
+	DeleteTimer(x);
+
+	x.m_pMerge = &m;
+	m.m_vElems.push_back(&x);
+	m.m_vTxs.push_back(x.m_pValue);
+}
+
+void TxPool::Stem::Merge::Execute()
+{
+	// the source txs are immutable while frozen
+	std::vector<TxVectors::Reader> vR;
+	std::vector<TxBase::IReader*> vpR;
+	vR.reserve(m_vTxs.size());
+	vpR.reserve(m_vTxs.size());
+
+	ECC::Scalar::Native offset;
+	offset = Zero;
+
+	for (size_t i = 0; i < m_vTxs.size(); i++)
+	{
+		vR.push_back(m_vTxs[i]->get_Reader());
+		vpR.push_back(&vR.back());
+		offset += ECC::Scalar::Native(m_vTxs[i]->m_Offset);
+	}
 
-	Transaction txNew;
-	TxVectors::Writer wtx(txNew, txNew);
+	Transaction::Ptr pTx = std::make_shared<Transaction>();
+	TxVectors::Writer wtx(*pTx, *pTx);
 
 	volatile bool bStop = false;
-	wtx.Combine(trg.m_pValue->get_Reader(), src.m_pValue->get_Reader(), bStop);
+	wtx.Combine(&vpR.front(), static_cast<int>(vpR.size()), bStop);
+
+	for (size_t i = 0; i < m_vDummies.size(); i++)
+	{
+		Output::Ptr pOutput(new Output);
+		ECC::Scalar::Native sk;
+		pOutput->Create(sk, *m_pKdf, m_vDummies[i], *m_pKdf);
+
+		pTx->m_vOutputs.push_back(std::move(pOutput));
+		offset += -sk;
+	}
 
-	txNew.m_Offset = ECC::Scalar::Native(trg.m_pValue->m_Offset) + ECC::Scalar::Native(src.m_pValue->m_Offset);
+	pTx->m_Offset = offset;
+	if (!m_vDummies.empty())
+		pTx->Normalize();
 
 #ifdef _DEBUG
 	Transaction::Context ctx;
-	assert(txNew.IsValid(ctx));
+	m_bValid = pTx->IsValid(ctx);
+	assert(m_bValid);
+#else // _DEBUG
+	m_bValid = true;
 #endif // _DEBUG
 
-	if (!ValidateTxContext(txNew))
-		return false; // conflicting txs, can't merge
+	m_pResult = std::move(pTx);
+}
+
+bool TxPool::Stem::ApplyMerge(Merge& m)
+{
+	bool bIntact = true;
+	for (size_t i = 0; i < m.m_vElems.size(); i++)
+	{
+		if (m.m_vElems[i])
+			m.m_vElems[i]->m_pMerge = NULL;
+		else
+			bIntact = false;
+	}
+
+	if (!(bIntact && m.m_bValid && ValidateTxContext(*m.m_pResult)))
+		return false; // some were deleted, or conflict with the recent state
 
-	trg.m_Profit.m_Fee += src.m_Profit.m_Fee;
-	trg.m_Profit.SetSize(txNew);
+	Element& trg = *m.m_vElems.front();
+	uint32_t now_ms = GetTime_ms();
 
-	Delete(src);
-	DeleteKrn(trg);
+	for (size_t i = 1; i < m.m_vElems.size(); i++)
+	{
+		Element& src = *m.m_vElems[i];
 
-	trg.m_pValue->m_vInputs.swap(txNew.m_vInputs);
-	trg.m_pValue->m_vOutputs.swap(txNew.m_vOutputs);
-	trg.m_pValue->m_vKernels.swap(txNew.m_vKernels);
-	trg.m_pValue->m_Offset = txNew.m_Offset;
+		trg.m_Profit.m_Fee += src.m_Profit.m_Fee;
+		trg.m_Depth += src.m_Depth;
+		if (now_ms - src.m_Received_ms > now_ms - trg.m_Received_ms)
+			trg.m_Received_ms = src.m_Received_ms;
 
+		m.m_vElems[i] = NULL;
+		Delete(src);
+	}
+
+	DeleteKrn(trg);
+	trg.m_pValue = std::move(m.m_pResult);
+	trg.m_Profit.SetSize(*trg.m_pValue);
 	InsertKrn(trg);
 
 	return true;
@@ -146,6 +361,14 @@ void TxPool::Stem::Delete(Element& x)
 
 void TxPool::Stem::DeleteRaw(Element& x)
 {
+	if (x.m_pMerge)
+	{
+		std::vector<Element*>& v = x.m_pMerge->m_vElems;
+		for (size_t i = 0; i < v.size(); i++)
+			if (&x == v[i])
+				v[i] = NULL;
+	}
+
 	DeleteTimer(x);
 	DeleteAggr(x);
 	DeleteKrn(x);
@@ -63,20 +63,82 @@ struct TxPool
 
 				IMPLEMENT_GET_PARENT_OBJ(Element, m_Threshold)
 			} m_Threshold;
+
+			struct Input
+				:public boost::intrusive::set_base_hook<>
+			{
+				Element* m_pThis;
+				ECC::Point m_Commitment;
+				bool operator < (const Input& t) const { return m_Commitment < t.m_Commitment; }
+			};
+
+			std::vector<Input> m_vInputs;
+
+			struct ShortID
+				:public boost::intrusive::set_base_hook<>
+			{
+				Element* m_pThis;
+				uint32_t m_Idx; // in the tx outputs or kernels
+				uint64_t m_Value;
+				bool operator < (const ShortID& t) const { return m_Value < t.m_Value; }
+			};
+
+			std::vector<ShortID> m_vOutputIDs;
+			std::vector<ShortID> m_vKernelIDs;
 		};
 
 		typedef boost::intrusive::multiset<Element::Tx> TxSet;
 		typedef boost::intrusive::multiset<Element::Profit> ProfitSet;
 		typedef boost::intrusive::multiset<Element::Threshold> ThresholdSet;
+		typedef boost::intrusive::multiset<Element::Input> InputSet;
+		typedef boost::intrusive::multiset<Element::ShortID> ShortIDSet;
 
 		TxSet m_setTxs;
 		ProfitSet m_setProfit;
 		ThresholdSet m_setThreshold;
+		InputSet m_setInputs; // spent commitments, to find the txs that conflict with a new block
+
+		// Outputs and kernels by 64-bit short IDs: the commitment prefix for outputs, and the ID prefix for kernels.
+		// Used to tell which elements of a new block were missing in the pool. Collisions are possible, those are resolved by the caller.
+		ShortIDSet m_setOutputIDs;
+		ShortIDSet m_setKernelIDs;
+
+		static uint64_t get_ShortID(const Output&);
+		static uint64_t get_ShortID(const TxKernel&);
+
+		const Output* FindOutput(uint64_t) const; // NULL if not found, or ambiguous
+		const TxKernel* FindKernel(uint64_t) const;
+
+		// Short IDs salted by the block hash, as sent in the compact block bodies. Collisions can't be crafted before the block is mined.
+		static uint64_t get_ShortID(const Output&, const Merkle::Hash& hvSalt);
+		static uint64_t get_ShortID(const TxKernel&, const Merkle::Hash& hvSalt);
+
+		// The pool indexed by the salted IDs of a specific block. Built on demand, when a compact body arrives.
+		struct SaltedIndex
+		{
+			std::map<uint64_t, const Output*> m_mapOutputs; // NULL if ambiguous
+			std::map<uint64_t, const TxKernel*> m_mapKernels;
+
+			void Build(const Fluff&, const Merkle::Hash& hvSalt);
+
+			const Output* FindOutput(uint64_t) const; // NULL if not found, or ambiguous
+			const TxKernel* FindKernel(uint64_t) const;
+		};
 
 		void AddValidTx(Transaction::Ptr&&, const Transaction::Context&, const Transaction::KeyType&);
 		void Delete(Element&);
 		void Clear();
 
+		template <typename Func>
+		void EnumSpending(const ECC::Point& comm, Func&& func)
+		{
+			Element::Input key;
+			key.m_Commitment = comm;
+
+			for (InputSet::iterator it = m_setInputs.lower_bound(key); (m_setInputs.end() != it) && (it->m_Commitment == comm); it++)
+				func(*it->m_pThis);
+		}
+
 		void DeleteOutOfBound(Height);
 		void ShrinkUpTo(uint32_t nCount);
 
@@ -85,11 +147,16 @@ struct TxPool
 
 	struct Stem
 	{
+		struct Merge;
 
 		struct Element
 		{
 			Transaction::Ptr m_pValue;
 			bool m_bAggregating; // if set - the tx isn't broadcasted yet, and inserted in the 'Profit' set
+			Merge* m_pMerge; // if set - the element is frozen until the merge is applied
+
+			uint32_t m_Depth; // num of original txs aggregated in this one
+			uint32_t m_Received_ms; // when the earliest of them arrived
 
 			struct Time
 				:public boost::intrusive::set_base_hook<>
@@ -118,6 +185,25 @@ struct TxPool
 			std::vector<Kernel> m_vKrn;
 		};
 
+		// Elements combined (and padded with dummy outputs) off the reactor thread.
+		// While pending they're kept in the kernel set, but excluded from aggregation and timers.
+		struct Merge
+		{
+			typedef std::unique_ptr<Merge> Ptr;
+
+			std::vector<Element*> m_vElems; // the 1st is the target. Reset if deleted meanwhile
+			std::vector<Transaction::Ptr> m_vTxs;
+
+			std::vector<Key::IDV> m_vDummies;
+			Key::IKdf::Ptr m_pKdf; // dummy outputs
+
+			bool m_bFinal = false; // the aggregation is over once applied
+			bool m_bValid = false;
+			Transaction::Ptr m_pResult;
+
+			void Execute(); // can be called from any thread
+		};
+
 		typedef boost::intrusive::multiset<Element::Kernel> KrnSet;
 		typedef boost::intrusive::multiset<Element::Time> TimeSet;
 		typedef boost::intrusive::multiset<Element::Profit> ProfitSet;
@@ -134,7 +220,8 @@ struct TxPool
 		void DeleteAggr(Element&);
 		void DeleteTimer(Element&);
 
-		bool TryMerge(Element& trg, Element& src);
+		void Freeze(Merge&, Element&);
+		bool ApplyMerge(Merge&); // releases all the frozen elements, the merged ones are deleted on success
 
 		Element* get_NextTimeout(uint32_t& nTimeout_ms);
 		void SetTimer(uint32_t nTimeout_ms, Element&);
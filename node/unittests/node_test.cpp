@@ -518,7 +518,8 @@ namespace beam
 		verify_test(h1 == 1055);
 		verify_test(id == 345U);
 
-		db.DeleteDummy(id);
+		db.DeleteDummySafe(id);
+		db.DeleteDummySafe(id); // already deleted
 
 		verify_test(!db.GetLowestDummy(h1));
 
@@ -554,6 +555,146 @@ namespace beam
 		const char* g_sz3 = "/tmp/macroblock_";
 #endif // WIN32
 
+	void TestNodeDBBodies(const char* sz)
+	{
+		Blob bBodyP("body", 4), bBodyE("abc", 3), bBodyP2("body2", 5), bEmpty(NULL, 0);
+		uint64_t pRows[2];
+
+		ByteBuffer bbP, bbE;
+		Blob bP, bE;
+
+		{
+			NodeDB db;
+			db.Open(sz, true);
+			NodeDB::Transaction tr(db);
+
+			Block::SystemState::Full s;
+			ZeroObject(s);
+
+			for (uint32_t i = 0; i < _countof(pRows); i++)
+			{
+				if (i)
+					s.get_Hash(s.m_Prev);
+				s.m_Height = Rules::HeightGenesis + i;
+				s.m_ChainWork = i;
+				pRows[i] = db.InsertState(s);
+			}
+
+			db.SetStateBlock(pRows[0], bBodyP, bBodyE);
+			db.SetStateBlock(pRows[1], bBodyP2, bEmpty);
+
+			verify_test(db.GetStateBlockMapped(pRows[0], bP, bE));
+			verify_test((bP.n == 4) && !memcmp(bP.p, "body", 4));
+			verify_test((bE.n == 3) && !memcmp(bE.p, "abc", 3));
+
+			db.GetStateBlock(pRows[1], &bbP, &bbE, NULL);
+			verify_test((bbP.size() == 5) && !memcmp(&bbP.front(), "body2", 5));
+			verify_test(bbE.empty());
+
+			tr.Commit();
+		}
+
+		{
+			// regular mode: bodies in the segments are still readable, new ones go to the DB
+			NodeDB db;
+			db.Open(sz);
+
+			db.GetStateBlock(pRows[0], &bbP, &bbE, NULL);
+			verify_test((bbP.size() == 4) && (bbE.size() == 3));
+
+			db.DelStateBlockAll(pRows[0]);
+			verify_test(!db.GetStateBlockMapped(pRows[0], bP, bE));
+
+			bbP.clear();
+			bbE.clear();
+			db.GetStateBlock(pRows[0], &bbP, &bbE, NULL);
+			verify_test(bbP.empty() && bbE.empty());
+
+			db.SetStateBlock(pRows[0], bBodyP, bBodyE);
+			verify_test(!db.GetStateBlockMapped(pRows[0], bP, bE));
+
+			db.GetStateBlock(pRows[0], &bbP, &bbE, NULL);
+			verify_test((bbP.size() == 4) && (bbE.size() == 3));
+		}
+
+		{
+			// appended after the existing bodies
+			NodeDB db;
+			db.Open(sz, true);
+
+			db.SetStateBlock(pRows[0], bBodyP2, bBodyE);
+			verify_test(db.GetStateBlockMapped(pRows[0], bP, bE));
+			verify_test((bP.n == 5) && !memcmp(bP.p, "body2", 5));
+
+			verify_test(db.GetStateBlockMapped(pRows[1], bP, bE));
+			verify_test((bP.n == 5) && !memcmp(bP.p, "body2", 5) && !bE.n);
+		}
+
+		const uint32_t nBig = 6;
+
+		{
+			// bodies bigger than half a segment (64MB), each in its own. Only the recently used segments remain mapped after commit
+			uint64_t pRowsBig[nBig];
+			ByteBuffer bbBig(40 << 20);
+
+			NodeDB db;
+			db.Open(sz, true);
+			NodeDB::Transaction tr(db);
+
+			Block::SystemState::Full s;
+			ZeroObject(s);
+
+			for (uint32_t i = 0; i < nBig; i++)
+			{
+				s.m_Height = Rules::HeightGenesis + 10 + i;
+				pRowsBig[i] = db.InsertState(s);
+
+				bbBig.front() = static_cast<uint8_t>(i);
+				db.SetStateBlock(pRowsBig[i], bbBig, bEmpty);
+			}
+
+			verify_test(db.get_BodySegmentsMapped() == nBig);
+			tr.Commit();
+			verify_test(db.get_BodySegmentsMapped() < nBig);
+
+			// unmapped are mapped again on demand
+			for (uint32_t i = 0; i < nBig; i++)
+			{
+				verify_test(db.GetStateBlockMapped(pRowsBig[i], bP, bE));
+				verify_test((bP.n == bbBig.size()) && (*static_cast<const uint8_t*>(bP.p) == i) && !bE.n);
+			}
+
+			tr.Start(db);
+			for (uint32_t i = 0; i < nBig; i++)
+				db.DelStateBlockAll(pRowsBig[i]);
+			tr.Commit();
+
+			verify_test(db.get_BodySegmentsMapped() < nBig);
+		}
+
+		{
+			// a truncated segment, still referenced. Must not be read as zeroes
+			std::FStream fs;
+			verify_test(fs.Open((std::string(sz) + ".body0").c_str(), false, true));
+			fs.Close();
+
+			NodeDB db;
+			db.Open(sz, true);
+
+			bool bThrown = false;
+			try {
+				db.GetStateBlockMapped(pRows[1], bP, bE);
+			}
+			catch (const std::exception&) {
+				bThrown = true;
+			}
+			verify_test(bThrown);
+		}
+
+		for (uint32_t i = 0; i < nBig; i++)
+			DeleteFile((std::string(sz) + ".body" + std::to_string(i)).c_str());
+	}
+
 	void TestNodeDB()
 	{
 		TestNodeDB(g_sz); // will create
@@ -562,6 +703,8 @@ namespace beam
 			NodeDB db;
 			db.Open(g_sz); // test to open already-existing DB
 		}
+
+		TestNodeDBBodies(g_sz2);
 	}
 
 	struct MiniWallet
@@ -654,6 +797,36 @@ namespace beam
 		typedef std::vector<MyKernel> KernelList;
 		KernelList m_MyKernels;
 
+		void MakeTxAlternative(Transaction::Ptr& pTx, const MyUtxo& utxo, Amount fee)
+		{
+			// spends the same utxo as some other tx. The result isn't tracked by the wallet
+			pTx = std::make_shared<Transaction>();
+
+			ECC::Scalar::Native kOffset = Zero;
+			ToInput(utxo, *pTx, kOffset);
+
+			MyUtxo utxoOut;
+			utxoOut.m_Kidv.m_Value = utxo.m_Kidv.m_Value - fee;
+			utxoOut.m_Kidv.m_Idx = ++m_nRunningIndex;
+			utxoOut.m_Kidv.m_SubIdx = 0;
+			utxoOut.m_Kidv.m_Type = Key::Type::Regular;
+			ToOutput(utxoOut, *pTx, kOffset, 0);
+
+			MyKernel mk;
+			mk.m_Fee = fee;
+			mk.m_bUseHashlock = false;
+			m_pKdf->DeriveKey(mk.m_k, Key::ID(++m_nRunningIndex, Key::Type::Kernel));
+
+			TxKernel::Ptr pKrn;
+			mk.Export(pKrn);
+			pTx->m_vKernels.push_back(std::move(pKrn));
+
+			kOffset += -mk.m_k;
+			pTx->m_Offset = kOffset;
+
+			pTx->Normalize();
+		}
+
 		bool MakeTx(Transaction::Ptr& pTx, Height h, Height hIncubation)
 		{
 			Amount val = MakeTxInput(pTx, h);
@@ -766,15 +939,56 @@ namespace beam
 
 		const Height hIncubation = 3; // artificial incubation period for outputs.
 
+		NodeProcessor::BlockTemplate bt;
+
+		auto fnInPool = [&np](const Transaction::KeyType& key) {
+			for (TxPool::Fluff::TxSet::iterator it = np.m_TxPool.m_setTxs.begin(); np.m_TxPool.m_setTxs.end() != it; it++)
+				if (it->m_Key == key)
+					return true;
+			return false;
+		};
+
 		for (Height h = Rules::HeightGenesis; h < 96 + Rules::HeightGenesis; h++)
 		{
+			std::vector<Transaction::KeyType> vAlt;
+			uint32_t nTxs = 0;
+
+			if (h & 1)
+			{
+				// build the template on the new tip before the txs arrive, they'll be appended to it
+				NodeProcessor::BlockContext bc(np.m_TxPool, 0, *np.m_Wallet.m_pKdf, *np.m_Wallet.m_pKdf);
+				verify_test(np.GenerateNewBlock(bc, bt));
+			}
+
 			while (true)
 			{
+				MiniWallet::MyUtxo utxo;
+				if (!np.m_Wallet.m_MyUtxos.empty())
+					utxo = np.m_Wallet.m_MyUtxos.begin()->second;
+
 				// Spend it in a transaction
 				Transaction::Ptr pTx;
 				if (!np.m_Wallet.MakeTx(pTx, np.m_Cursor.m_ID.m_Height, hIncubation))
 					break;
 
+				if (!(nTxs++ % 4) && (utxo.m_Kidv.m_Value > 100))
+				{
+					// lower-fee double-spend. Must not be selected along with the original, but must stay in the pool until the block is applied
+					Transaction::Ptr pAlt;
+					np.m_Wallet.MakeTxAlternative(pAlt, utxo, 100);
+
+					Transaction::Context ctx;
+					ctx.m_Height.m_Min = ctx.m_Height.m_Max = np.m_Cursor.m_Sid.m_Height + 1;
+					verify_test(pAlt->IsValid(ctx));
+					verify_test(np.ValidateTxContext(*pAlt));
+
+					Transaction::KeyType key;
+					pAlt->get_Key(key);
+					vAlt.push_back(key);
+
+					np.m_TxPool.AddValidTx(std::move(pAlt), ctx, key);
+				}
+
 				verify_test(np.ValidateTxContext(*pTx));
 				verify_test(np.ValidateTxWrtHeight(*pTx));
 
@@ -789,7 +1003,23 @@ namespace beam
 			}
 
 			NodeProcessor::BlockContext bc(np.m_TxPool, 0, *np.m_Wallet.m_pKdf, *np.m_Wallet.m_pKdf);
-			verify_test(np.GenerateNewBlock(bc));
+			verify_test((h & 1) ? np.GenerateNewBlock(bc, bt) : np.GenerateNewBlock(bc));
+
+			if (h & 1)
+			{
+				// nothing new in the pool - the same block is returned, only the timestamp is refreshed. Mine this one
+				NodeProcessor::BlockContext bc2(np.m_TxPool, 0, *np.m_Wallet.m_pKdf, *np.m_Wallet.m_pKdf);
+				verify_test(np.GenerateNewBlock(bc2, bt));
+
+				verify_test((bc2.m_BodyP == bc.m_BodyP) && (bc2.m_BodyE == bc.m_BodyE) && (bc2.m_Fees == bc.m_Fees));
+				verify_test((bc2.m_Hdr.m_Height == bc.m_Hdr.m_Height) && (bc2.m_Hdr.m_Definition == bc.m_Hdr.m_Definition) && (bc2.m_Hdr.m_Kernels == bc.m_Hdr.m_Kernels));
+				verify_test(bc2.m_Hdr.m_TimeStamp >= bc.m_Hdr.m_TimeStamp);
+
+				bc.m_Hdr = bc2.m_Hdr;
+			}
+
+			for (size_t i = 0; i < vAlt.size(); i++)
+				verify_test(fnInPool(vAlt[i]));
 
 			np.OnState(bc.m_Hdr, PeerID());
 
@@ -798,6 +1028,14 @@ namespace beam
 
 			np.OnBlock(id, bc.m_BodyP, bc.m_BodyE, PeerID());
 
+			// only the txs that conflict with the block should be revalidated and evicted. All the survivors must still be valid
+			np.DeleteOutdated(np.m_TxPool);
+			for (TxPool::Fluff::ProfitSet::iterator it = np.m_TxPool.m_setProfit.begin(); np.m_TxPool.m_setProfit.end() != it; it++)
+				verify_test(np.ValidateTxContext(*it->get_ParentObj().m_pValue));
+
+			for (size_t i = 0; i < vAlt.size(); i++)
+				verify_test(!fnInPool(vAlt[i]));
+
 			np.m_Wallet.AddMyUtxo(Key::IDV(bc.m_Fees, h, Key::Type::Comission));
 			np.m_Wallet.AddMyUtxo(Key::IDV(Rules::get_Emission(h), h, Key::Type::Coinbase));
 
@@ -889,13 +1127,118 @@ namespace beam
 
 
 		// NodeProcessor
-		virtual void RequestData(const Block::SystemState::ID&, bool bBlock, const PeerID* pPreferredPeer) override {}
+		virtual void RequestData(const Block::SystemState::ID&, bool bBlock, const PeerID* pPreferredPeer, const NodeDB::StateID& sidTrg) override {}
 		virtual void OnPeerInsane(const PeerID&) override {}
 		virtual void OnNewState() override {}
 		virtual void AdjustFossilEnd(Height& h) override { h = 0; } // don't fossile anything, since we're not creating macroblocks
 
 	};
 
+	class MyNodeProcessorAsync
+		:public MyNodeProcessor2
+	{
+	public:
+
+		std::vector<std::pair<uint64_t, bool> > m_vVerified;
+
+		virtual bool VerifyBlockAsync(uint64_t rowid, Height h, const Blob& bodyP, const Blob& bodyE) override
+		{
+			m_vVerified.emplace_back(rowid, VerifyBlockContextFree(bodyP, bodyE, h));
+			return true;
+		}
+
+		void CompleteVerification()
+		{
+			std::vector<std::pair<uint64_t, bool> > v;
+			v.swap(m_vVerified);
+
+			for (size_t i = 0; i < v.size(); i++)
+				OnBlockVerified(v[i].first, v[i].second);
+		}
+	};
+
+	void TestAsyncVerdicts(const std::vector<BlockPlus::Ptr>& blockChain)
+	{
+		// The verdicts of the blocks that are never applied must be dropped once their states are pruned
+		MyNodeProcessorAsync np;
+		np.m_Horizon.m_Branching = 12;
+		np.m_Horizon.m_Schwarzschild = 12;
+		np.Initialize(g_sz);
+		np.OnTreasury(g_Treasury);
+
+		PeerID peer;
+		ZeroObject(peer);
+
+		const size_t iFork = 5;
+		const size_t iFork2 = iFork + 3;
+
+		for (size_t i = 0; i < blockChain.size(); i++)
+		{
+			const BlockPlus& b = *blockChain[i];
+
+			Block::SystemState::ID id;
+			b.m_Hdr.get_ID(id);
+
+			verify_test(NodeProcessor::DataStatus::Accepted == np.OnState(b.m_Hdr, peer));
+			verify_test(NodeProcessor::DataStatus::Accepted == np.OnBlock(id, b.m_BodyP, b.m_BodyE, peer));
+			np.CompleteVerification();
+
+			verify_test(np.m_Cursor.m_ID == id);
+
+			if (iFork + 1 == i)
+			{
+				// alternative branch of 2 blocks, only the body of the upper one is received. Won't be applied
+				Block::SystemState::Full s0 = blockChain[iFork]->m_Hdr;
+				s0.m_TimeStamp++;
+
+				Block::SystemState::Full s1 = b.m_Hdr;
+				s0.get_Hash(s1.m_Prev);
+				s1.m_TimeStamp++;
+
+				verify_test(NodeProcessor::DataStatus::Accepted == np.OnState(s0, peer));
+				verify_test(NodeProcessor::DataStatus::Accepted == np.OnState(s1, peer));
+
+				s1.get_ID(id);
+				verify_test(NodeProcessor::DataStatus::Accepted == np.OnBlock(id, b.m_BodyP, b.m_BodyE, peer));
+				np.CompleteVerification();
+
+				verify_test(np.get_AsyncVerdictsCount() == 1);
+			}
+
+			if (iFork2 + 1 == i)
+			{
+				// alternative branch of 3 blocks, more chainwork. While its blocks are being verified - the current branch must be retained
+				Block::SystemState::Full pS[3];
+				for (uint32_t j = 0; j < _countof(pS); j++)
+				{
+					pS[j] = blockChain[iFork2 + j]->m_Hdr;
+					pS[j].m_TimeStamp++;
+					if (j)
+						pS[j - 1].get_Hash(pS[j].m_Prev);
+
+					verify_test(NodeProcessor::DataStatus::Accepted == np.OnState(pS[j], peer));
+				}
+
+				Block::SystemState::ID idTip = id;
+
+				for (uint32_t j = 0; j < _countof(pS); j++)
+				{
+					const BlockPlus& bAlt = *blockChain[iFork2 + j];
+					pS[j].get_ID(id);
+					verify_test(NodeProcessor::DataStatus::Accepted == np.OnBlock(id, bAlt.m_BodyP, bAlt.m_BodyE, peer));
+					verify_test(np.m_Cursor.m_ID == idTip);
+				}
+
+				// the alternative branch is invalid above its 1st block (the headers don't match the bodies). Back to the original one
+				np.CompleteVerification();
+				verify_test(np.m_Cursor.m_ID == idTip);
+			}
+		}
+
+		verify_test(np.m_Cursor.m_ID.m_Height > iFork + 1 + np.m_Horizon.m_Branching);
+		verify_test(!np.get_AsyncVerdictsCount());
+	}
+
 
 	void TestNodeProcessor2(std::vector<BlockPlus::Ptr>& blockChain)
 	{
@@ -978,6 +1321,57 @@ namespace beam
 			}
 		}
 
+		{
+			// restart from the UTXO snapshot, saved on the previous shutdown
+			std::string sSnapshot = std::string(g_sz) + ".utxo";
+
+			Merkle::Hash hvDef;
+			{
+				MyNodeProcessor2 np;
+				np.m_Horizon = horz;
+				np.Initialize(g_sz);
+
+				verify_test(np.m_Cursor.m_ID.m_Height == blockChain.size() + Rules::HeightGenesis - 1);
+				hvDef = np.m_Cursor.m_Full.m_Definition;
+
+				// saved at the tip, nothing to interpret
+				verify_test(np.m_InitStats.m_UtxoSnapshot == np.m_Cursor.m_ID.m_Height);
+				verify_test(!np.m_InitStats.m_BlocksInterpreted);
+			}
+
+			std::FStream fs;
+			verify_test(fs.Open(sSnapshot.c_str(), true));
+			verify_test(fs.get_Remaining() > 0);
+			fs.Close();
+
+			// damaged snapshot must be ignored
+			verify_test(fs.Open(sSnapshot.c_str(), false));
+			fs.write(hvDef.m_pData, hvDef.nBytes);
+			fs.Close();
+
+			{
+				MyNodeProcessor2 np;
+				np.m_Horizon = horz;
+				np.m_UtxoSnapshot.m_Period = 1;
+				np.Initialize(g_sz);
+
+				verify_test(np.m_Cursor.m_Full.m_Definition == hvDef);
+				verify_test(!np.m_InitStats.m_UtxoSnapshot && np.m_InitStats.m_BlocksInterpreted);
+			}
+
+			{
+				// rewritten on shutdown
+				MyNodeProcessor2 np;
+				np.m_Horizon = horz;
+				np.Initialize(g_sz);
+
+				verify_test(np.m_Cursor.m_Full.m_Definition == hvDef);
+				verify_test(np.m_InitStats.m_UtxoSnapshot == np.m_Cursor.m_ID.m_Height);
+			}
+
+			DeleteFile(sSnapshot.c_str());
+		}
+
 		{
 			MyNodeProcessor2 np;
 			np.m_Horizon = horz;
@@ -986,6 +1380,108 @@ namespace beam
 
 	}
 
+	void TestHeadersPack()
+	{
+		// Headers sync: the same chain fed one-by-one and in packs. PoW is fake in this test, so it checks the results only, not the throughput
+		const uint32_t nPacks = 40;
+		const uint32_t nCount = nPacks * proto::g_HdrPackMaxSize;
+
+		std::vector<Block::SystemState::Full> vStates(nCount);
+		memset0(&vStates.front(), sizeof(vStates.front()) * vStates.size());
+
+		for (uint32_t i = 0; i < nCount; i++)
+		{
+			Block::SystemState::Full& s = vStates[i];
+			if (i)
+			{
+				s = vStates[i - 1];
+				s.NextPrefix();
+			}
+			else
+			{
+				s.m_Height = Rules::HeightGenesis;
+				s.m_Prev = Rules::get().Prehistoric;
+				s.m_PoW.m_Difficulty = Rules::get().StartDifficulty;
+				s.m_TimeStamp = getTimestamp() - nCount;
+			}
+
+			s.m_ChainWork += s.m_PoW.m_Difficulty;
+			s.m_TimeStamp++;
+		}
+
+		PeerID peer;
+		ZeroObject(peer);
+
+		std::vector<proto::HdrPack> vPacks(nPacks);
+		for (uint32_t iPack = 0; iPack < nPacks; iPack++)
+		{
+			const Block::SystemState::Full* pS = &vStates[iPack * proto::g_HdrPackMaxSize];
+
+			proto::HdrPack& msg = vPacks[iPack];
+			msg.m_Prefix = pS[0];
+			msg.m_vElements.resize(proto::g_HdrPackMaxSize);
+
+			for (uint32_t i = 0; i < proto::g_HdrPackMaxSize; i++)
+				msg.m_vElements[proto::g_HdrPackMaxSize - i - 1] = pS[i];
+		}
+
+		{
+			MyNodeProcessor2 np;
+			np.Initialize(g_sz);
+
+			for (uint32_t iPack = nPacks; iPack--; )
+			{
+				// expand and feed one-by-one
+				const proto::HdrPack& msg = vPacks[iPack];
+
+				Block::SystemState::Full s;
+				Cast::Down<Block::SystemState::Sequence::Prefix>(s) = msg.m_Prefix;
+				Cast::Down<Block::SystemState::Sequence::Element>(s) = msg.m_vElements.back();
+
+				for (size_t i = msg.m_vElements.size(); ; )
+				{
+					verify_test(NodeProcessor::DataStatus::Accepted == np.OnState(s, peer));
+
+					if (!--i)
+						break;
+
+					s.NextPrefix();
+					Cast::Down<Block::SystemState::Sequence::Element>(s) = msg.m_vElements[i - 1];
+					s.m_ChainWork += s.m_PoW.m_Difficulty;
+				}
+			}
+		}
+
+		{
+			MyNodeProcessor2 np;
+			np.Initialize(g_sz2);
+
+			for (uint32_t iPack = nPacks; iPack--; )
+			{
+				const Block::SystemState::Full* pS = &vStates[iPack * proto::g_HdrPackMaxSize];
+				const proto::HdrPack& msg = vPacks[iPack];
+
+				bool bInvalid = true;
+				Block::SystemState::ID idTop, idTopRef;
+				pS[proto::g_HdrPackMaxSize - 1].get_ID(idTopRef);
+
+				verify_test(np.OnStatePack(msg.m_Prefix, msg.m_vElements, peer, bInvalid, idTop) == proto::g_HdrPackMaxSize);
+				verify_test(!bInvalid);
+				verify_test(idTop == idTopRef);
+			}
+
+			// all the headers are already known
+			proto::HdrPack msg;
+			msg.m_Prefix = vStates[0];
+			msg.m_vElements.push_back(vStates[0]);
+
+			bool bInvalid = true;
+			Block::SystemState::ID idTop;
+			verify_test(!np.OnStatePack(msg.m_Prefix, msg.m_vElements, peer, bInvalid, idTop));
+			verify_test(!bInvalid);
+		}
+	}
+
 	const uint16_t g_Port = 25003; // don't use the default port to prevent collisions with running nodes, beacons and etc.
 
 	void TestNodeConversation()
@@ -995,122 +1491,560 @@ namespace beam
 		io::Reactor::Ptr pReactor(io::Reactor::create());
 		io::Reactor::Scope scope(*pReactor);
 
-		Node node, node2;
-		node.m_Cfg.m_sPathLocal = g_sz;
-		node.m_Cfg.m_Listen.port(g_Port);
-		node.m_Cfg.m_Listen.ip(INADDR_ANY);
-		node.m_Cfg.m_Sync.m_SrcPeers = 0;
-		node.m_Cfg.m_Treasury = g_Treasury;
+		Node node, node2;
+		node.m_Cfg.m_sPathLocal = g_sz;
+		node.m_Cfg.m_Listen.port(g_Port);
+		node.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node.m_Cfg.m_Sync.m_SrcPeers = 0;
+		node.m_Cfg.m_Treasury = g_Treasury;
+
+		node.m_Cfg.m_Timeout.m_GetBlock_ms = 1000 * 60;
+		node.m_Cfg.m_Timeout.m_GetState_ms = 1000 * 60;
+		node.m_Cfg.m_BodyStore = true; // its blocks are served from the mapped segments
+
+		node2.m_Cfg.m_sPathLocal = g_sz2;
+		node2.m_Cfg.m_Listen.port(g_Port + 1);
+		node2.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node2.m_Cfg.m_Timeout = node.m_Cfg.m_Timeout;
+		node2.m_Cfg.m_Sync.m_SrcPeers = 0;
+		node2.m_Cfg.m_Treasury = g_Treasury;
+
+		node2.m_Cfg.m_BeaconPort = g_Port;
+		node2.m_Cfg.m_BlockValidationThreads = 2; // received blocks are verified in background
+
+		ECC::SetRandom(node);
+		ECC::SetRandom(node2);
+
+		node.Initialize();
+		node2.Initialize();
+
+		struct MyClient
+			:public proto::NodeConnection
+		{
+			Node* m_ppNode[2];
+			unsigned int m_iNode;
+			unsigned int m_WaitingCycles;
+
+			Height m_HeightMax;
+			const Height m_HeightTrg = 70;
+
+			MyClient()
+			{
+				m_pTimer = io::Timer::create(io::Reactor::get_Current());
+			}
+
+			virtual void OnConnectedSecure() override {
+				OnTimer();
+			}
+
+			virtual void OnDisconnect(const DisconnectReason&) override {
+				fail_test("OnDisconnect");
+			}
+
+			io::Timer::Ptr m_pTimer;
+
+			void OnTimer() {
+
+
+				if (m_HeightMax < m_HeightTrg)
+				{
+					Node& n = *m_ppNode[m_iNode];
+
+					TxPool::Fluff txPool; // empty, no transactions
+					NodeProcessor::BlockContext bc(txPool, 0, *n.m_Keys.m_pMiner, *n.m_Keys.m_pMiner);
+
+					verify_test(n.get_Processor().GenerateNewBlock(bc));
+
+					n.get_Processor().OnState(bc.m_Hdr, PeerID());
+
+					Block::SystemState::ID id;
+					bc.m_Hdr.get_ID(id);
+
+					n.get_Processor().OnBlock(id, bc.m_BodyP, bc.m_BodyE, PeerID());
+
+					m_HeightMax = std::max(m_HeightMax, bc.m_Hdr.m_Height);
+
+					printf("Mined block Height = %u, node = %u \n", (unsigned int) bc.m_Hdr.m_Height, (unsigned int)m_iNode);
+
+					++m_iNode %= _countof(m_ppNode);
+				}
+				else
+					if (m_WaitingCycles++ > 60)
+					{
+						fail_test("Blockchain height didn't reach target");
+						io::Reactor::get_Current().stop();
+					}
+
+				SetTimer(100);
+			}
+
+			virtual void OnMsg(proto::NewTip&& msg) override
+			{
+				printf("Tip Height=%u\n", (unsigned int) msg.m_Description.m_Height);
+				verify_test(msg.m_Description.m_Height <= m_HeightMax);
+				if (msg.m_Description.m_Height == m_HeightTrg)
+					io::Reactor::get_Current().stop();
+			}
+
+			void SetTimer(uint32_t timeout_ms) {
+				m_pTimer->start(timeout_ms, false, [this]() { return (this->OnTimer)(); });
+			}
+		};
+
+		MyClient cl;
+		cl.m_iNode = 0;
+		cl.m_HeightMax = 0;
+		cl.m_WaitingCycles = 0;
+		cl.m_ppNode[0] = &node;
+		cl.m_ppNode[1] = &node2;
+
+		io::Address addr;
+		addr.resolve("127.0.0.1");
+		addr.port(g_Port + 1);
+
+		cl.Connect(addr);
+
+
+		pReactor->run();
+	}
+
+
+
+	void TestNodeBodyPacks(bool bSrcPacks)
+	{
+		// Node <- Node2. Node2 syncs the blocks mined by Node. If Node doesn't support packs (like older nodes) - it disconnects on GetBodyPack
+		io::Reactor::Ptr pReactor(io::Reactor::create());
+		io::Reactor::Scope scope(*pReactor);
+
+		const Height hTrg = 30;
+
+		Node node;
+		node.m_Cfg.m_sPathLocal = g_sz;
+		node.m_Cfg.m_Listen.port(g_Port);
+		node.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node.m_Cfg.m_BodyPacks = bSrcPacks;
+		node.m_Cfg.m_Treasury = g_Treasury;
+
+		ECC::SetRandom(node);
+		node.Initialize();
+
+		for (Height h = 0; h < hTrg; h++)
+		{
+			TxPool::Fluff txPool;
+			NodeProcessor::BlockContext bc(txPool, 0, *node.m_Keys.m_pMiner, *node.m_Keys.m_pMiner);
+			verify_test(node.get_Processor().GenerateNewBlock(bc));
+
+			Block::SystemState::ID id;
+			bc.m_Hdr.get_ID(id);
+
+			verify_test(NodeProcessor::DataStatus::Accepted == node.get_Processor().OnState(bc.m_Hdr, PeerID()));
+			verify_test(NodeProcessor::DataStatus::Accepted == node.get_Processor().OnBlock(id, bc.m_BodyP, bc.m_BodyE, PeerID()));
+		}
+
+		verify_test(node.get_Processor().m_Cursor.m_ID.m_Height == hTrg);
+
+		Node node2;
+		node2.m_Cfg.m_sPathLocal = g_sz2;
+		node2.m_Cfg.m_Connect.resize(1);
+		node2.m_Cfg.m_Connect[0].resolve("127.0.0.1");
+		node2.m_Cfg.m_Connect[0].port(g_Port);
+		node2.m_Cfg.m_Sync.m_Timeout_ms = 0; // sync immediately after seeing 1st peer
+		node2.m_Cfg.m_Treasury = g_Treasury;
+
+		ECC::SetRandom(node2);
+		node2.Initialize();
+
+		uint32_t nCycles = 0;
+		io::Timer::Ptr pTimer = io::Timer::create(*pReactor);
+		pTimer->start(100, true, [&]() {
+			if ((node2.get_Processor().m_Cursor.m_ID.m_Height >= hTrg) || (++nCycles > 300))
+				io::Reactor::get_Current().stop();
+		});
+
+		pReactor->run();
+
+		verify_test(node2.get_Processor().m_Cursor.m_ID.m_Height == hTrg);
+
+		const Node::BodyStats& bs = node2.get_BodyStats();
+		printf("Blocks received in packs: %u, individually: %u\n", (unsigned int) bs.m_PackBlocks, (unsigned int) bs.m_Single);
+		if (bSrcPacks)
+			verify_test(bs.m_Packs && (bs.m_PackBlocks > bs.m_Packs));
+		else
+			verify_test(!bs.m_Packs && (bs.m_Single >= hTrg)); // fallback to individual blocks
+	}
+
+	void TestNodeTxBatch(int nVerificationThreads)
+	{
+		// Testing configuration: Node <-> Client. Client sends a burst of fluff txs, some of them are invalid
+
+		io::Reactor::Ptr pReactor(io::Reactor::create());
+		io::Reactor::Scope scope(*pReactor);
+
+		Node node;
+		node.m_Cfg.m_sPathLocal = g_sz;
+		node.m_Cfg.m_Listen.port(g_Port);
+		node.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node.m_Cfg.m_VerificationThreads = nVerificationThreads;
+		node.m_Cfg.m_Timeout.m_TxBatch_ms = 100;
+
+		ECC::SetRandom(node);
+		node.Initialize();
+
+		struct MyClient
+			:public proto::NodeConnection
+		{
+			const uint32_t m_nTxs = 12;
+			uint32_t m_nValid = 0;
+			uint32_t m_nAdvertised = 0;
+			bool m_bLoggedIn = false;
+
+			io::Timer::Ptr m_pTimer;
+
+			MyClient()
+			{
+				m_pTimer = io::Timer::create(io::Reactor::get_Current());
+			}
+
+			virtual void OnConnectedSecure() override
+			{
+				proto::Login msg;
+				msg.m_CfgChecksum = Rules::get().Checksum;
+				Send(msg);
+
+				for (uint32_t i = 0; i < m_nTxs; i++)
+				{
+					// kernel-only tx
+					ECC::Scalar::Native sk;
+					ECC::SetRandom(sk);
+
+					TxKernel::Ptr pKrn(new TxKernel);
+					pKrn->Sign(sk);
+
+					bool bValid = (i % 5) != 3;
+					if (bValid)
+						m_nValid++;
+					else
+						pKrn->m_Signature.m_k.m_Value.m_pData[0] ^= 0x10; // still a valid scalar, but a wrong signature
+
+					proto::NewTransaction msgTx;
+					msgTx.m_Fluff = true;
+					msgTx.m_Transaction.reset(new Transaction);
+					msgTx.m_Transaction->m_Offset = -sk;
+					msgTx.m_Transaction->m_vKernels.push_back(std::move(pKrn));
+					msgTx.m_Transaction->Normalize();
+
+					Send(msgTx);
+				}
+
+				m_pTimer->start(1000, false, [this]() { OnTimer(); });
+			}
+
+			void OnTimer()
+			{
+				if (m_bLoggedIn)
+				{
+					fail_test("Tx batch test timeout");
+					io::Reactor::get_Current().stop();
+					return;
+				}
+
+				// the batch must have been verified by now. Request the pool contents
+				m_bLoggedIn = true;
+
+				proto::Login msg;
+				msg.m_CfgChecksum = Rules::get().Checksum;
+				msg.m_Flags = proto::LoginFlags::SpreadingTransactions;
+				Send(msg);
+
+				Send(proto::GetTime(Zero));
+
+				m_pTimer->start(5000, false, [this]() { OnTimer(); });
+			}
+
+			virtual void OnMsg(proto::HaveTransaction&&) override
+			{
+				m_nAdvertised++;
+			}
+
+			virtual void OnMsg(proto::Time&&) override
+			{
+				verify_test(m_bLoggedIn);
+				verify_test(m_nAdvertised == m_nValid);
+				io::Reactor::get_Current().stop();
+			}
+
+			virtual void OnDisconnect(const DisconnectReason&) override {
+				fail_test("OnDisconnect");
+				io::Reactor::get_Current().stop();
+			}
+		};
+
+		MyClient cl;
+
+		io::Address addr;
+		addr.resolve("127.0.0.1");
+		addr.port(g_Port);
+
+		cl.Connect(addr);
+
+		pReactor->run();
+	}
+
+	void TestNodeCompact()
+	{
+		// Node --> Node2 --> Client. Node2 gets its txs from the client, and the new tip blocks from Node in a compact form.
+		// The blocks are generated directly from the chosen txs, so that Node doesn't remember what to prefill.
+		//	1st block: one of its txs isn't in the Node2 pool, its kernel is requested.
+		//	2nd block: its output collides (same commitment) with the one of a different tx in the Node2 pool. The full body is requested.
+		io::Reactor::Ptr pReactor(io::Reactor::create());
+		io::Reactor::Scope scope(*pReactor);
+
+		Node node;
+		node.m_Cfg.m_sPathLocal = g_sz;
+		node.m_Cfg.m_Listen.port(g_Port);
+		node.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node.m_Cfg.m_Treasury = g_Treasury;
+
+		ECC::SetRandom(node);
+		node.Initialize();
+
+		Key::IKdf::Ptr pKdf;
+		ECC::SetRandom(pKdf);
+
+		auto fnAddTx = [&node](TxPool::Fluff& txp, const Transaction::Ptr& pTx)
+		{
+			Transaction::Context ctx;
+			ctx.m_Height.m_Min = ctx.m_Height.m_Max = node.get_Processor().m_Cursor.m_ID.m_Height + 1;
+			verify_test(pTx->IsValid(ctx));
+
+			Transaction::KeyType key;
+			pTx->get_Key(key);
+
+			Transaction::Ptr pVal = pTx;
+			txp.AddValidTx(std::move(pVal), ctx, key);
+		};
+
+		auto fnMine = [&node](TxPool::Fluff& txp)
+		{
+			NodeProcessor::BlockContext bc(txp, 0, *node.m_Keys.m_pMiner, *node.m_Keys.m_pMiner);
+			verify_test(node.get_Processor().GenerateNewBlock(bc));
+
+			Block::SystemState::ID id;
+			bc.m_Hdr.get_ID(id);
+
+			verify_test(NodeProcessor::DataStatus::Accepted == node.get_Processor().OnState(bc.m_Hdr, PeerID()));
+			verify_test(NodeProcessor::DataStatus::Accepted == node.get_Processor().OnBlock(id, bc.m_BodyP, bc.m_BodyE, PeerID()));
+		};
+
+		auto fnTxKrn = []() -> Transaction::Ptr
+		{
+			ECC::Scalar::Native sk;
+			ECC::SetRandom(sk);
+
+			TxKernel::Ptr pKrn(new TxKernel);
+			pKrn->Sign(sk);
+
+			Transaction::Ptr pTx(new Transaction);
+			pTx->m_Offset = -sk;
+			pTx->m_vKernels.push_back(std::move(pKrn));
+			pTx->Normalize();
+			return pTx;
+		};
+
+		auto fnTxOutp = [&pKdf](Height hIncubation) -> Transaction::Ptr
+		{
+			// the commitment depends only on the kidv. Different incubation - different output with the same short ID
+			ECC::Scalar::Native sk, skKrn;
+
+			Output::Ptr pOutp(new Output);
+			pOutp->m_Incubation = hIncubation;
+			pOutp->Create(sk, *pKdf, Key::IDV(0, 1, Key::Type::Regular), *pKdf); // zero value, must be confidential
+
+			ECC::SetRandom(skKrn);
+			TxKernel::Ptr pKrn(new TxKernel);
+			pKrn->Sign(skKrn);
+
+			sk += skKrn;
+			sk = -sk;
+
+			Transaction::Ptr pTx(new Transaction);
+			pTx->m_Offset = sk;
+			pTx->m_vOutputs.push_back(std::move(pOutp));
+			pTx->m_vKernels.push_back(std::move(pKrn));
+			pTx->Normalize();
+			return pTx;
+		};
 
-		node.m_Cfg.m_Timeout.m_GetBlock_ms = 1000 * 60;
-		node.m_Cfg.m_Timeout.m_GetState_ms = 1000 * 60;
+		{
+			TxPool::Fluff txp;
+			fnMine(txp);
+		}
 
+		Node node2;
 		node2.m_Cfg.m_sPathLocal = g_sz2;
 		node2.m_Cfg.m_Listen.port(g_Port + 1);
 		node2.m_Cfg.m_Listen.ip(INADDR_ANY);
-		node2.m_Cfg.m_Timeout = node.m_Cfg.m_Timeout;
-		node2.m_Cfg.m_Sync.m_SrcPeers = 0;
+		node2.m_Cfg.m_Connect.resize(1);
+		node2.m_Cfg.m_Connect[0].resolve("127.0.0.1");
+		node2.m_Cfg.m_Connect[0].port(g_Port);
+		node2.m_Cfg.m_Sync.m_Timeout_ms = 0;
 		node2.m_Cfg.m_Treasury = g_Treasury;
 
-		node2.m_Cfg.m_BeaconPort = g_Port;
-
-		ECC::SetRandom(node);
 		ECC::SetRandom(node2);
-
-		node.Initialize();
 		node2.Initialize();
 
 		struct MyClient
 			:public proto::NodeConnection
 		{
-			Node* m_ppNode[2];
-			unsigned int m_iNode;
-			unsigned int m_WaitingCycles;
+			// The node doesn't advertise the tx back to its originator. Query the whole pool instead: re-login with SpreadingTransactions
+			std::set<Transaction::KeyType> m_setPool;
+			bool m_bQuerying = true;
 
-			Height m_HeightMax;
-			const Height m_HeightTrg = 70;
+			void Login(uint8_t nFlags)
+			{
+				proto::Login msg;
+				msg.m_CfgChecksum = Rules::get().Checksum;
+				msg.m_Flags = nFlags;
+				Send(msg);
+			}
 
-			MyClient()
+			virtual void OnConnectedSecure() override
 			{
-				m_pTimer = io::Timer::create(io::Reactor::get_Current());
+				Login(0);
+				m_bQuerying = false;
 			}
 
-			virtual void OnConnectedSecure() override {
-				OnTimer();
+			virtual void OnMsg(proto::HaveTransaction&& msg) override
+			{
+				m_setPool.insert(msg.m_ID);
+			}
+
+			virtual void OnMsg(proto::Time&&) override
+			{
+				m_bQuerying = false;
 			}
 
 			virtual void OnDisconnect(const DisconnectReason&) override {
 				fail_test("OnDisconnect");
+				io::Reactor::get_Current().stop();
 			}
 
-			io::Timer::Ptr m_pTimer;
+			void SendTx(const Transaction::Ptr& pTx)
+			{
+				proto::NewTransaction msg;
+				msg.m_Fluff = true;
+				msg.m_Transaction = pTx;
+				Send(msg);
+			}
 
-			void OnTimer() {
+			bool IsInPool(const Transaction& tx)
+			{
+				if (m_bQuerying)
+					return false;
 
+				Transaction::KeyType key;
+				tx.get_Key(key);
+				if (m_setPool.end() != m_setPool.find(key))
+					return true;
 
-				if (m_HeightMax < m_HeightTrg)
-				{
-					Node& n = *m_ppNode[m_iNode];
+				m_setPool.clear();
+				m_bQuerying = true;
 
-					TxPool::Fluff txPool; // empty, no transactions
-					NodeProcessor::BlockContext bc(txPool, 0, *n.m_Keys.m_pMiner, *n.m_Keys.m_pMiner);
+				Login(0);
+				Login(proto::LoginFlags::SpreadingTransactions);
+				Send(proto::GetTime(Zero));
+				return false;
+			}
+		};
 
-					verify_test(n.get_Processor().GenerateNewBlock(bc));
+		MyClient cl;
 
-					n.get_Processor().OnState(bc.m_Hdr, PeerID());
+		io::Address addr;
+		addr.resolve("127.0.0.1");
+		addr.port(g_Port + 1);
 
-					Block::SystemState::ID id;
-					bc.m_Hdr.get_ID(id);
+		cl.Connect(addr);
 
-					n.get_Processor().OnBlock(id, bc.m_BodyP, bc.m_BodyE, PeerID());
+		Transaction::Ptr pTx0 = fnTxKrn();
+		Transaction::Ptr pTx1 = fnTxOutp(1);
 
-					m_HeightMax = std::max(m_HeightMax, bc.m_Hdr.m_Height);
+		uint32_t nPhase = 0, nCycles = 0;
+		io::Timer::Ptr pTimer = io::Timer::create(*pReactor);
+		pTimer->start(100, true, [&]() {
 
-					printf("Mined block Height = %u, node = %u \n", (unsigned int) bc.m_Hdr.m_Height, (unsigned int)m_iNode);
+			if (++nCycles > 300)
+			{
+				fail_test("Compact blocks test timeout");
+				io::Reactor::get_Current().stop();
+				return;
+			}
 
-					++m_iNode %= _countof(m_ppNode);
+			const Node::CompactStats& cs = node2.get_CompactStats();
+			Height h2 = node2.get_Processor().m_Cursor.m_ID.m_Height;
+
+			switch (nPhase)
+			{
+			case 0:
+				if (h2 != node.get_Processor().m_Cursor.m_ID.m_Height)
+					break;
+
+				cl.SendTx(pTx0);
+				nPhase++;
+				break;
+
+			case 1:
+				if (!cl.IsInPool(*pTx0))
+					break;
+
+				{
+					TxPool::Fluff txp;
+					fnAddTx(txp, pTx0);
+					fnAddTx(txp, fnTxKrn()); // Node2 doesn't have it
+					fnMine(txp);
 				}
-				else
-					if (m_WaitingCycles++ > 60)
-					{
-						fail_test("Blockchain height didn't reach target");
-						io::Reactor::get_Current().stop();
-					}
+				nPhase++;
+				break;
 
-				SetTimer(100);
-			}
+			case 2:
+				if (h2 != node.get_Processor().m_Cursor.m_ID.m_Height)
+					break;
 
-			virtual void OnMsg(proto::NewTip&& msg) override
-			{
-				printf("Tip Height=%u\n", (unsigned int) msg.m_Description.m_Height);
-				verify_test(msg.m_Description.m_Height <= m_HeightMax);
-				if (msg.m_Description.m_Height == m_HeightTrg)
-					io::Reactor::get_Current().stop();
-			}
+				// the coinbase kernel isn't prefilled either, since Node doesn't remember the block
+				verify_test((cs.m_Received == 1) && (cs.m_MissingRounds == 1) && (cs.m_ElementsMissing == 2));
+				verify_test((cs.m_Reconstructed == 1) && !cs.m_Fallback);
 
-			void SetTimer(uint32_t timeout_ms) {
-				m_pTimer->start(timeout_ms, false, [this]() { return (this->OnTimer)(); });
-			}
-		};
+				cl.SendTx(pTx1);
+				nPhase++;
+				break;
 
-		MyClient cl;
-		cl.m_iNode = 0;
-		cl.m_HeightMax = 0;
-		cl.m_WaitingCycles = 0;
-		cl.m_ppNode[0] = &node;
-		cl.m_ppNode[1] = &node2;
+			case 3:
+				if (!cl.IsInPool(*pTx1))
+					break;
 
-		io::Address addr;
-		addr.resolve("127.0.0.1");
-		addr.port(g_Port + 1);
+				{
+					Transaction::Ptr pTx = fnTxOutp(0);
+					verify_test(TxPool::Fluff::get_ShortID(*pTx->m_vOutputs[0]) == TxPool::Fluff::get_ShortID(*pTx1->m_vOutputs[0]));
 
-		cl.Connect(addr);
+					TxPool::Fluff txp;
+					fnAddTx(txp, pTx);
+					fnMine(txp);
+				}
+				nPhase++;
+				break;
 
+			case 4:
+				if (h2 != node.get_Processor().m_Cursor.m_ID.m_Height)
+					break;
 
-		pReactor->run();
-	}
+				verify_test((cs.m_Received == 2) && (cs.m_Fallback == 1) && (cs.m_Reconstructed == 1));
+				io::Reactor::get_Current().stop();
+			}
+		});
 
+		pReactor->run();
 
+		verify_test(node2.get_Processor().m_Cursor.m_ID.m_Height == 3);
+	}
 
 	void TestNodeClientProto()
 	{
@@ -1153,6 +2087,10 @@ namespace beam
 			uint32_t m_nChainWorkProofsPending = 0;
 			uint32_t m_nBbsMsgsPending = 0;
 			uint32_t m_nRecoveryPending = 0;
+			uint32_t m_nBodyPacksPending = 0;
+			Height m_hUtxoEventsNext = 0;
+			size_t m_nUtxoEventsStreamed = 0;
+			uint32_t m_UtxoEventsID = 0;
 			AssetID m_AssetEmitted = Zero;
 			bool m_bCustomAssetRecognized = false;
 
@@ -1182,7 +2120,14 @@ namespace beam
 				switch (msg.m_IDType)
 				{
 				case proto::IDType::Node:
-					ProveKdfObscured(*m_Wallet.m_pKdf, proto::IDType::Owner);
+					{
+						ProveKdfObscured(*m_Wallet.m_pKdf, proto::IDType::Owner);
+
+						proto::UtxoEventsSubscribe msgOut;
+						msgOut.m_ID = ++m_UtxoEventsID;
+						msgOut.m_Window = 1;
+						Send(msgOut);
+					}
 					break;
 
 				case proto::IDType::Viewer:
@@ -1230,7 +2175,7 @@ namespace beam
 
 			bool IsAllRecoveryReceived() const
 			{
-				return !m_nRecoveryPending;
+				return !m_nRecoveryPending && !m_nBodyPacksPending;
 			}
 
 			void OnTimer() {
@@ -1382,6 +2327,16 @@ namespace beam
 				Send(msgEvt);
 				m_nRecoveryPending++;
 
+				if (m_vStates.size() == 10)
+				{
+					// the last 4 blocks in a single response
+					proto::GetBodyPack msgPack;
+					m_vStates.back().get_ID(msgPack.m_Top);
+					msgPack.m_CountExtra = 3;
+					Send(msgPack);
+					m_nBodyPacksPending++;
+				}
+
 				if (!(msg.m_Description.m_Height % 4))
 				{
 					// switch offline/online mining modes
@@ -1496,6 +2451,17 @@ namespace beam
 				m_nChainWorkProofsPending--;
 			}
 
+			virtual void OnMsg(proto::BodyPack&& msg) override
+			{
+				verify_test(m_nBodyPacksPending);
+				verify_test(msg.m_Bodies.size() == 4);
+
+				for (size_t i = 0; i < msg.m_Bodies.size(); i++)
+					verify_test(!msg.m_Bodies[i].m_Perishable.empty());
+
+				m_nBodyPacksPending--;
+			}
+
 			virtual void OnMsg(proto::UtxoEvents&& msg) override
 			{
 				verify_test(m_nRecoveryPending);
@@ -1521,6 +2487,45 @@ namespace beam
 				}
 			}
 
+			virtual void OnMsg(proto::UtxoEventsPack&& msg) override
+			{
+				verify_test(msg.m_ID <= m_UtxoEventsID);
+				if (msg.m_ID != m_UtxoEventsID)
+					return; // previous subscription, not acknowledged
+
+				if (1 == m_UtxoEventsID)
+				{
+					// restart before acknowledging. The node must not wait for the ack of the previous subscription (the window is 1)
+					proto::UtxoEventsSubscribe msgOut;
+					msgOut.m_ID = ++m_UtxoEventsID;
+					msgOut.m_HeightMin = m_hUtxoEventsNext;
+					msgOut.m_Window = 1;
+					Send(msgOut);
+					return;
+				}
+
+				verify_test((msg.m_HeightMin <= m_hUtxoEventsNext) && (msg.m_HeightMin <= msg.m_HeightMax));
+
+				std::vector<proto::UtxoEvent> v;
+				proto::UtxoEvent::Decode(v, msg.m_Events, msg.m_HeightMin);
+
+				for (size_t i = 0; i < v.size(); i++)
+				{
+					const proto::UtxoEvent& evt = v[i];
+					verify_test((evt.m_Height >= msg.m_HeightMin) && (evt.m_Height <= msg.m_HeightMax));
+
+					ECC::Scalar::Native sk;
+					ECC::Point comm;
+					SwitchCommitment(&evt.m_AssetID).Create(sk, comm, *m_Wallet.m_pKdf, evt.m_Kidv);
+					verify_test(comm == evt.m_Commitment);
+				}
+
+				m_nUtxoEventsStreamed += v.size();
+				m_hUtxoEventsNext = msg.m_HeightMax + 1;
+
+				Send(proto::UtxoEventsAck(Zero));
+			}
+
 			virtual void OnMsg(proto::GetBlockFinalization&& msg) override
 			{
 				Block::Builder bb(0, *m_Wallet.m_pKdf, *m_Wallet.m_pKdf, msg.m_Height);
@@ -1626,6 +2631,22 @@ namespace beam
 			fail_test("some BBS messages missing");
 		if (!cl.IsAllRecoveryReceived())
 			fail_test("some recovery messages missing");
+		if (!cl.m_nUtxoEventsStreamed)
+			fail_test("no utxo events streamed");
+
+		// the stem txs were aggregated, then fluffed by one of the nodes
+		const Node::DandelionStats& ds = node.get_DandelionStats();
+		verify_test(ds.m_Aggregated && (ds.m_Depth >= ds.m_Aggregated));
+		verify_test(ds.m_Fluffed + node2.get_DandelionStats().m_Fluffed);
+
+		// node2 got the new blocks as compact bodies, rebuilt from the fluffed txs
+		const Node::CompactStats& cs = node2.get_CompactStats();
+		verify_test(cs.m_Reconstructed && !cs.m_Fallback);
+
+		// and measured the speed of its peer
+		std::vector<Node::PeerStats> vPeers;
+		node2.get_PeerStats(vPeers);
+		verify_test((vPeers.size() == 1) && vPeers[0].m_Samples && vPeers[0].m_Window && !vPeers[0].m_Lagging);
 		//if (!cl.m_bCustomAssetRecognized)
 		//	fail_test("CA not recognized");
 
@@ -1907,6 +2928,244 @@ namespace beam
 		}
 	}
 
+	void TestTxPoolShortIDs()
+	{
+		TxPool::Fluff txp;
+
+		// fake txs, not verified. Outputs with the same prefix have the same short ID
+		auto fnAdd = [&txp](uint8_t nPrefix, uint8_t nTag) -> Transaction::Ptr
+		{
+			Transaction::Ptr pTx(new Transaction);
+
+			Output::Ptr pOutp(new Output);
+			pOutp->m_Commitment.m_X = Zero;
+			pOutp->m_Commitment.m_X.m_pData[0] = nPrefix;
+			pOutp->m_Commitment.m_X.m_pData[31] = nTag;
+			pTx->m_vOutputs.push_back(std::move(pOutp));
+
+			TxKernel::Ptr pKrn(new TxKernel);
+			pKrn->m_Fee = nTag;
+			pTx->m_vKernels.push_back(std::move(pKrn));
+
+			Transaction::Context ctx;
+			ctx.m_Height.m_Max = MaxHeight;
+
+			Transaction::KeyType key = Zero;
+			key.m_pData[0] = nTag;
+
+			Transaction::Ptr pRet = pTx;
+			txp.AddValidTx(std::move(pTx), ctx, key);
+			return pRet;
+		};
+
+		Transaction::Ptr pTxA = fnAdd(1, 1);
+		uint64_t idOutpA = TxPool::Fluff::get_ShortID(*pTxA->m_vOutputs[0]);
+		uint64_t idKrnA = TxPool::Fluff::get_ShortID(*pTxA->m_vKernels[0]);
+
+		verify_test(txp.FindOutput(idOutpA) == pTxA->m_vOutputs[0].get());
+		verify_test(txp.FindKernel(idKrnA) == pTxA->m_vKernels[0].get());
+		verify_test(!txp.FindOutput(idOutpA + 1));
+		verify_test(!txp.FindKernel(idKrnA + 1));
+
+		// same output short ID, different kernel
+		Transaction::Ptr pTxB = fnAdd(1, 2);
+		verify_test(TxPool::Fluff::get_ShortID(*pTxB->m_vOutputs[0]) == idOutpA);
+
+		verify_test(!txp.FindOutput(idOutpA)); // ambiguous
+		verify_test(txp.FindKernel(TxPool::Fluff::get_ShortID(*pTxB->m_vKernels[0])) == pTxB->m_vKernels[0].get());
+
+		// the salted IDs depend on the whole commitment, and differ between the blocks
+		Merkle::Hash hvSalt1, hvSalt2;
+		ECC::SetRandom(hvSalt1);
+		ECC::SetRandom(hvSalt2);
+
+		TxPool::Fluff::SaltedIndex si;
+		si.Build(txp, hvSalt1);
+
+		uint64_t idOutpA1 = TxPool::Fluff::get_ShortID(*pTxA->m_vOutputs[0], hvSalt1);
+		verify_test(idOutpA1 != TxPool::Fluff::get_ShortID(*pTxA->m_vOutputs[0], hvSalt2));
+		verify_test(si.FindOutput(idOutpA1) == pTxA->m_vOutputs[0].get());
+		verify_test(si.FindOutput(TxPool::Fluff::get_ShortID(*pTxB->m_vOutputs[0], hvSalt1)) == pTxB->m_vOutputs[0].get());
+		verify_test(si.FindKernel(TxPool::Fluff::get_ShortID(*pTxA->m_vKernels[0], hvSalt1)) == pTxA->m_vKernels[0].get());
+		verify_test(!si.FindKernel(TxPool::Fluff::get_ShortID(*pTxA->m_vKernels[0], hvSalt2)));
+
+		Transaction::KeyType key = Zero;
+		key.m_pData[0] = 1;
+		TxPool::Fluff::Element::Tx keyTx;
+		keyTx.m_Key = key;
+
+		TxPool::Fluff::TxSet::iterator it = txp.m_setTxs.find(keyTx);
+		verify_test(txp.m_setTxs.end() != it);
+		txp.Delete(it->get_ParentObj());
+
+		verify_test(txp.FindOutput(idOutpA) == pTxB->m_vOutputs[0].get());
+		verify_test(!txp.FindKernel(idKrnA));
+
+		txp.Clear();
+		verify_test(txp.m_setOutputIDs.empty() && txp.m_setKernelIDs.empty());
+	}
+
+	void TestTxPoolStemMerge()
+	{
+		// merged stem txs replace their sources in the stem pool, and an aborted merge leaves them intact
+		struct MyStem
+			:public TxPool::Stem
+		{
+			virtual bool ValidateTxContext(const Transaction&) override { return true; }
+			virtual void OnTimedOut(Element&) override {}
+		} stem;
+
+		Key::IKdf::Ptr pKdf;
+		ECC::SetRandom(pKdf);
+
+		auto fnAdd = [&stem, &pKdf](uint64_t nIdx) -> TxPool::Stem::Element&
+		{
+			ECC::Scalar::Native skIn, skOut, skKrn;
+
+			Input::Ptr pInp(new Input);
+			SwitchCommitment().Create(skIn, pInp->m_Commitment, *pKdf, Key::IDV(100, nIdx, Key::Type::Regular));
+
+			Output::Ptr pOutp(new Output);
+			pOutp->Create(skOut, *pKdf, Key::IDV(100, nIdx + 1000, Key::Type::Regular), *pKdf);
+
+			ECC::SetRandom(skKrn);
+			TxKernel::Ptr pKrn(new TxKernel);
+			pKrn->Sign(skKrn);
+
+			skOut += skKrn;
+			skIn += -skOut;
+
+			Transaction::Ptr pTx(new Transaction);
+			pTx->m_Offset = skIn;
+			pTx->m_vInputs.push_back(std::move(pInp));
+			pTx->m_vOutputs.push_back(std::move(pOutp));
+			pTx->m_vKernels.push_back(std::move(pKrn));
+			pTx->Normalize();
+
+			TxPool::Stem::Element* pElem = new TxPool::Stem::Element;
+			pElem->m_bAggregating = false;
+			pElem->m_pMerge = NULL;
+			pElem->m_Depth = 1;
+			pElem->m_Received_ms = GetTime_ms();
+			pElem->m_Time.m_Value = 0;
+			pElem->m_Profit.m_Fee = Zero;
+			pElem->m_Profit.SetSize(*pTx);
+			pElem->m_pValue = std::move(pTx);
+
+			stem.InsertKrn(*pElem);
+			stem.InsertAggr(*pElem);
+			return *pElem;
+		};
+
+		auto fnHasInput = [](const Transaction& tx, const Input& inp)
+		{
+			for (size_t i = 0; i < tx.m_vInputs.size(); i++)
+				if (tx.m_vInputs[i]->m_Commitment == inp.m_Commitment)
+					return true;
+			return false;
+		};
+
+		TxPool::Stem::Element& x0 = fnAdd(1);
+		TxPool::Stem::Element& x1 = fnAdd(2);
+		Transaction::Ptr pTx0 = x0.m_pValue;
+		Transaction::Ptr pTx1 = x1.m_pValue;
+
+		{
+			TxPool::Stem::Merge m;
+			stem.Freeze(m, x0);
+			stem.Freeze(m, x1);
+			verify_test(stem.m_setProfit.empty()); // frozen elements don't take part in the aggregation
+
+			m.Execute();
+			verify_test(m.m_bValid);
+			verify_test(stem.ApplyMerge(m));
+		}
+
+		// x1 is gone, x0 holds the merged tx with the inputs, outputs and kernels of both
+		verify_test(stem.m_setKrns.size() == 2);
+		for (TxPool::Stem::KrnSet::iterator it = stem.m_setKrns.begin(); stem.m_setKrns.end() != it; it++)
+			verify_test(it->m_pThis == &x0);
+
+		const Transaction::Ptr pMerged = x0.m_pValue;
+		verify_test((pMerged != pTx0) && !x0.m_pMerge && (x0.m_Depth == 2));
+		verify_test((pMerged->m_vInputs.size() == 2) && (pMerged->m_vOutputs.size() == 2) && (pMerged->m_vKernels.size() == 2));
+		verify_test(fnHasInput(*pMerged, *pTx0->m_vInputs[0]) && fnHasInput(*pMerged, *pTx1->m_vInputs[0]));
+
+		Transaction::Context ctx;
+		verify_test(pMerged->IsValid(ctx));
+
+		// one of the sources is deleted while the merge is in progress
+		TxPool::Stem::Element& x2 = fnAdd(3);
+		{
+			TxPool::Stem::Merge m;
+			stem.Freeze(m, x0);
+			stem.Freeze(m, x2);
+
+			m.Execute();
+			stem.Delete(x2);
+
+			verify_test(!m.m_vElems[1]);
+			verify_test(!stem.ApplyMerge(m));
+		}
+
+		verify_test((x0.m_pValue == pMerged) && !x0.m_pMerge);
+		verify_test(stem.m_setKrns.size() == 2);
+
+		stem.Clear();
+	}
+
+	void TestPeerPerf()
+	{
+		const uint32_t nMax = 5;
+		const uint32_t nBlock = 100000;
+
+		Node::Config::Timeout cfg;
+		Node::PeerPerf pp;
+
+		verify_test(pp.get_BlocksWindow(nMax) == nMax);
+		verify_test(!pp.get_Expected_ms(1) && !pp.get_Lagging_ms(1, cfg.m_GetBlock_ms, cfg));
+
+		// bodies only. The 1st response: nothing is known yet, all the time is accounted to the transfer
+		pp.OnSample(100, 0, nBlock, 1);
+		verify_test((pp.m_BytesPerSec == 1000000) && (pp.m_BlockSize == nBlock) && !pp.m_Rtt_ms);
+
+		// pipelined: the transfer time is since the previous response
+		pp.OnSample(250, 100, nBlock, 1);
+		verify_test((pp.m_BytesPerSec == 1000000) && !pp.m_Rtt_ms);
+
+		// latency still unknown - the default window, not 1
+		verify_test(pp.get_BlocksWindow(nMax) == nMax);
+		verify_test(pp.get_Expected_ms(1) == 100);
+
+		// not pipelined: the latency is derived from the known rate
+		pp.OnSample(300, 0, nBlock, 1);
+		verify_test((pp.m_Rtt_ms == 200) && (pp.m_BytesPerSec == 1000000));
+
+		pp.OnSample(300, 0, nBlock, 1);
+		verify_test((pp.m_Rtt_ms == 200) && (pp.m_BytesPerSec == 1000000));
+
+		// 2 blocks in flight, plus the one being transferred
+		verify_test(pp.get_BlocksWindow(nMax) == 3);
+		verify_test(pp.get_BlocksWindow(2) == 2);
+
+		verify_test(pp.get_Expected_ms(0) == 200);
+		verify_test(pp.get_Expected_ms(1) == 300);
+		verify_test(pp.get_Expected_ms(30) == 3200);
+
+		verify_test(pp.get_Lagging_ms(0, cfg.m_GetState_ms, cfg) == cfg.m_LaggingMin_ms);
+		verify_test(pp.get_Lagging_ms(1, cfg.m_GetBlock_ms, cfg) == cfg.m_LaggingMin_ms);
+		verify_test(pp.get_Lagging_ms(30, cfg.m_GetBlock_ms, cfg) == 3200 * 4);
+		verify_test(!pp.get_Lagging_ms(100, cfg.m_GetBlock_ms, cfg)); // would exceed the timeout
+
+		// headers: pipelined ones don't tell the latency
+		pp.OnSample(500, 20, 0, 0);
+		verify_test(pp.m_Rtt_ms == 200);
+
+		pp.OnSample(120, 0, 0, 0);
+		verify_test(pp.m_Rtt_ms == 180);
+		verify_test(pp.get_BlocksWindow(nMax) == 2);
+	}
+
 }
 
 int main()
@@ -1928,6 +3187,9 @@ int main()
 
 	beam::TestHalving();
 	beam::TestChainworkProof();
+	beam::TestPeerPerf();
+	beam::TestTxPoolShortIDs();
+	beam::TestTxPoolStemMerge();
 
 	// Make sure this test doesn't run in parallel. We have the following potential collisions for Nodes:
 	//	.db files
@@ -1942,6 +3204,7 @@ int main()
 
 	beam::TestNodeDB();
 	beam::DeleteFile(beam::g_sz);
+	beam::DeleteFile(beam::g_sz2);
 
 	{
 		printf("NodeProcessor test1...\n");
@@ -1958,14 +3221,55 @@ int main()
 
 		beam::TestNodeProcessor2(blockChain);
 		beam::DeleteFile(beam::g_sz);
+
+		printf("NodeProcessor async verdicts test...\n");
+		fflush(stdout);
+
+		beam::TestAsyncVerdicts(blockChain);
+		beam::DeleteFile(beam::g_sz);
 	}
 
+	printf("Headers pack test...\n");
+	fflush(stdout);
+
+	beam::TestHeadersPack();
+	beam::DeleteFile(beam::g_sz);
+	beam::DeleteFile(beam::g_sz2);
+
 	printf("NodeX2 concurrent test...\n");
 	fflush(stdout);
 
 	beam::TestNodeConversation();
 	beam::DeleteFile(beam::g_sz);
 	beam::DeleteFile(beam::g_sz2);
+	beam::DeleteFile((std::string(beam::g_sz) + ".body0").c_str());
+
+	printf("Node <-- Node blocks pack test...\n");
+	fflush(stdout);
+
+	beam::TestNodeBodyPacks(true);
+	beam::DeleteFile(beam::g_sz);
+	beam::DeleteFile(beam::g_sz2);
+
+	beam::TestNodeBodyPacks(false);
+	beam::DeleteFile(beam::g_sz);
+	beam::DeleteFile(beam::g_sz2);
+
+	printf("Node <---> Client tx batch test...\n");
+	fflush(stdout);
+
+	beam::TestNodeTxBatch(0);
+	beam::DeleteFile(beam::g_sz);
+
+	beam::TestNodeTxBatch(2);
+	beam::DeleteFile(beam::g_sz);
+
+	printf("Node --> Node compact blocks test...\n");
+	fflush(stdout);
+
+	beam::TestNodeCompact();
+	beam::DeleteFile(beam::g_sz);
+	beam::DeleteFile(beam::g_sz2);
 
 	printf("Node <---> Client test (with proofs)...\n");
 	fflush(stdout);
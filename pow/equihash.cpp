@@ -17,6 +17,9 @@
 #include "uint256.h"
 #include "arith_uint256.h"
 #include <utility>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #if defined (BEAM_USE_GPU)
 #include "3rdparty/equihash_gpu.h"
@@ -46,6 +49,501 @@ struct Block::PoW::Helper
 
 		return d.IsTargetReached(hv);
 	}
+
+	typedef Equihash<Block::PoW::N, Block::PoW::K> Eh;
+	static const uint32_t s_HashBytes = GetSizeInBytes(Block::PoW::N);
+
+	// H(...||iBlock), the hash output contains Eh::IndicesPerHashOutput leaves
+	static void GenerateBlock(const blake2b_state& base, uint32_t iBlock, uint8_t* pHash)
+	{
+		blake2b_state s = base;
+
+		uint8_t pLe[sizeof(uint32_t)];
+		for (uint32_t j = 0; j < sizeof(pLe); j++)
+			pLe[j] = static_cast<uint8_t>(iBlock >> (j << 3));
+
+		blake2b_update(&s, pLe, sizeof(pLe));
+		blake2b_final(&s, pHash, static_cast<uint8_t>(Eh::HashOutput));
+
+		if (Block::PoW::N & 7)
+			for (uint32_t j = s_HashBytes - 1; j < Eh::HashOutput; j += s_HashBytes)
+				pHash[j] &= static_cast<uint8_t>(0xff << (8 - (Block::PoW::N & 7)));
+	}
+
+	struct Verifier;
+	struct Solver;
+};
+
+// Fixed-size solution verifier, equivalent to Equihash<N,K>::IsValidSolution, but without heap allocations.
+// All the rows are kept on stack, the tree is collapsed in-place.
+struct Block::PoW::Helper::Verifier
+{
+	static const uint32_t s_CollisionBytes = Eh::CollisionByteLength;
+	static const uint32_t s_RowBytes = Eh::HashLength;
+
+	// the rows are handled as raw bytes, no bit expansion
+	static_assert(!(Eh::CollisionBitLength & 7), "collision length must be byte-aligned");
+	static_assert(s_RowBytes == s_HashBytes, "");
+	static_assert(nSolutionBytes == Eh::SolutionWidth, "");
+	static_assert(nBitsPerIndex == Eh::CollisionBitLength + 1, "");
+
+	uint32_t m_pIdx[nNumIndices];
+	uint8_t m_pRow[nNumIndices][s_RowBytes];
+
+	void DecodeIndices(const uint8_t* pSol)
+	{
+		// big-endian, nBitsPerIndex each
+		const uint32_t nMsk = (1U << nBitsPerIndex) - 1;
+
+		uint64_t nAcc = 0;
+		uint32_t nBits = 0, iIdx = 0;
+
+		for (uint32_t i = 0; i < nSolutionBytes; i++)
+		{
+			nAcc = (nAcc << 8) | pSol[i];
+			nBits += 8;
+
+			if (nBits >= nBitsPerIndex)
+			{
+				nBits -= nBitsPerIndex;
+				m_pIdx[iIdx++] = static_cast<uint32_t>(nAcc >> nBits) & nMsk;
+			}
+		}
+
+		assert(nNumIndices == iIdx);
+	}
+
+	void GenerateRows(const blake2b_state& base)
+	{
+		uint8_t pHash[Eh::HashOutput];
+		uint32_t iBlockPrev = static_cast<uint32_t>(-1);
+
+		for (uint32_t i = 0; i < nNumIndices; i++)
+		{
+			uint32_t iBlock = m_pIdx[i] / Eh::IndicesPerHashOutput;
+			if (iBlockPrev != iBlock)
+			{
+				// neighbor indices often come from the same hash output
+				iBlockPrev = iBlock;
+				GenerateBlock(base, iBlock, pHash);
+			}
+
+			memcpy(m_pRow[i], pHash + (m_pIdx[i] % Eh::IndicesPerHashOutput) * s_HashBytes, s_RowBytes);
+		}
+	}
+
+	bool AreIndicesDistinct() const
+	{
+		uint32_t pIdx[nNumIndices];
+		memcpy(pIdx, m_pIdx, sizeof(pIdx));
+		std::sort(pIdx, pIdx + nNumIndices);
+
+		for (uint32_t i = 1; i < nNumIndices; i++)
+			if (pIdx[i - 1] == pIdx[i])
+				return false;
+
+		return true;
+	}
+
+	bool Collapse()
+	{
+		// The subtree of width nW starting at i is represented by the row i, and its indices are m_pIdx[i..i+nW)
+		// The order of subtrees is determined by their first index (if they're equal - the indices aren't distinct anyway)
+		uint32_t nPos = 0;
+
+		for (uint32_t nW = 1; nW < nNumIndices; nW <<= 1, nPos += s_CollisionBytes)
+		{
+			for (uint32_t i = 0; i < nNumIndices; i += (nW << 1))
+			{
+				uint8_t* pA = m_pRow[i];
+				const uint8_t* pB = m_pRow[i + nW];
+
+				if (memcmp(pA + nPos, pB + nPos, s_CollisionBytes))
+					return false;
+
+				if (m_pIdx[i] >= m_pIdx[i + nW])
+					return false;
+
+				for (uint32_t j = nPos + s_CollisionBytes; j < s_RowBytes; j++)
+					pA[j] ^= pB[j];
+			}
+		}
+
+		for (uint32_t j = nPos; j < s_RowBytes; j++)
+			if (m_pRow[0][j])
+				return false;
+
+		return true;
+	}
+
+	bool IsValid(const blake2b_state& base, const uint8_t* pSol)
+	{
+		DecodeIndices(pSol);
+
+		if (!AreIndicesDistinct())
+			return false;
+
+		GenerateRows(base);
+		return Collapse();
+	}
+};
+
+// Cooperative solver: a single nonce is solved by several threads.
+// Each round the rows are distributed into buckets by the first s_BucketBits of the collision segment (counting sort),
+// then the buckets are processed independently: sorted by the remaining bits within a cache-sized table, and the colliding
+// pairs are combined into the rows of the next round. Buckets are picked dynamically, so that the faster threads take more.
+// Only the back-references are kept for the processed rounds, the solution indices are recovered at the end.
+struct Block::PoW::Helper::Solver
+{
+	static const uint32_t s_CollisionBytes = Eh::CollisionByteLength;
+	static const uint32_t s_BucketBits = 12;
+	static const uint32_t s_Buckets = 1U << s_BucketBits;
+	static const uint32_t s_SubBits = Eh::CollisionBitLength - s_BucketBits;
+	static const uint32_t s_RunBits = 6; // back-reference: index of the 1st row, and the distance to the 2nd within the run
+	static const uint32_t s_RowsMax = 1U << (32 - s_RunBits);
+	static const uint32_t s_Leaves = 1U << (Eh::CollisionBitLength + 1);
+	static const uint32_t s_LeafBlocksPerChunk = 0x1000;
+
+	static_assert(!(Eh::CollisionBitLength & 7), "collision length must be byte-aligned");
+	static_assert((s_BucketBits > 8) && (s_BucketBits <= 16) && (s_SubBits > 0) && (s_SubBits <= 16), "");
+
+	const blake2b_state& m_Base;
+	const uint32_t m_nThreads;
+	const std::function<bool(const uint8_t*)>& m_fnValid;
+
+	std::vector<std::vector<uint8_t> > m_vOut; // per-thread rows of the next round
+	std::vector<std::vector<uint32_t> > m_vCandidates; // per-thread pairs of the last round
+	std::vector<uint8_t> m_vRows; // current round, sorted
+	std::vector<uint32_t> m_pRef[Block::PoW::K]; // back-references for each round, in the sorted order
+	std::vector<uint32_t> m_vBucket; // first row of each bucket (+ the end)
+	std::atomic<uint32_t> m_iNext;
+
+	Solver(const blake2b_state& base, uint32_t nThreads, const std::function<bool(const uint8_t*)>& fnValid)
+		:m_Base(base)
+		,m_nThreads(nThreads)
+		,m_fnValid(fnValid)
+	{
+		m_vOut.resize(m_nThreads);
+		m_vCandidates.resize(m_nThreads);
+	}
+
+	static uint32_t get_HashBytes(uint32_t iRound) { return s_HashBytes - iRound * s_CollisionBytes; }
+	static uint32_t get_RowBytes(uint32_t iRound) { return get_HashBytes(iRound) + sizeof(uint32_t); }
+
+	static uint32_t get_Bucket(const uint8_t* p)
+	{
+		return ((static_cast<uint32_t>(p[0]) << 8) | p[1]) >> (16 - s_BucketBits);
+	}
+
+	static uint32_t get_Sub(const uint8_t* p)
+	{
+		uint32_t n = (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+		return n & ((1U << s_SubBits) - 1);
+	}
+
+	template <typename Func>
+	void RunParallel(const Func& func)
+	{
+		std::vector<std::thread> vThreads;
+		vThreads.reserve(m_nThreads - 1);
+
+		for (uint32_t i = 1; i < m_nThreads; i++)
+			vThreads.emplace_back([&func, i]() { func(i); });
+
+		func(0);
+
+		for (size_t i = 0; i < vThreads.size(); i++)
+			vThreads[i].join();
+	}
+
+	void Generate(uint32_t iThread)
+	{
+		const uint32_t nRow = get_RowBytes(0);
+		const uint32_t nBlocks = s_Leaves / Eh::IndicesPerHashOutput + 1;
+
+		std::vector<uint8_t>& vOut = m_vOut[iThread];
+		vOut.reserve(size_t(s_Leaves / m_nThreads + 1) * nRow);
+
+		uint8_t pHash[Eh::HashOutput];
+
+		while (true)
+		{
+			uint32_t iBlock0 = m_iNext.fetch_add(s_LeafBlocksPerChunk);
+			if (iBlock0 >= nBlocks)
+				break;
+
+			uint32_t iBlock1 = std::min(iBlock0 + s_LeafBlocksPerChunk, nBlocks);
+			for (uint32_t iBlock = iBlock0; iBlock < iBlock1; iBlock++)
+			{
+				GenerateBlock(m_Base, iBlock, pHash);
+
+				for (uint32_t j = 0; j < Eh::IndicesPerHashOutput; j++)
+				{
+					uint32_t iLeaf = iBlock * Eh::IndicesPerHashOutput + j;
+					if (iLeaf >= s_Leaves)
+						break;
+
+					size_t nPos = vOut.size();
+					vOut.resize(nPos + nRow);
+
+					memcpy(&vOut[nPos], pHash + j * s_HashBytes, s_HashBytes);
+					memcpy(&vOut[nPos + s_HashBytes], &iLeaf, sizeof(iLeaf));
+				}
+			}
+		}
+	}
+
+	void Distribute(uint32_t iRound)
+	{
+		// counting sort of all the per-thread outputs into m_vRows, by bucket
+		const uint32_t nRow = get_RowBytes(iRound);
+
+		m_vRows.clear();
+		m_vRows.shrink_to_fit();
+
+		std::vector<uint32_t> vCount(m_nThreads * s_Buckets);
+
+		RunParallel([this, nRow, &vCount](uint32_t iThread) {
+			const std::vector<uint8_t>& v = m_vOut[iThread];
+			uint32_t* pCount = &vCount[iThread * s_Buckets];
+
+			for (size_t nPos = 0; nPos < v.size(); nPos += nRow)
+				pCount[get_Bucket(&v[nPos])]++;
+		});
+
+		m_vBucket.resize(s_Buckets + 1);
+
+		uint32_t nTotal = 0;
+		for (uint32_t iBucket = 0; iBucket < s_Buckets; iBucket++)
+		{
+			m_vBucket[iBucket] = nTotal;
+
+			for (uint32_t iThread = 0; iThread < m_nThreads; iThread++)
+			{
+				uint32_t& n = vCount[iThread * s_Buckets + iBucket];
+				uint32_t nThis = n;
+				n = nTotal; // becomes the write position
+				nTotal += nThis;
+			}
+		}
+
+		m_vBucket[s_Buckets] = nTotal;
+		m_vRows.resize(size_t(nTotal) * nRow);
+		m_pRef[iRound].resize(nTotal);
+
+		RunParallel([this, nRow, &vCount](uint32_t iThread) {
+			std::vector<uint8_t>& v = m_vOut[iThread];
+			uint32_t* pPos = &vCount[iThread * s_Buckets];
+
+			for (size_t nPos = 0; nPos < v.size(); nPos += nRow)
+			{
+				uint32_t& iDst = pPos[get_Bucket(&v[nPos])];
+				memcpy(&m_vRows[size_t(iDst++) * nRow], &v[nPos], nRow);
+			}
+
+			v.clear();
+			v.shrink_to_fit();
+		});
+	}
+
+	void Collide(uint32_t iThread, uint32_t iRound)
+	{
+		const bool bLast = (Block::PoW::K == iRound + 1);
+		const uint32_t nHash = get_HashBytes(iRound);
+		const uint32_t nRow = get_RowBytes(iRound);
+		const uint32_t nHashNext = nHash - s_CollisionBytes;
+		const uint32_t nRowNext = nHashNext + sizeof(uint32_t);
+		const size_t nOutMax = size_t(s_RowsMax / m_nThreads) * nRowNext;
+
+		std::vector<uint8_t>& vOut = m_vOut[iThread];
+		std::vector<uint32_t>& vCandidates = m_vCandidates[iThread];
+
+		std::vector<uint32_t> vCount(size_t(1) << s_SubBits);
+		std::vector<uint8_t> vTmp;
+
+		while (true)
+		{
+			uint32_t iBucket = m_iNext++;
+			if (iBucket >= s_Buckets)
+				break;
+
+			uint32_t i0 = m_vBucket[iBucket];
+			uint32_t n = m_vBucket[iBucket + 1] - i0;
+			if (!n)
+				continue;
+
+			uint8_t* pRows = &m_vRows[size_t(i0) * nRow];
+
+			// sort by the remaining collision bits
+			std::fill(vCount.begin(), vCount.end(), 0);
+			for (uint32_t i = 0; i < n; i++)
+				vCount[get_Sub(pRows + i * nRow)]++;
+
+			uint32_t nPos = 0;
+			for (size_t i = 0; i < vCount.size(); i++)
+			{
+				uint32_t nThis = vCount[i];
+				vCount[i] = nPos;
+				nPos += nThis;
+			}
+
+			vTmp.resize(size_t(n) * nRow);
+			for (uint32_t i = 0; i < n; i++)
+				memcpy(&vTmp[size_t(vCount[get_Sub(pRows + i * nRow)]++) * nRow], pRows + i * nRow, nRow);
+
+			memcpy(pRows, &vTmp.front(), vTmp.size());
+
+			uint32_t* pRef = &m_pRef[iRound][i0];
+			for (uint32_t i = 0; i < n; i++)
+				memcpy(pRef + i, pRows + i * nRow + nHash, sizeof(uint32_t));
+
+			// pairs within the runs
+			for (uint32_t i = 0; i < n; )
+			{
+				uint32_t nSub = get_Sub(pRows + i * nRow);
+
+				uint32_t nRun = 1;
+				while ((i + nRun < n) && (get_Sub(pRows + (i + nRun) * nRow) == nSub))
+					nRun++;
+
+				uint32_t nUse = std::min(nRun, 1U << s_RunBits); // longer runs are too unlikely to care
+
+				for (uint32_t a = 0; a < nUse; a++)
+				{
+					const uint8_t* pA = pRows + (i + a) * nRow + s_CollisionBytes;
+
+					for (uint32_t b = a + 1; b < nUse; b++)
+					{
+						const uint8_t* pB = pRows + (i + b) * nRow + s_CollisionBytes;
+
+						if (bLast)
+						{
+							if (!memcmp(pA, pB, nHashNext))
+							{
+								vCandidates.push_back(i0 + i + a);
+								vCandidates.push_back(i0 + i + b);
+							}
+							continue;
+						}
+
+						if (vOut.size() >= nOutMax)
+							continue;
+
+						size_t nDst = vOut.size();
+						vOut.resize(nDst + nRowNext);
+						uint8_t* pDst = &vOut[nDst];
+
+						uint8_t nOr = 0;
+						for (uint32_t j = 0; j < nHashNext; j++)
+							nOr |= (pDst[j] = pA[j] ^ pB[j]);
+
+						if (!nOr)
+						{
+							// complete collision, almost surely the same indices
+							vOut.resize(nDst);
+							continue;
+						}
+
+						uint32_t nRef = ((i0 + i + a) << s_RunBits) | (b - a);
+						memcpy(pDst + nHashNext, &nRef, sizeof(nRef));
+					}
+				}
+
+				i += nRun;
+			}
+		}
+	}
+
+	void Expand(uint32_t iRound, uint32_t iRow, uint32_t* pIdx) const
+	{
+		uint32_t nRef = m_pRef[iRound][iRow];
+		if (!iRound)
+		{
+			*pIdx = nRef;
+			return;
+		}
+
+		uint32_t iA = nRef >> s_RunBits;
+		uint32_t nHalf = 1U << (iRound - 1);
+
+		Expand(iRound - 1, iA, pIdx);
+		Expand(iRound - 1, iA + (nRef & ((1U << s_RunBits) - 1)), pIdx + nHalf);
+
+		if (pIdx[nHalf] < pIdx[0])
+			std::swap_ranges(pIdx, pIdx + nHalf, pIdx + nHalf);
+	}
+
+	static void EncodeIndices(const uint32_t* pIdx, uint8_t* pSol)
+	{
+		uint64_t nAcc = 0;
+		uint32_t nBits = 0, iByte = 0;
+
+		for (uint32_t i = 0; i < nNumIndices; i++)
+		{
+			nAcc = (nAcc << nBitsPerIndex) | pIdx[i];
+			nBits += nBitsPerIndex;
+
+			for ( ; nBits >= 8; nBits -= 8)
+				pSol[iByte++] = static_cast<uint8_t>(nAcc >> (nBits - 8));
+		}
+
+		assert((nSolutionBytes == iByte) && !nBits);
+	}
+
+	bool ProcessCandidate(uint32_t iA, uint32_t iB)
+	{
+		const uint32_t nHalf = nNumIndices >> 1;
+		const uint32_t iRound = Block::PoW::K - 1;
+
+		uint32_t pIdx[nNumIndices];
+		Expand(iRound, iA, pIdx);
+		Expand(iRound, iB, pIdx + nHalf);
+
+		if (pIdx[nHalf] < pIdx[0])
+			std::swap_ranges(pIdx, pIdx + nHalf, pIdx + nHalf);
+
+		uint8_t pSol[nSolutionBytes];
+		EncodeIndices(pIdx, pSol);
+
+		Verifier v;
+		if (!v.IsValid(m_Base, pSol))
+			return false; // duplicate indices, or the solution is damaged by the truncations
+
+		return m_fnValid(pSol);
+	}
+
+	bool Solve(const std::function<bool()>& fnCancel)
+	{
+		for (uint32_t iThread = 0; iThread < m_nThreads; iThread++)
+			m_vCandidates[iThread].clear();
+
+		m_iNext = 0;
+		RunParallel([this](uint32_t iThread) { Generate(iThread); });
+
+		for (uint32_t iRound = 0; iRound < Block::PoW::K; iRound++)
+		{
+			if (fnCancel())
+				return false;
+
+			Distribute(iRound);
+
+			m_iNext = 0;
+			RunParallel([this, iRound](uint32_t iThread) { Collide(iThread, iRound); });
+		}
+
+		m_vRows.clear();
+		m_vRows.shrink_to_fit();
+
+		for (uint32_t iThread = 0; iThread < m_nThreads; iThread++)
+		{
+			const std::vector<uint32_t>& v = m_vCandidates[iThread];
+			for (size_t i = 0; i < v.size(); i += 2)
+				if (ProcessCandidate(v[i], v[i + 1]))
+					return true;
+		}
+
+		return false;
+	}
 };
 
 #if defined (BEAM_USE_GPU)
@@ -127,14 +625,48 @@ bool Block::PoW::Solve(const void* pInput, uint32_t nSizeInput, const Cancel& fn
     return true;
 }
 
+bool Block::PoW::SolveMT(const void* pInput, uint32_t nSizeInput, uint32_t nThreads, const Cancel& fnCancel)
+{
+	Helper hlp;
+
+	std::function<bool(const uint8_t*)> fnValid = [this, &hlp](const uint8_t* pSol)
+		{
+			if (!hlp.TestDifficulty(pSol, nSolutionBytes, m_Difficulty))
+				return false;
+			std::copy(pSol, pSol + nSolutionBytes, m_Indices.begin());
+			return true;
+		};
+
+	std::function<bool()> fnCancelInternal = [&fnCancel]() {
+		return fnCancel(false);
+	};
+
+	Helper::Solver slv(hlp.m_Blake, std::max(nThreads, 1U), fnValid);
+
+	while (true)
+	{
+		hlp.Reset(pInput, nSizeInput, m_Nonce);
+
+		if (slv.Solve(fnCancelInternal))
+			break;
+
+		if (fnCancel(true))
+			return false; // retry not allowed
+
+		m_Nonce.Inc();
+	}
+
+	return true;
+}
+
 bool Block::PoW::IsValid(const void* pInput, uint32_t nSizeInput) const
 {
 	Helper hlp;
 	hlp.Reset(pInput, nSizeInput, m_Nonce);
 
-	std::vector<uint8_t> v(m_Indices.begin(), m_Indices.end());
-    return
-		hlp.m_Eh.IsValidSolution(hlp.m_Blake, v) &&
+	Helper::Verifier v;
+	return
+		v.IsValid(hlp.m_Blake, &m_Indices.front()) &&
 		hlp.TestDifficulty(&m_Indices.front(), (uint32_t) m_Indices.size(), m_Difficulty);
 }
 
@@ -29,6 +29,17 @@ public:
         std::string privKeyFile;
     };
 
+    // share counters of a connected miner
+    struct ShareStats {
+        std::string peer;
+        uint64_t submitted = 0;
+        uint64_t accepted = 0;
+        uint64_t stale = 0;
+        // msec from job notification to accepted solution
+        uint64_t latencyTotal = 0;
+        uint64_t latencyMax = 0;
+    };
+
     // creates stratum server
     static std::unique_ptr<IExternalPOW> create(const Options& o, io::Reactor& reactor, io::Address listenTo);
 
@@ -48,6 +59,9 @@ public:
 
     virtual void stop_current() = 0;
 
+    // per-miner stats, local solvers have none
+    virtual void get_stats(std::vector<ShareStats>& stats) { stats.clear(); }
+
     virtual void stop() = 0;
 };
 
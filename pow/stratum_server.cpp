@@ -108,7 +108,8 @@ bool Server::on_login(uint64_t from, const Login& login) {
         conn->set_logged_in();
 
         // TODO send result first
-        return _connections[from]->send_msg(_job.msg, true);
+        if (_job.msg.empty()) return true;
+        return conn->send_job(_job.msg, local_timestamp_msec());
     } else {
         LOG_INFO() << STS << "peer login failed, key=" << login.api_key;
         Result res(login.id, login_failed);
@@ -120,15 +121,40 @@ bool Server::on_login(uint64_t from, const Login& login) {
 }
 
 bool Server::on_solution(uint64_t from, const Solution& sol) {
-    if (sol.id != _job.id) {
+    assert(_connections.count(from) > 0);
+
+    auto& conn = _connections[from];
+    uint64_t now = local_timestamp_msec();
+
+    if (_job.id.empty() || sol.id != _job.id) {
         LOG_INFO() << STS << "ignoring solution to " << sol.id << " from " << io::Address::from_u64(from) << ", current is " << _job.id;
+        conn->on_share(solution_expired, now);
+        return send_result(from, sol.id, solution_expired);
     }
     LOG_DEBUG() << TRACE(sol.nonce) << TRACE(sol.output);
-    sol.fill_pow(_job.pow);
+
+    Block::PoW pow = _job.pow;
+    bool valid = sol.fill_pow(pow) && (Rules::get().FakePoW || pow.IsValid(_job.input.m_pData, _job.input.nBytes));
+    if (!valid) {
+        LOG_INFO() << STS << "invalid solution to " << sol.id << " from " << io::Address::from_u64(from);
+        conn->on_share(solution_rejected, now);
+        return send_result(from, sol.id, solution_rejected);
+    }
+    _job.pow = pow;
+    conn->on_share(solution_accepted, now);
 
     LOG_INFO() << STS << "solution to " << sol.id << " from " << io::Address::from_u64(from);
+    bool sent = send_result(from, sol.id, solution_accepted);
     _job.onBlockFound();
-    return true;
+    return sent;
+}
+
+bool Server::send_result(uint64_t to, const std::string& id, ResultCode code) {
+    Result res(id, code);
+    append_json_msg(_fw, res);
+    bool sent = _connections[to]->send_msg(_currentMsg, false);
+    _currentMsg.clear();
+    return sent;
 }
 
 void Server::on_bad_peer(uint64_t from) {
@@ -144,6 +170,7 @@ void Server::new_job(
     const CancelCallback& cancelCallback
 ) {
     _job.id = id;
+    _job.input = input;
     _job.pow = pow;
     _job.onBlockFound = callback;
     _job.cancelFn = cancelCallback;
@@ -152,11 +179,14 @@ void Server::new_job(
 
     Job jobMsg(_job.id, input, pow);
     append_json_msg(_fw, jobMsg);
-    _job.msg.swap(_currentMsg);
+
+    // detach from the writer's page: the job outlives many other messages
+    _job.msg = io::normalize(_currentMsg, true);
     _currentMsg.clear();
 
+    uint64_t now = local_timestamp_msec();
     for (auto& p : _connections) {
-        if (!p.second->send_msg(_job.msg, true)) {
+        if (!p.second->send_job(_job.msg, now)) {
             _deadConnections.push_back(p.first);
         }
     }
@@ -183,6 +213,14 @@ void Server::stop() {
     _server.reset();
 }
 
+void Server::get_stats(std::vector<ShareStats>& stats) {
+    stats.clear();
+    stats.reserve(_connections.size());
+    for (const auto& p : _connections) {
+        stats.push_back(p.second->get_stats());
+    }
+}
+
 Server::AccessControl::AccessControl(const std::string &keysFileName) :
     _enabled(!keysFileName.empty()),
     _keysFileName(keysFileName),
@@ -230,8 +268,10 @@ Server::Connection::Connection(ConnectionToServer& owner, uint64_t id, io::TcpSt
     _id(id),
     _stream(std::move(newStream)),
     _lineReader(BIND_THIS_MEMFN(on_raw_message)),
-    _loggedIn(false)
+    _loggedIn(false),
+    _jobSentAt(0)
 {
+    _stats.peer = io::Address::from_u64(id).str();
     _stream->enable_keepalive(2);
     _stream->enable_read(BIND_THIS_MEMFN(on_stream_data));
 }
@@ -258,6 +298,27 @@ bool Server::Connection::send_msg(const io::SerializedMsg& msg, bool onlyIfLogge
     return sent;
 }
 
+bool Server::Connection::send_job(const io::SharedBuffer& msg, uint64_t now) {
+    if (!_loggedIn) return true;
+    if (!_stream || !_stream->write(msg)) return false;
+    _jobSentAt = now;
+    return true;
+}
+
+void Server::Connection::on_share(ResultCode code, uint64_t now) {
+    ++_stats.submitted;
+    if (code == solution_expired) {
+        ++_stats.stale;
+    } else if (code == solution_accepted) {
+        ++_stats.accepted;
+        if (_jobSentAt && now > _jobSentAt) {
+            uint64_t latency = now - _jobSentAt;
+            _stats.latencyTotal += latency;
+            if (_stats.latencyMax < latency) _stats.latencyMax = latency;
+        }
+    }
+}
+
 bool Server::Connection::on_message(const stratum::Login& login) {
     return _owner.on_login(_id, login);
 }
@@ -58,6 +58,13 @@ private:
 
         bool send_msg(const io::SerializedMsg& msg, bool onlyIfLoggedIn, bool shutdown=false);
 
+        // writes the shared job notification, remembers when it was sent
+        bool send_job(const io::SharedBuffer& msg, uint64_t now);
+
+        void on_share(ResultCode code, uint64_t now);
+
+        const ShareStats& get_stats() const { return _stats; }
+
     private:
         bool on_message(const Login& login) override;
 
@@ -76,11 +83,15 @@ private:
         io::TcpStream::Ptr _stream;
         LineReader _lineReader;
         bool _loggedIn;
+        uint64_t _jobSentAt;
+        ShareStats _stats;
     };
 
     struct JobCtx {
-        io::SerializedMsg msg;
+        // serialized once, shared by all connections
+        io::SharedBuffer msg;
         std::string id;
+        Merkle::Hash input;
         Block::PoW pow;
         BlockFound onBlockFound;
         CancelCallback cancelFn;
@@ -106,6 +117,9 @@ private:
     void get_last_found_block(std::string& jobID, Block::PoW& pow) override;
     void stop_current() override;
     void stop() override;
+    void get_stats(std::vector<ShareStats>& stats) override;
+
+    bool send_result(uint64_t to, const std::string& id, ResultCode code);
 
     Options _options;
     io::Reactor& _reactor;
@@ -0,0 +1,70 @@
+// Copyright 2018 The Beam Team
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "core/block_crypt.h"
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+
+using namespace std;
+
+// Usage: equihash_bench [solutions] [threads]
+// Compares the default solver (one nonce per thread, run on a single core here) vs the cooperative one.
+int main(int argc, char* argv[])
+{
+    uint32_t nSolutions = (argc > 1) ? atoi(argv[1]) : 2;
+    uint32_t nThreads = (argc > 2) ? atoi(argv[2]) : std::thread::hardware_concurrency();
+    if (!nSolutions)
+        nSolutions = 1;
+    if (!nThreads)
+        nThreads = 1;
+
+    uint8_t pInput[] = { 1, 2, 3, 4, 56 };
+
+    for (int iMode = 0; iMode < 2; iMode++)
+    {
+        beam::Block::PoW pow;
+        pow.m_Difficulty = 0;
+        pow.m_Nonce = 0x010204U;
+
+        uint32_t nCores = iMode ? nThreads : 1;
+
+        auto t0 = chrono::high_resolution_clock::now();
+
+        for (uint32_t i = 0; i < nSolutions; i++)
+        {
+            if (iMode)
+                pow.SolveMT(pInput, sizeof(pInput), nThreads);
+            else
+                pow.Solve(pInput, sizeof(pInput));
+
+            if (!pow.IsValid(pInput, sizeof(pInput)))
+            {
+                cout << "Invalid solution" << endl;
+                return -1;
+            }
+
+            pow.m_Nonce.Inc();
+        }
+
+        double dt = chrono::duration<double>(chrono::high_resolution_clock::now() - t0).count();
+
+        cout << (iMode ? "Cooperative" : "Default") << " solver, threads=" << nCores
+            << ": " << nSolutions << " solutions in " << dt << " sec, "
+            << nSolutions / dt / nCores << " solutions/sec/core" << endl;
+    }
+
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include "3rdparty/crypto/equihash.h"
 #include "wallet/unittests/test_helpers.h"
 #include <algorithm>
+#include <chrono>
 
 WALLET_TEST_INIT
 using namespace std;
@@ -89,6 +90,75 @@ void TestArrayExpanding()
     TestArrayExpanding(96, 5);
 }
 
+bool IsValidLegacy(const beam::Block::PoW& pow, const void* pInput, uint32_t nSizeInput)
+{
+    Equihash<beam::Block::PoW::N, beam::Block::PoW::K> eh;
+    blake2b_state state;
+    eh.InitialiseState(state);
+    blake2b_update(&state, (const uint8_t*) pInput, nSizeInput);
+    blake2b_update(&state, pow.m_Nonce.m_pData, pow.m_Nonce.nBytes);
+
+    return eh.IsValidSolution(state, vector<uint8_t>(pow.m_Indices.begin(), pow.m_Indices.end()));
+}
+
+void TestVerifier(const beam::Block::PoW& pow, const void* pInput, uint32_t nSizeInput)
+{
+    cout << "Test PoW verifier...\n";
+
+    const size_t nBitsPerIndex = beam::Block::PoW::nBitsPerIndex;
+
+    // malformed solutions, must be rejected by both verifiers
+    for (size_t i = 0; i < pow.m_Indices.size() * 8; i += 7)
+    {
+        beam::Block::PoW pow2 = pow;
+        pow2.m_Indices[i >> 3] ^= 1 << (i & 7);
+
+        WALLET_CHECK(!pow2.IsValid(pInput, nSizeInput));
+        WALLET_CHECK(!IsValidLegacy(pow2, pInput, nSizeInput));
+    }
+
+    vector<eh_index> vIdx = GetIndicesFromMinimal(vector<uint8_t>(pow.m_Indices.begin(), pow.m_Indices.end()), nBitsPerIndex - 1);
+    WALLET_CHECK(vIdx.size() == beam::Block::PoW::nNumIndices);
+
+    for (int iMode = 0; iMode < 3; iMode++)
+    {
+        vector<eh_index> v = vIdx;
+        switch (iMode)
+        {
+        case 0: swap(v[0], v[1]); break; // wrong order, collisions are still ok
+        case 1: swap_ranges(v.begin(), v.begin() + v.size() / 2, v.begin() + v.size() / 2); break; // same for the top level
+        default: v[1] = v[0]; // duplicate
+        }
+
+        vector<uint8_t> vSol = GetMinimalFromIndices(v, nBitsPerIndex - 1);
+        WALLET_CHECK(vSol.size() == pow.m_Indices.size());
+
+        beam::Block::PoW pow2 = pow;
+        copy(vSol.begin(), vSol.end(), pow2.m_Indices.begin());
+
+        WALLET_CHECK(!pow2.IsValid(pInput, nSizeInput));
+        WALLET_CHECK(!IsValidLegacy(pow2, pInput, nSizeInput));
+    }
+
+    // throughput
+    const uint32_t nIterations = 2000;
+
+    auto t0 = chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < nIterations; i++)
+        WALLET_CHECK(IsValidLegacy(pow, pInput, nSizeInput));
+
+    auto t1 = chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < nIterations; i++)
+        WALLET_CHECK(pow.IsValid(pInput, nSizeInput));
+
+    auto t2 = chrono::high_resolution_clock::now();
+
+    double dt0 = chrono::duration<double>(t1 - t0).count();
+    double dt1 = chrono::duration<double>(t2 - t1).count();
+
+    cout << "Headers/sec: legacy=" << uint32_t(nIterations / dt0) << ", fixed-size=" << uint32_t(nIterations / dt1) << endl;
+}
+
 int main()
 {
     TestArrayExpanding();
@@ -115,6 +185,21 @@ int main()
             pow.Solve(pInput, sizeof(pInput));
 
             WALLET_CHECK(pow.IsValid(pInput, sizeof(pInput)));
+            WALLET_CHECK(IsValidLegacy(pow, pInput, sizeof(pInput)));
+        }
+
+        TestVerifier(pow, pInput, sizeof(pInput));
+
+        {
+            cout << "Test cooperative PoW solver...\n";
+
+            beam::Block::PoW pow2;
+            pow2.m_Difficulty = 0;
+            pow2.m_Nonce = 0x010204U;
+
+            pow2.SolveMT(pInput, sizeof(pInput), 2);
+            WALLET_CHECK(pow2.IsValid(pInput, sizeof(pInput)));
+            WALLET_CHECK(IsValidLegacy(pow2, pInput, sizeof(pInput)));
         }
 
         //#endif
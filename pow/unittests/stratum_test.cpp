@@ -13,10 +13,13 @@
 // limitations under the License.
 
 #include "pow/stratum.h"
+#include "pow/external_pow.h"
 #include "core/ecc.h"
 #include "utility/io/json_serializer.h"
 #include "p2p/line_protocol.h"
 #include "utility/helpers.h"
+#include "utility/io/tcpstream.h"
+#include "utility/io/timer.h"
 #include "utility/logger.h"
 
 using namespace beam;
@@ -106,6 +109,132 @@ void gen_examples() {
     reader.new_data_from_stream((void*)buf.data, buf.size);
 }
 
+// miner that sends one stale and one bogus solution to the current job. The latter is accepted only with FakePoW
+struct StatsTestClient : beam::stratum::ParserCallback {
+    io::Reactor& reactor;
+    stratum::ResultCode expectedBogus;
+    io::TcpStream::Ptr stream;
+    LineReader reader;
+    LineProtocol packer;
+    io::SerializedMsg out;
+    int nJobs = 0;
+    int nResults = 0;
+    int nErrors = 0;
+
+    StatsTestClient(io::Reactor& r, stratum::ResultCode bogus) :
+        reactor(r),
+        expectedBogus(bogus),
+        reader([this](void* data, size_t size) { return stratum::parse_json_msg(data, size, *this); }),
+        packer(
+            [](void*, size_t) -> bool { return false; },
+            [this](io::SharedBuffer&& fragment) { out.push_back(fragment); }
+        )
+    {}
+
+    template <typename M> void send(const M& m) {
+        stratum::append_json_msg(packer, m);
+        if (!stream->write(out)) ++nErrors;
+        out.clear();
+    }
+
+    void on_connected(uint64_t, io::TcpStream::Ptr&& newStream, io::ErrorCode errorCode) {
+        if (errorCode != 0) {
+            LOG_ERROR() << "cannot connect: " << io::error_str(errorCode);
+            ++nErrors;
+            reactor.stop();
+            return;
+        }
+        stream = std::move(newStream);
+        stream->enable_read([this](io::ErrorCode ec, void* data, size_t size) -> bool {
+            if (ec != 0 || !reader.new_data_from_stream(data, size)) {
+                ++nErrors;
+                reactor.stop();
+                return false;
+            }
+            return true;
+        });
+        send(stratum::Login("stats_test_key"));
+    }
+
+    bool on_message(const stratum::Job& job) override {
+        ++nJobs;
+        Block::PoW pow;
+        ZeroObject(pow);
+        send(stratum::Solution("0", pow));
+        send(stratum::Solution(job.id, pow));
+        return true;
+    }
+
+    bool on_message(const stratum::Result& res) override {
+        const stratum::ResultCode expected[] = { stratum::solution_expired, expectedBogus };
+        if (nResults >= 2 || res.code != expected[nResults]) {
+            LOG_ERROR() << "unexpected result " << res.code;
+            ++nErrors;
+        }
+        if (++nResults == 2) reactor.stop();
+        return true;
+    }
+};
+
+int server_stats_test(bool fakePoW) {
+    int nErrors = 0;
+    Rules::get().FakePoW = fakePoW;
+
+    try {
+        io::Reactor::Ptr reactor = io::Reactor::create();
+        io::Reactor::Scope scope(*reactor);
+        io::Address addr = io::Address::localhost().port(fakePoW ? 33336 : 33335);
+
+        std::unique_ptr<IExternalPOW> server = IExternalPOW::create(IExternalPOW::Options(), *reactor, addr);
+
+        Merkle::Hash input;
+        ECC::GenRandom(input.m_pData, 32);
+        Block::PoW pow;
+        ZeroObject(pow);
+        int nFound = 0;
+        server->new_job("1", input, pow, [&nFound]() { ++nFound; }, []() { return false; });
+
+        StatsTestClient client(*reactor, fakePoW ? stratum::solution_accepted : stratum::solution_rejected);
+
+        io::Timer::Ptr connectTimer = io::Timer::create(*reactor);
+        connectTimer->start(300, false, [&]() {
+            reactor->tcp_connect(addr, 1,
+                [&client](uint64_t tag, io::TcpStream::Ptr&& newStream, io::ErrorCode errorCode) {
+                    client.on_connected(tag, std::move(newStream), errorCode);
+                },
+                1000
+            );
+        });
+        io::Timer::Ptr timeoutTimer = io::Timer::create(*reactor);
+        timeoutTimer->start(5000, false, [&]() {
+            LOG_ERROR() << "timed out";
+            ++nErrors;
+            reactor->stop();
+        });
+
+        reactor->run();
+
+        std::vector<IExternalPOW::ShareStats> stats;
+        server->get_stats(stats);
+
+        nErrors += client.nErrors;
+        if (client.nJobs != 1 || client.nResults != 2 || nFound != (fakePoW ? 1 : 0)) {
+            LOG_ERROR() << TRACE(client.nJobs) << TRACE(client.nResults) << TRACE(nFound);
+            ++nErrors;
+        }
+        if (stats.size() != 1 || stats[0].submitted != 2 || stats[0].stale != 1 || stats[0].accepted != (fakePoW ? 1U : 0U)) {
+            LOG_ERROR() << "unexpected share stats";
+            ++nErrors;
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR() << e.what();
+        nErrors = 255;
+    }
+
+    Rules::get().FakePoW = false;
+    return nErrors;
+}
+
 } //namespace
 
 int main() {
@@ -116,6 +245,8 @@ int main() {
     auto logger = Logger::create(logLevel, logLevel);
     auto res = json_creation_test();
     gen_examples();
+    res += server_stats_test(false);
+    res += server_stats_test(true);
     return res;
 }
 
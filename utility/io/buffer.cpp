@@ -30,10 +30,6 @@
 
 namespace beam { namespace io {
 
-struct AllocatedMemory {
-    virtual ~AllocatedMemory() {}
-};
-
 struct HeapAllocatedMemory : AllocatedMemory {
     explicit HeapAllocatedMemory(size_t s) {
         size = s;
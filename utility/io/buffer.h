@@ -80,8 +80,13 @@ struct IOVec {
     }
 };
 
+/// Owner of a memory region, releases it on destruction. Derive to share regions allocated elsewhere (i.e. mapped files)
+struct AllocatedMemory {
+    virtual ~AllocatedMemory() {}
+};
+
 /// Allows for sharing const memory regions
-using SharedMem = std::shared_ptr<struct AllocatedMemory>;
+using SharedMem = std::shared_ptr<AllocatedMemory>;
 
 /// Allocs shared memory from heap, throws on error
 std::pair<uint8_t*, SharedMem> alloc_heap(size_t size);
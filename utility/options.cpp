@@ -39,7 +39,9 @@ namespace beam
         const char* TEMP = "temp_dir";
         const char* IMPORT = "import";
         const char* MINING_THREADS = "mining_threads";
+        const char* MINING_COOPERATIVE = "mining_cooperative";
         const char* VERIFICATION_THREADS = "verification_threads";
+        const char* BLOCK_VALIDATION_THREADS = "block_validation_threads";
         const char* NODE_PEER = "peer";
         const char* PASS = "pass";
         const char* AMOUNT = "amount";
@@ -53,6 +55,7 @@ namespace beam
         const char* TREASURY = "treasury";
         const char* TREASURY_BLOCK = "treasury_path";
 		const char* RESYNC = "resync";
+		const char* BODY_STORE = "body_store";
 		const char* CRASH = "crash";
 		const char* INIT = "init";
 		const char* KEY_EXPORT = "key_export";
@@ -126,13 +129,16 @@ namespace beam
             (cli::TEMP, po::value<string>()->default_value(szTempDir), "temp directory for compressed history, must be on the same volume")
             (cli::TREASURY_BLOCK, po::value<string>()->default_value("treasury.mw"), "Block pack to import treasury from")
             (cli::MINING_THREADS, po::value<uint32_t>()->default_value(0), "number of mining threads(there is no mining if 0)")
+            (cli::MINING_COOPERATIVE, po::value<bool>()->default_value(false), "all the mining threads solve the same nonce together, sharing the memory")
 #if defined(BEAM_USE_GPU)
             (cli::MINER_TYPE, po::value<string>()->default_value("cpu"), "miner type [cpu|gpu]")
 #endif
             (cli::VERIFICATION_THREADS, po::value<int>()->default_value(-1), "number of threads for cryptographic verifications (0 = single thread, -1 = auto)")
+            (cli::BLOCK_VALIDATION_THREADS, po::value<uint32_t>()->default_value(0), "number of background threads verifying received blocks off the network thread (0 = disabled)")
             (cli::NODE_PEER, po::value<vector<string>>()->multitoken(), "nodes to connect to")
             (cli::IMPORT, po::value<Height>()->default_value(0), "Specify the blockchain height to import. The compressed history is asumed to be downloaded the the specified directory")
 			(cli::RESYNC, po::value<bool>()->default_value(false), "Enforce re-synchronization (soft reset)")
+			(cli::BODY_STORE, po::value<bool>()->default_value(false), "Keep block bodies in append-only segment files next to the node storage")
 			(cli::CRASH, po::value<int>()->default_value(0), "Induce crash (test proper handling)")
 			(cli::KEY_OWNER, po::value<string>(), "Owner viewer key")
 			(cli::KEY_MINE, po::value<string>(), "Standalone miner key")
@@ -36,7 +36,9 @@ namespace beam
         extern const char* TEMP;
         extern const char* IMPORT;
         extern const char* MINING_THREADS;
+        extern const char* MINING_COOPERATIVE;
         extern const char* VERIFICATION_THREADS;
+        extern const char* BLOCK_VALIDATION_THREADS;
         extern const char* NODE_PEER;
         extern const char* PASS;
         extern const char* AMOUNT;
@@ -52,6 +54,7 @@ namespace beam
         extern const char* TREASURY;
         extern const char* TREASURY_BLOCK;
 		extern const char* RESYNC;
+		extern const char* BODY_STORE;
 		extern const char* CRASH;
 		extern const char* INIT;
 		extern const char* KEY_EXPORT;
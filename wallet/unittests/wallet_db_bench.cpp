@@ -0,0 +1,82 @@
+// Copyright 2018 The Beam Team
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wallet/wallet_db.h"
+#include "utility/test_helpers.h"
+#include "utility/logger.h"
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+using namespace beam;
+
+// Usage: wallet_db_bench [max coins] [sends]
+// Coin selection latency, as seen by the send: the 1st selection (builds the index), then the selections that lock the coins.
+// The number of coins starts at 1K, and grows 10 times per step.
+int main(int argc, char* argv[])
+{
+    uint32_t nMaxCoins = (argc > 1) ? atoi(argv[1]) : 100000;
+    uint32_t nSends = (argc > 2) ? atoi(argv[2]) : 100;
+    if (!nSends)
+        nSends = 1;
+
+    auto logger = Logger::create(LOG_LEVEL_WARNING, LOG_LEVEL_WARNING);
+    ECC::InitializeContext();
+
+    const char* szDB = "wallet_bench.db";
+
+    for (uint32_t nCoins = 1000; nCoins <= nMaxCoins; nCoins *= 10)
+    {
+        if (boost::filesystem::exists(szDB))
+            boost::filesystem::remove(szDB);
+
+        ECC::NoLeak<ECC::uintBig> seed;
+        seed.V = Zero;
+        auto db = WalletDB::init(szDB, string("pass123"), seed);
+
+        Block::SystemState::ID id = { };
+        id.m_Height = 134;
+        db->setSystemStateID(id);
+
+        vector<Coin> coins;
+        coins.reserve(nCoins);
+        for (uint32_t i = 0; i < nCoins; ++i)
+            coins.push_back(Coin(1 + rand() % 10'000'000, Coin::Available, 10, Key::Type::Regular));
+        db->store(coins);
+
+        helpers::StopWatch sw;
+
+        sw.start();
+        db->selectCoins(100'000, false);
+        sw.stop();
+        uint64_t nFirst_ms = sw.milliseconds();
+
+        sw.start();
+        for (uint32_t i = 0; i < nSends; ++i)
+        {
+            if (db->selectCoins(100'000, true).empty())
+            {
+                cout << "Out of coins" << endl;
+                return -1;
+            }
+        }
+        sw.stop();
+
+        cout << "Coins: " << nCoins << ", first selection: " << nFirst_ms << " ms, " << nSends << " sends: " << sw.milliseconds() << " ms" << endl;
+    }
+
+    boost::filesystem::remove(szDB);
+    return 0;
+}
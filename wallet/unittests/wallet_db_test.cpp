@@ -289,6 +289,27 @@ void TestStoreTxRecord()
 
     t = walletDB->getTxHistory(100, 1);
     WALLET_CHECK(t.size() == 0);
+
+    // bulk history must be the same as separate reads
+    t = walletDB->getTxHistory(0, 1000);
+    WALLET_CHECK(t.size() == 100);
+    for (const auto& x : t)
+    {
+        auto tx = walletDB->getTx(x.m_txId);
+        WALLET_CHECK(tx.is_initialized());
+        WALLET_CHECK(tx->m_txId == x.m_txId);
+        WALLET_CHECK(tx->m_amount == x.m_amount);
+        WALLET_CHECK(tx->m_createTime == x.m_createTime);
+        WALLET_CHECK(tx->m_status == x.m_status);
+        WALLET_CHECK(tx->m_change == x.m_change);
+    }
+
+    // incomplete tx is skipped, but occupies its place in paging
+    id[0] = 200;
+    WALLET_CHECK(wallet::setTxParameter(walletDB, id, wallet::TxParameterID::Amount, Amount(5), false));
+    WALLET_CHECK(!walletDB->getTx(id).is_initialized());
+    WALLET_CHECK(walletDB->getTxHistory(0, 1000).size() == 100);
+    WALLET_CHECK(walletDB->getTxHistory(99, 2).size() == 1);
 }
 
 void TestRollback()
@@ -951,6 +972,76 @@ void TestSelect6()
     }
 }
 
+void TestCoinIndex()
+{
+    cout << "\nWallet database coin index test\n";
+    auto db = createSqliteWalletDB();
+
+    // the same selection, from a fresh instance that reads the storage directly
+    auto checkSelect = [&db](Amount amount)
+    {
+        auto db2 = WalletDB::open("wallet.db", string("pass123"));
+        auto c1 = db->selectCoins(amount, false);
+        auto c2 = db2->selectCoins(amount, false);
+        WALLET_CHECK(c1.size() == c2.size());
+        for (size_t i = 0; (i < c1.size()) && (i < c2.size()); i++)
+        {
+            WALLET_CHECK(c1[i].m_ID == c2[i].m_ID);
+            WALLET_CHECK(c1[i].m_status == c2[i].m_status);
+        }
+    };
+
+    vector<Coin> coins;
+    for (Amount i = 1; i <= 20; i++)
+        coins.push_back(Coin(i * 10, Coin::Available, 10, Key::Type::Regular, 5));
+    db->store(coins);
+
+    checkSelect(95);
+
+    Coin c(500, Coin::Maturing, 140, Key::Type::Regular);
+    db->store(c);
+    checkSelect(495);
+    WALLET_CHECK(db->selectCoins(495, false).size() > 1);
+
+    // maturity
+    beam::Block::SystemState::ID id = {};
+    id.m_Height = 140;
+    db->setSystemStateID(id);
+    checkSelect(495);
+    auto sel = db->selectCoins(495, false);
+    WALLET_CHECK(sel.size() == 1 && sel[0].m_ID == c.m_ID);
+
+    // amount changed for the same key
+    c.m_status = Coin::Available;
+    c.m_ID.m_Value = 5;
+    db->save(c);
+    checkSelect(495);
+
+    // spent
+    coins[3].m_status = Coin::Spent;
+    db->save(coins[3]);
+    db->remove(coins[4].m_ID);
+    db->remove(vector<Coin::ID>{ coins[5].m_ID, coins[6].m_ID });
+    checkSelect(95);
+
+    // locked by selection
+    sel = db->selectCoins(75, true);
+    WALLET_CHECK(!sel.empty());
+    checkSelect(1000);
+
+    // rollback, the locked coins become available again
+    db->rollbackConfirmedUtxo(100);
+    checkSelect(1000);
+    for (auto& x : sel)
+    {
+        WALLET_CHECK(db->find(x));
+        WALLET_CHECK(x.m_status == Coin::Available);
+    }
+
+    db->clear();
+    WALLET_CHECK(db->selectCoins(5, false).empty());
+}
+
 void TestTransferredByTx()
 {
     cout << "\nWallet database test: calculate sums of spent & received in transactions\n";
@@ -1045,6 +1136,7 @@ int main()
     TestSelect4();
     TestSelect5();
     TestSelect6();
+    TestCoinIndex();
     TestAddresses();
 
     TestTxParameters();
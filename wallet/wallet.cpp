@@ -115,6 +115,8 @@ namespace beam
         , m_tx_completed_action{move(action)}
         , m_LastSyncTotal(0)
         , m_OwnedNodesOnline(0)
+        , m_UtxoEventsStreams(0)
+        , m_hUtxoEventsAhead(0)
     {
         assert(walletDB);
         resume_all_tx();
@@ -149,6 +151,8 @@ namespace beam
     {
         m_pNodeNetwork = &netNode;
         m_pWalletNetwork = &netWallet;
+
+        m_pNodeNetwork->UtxoEventsSubscribe(this);
     }
 
     Wallet::~Wallet()
@@ -460,7 +464,7 @@ namespace beam
 
     void Wallet::RequestUtxoEvents()
     {
-        if (!m_OwnedNodesOnline)
+        if (!m_OwnedNodesOnline || m_UtxoEventsStreams)
             return;
 
         Block::SystemState::Full sTip;
@@ -494,19 +498,7 @@ namespace beam
         Block::SystemState::Full sTip;
         m_WalletDB->get_History().get_Tip(sTip);
 
-        const std::vector<proto::UtxoEvent>& v = r.m_Res.m_Events;
-		for (size_t i = 0; i < v.size(); i++)
-		{
-			const proto::UtxoEvent& evt = v[i];
-
-			// filter-out false positives
-			Scalar::Native sk;
-			Point comm;
-			m_WalletDB->calcCommitment(sk, comm, evt.m_Kidv);
-
-			if (comm == evt.m_Commitment)
-				ProcessUtxoEvent(evt, sTip.m_Height);
-		}
+        ProcessUtxoEvents(r.m_Res.m_Events, sTip.m_Height);
 
         if (r.m_Res.m_Events.size() < proto::UtxoEvent::s_Max)
             SetUtxoEventsHeight(sTip.m_Height);
@@ -517,6 +509,97 @@ namespace beam
         }
     }
 
+    Height Wallet::get_UtxoEventsStart()
+    {
+        // (re)started, the pending events will be sent again
+        m_vUtxoEventsAhead.clear();
+        m_hUtxoEventsAhead = 0;
+
+        return GetUtxoEventsHeightNext();
+    }
+
+    void Wallet::OnUtxoEvents(std::vector<proto::UtxoEvent>& v, Height hMin, Height hMax)
+    {
+        Height hNext = m_hUtxoEventsAhead ? (m_hUtxoEventsAhead + 1) : GetUtxoEventsHeightNext();
+        if (hMin > hNext)
+            return; // not contiguous, shouldn't happen
+
+        m_vUtxoEventsAhead.insert(m_vUtxoEventsAhead.end(), v.begin(), v.end());
+        m_hUtxoEventsAhead = std::max(m_hUtxoEventsAhead, hMax);
+
+        ProcessUtxoEventsAhead();
+    }
+
+    void Wallet::ProcessUtxoEventsAhead()
+    {
+        if (!m_hUtxoEventsAhead)
+            return;
+
+        Block::SystemState::Full sTip;
+        m_WalletDB->get_History().get_Tip(sTip);
+
+        // the events are ordered by height
+        size_t n = 0;
+        while ((n < m_vUtxoEventsAhead.size()) && (m_vUtxoEventsAhead[n].m_Height <= sTip.m_Height))
+            n++;
+
+        if (n)
+        {
+            std::vector<proto::UtxoEvent> v(m_vUtxoEventsAhead.begin(), m_vUtxoEventsAhead.begin() + n);
+            m_vUtxoEventsAhead.erase(m_vUtxoEventsAhead.begin(), m_vUtxoEventsAhead.begin() + n);
+
+            ProcessUtxoEvents(v, sTip.m_Height);
+        }
+
+        if (m_hUtxoEventsAhead <= sTip.m_Height)
+        {
+            assert(m_vUtxoEventsAhead.empty());
+            SetUtxoEventsHeight(m_hUtxoEventsAhead);
+            m_hUtxoEventsAhead = 0;
+        }
+        else
+            SetUtxoEventsHeight(sTip.m_Height);
+    }
+
+    void Wallet::OnUtxoEventsStream(bool bUp)
+    {
+        if (bUp)
+        {
+            if (!m_UtxoEventsStreams++)
+                AbortUtxoEvents(); // superseded by the stream
+        }
+        else
+        {
+            assert(m_UtxoEventsStreams);
+            if (!--m_UtxoEventsStreams)
+            {
+                m_vUtxoEventsAhead.clear();
+                m_hUtxoEventsAhead = 0;
+
+                RequestUtxoEvents(); // fallback, if there're other owned nodes
+            }
+        }
+    }
+
+    void Wallet::ProcessUtxoEvents(const std::vector<proto::UtxoEvent>& v, Height hTip)
+    {
+        // filter-out false positives, all the commitments are derived at once
+        std::vector<Coin::ID> vCid(v.size());
+        for (size_t i = 0; i < v.size(); i++)
+            vCid[i] = v[i].m_Kidv;
+
+        std::vector<Point> vComm(v.size());
+        if (!v.empty())
+            m_WalletDB->calcCommitments(&vComm.front(), &vCid.front(), static_cast<uint32_t>(v.size()));
+
+        for (size_t i = 0; i < v.size(); i++)
+        {
+            const proto::UtxoEvent& evt = v[i];
+            if (vComm[i] == evt.m_Commitment)
+                ProcessUtxoEvent(evt, hTip);
+        }
+    }
+
     void Wallet::SetUtxoEventsHeight(Height h)
     {
         uintBigFor<Height>::Type var;
@@ -615,8 +698,15 @@ namespace beam
         }
 
         Height h = GetUtxoEventsHeightNext();
+        bool bRestart = (m_hUtxoEventsAhead != 0); // the pending events may belong to the abandoned branch
         if (h > sTip.m_Height + 1)
+        {
             SetUtxoEventsHeight(sTip.m_Height);
+            bRestart = true;
+        }
+
+        if (bRestart && m_UtxoEventsStreams)
+            m_pNodeNetwork->UtxoEventsSubscribe(this); // restart from the new height
     }
 
     void Wallet::OnNewTip()
@@ -635,6 +725,7 @@ namespace beam
         if (!m_WalletDB->getSystemStateID(id2))
             id2.m_Height = 0;
 
+        ProcessUtxoEventsAhead();
         RequestUtxoEvents();
 
         auto t = m_transactions;
@@ -52,6 +52,7 @@ namespace beam
     class Wallet
         : public IWallet
         , public wallet::INegotiatorGateway
+        , public proto::FlyClient::IUtxoEventsReceiver
     {
         using Callback = std::function<void()>;
     public:
@@ -92,6 +93,11 @@ namespace beam
         Block::SystemState::IHistory& get_History() override;
         void OnOwnedNode(const PeerID&, bool bUp) override;
 
+        // IUtxoEventsReceiver
+        Height get_UtxoEventsStart() override;
+        void OnUtxoEvents(std::vector<proto::UtxoEvent>&, Height hMin, Height hMax) override;
+        void OnUtxoEventsStream(bool bUp) override;
+
         struct RequestHandler
             : public proto::FlyClient::Request::IHandler
         {
@@ -109,6 +115,8 @@ namespace beam
         void RequestUtxoEvents();
         void AbortUtxoEvents();
         void ProcessUtxoEvent(const proto::UtxoEvent&, Height hTip);
+        void ProcessUtxoEvents(const std::vector<proto::UtxoEvent>&, Height hTip);
+        void ProcessUtxoEventsAhead();
         void SetUtxoEventsHeight(Height);
         Height GetUtxoEventsHeightNext();
 
@@ -192,6 +200,11 @@ namespace beam
         TxCompletedAction m_tx_completed_action;
         uint32_t m_LastSyncTotal;
         uint32_t m_OwnedNodesOnline;
+        uint32_t m_UtxoEventsStreams; // if streaming - no need to request the events
+
+        // streamed events may go beyond our tip, those are kept until it catches up
+        std::vector<proto::UtxoEvent> m_vUtxoEventsAhead;
+        Height m_hUtxoEventsAhead; // the stream is complete up to this height. 0 if nothing is pending
 
         std::vector<IWalletObserver*> m_subscribers;
     };
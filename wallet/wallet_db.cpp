@@ -600,11 +600,57 @@ namespace beam
 
     namespace sqlite
     {
+        struct StatementCache
+        {
+            struct Entry
+            {
+                sqlite3_stmt* m_pStm = nullptr;
+                bool m_InUse = false;
+            };
+
+            std::unordered_map<std::string, Entry> m_Map; // by sql text. Element references survive rehash
+
+            ~StatementCache()
+            {
+                for (auto& x : m_Map)
+                    sqlite3_finalize(x.second.m_pStm);
+            }
+        };
+
         struct Statement
         {
             Statement(sqlite3* db, const char* sql)
                 : _db(db)
                 , _stm(nullptr)
+                , _pCached(nullptr)
+            {
+                prepare(sql);
+            }
+
+            Statement(const WalletDB* pDB, const char* sql)
+                : _db(pDB->_db)
+                , _stm(nullptr)
+                , _pCached(nullptr)
+            {
+                StatementCache::Entry& e = pDB->m_pStmCache->m_Map[sql];
+                if (e.m_InUse)
+                {
+                    prepare(sql); // the same query is already running (nested call), fallback to a private statement
+                    return;
+                }
+
+                if (!e.m_pStm)
+                {
+                    int ret = sqlite3_prepare_v2(_db, sql, -1, &e.m_pStm, nullptr);
+                    throwIfError(ret, _db);
+                }
+
+                _stm = e.m_pStm;
+                _pCached = &e;
+                e.m_InUse = true;
+            }
+
+            void prepare(const char* sql)
             {
                 int ret = sqlite3_prepare_v2(_db, sql, -1, &_stm, nullptr);
                 throwIfError(ret, _db);
@@ -842,12 +888,20 @@ namespace beam
 
             ~Statement()
             {
-                sqlite3_finalize(_stm);
+                if (_pCached)
+                {
+                    // return to the cache: release the read lock and the bound (not copied) data
+                    Reset();
+                    _pCached->m_InUse = false;
+                }
+                else
+                    sqlite3_finalize(_stm);
             }
         private:
 
             sqlite3 * _db;
             sqlite3_stmt* _stm;
+            StatementCache::Entry* _pCached;
         };
 
         struct Transaction
@@ -1098,17 +1152,21 @@ namespace beam
 
     WalletDB::WalletDB()
         : _db(nullptr)
+        , m_pStmCache(new sqlite::StatementCache)
     {
     }
 
     WalletDB::WalletDB(const ECC::NoLeak<ECC::uintBig>& secretKey)
         : _db(nullptr)
+        , m_pStmCache(new sqlite::StatementCache)
     {
         ECC::HKdf::Create(m_pKdf, secretKey.V);
     }
 
     WalletDB::~WalletDB()
     {
+        m_pStmCache.reset(); // finalize before close
+
         if (_db)
         {
             sqlite3_close_v2(_db);
@@ -1136,6 +1194,25 @@ namespace beam
     {
         SwitchCommitment().Create(sk, comm, *get_ChildKdf(cid.m_SubIdx), cid);
     }
+
+    void IWalletDB::calcCommitments(ECC::Point* pComm, const Coin::ID* pCid, uint32_t nCount)
+    {
+        // child kdfs are created once per batch
+        std::map<Key::Index, Key::IKdf::Ptr> mapKdf;
+        std::vector<Key::IKdf*> vKdf(nCount);
+
+        for (uint32_t i = 0; i < nCount; i++)
+        {
+            Key::IKdf::Ptr& pKdf = mapKdf[pCid[i].m_SubIdx];
+            if (!pKdf)
+                pKdf = get_ChildKdf(pCid[i].m_SubIdx);
+
+            vKdf[i] = pKdf.get();
+        }
+
+        if (nCount)
+            SwitchCommitment().CreateBatch(pComm, &vKdf.front(), pCid, nCount);
+    }
 
     vector<Coin> WalletDB::selectCoins(const Amount& amount, bool lock)
     {
@@ -1143,20 +1220,18 @@ namespace beam
         Block::SystemState::ID stateID = {};
         getSystemStateID(stateID);
 
+        buildCoinIndex();
+
+        for (const auto& x : m_CoinIndex.m_ByAmount)
         {
-            sqlite::Statement stm(_db, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity<=?2 ORDER BY amount ASC");
-            stm.bind(1, Coin::Available);
-            stm.bind(2, stateID.m_Height);
+            const Coin& coin = x.second;
+            if (coin.m_maturity > stateID.m_Height)
+                continue;
 
-            while (stm.step())
-            {
-                auto& coin = coins.emplace_back();
-                int colIdx = 0;
-                ENUM_ALL_STORAGE_FIELDS(STM_GET_LIST, NOSEP, coin);
+            coins.push_back(coin);
 
-                if (coin.m_ID.m_Value >= amount)
-                    break;
-            }
+            if (coin.m_ID.m_Value >= amount)
+                break;
         }
 
         CoinSelector3 csel(coins);
@@ -1177,7 +1252,7 @@ namespace beam
                 {
                     coin.m_status = Coin::Outgoing;
                     const char* req = "UPDATE " STORAGE_NAME " SET status=?, lockedHeight=?" STORAGE_WHERE_ID;
-                    sqlite::Statement stm(_db, req);
+                    sqlite::Statement stm(this, req);
 
                     int colIdx = 0;
                     stm.bind(++colIdx, coin.m_status);
@@ -1189,6 +1264,9 @@ namespace beam
 
                 trans.commit();
 
+                for (const auto& coin : coinsSel)
+                    m_CoinIndex.OnRemoved(coin.m_ID);
+
                 notifyCoinsChanged();
             }
         }
@@ -1200,7 +1278,7 @@ namespace beam
     std::vector<Coin> WalletDB::getCoinsCreatedByTx(const TxID& txId)
     {
         // select all coins for TxID
-        sqlite::Statement stm(_db, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE createTxID=?1 ORDER BY amount DESC;");
+        sqlite::Statement stm(this, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE createTxID=?1 ORDER BY amount DESC;");
         stm.bind(1, txId);
 
         vector<Coin> coins;
@@ -1219,8 +1297,8 @@ namespace beam
     {
         struct InsertCoinStatement : public sqlite::Statement
         {
-            InsertCoinStatement(sqlite3* db)
-                : sqlite::Statement(db, "INSERT OR REPLACE INTO " STORAGE_NAME " (" ENUM_ALL_STORAGE_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_ALL_STORAGE_FIELDS(BIND_LIST, COMMA, ) ");")
+            InsertCoinStatement(const WalletDB* pDB)
+                : sqlite::Statement(pDB, "INSERT OR REPLACE INTO " STORAGE_NAME " (" ENUM_ALL_STORAGE_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_ALL_STORAGE_FIELDS(BIND_LIST, COMMA, ) ");")
             {
             }
 
@@ -1241,10 +1319,11 @@ namespace beam
         sqlite::Transaction trans(_db);
 
         coin.m_ID.m_Idx = AllocateKidRange(1);
-        InsertCoinStatement stm(_db);
+        InsertCoinStatement stm(this);
         stm.apply(coin);
 
         trans.commit();
+        m_CoinIndex.OnSaved(coin);
         notifyCoinsChanged();
     }
 
@@ -1256,7 +1335,7 @@ namespace beam
         sqlite::Transaction trans(_db);
 
         uint64_t nKeyIndex = AllocateKidRange(coins.size());
-        InsertCoinStatement stm(_db);
+        InsertCoinStatement stm(this);
         for (auto& coin : coins)
         {
             coin.m_ID.m_Idx = nKeyIndex++;
@@ -1264,13 +1343,18 @@ namespace beam
         }
 
         trans.commit();
+
+        for (const auto& coin : coins)
+            m_CoinIndex.OnSaved(coin);
+
         notifyCoinsChanged();
     }
 
     void WalletDB::save(const Coin& coin)
     {
-        InsertCoinStatement stm(_db);
+        InsertCoinStatement stm(this);
         stm.apply(coin);
+        m_CoinIndex.OnSaved(coin);
         notifyCoinsChanged();
     }
 
@@ -1280,13 +1364,17 @@ namespace beam
             return;
 
         sqlite::Transaction trans(_db);
-        InsertCoinStatement stm(_db);
+        InsertCoinStatement stm(this);
         for (auto& coin : coins)
         {
             stm.apply(coin);
         }
 
         trans.commit();
+
+        for (const auto& coin : coins)
+            m_CoinIndex.OnSaved(coin);
+
         notifyCoinsChanged();
     }
 
@@ -1323,6 +1411,10 @@ namespace beam
                 removeImpl(cid);
 
             trans.commit();
+
+            for (const auto& cid : coins)
+                m_CoinIndex.OnRemoved(cid);
+
             notifyCoinsChanged();
         }
     }
@@ -1330,7 +1422,7 @@ namespace beam
     void WalletDB::removeImpl(const Coin::ID& cid)
     {
         const char* req = "DELETE FROM " STORAGE_NAME STORAGE_WHERE_ID;
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
 
         struct DummyWrapper {
             Coin::ID m_ID;
@@ -1348,19 +1440,21 @@ namespace beam
     void WalletDB::remove(const Coin::ID& cid)
     {
         removeImpl(cid);
+        m_CoinIndex.OnRemoved(cid);
         notifyCoinsChanged();
     }
 
     void WalletDB::clear()
     {
         {
-            sqlite::Statement stm(_db, "DELETE FROM " STORAGE_NAME ";");
+            sqlite::Statement stm(this, "DELETE FROM " STORAGE_NAME ";");
             stm.step();
+            m_CoinIndex.Reset();
             notifyCoinsChanged();
         }
 
         {
-            sqlite::Statement stm(_db, "DELETE FROM " TX_PARAMS_NAME ";");
+            sqlite::Statement stm(this, "DELETE FROM " TX_PARAMS_NAME ";");
             stm.step();
             notifyTransactionChanged(ChangeAction::Reset, {});
         }
@@ -1369,7 +1463,7 @@ namespace beam
     bool WalletDB::find(Coin& coin)
     {
         const char* req = "SELECT " ENUM_STORAGE_FIELDS(LIST, COMMA, ) " FROM " STORAGE_NAME STORAGE_WHERE_ID;
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
 
         int colIdx = 0;
         STORAGE_BIND_ID(coin)
@@ -1386,26 +1480,105 @@ namespace beam
     void WalletDB::updateCoinMaturityStatus()
     {
         sqlite::Transaction trans(_db);
+        Height h = getCurrentHeight();
+
+        vector<Coin> coinsMatured;
+        if (m_CoinIndex.m_Valid)
+        {
+            const char* req = "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity <= ?2;";
+            sqlite::Statement stm(this, req);
+
+            stm.bind(1, Coin::Maturing);
+            stm.bind(2, h);
+
+            while (stm.step())
+            {
+                auto& coin = coinsMatured.emplace_back();
+                int colIdx = 0;
+                ENUM_ALL_STORAGE_FIELDS(STM_GET_LIST, NOSEP, coin);
+                coin.m_status = Coin::Available;
+            }
+        }
 
         {
             const char* req = "UPDATE " STORAGE_NAME " SET status=?3 WHERE status=?1 AND maturity <= ?2;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(this, req);
 
             stm.bind(1, Coin::Maturing);
-            stm.bind(2, getCurrentHeight());
+            stm.bind(2, h);
             stm.bind(3, Coin::Available);
 
             stm.step();
         }
 
         trans.commit();
+
+        for (const auto& coin : coinsMatured)
+            m_CoinIndex.OnSaved(coin);
+
         notifyCoinsChanged();
     }
 
+    void WalletDB::buildCoinIndex()
+    {
+        if (m_CoinIndex.m_Valid)
+            return;
+
+        m_CoinIndex.Reset();
+
+        sqlite::Statement stm(this, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1;");
+        stm.bind(1, Coin::Available);
+
+        while (stm.step())
+        {
+            Coin coin;
+            int colIdx = 0;
+            ENUM_ALL_STORAGE_FIELDS(STM_GET_LIST, NOSEP, coin);
+
+            m_CoinIndex.Add(coin);
+        }
+
+        m_CoinIndex.m_Valid = true;
+    }
+
+    void WalletDB::CoinIndex::Reset()
+    {
+        m_ByAmount.clear();
+        m_ByID.clear();
+        m_Valid = false;
+    }
+
+    void WalletDB::CoinIndex::Add(const Coin& coin)
+    {
+        auto it = m_ByAmount.emplace(std::make_pair(coin.m_ID.m_Value, Key::ID(coin.m_ID)), coin).first;
+        m_ByID[coin.m_ID] = it;
+    }
+
+    void WalletDB::CoinIndex::OnSaved(const Coin& coin)
+    {
+        OnRemoved(coin.m_ID); // the amount may have changed, or the coin isn't available anymore
+
+        if (m_Valid && (Coin::Available == coin.m_status))
+            Add(coin);
+    }
+
+    void WalletDB::CoinIndex::OnRemoved(const Key::ID& kid)
+    {
+        if (!m_Valid)
+            return;
+
+        auto it = m_ByID.find(kid);
+        if (m_ByID.end() != it)
+        {
+            m_ByAmount.erase(it->second);
+            m_ByID.erase(it);
+        }
+    }
+
     void WalletDB::visit(function<bool(const Coin& coin)> func)
     {
         const char* req = "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " ORDER BY " ENUM_STORAGE_ID(LIST, COMMA, ) ";";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
 
         while (stm.step())
         {
@@ -1423,7 +1596,7 @@ namespace beam
     {
         const char* req = "INSERT or REPLACE INTO " VARIABLES_NAME " (" VARIABLES_FIELDS ") VALUES(?1, ?2);";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
 
         stm.bind(1, name);
         stm.bind(2, data, size);
@@ -1435,7 +1608,7 @@ namespace beam
     {
         const char* req = "SELECT value FROM " VARIABLES_NAME " WHERE name=?1;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         stm.bind(1, name);
 
         return
@@ -1447,7 +1620,7 @@ namespace beam
     {
         const char* req = "SELECT value FROM " VARIABLES_NAME " WHERE name=?1;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         stm.bind(1, name);
         if (stm.step())
         {
@@ -1495,11 +1668,12 @@ namespace beam
 
     void WalletDB::rollbackConfirmedUtxo(Height minHeight)
     {
+        m_CoinIndex.Reset(); // bulk update, rebuilt on demand
         sqlite::Transaction trans(_db);
 
         {
             const char* req = "UPDATE " STORAGE_NAME " SET status=?1, confirmHeight=?2, lockedHeight=?2 WHERE confirmHeight > ?3 ;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(this, req);
             stm.bind(1, Coin::Unavailable);
             stm.bind(2, MaxHeight);
             stm.bind(3, minHeight);
@@ -1508,7 +1682,7 @@ namespace beam
 
         {
             const char* req = "UPDATE " STORAGE_NAME " SET status=?1, lockedHeight=?2 WHERE lockedHeight > ?3 AND confirmHeight <= ?3 ;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(this, req);
             stm.bind(1, Coin::Available);
             stm.bind(2, MaxHeight);
             stm.bind(3, minHeight);
@@ -1519,55 +1693,125 @@ namespace beam
         notifyCoinsChanged();
     }
 
-    vector<TxDescription> WalletDB::getTxHistory(uint64_t start, int count)
+    namespace
     {
-        // TODO this is temporary solution
-        int txCount = 0;
+        // Assembles TxDescription from its parameters, in any order
+        struct TxDescriptionBuilder
         {
-            sqlite::Statement stm(_db, "SELECT COUNT(DISTINCT txID) FROM " TX_PARAMS_NAME " ;");
-            stm.step();
-            stm.get(0, txCount);
-        }
-        
-        vector<TxDescription> res;
-        if (txCount > 0)
-        {
-            res.reserve(static_cast<size_t>(min(txCount, count)));
-            const char* req = "SELECT DISTINCT txID FROM " TX_PARAMS_NAME " LIMIT ?1 OFFSET ?2 ;";
+            TxDescription m_Tx;
+            std::set<wallet::TxParameterID> m_Params;
 
-            sqlite::Statement stm(_db, req);
-            stm.bind(1, count);
-            stm.bind(2, start);
+            void Reset(const TxID& txId)
+            {
+                m_Tx = TxDescription();
+                m_Tx.m_txId = txId;
+                m_Params.clear();
+            }
 
-            while (stm.step())
+            void Add(TxParameter& parameter)
             {
-                TxID txID;
-                stm.get(0, txID);
-                auto t = getTx(txID);
-                if (t.is_initialized())
+                m_Params.emplace(static_cast<wallet::TxParameterID>(parameter.m_paramID));
+
+                switch (static_cast<wallet::TxParameterID>(parameter.m_paramID))
                 {
-                    res.emplace_back(*t);
+                case wallet::TxParameterID::Amount:
+                    deserialize(m_Tx.m_amount, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::Fee:
+                    deserialize(m_Tx.m_fee, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::MinHeight:
+                    deserialize(m_Tx.m_minHeight, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::PeerID:
+                    deserialize(m_Tx.m_peerId, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::MyID:
+                    deserialize(m_Tx.m_myId, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::CreateTime:
+                    deserialize(m_Tx.m_createTime, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::IsSender:
+                    deserialize(m_Tx.m_sender, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::Message:
+                    deserialize(m_Tx.m_message, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::Change:
+                    deserialize(m_Tx.m_change, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::ModifyTime:
+                    deserialize(m_Tx.m_modifyTime, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::Status:
+                    deserialize(m_Tx.m_status, parameter.m_value);
+                    break;
+                case wallet::TxParameterID::KernelID:
+                    deserialize(m_Tx.m_kernelID, parameter.m_value);
+                    break;
+                default:
+                    break; // suppress warning
                 }
             }
+
+            bool IsComplete() const
+            {
+                static const std::set<wallet::TxParameterID> mandatoryParams{ wallet::TxParameterID::Amount, wallet::TxParameterID::Fee,
+                    wallet::TxParameterID::MinHeight, wallet::TxParameterID::PeerID,
+                    wallet::TxParameterID::MyID, wallet::TxParameterID::CreateTime,
+                    wallet::TxParameterID::IsSender };
+
+                return std::includes(m_Params.begin(), m_Params.end(), mandatoryParams.begin(), mandatoryParams.end());
+            }
+        };
+    }
+
+    vector<TxDescription> WalletDB::getTxHistory(uint64_t start, int count)
+    {
+        // single scan of the parameters of the requested page, grouped by txID
+        const char* req = "SELECT * FROM " TX_PARAMS_NAME " WHERE txID IN (SELECT DISTINCT txID FROM " TX_PARAMS_NAME " ORDER BY txID LIMIT ?1 OFFSET ?2) ORDER BY txID;";
+
+        sqlite::Statement stm(this, req);
+        stm.bind(1, count);
+        stm.bind(2, start);
+
+        vector<TxDescription> res;
+        TxDescriptionBuilder txb;
+        bool bHasTx = false;
+
+        while (stm.step())
+        {
+            TxParameter parameter = {};
+            int colIdx = 0;
+            ENUM_TX_PARAMS_FIELDS(STM_GET_LIST, NOSEP, parameter);
+
+            if (!bHasTx || (parameter.m_txID != txb.m_Tx.m_txId))
+            {
+                if (bHasTx && txb.IsComplete())
+                    res.push_back(std::move(txb.m_Tx));
+
+                txb.Reset(parameter.m_txID);
+                bHasTx = true;
+            }
+
+            txb.Add(parameter);
         }
 
+        if (bHasTx && txb.IsComplete())
+            res.push_back(std::move(txb.m_Tx));
+
         return res;
     }
 
     boost::optional<TxDescription> WalletDB::getTx(const TxID& txId)
     {
         const char* req = "SELECT * FROM " TX_PARAMS_NAME " WHERE txID=?1;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         stm.bind(1, txId);
 
-        TxDescription txDescription;
-        txDescription.m_txId = txId;
-
-        const std::set<wallet::TxParameterID> mandatoryParams{ wallet::TxParameterID::Amount, wallet::TxParameterID::Fee,
-            wallet::TxParameterID::MinHeight, wallet::TxParameterID::PeerID,
-            wallet::TxParameterID::MyID, wallet::TxParameterID::CreateTime,
-            wallet::TxParameterID::IsSender };
-        std::set<wallet::TxParameterID> gottenParams;
+        TxDescriptionBuilder txb;
+        txb.Reset(txId);
 
         while (stm.step())
         {
@@ -1575,54 +1819,12 @@ namespace beam
             int colIdx = 0;
             ENUM_TX_PARAMS_FIELDS(STM_GET_LIST, NOSEP, parameter);
 
-            gottenParams.emplace(static_cast<wallet::TxParameterID>(parameter.m_paramID));
-
-            switch (static_cast<wallet::TxParameterID>(parameter.m_paramID))
-            {
-            case wallet::TxParameterID::Amount:
-                deserialize(txDescription.m_amount, parameter.m_value);
-                break;
-            case wallet::TxParameterID::Fee:
-                deserialize(txDescription.m_fee, parameter.m_value);
-                break;
-            case wallet::TxParameterID::MinHeight:
-                deserialize(txDescription.m_minHeight, parameter.m_value);
-                break;
-            case wallet::TxParameterID::PeerID:
-                deserialize(txDescription.m_peerId, parameter.m_value);
-                break;
-            case wallet::TxParameterID::MyID:
-                deserialize(txDescription.m_myId, parameter.m_value);
-                break;
-            case wallet::TxParameterID::CreateTime:
-                deserialize(txDescription.m_createTime, parameter.m_value);
-                break;
-            case wallet::TxParameterID::IsSender:
-                deserialize(txDescription.m_sender, parameter.m_value);
-                break;
-            case wallet::TxParameterID::Message:
-                deserialize(txDescription.m_message, parameter.m_value);
-                break;
-            case wallet::TxParameterID::Change:
-                deserialize(txDescription.m_change, parameter.m_value);
-                break;
-            case wallet::TxParameterID::ModifyTime:
-                deserialize(txDescription.m_modifyTime, parameter.m_value);
-                break;
-            case wallet::TxParameterID::Status:
-                deserialize(txDescription.m_status, parameter.m_value);
-                break;
-            case wallet::TxParameterID::KernelID:
-                deserialize(txDescription.m_kernelID, parameter.m_value);
-                break;
-			default:
-				break; // suppress warning
-            }
+            txb.Add(parameter);
         }
 
-        if (std::includes(gottenParams.begin(), gottenParams.end(), mandatoryParams.begin(), mandatoryParams.end()))
+        if (txb.IsComplete())
         {
-            return txDescription;
+            return txb.m_Tx;
         }
 
         return boost::optional<TxDescription>{};
@@ -1658,7 +1860,7 @@ namespace beam
         if (tx.is_initialized())
         {
             const char* req = "DELETE FROM " TX_PARAMS_NAME " WHERE txID=?1;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(this, req);
 
             stm.bind(1, txId);
 
@@ -1669,11 +1871,12 @@ namespace beam
 
     void WalletDB::rollbackTx(const TxID& txId)
     {
+        m_CoinIndex.Reset(); // bulk update, rebuilt on demand
         sqlite::Transaction trans(_db);
 
         {
             const char* req = "UPDATE " STORAGE_NAME " SET status=?3, spentTxId=NULL WHERE spentTxId=?1 AND status=?2;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(this, req);
             stm.bind(1, txId);
             stm.bind(2, Coin::Outgoing);
             stm.bind(3, Coin::Available);
@@ -1681,7 +1884,7 @@ namespace beam
         }
         {
             const char* req = "DELETE FROM " STORAGE_NAME " WHERE createTxId=?1;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(this, req);
             stm.bind(1, txId);
             stm.step();
         }
@@ -1694,7 +1897,7 @@ namespace beam
         vector<WalletAddress> res;
         const char* req = "SELECT * FROM " ADDRESSES_NAME " ORDER BY createTime DESC;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
 
         while (stm.step())
         {
@@ -1714,13 +1917,13 @@ namespace beam
 
         {
             const char* selectReq = "SELECT * FROM " ADDRESSES_NAME " WHERE walletID=?1;";
-            sqlite::Statement stm2(_db, selectReq);
+            sqlite::Statement stm2(this, selectReq);
             stm2.bind(1, address.m_walletID);
 
             if (stm2.step())
             {
                 const char* updateReq = "UPDATE " ADDRESSES_NAME " SET label=?2, category=?3 WHERE walletID=?1;";
-                sqlite::Statement stm(_db, updateReq);
+                sqlite::Statement stm(this, updateReq);
 
                 stm.bind(1, address.m_walletID);
                 stm.bind(2, address.m_label);
@@ -1730,7 +1933,7 @@ namespace beam
             else
             {
                 const char* insertReq = "INSERT INTO " ADDRESSES_NAME " (" ENUM_ADDRESS_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_ADDRESS_FIELDS(BIND_LIST, COMMA, ) ");";
-                sqlite::Statement stm(_db, insertReq);
+                sqlite::Statement stm(this, insertReq);
                 int colIdx = 0;
                 ENUM_ADDRESS_FIELDS(STM_BIND_LIST, NOSEP, address);
                 stm.step();
@@ -1745,7 +1948,7 @@ namespace beam
     boost::optional<WalletAddress> WalletDB::getAddress(const WalletID& id)
     {
         const char* req = "SELECT * FROM " ADDRESSES_NAME " WHERE walletID=?1;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
 
         stm.bind(1, id);
 
@@ -1762,7 +1965,7 @@ namespace beam
     void WalletDB::deleteAddress(const WalletID& id)
     {
         const char* req = "DELETE FROM " ADDRESSES_NAME " WHERE walletID=?1;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
 
         stm.bind(1, id);
 
@@ -1816,7 +2019,7 @@ namespace beam
     {
         bool hasTx = getTx(txID).is_initialized();
         {
-            sqlite::Statement stm(_db, "SELECT * FROM " TX_PARAMS_NAME " WHERE txID=?1 AND paramID=?2;");
+            sqlite::Statement stm(this, "SELECT * FROM " TX_PARAMS_NAME " WHERE txID=?1 AND paramID=?2;");
 
             stm.bind(1, txID);
             stm.bind(2, paramID);
@@ -1828,7 +2031,7 @@ namespace beam
                     return false;
                 }
 
-                sqlite::Statement stm2(_db, "UPDATE " TX_PARAMS_NAME  " SET value = ?3 WHERE txID = ?1 AND paramID = ?2;");
+                sqlite::Statement stm2(this, "UPDATE " TX_PARAMS_NAME  " SET value = ?3 WHERE txID = ?1 AND paramID = ?2;");
                 stm2.bind(1, txID);
                 stm2.bind(2, paramID);
                 stm2.bind(3, blob);
@@ -1845,7 +2048,7 @@ namespace beam
             }
         }
         
-        sqlite::Statement stm(_db, "INSERT INTO " TX_PARAMS_NAME " (" ENUM_TX_PARAMS_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_TX_PARAMS_FIELDS(BIND_LIST, COMMA, ) ");");
+        sqlite::Statement stm(this, "INSERT INTO " TX_PARAMS_NAME " (" ENUM_TX_PARAMS_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_TX_PARAMS_FIELDS(BIND_LIST, COMMA, ) ");");
         TxParameter parameter;
         parameter.m_txID = txID;
         parameter.m_paramID = static_cast<int>(paramID);
@@ -1866,7 +2069,7 @@ namespace beam
 
     bool WalletDB::getTxParameter(const TxID& txID, wallet::TxParameterID paramID, ByteBuffer& blob)
     {
-        sqlite::Statement stm(_db, "SELECT * FROM " TX_PARAMS_NAME " WHERE txID=?1 AND paramID=?2;");
+        sqlite::Statement stm(this, "SELECT * FROM " TX_PARAMS_NAME " WHERE txID=?1 AND paramID=?2;");
 
         stm.bind(1, txID);
         stm.bind(2, paramID);
@@ -1920,7 +2123,7 @@ namespace beam
             if (s.m_Height > hMaxBacklog)
             {
                 const char* req = "DELETE FROM " TblStates " WHERE " TblStates_Height "<=?";
-                sqlite::Statement stm(_db, req);
+                sqlite::Statement stm(this, req);
                 stm.bind(1, s.m_Height - hMaxBacklog);
                 stm.step();
 
@@ -1932,7 +2135,7 @@ namespace beam
     {
         auto currentHeight = getCurrentHeight();
         const char* req = "SELECT SUM(amount) FROM " STORAGE_NAME " WHERE status = ?1 AND maturity <= ?2;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         stm.bind(1, Coin::Available);
         stm.bind(2, currentHeight);
 
@@ -1949,7 +2152,7 @@ namespace beam
     {
         auto currentHeight = getCurrentHeight();
         const char* req = "SELECT SUM(amount) FROM " STORAGE_NAME " WHERE status = ?1 AND type = ?2 AND maturity <= ?3;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         stm.bind(1, Coin::Available);
         stm.bind(2, keyType);
         stm.bind(3, currentHeight);
@@ -1966,7 +2169,7 @@ namespace beam
     Amount WalletDB::getTotal(Coin::Status status)
     {
         const char* req = "SELECT SUM(amount) FROM " STORAGE_NAME " WHERE status = ?1;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         stm.bind(1, status);
 
         Amount result = 0;
@@ -1981,7 +2184,7 @@ namespace beam
     Amount WalletDB::getTotalByType(Coin::Status status, Key::Type keyType)
     {
         const char* req = "SELECT SUM(amount) FROM " STORAGE_NAME " WHERE status = ?1 AND type = ?2;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         stm.bind(1, status);
         stm.bind(2, keyType);
 
@@ -1998,7 +2201,7 @@ namespace beam
     {
         const char* req = "SELECT value FROM " TX_PARAMS_NAME " WHERE paramID = ?5 AND txID IN (SELECT txID FROM " TX_PARAMS_NAME " WHERE paramID= ?1 AND value = ?2 AND txID IN (SELECT txID FROM " TX_PARAMS_NAME " WHERE paramID= ?3 AND value = ?4 ));";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(this, req);
         ByteBuffer blobStatus = wallet::toByteBuffer(status);
         ByteBuffer blobIsSender = wallet::toByteBuffer(isSender);
 
@@ -2028,7 +2231,7 @@ namespace beam
             "SELECT " TblStates_Hdr " FROM " TblStates " WHERE " TblStates_Height "<? ORDER BY " TblStates_Height " DESC" :
             "SELECT " TblStates_Hdr " FROM " TblStates " ORDER BY " TblStates_Height " DESC";
 
-        sqlite::Statement stm(get_ParentObj()._db, req);
+        sqlite::Statement stm(&get_ParentObj(), req);
 
         if (pBelow)
             stm.bind(1, *pBelow);
@@ -2049,7 +2252,7 @@ namespace beam
     {
         const char* req = "SELECT " TblStates_Hdr " FROM " TblStates " WHERE " TblStates_Height "=?";
 
-        sqlite::Statement stm(get_ParentObj()._db, req);
+        sqlite::Statement stm(&get_ParentObj(), req);
         stm.bind(1, h);
 
         if (!stm.step())
@@ -2064,7 +2267,7 @@ namespace beam
         sqlite::Transaction trans(get_ParentObj()._db);
 
         const char* req = "INSERT OR REPLACE INTO " TblStates " (" TblStates_Height "," TblStates_Hdr ") VALUES(?,?)";
-        sqlite::Statement stm(get_ParentObj()._db, req);
+        sqlite::Statement stm(&get_ParentObj(), req);
 
         for (size_t i = 0; i < nCount; i++)
         {
@@ -2083,7 +2286,7 @@ namespace beam
     void WalletDB::History::DeleteFrom(Height h)
     {
         const char* req = "DELETE FROM " TblStates " WHERE " TblStates_Height ">=?";
-        sqlite::Statement stm(get_ParentObj()._db, req);
+        sqlite::Statement stm(&get_ParentObj(), req);
         stm.bind(1, h);
         stm.step();
     }
@@ -35,6 +35,12 @@ struct sqlite3;
 
 namespace beam
 {
+    namespace sqlite
+    {
+        struct Statement;
+        struct StatementCache;
+    }
+
     struct Coin
     {
         enum Status
@@ -137,6 +143,7 @@ namespace beam
         virtual beam::Key::IKdf::Ptr get_MasterKdf() const = 0;
         beam::Key::IKdf::Ptr get_ChildKdf(Key::Index) const;
         void calcCommitment(ECC::Scalar::Native& sk, ECC::Point& comm, const Coin::ID&);
+        void calcCommitments(ECC::Point* pComm, const Coin::ID* pCid, uint32_t nCount); // batched, multi-threaded
         virtual uint64_t AllocateKidRange(uint64_t nCount) = 0;
         virtual std::vector<Coin> selectCoins(const Amount& amount, bool lock = true) = 0;
         virtual std::vector<Coin> getCoinsCreatedByTx(const TxID& txId) = 0;
@@ -271,9 +278,12 @@ namespace beam
         void notifySystemStateChanged();
         void notifyAddressChanged();
         void updateCoinMaturityStatus();
+        void buildCoinIndex();
     private:
+        friend struct sqlite::Statement;
 
         sqlite3* _db;
+        std::unique_ptr<sqlite::StatementCache> m_pStmCache; // prepared statements of _db, reused across calls
         Key::IKdf::Ptr m_pKdf;
 
         std::vector<IWalletDbObserver*> m_subscribers;
@@ -286,6 +296,22 @@ namespace beam
 
             IMPLEMENT_GET_PARENT_OBJ(WalletDB, m_History)
         } m_History;
+
+        // Available coins ordered by amount, mirrors the storage. Built on demand, kept up-to-date by the coin modifications,
+        // reset by bulk updates that can't be tracked.
+        struct CoinIndex
+        {
+            typedef std::map<std::pair<Amount, Key::ID>, Coin> ByAmount;
+            ByAmount m_ByAmount;
+            std::map<Key::ID, ByAmount::iterator> m_ByID; // the storage key doesn't include the amount
+
+            bool m_Valid = false;
+
+            void Reset();
+            void Add(const Coin&); // must not be present
+            void OnSaved(const Coin&);
+            void OnRemoved(const Key::ID&);
+        } m_CoinIndex;
     };
 
     namespace wallet